@@ -269,6 +269,23 @@ void dStr_fit (Dstr *ds)
    dStr_resize(ds, ds->len + 1, 1);
 }
 
+/*
+ * Make room for at least 'l' more bytes past the end of a Dstr, so that
+ * data can be placed there directly (e.g. by read(2)). Return a pointer to
+ * that room; its real size is (ds->sz - ds->len - 1).
+ * The caller is responsible for updating ds->len and the trailing '\0'.
+ */
+char *dStr_reserve_l (Dstr *ds, int l)
+{
+   int n_sz;
+
+   for (n_sz = ds->sz; ds->len + l >= n_sz; n_sz *= 2);
+   if (n_sz > ds->sz) {
+      dStr_resize(ds, n_sz, (ds->len > 0) ? 1 : 0);
+   }
+   return ds->str + ds->len;
+}
+
 /*
  * Insert a C string, at a given position, into a Dstr (providing length).
  * Note: It also works with embedded nil characters.
@@ -112,6 +112,7 @@ void dStr_free (Dstr *ds, int all);
 void dStr_append_c (Dstr *ds, int c);
 void dStr_append (Dstr *ds, const char *s);
 void dStr_append_l (Dstr *ds, const char *s, int l);
+char *dStr_reserve_l (Dstr *ds, int l);
 void dStr_insert (Dstr *ds, int pos_0, const char *s);
 void dStr_insert_l (Dstr *ds, int pos_0, const char *s, int l);
 void dStr_truncate (Dstr *ds, int len);
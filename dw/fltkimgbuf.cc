@@ -39,6 +39,7 @@ const enum ScaleMode { SIMPLE, BEAUTIFUL, BEAUTIFUL_GAMMA }
 
 Vector <FltkImgbuf::GammaCorrectionTable> *FltkImgbuf::gammaCorrectionTables
    = new Vector <FltkImgbuf::GammaCorrectionTable> (true, 2);
+long FltkImgbuf::scaledMemSize = 0;
 
 uchar *FltkImgbuf::findGammaCorrectionTable (double gamma)
 {
@@ -122,8 +123,8 @@ void FltkImgbuf::init (Type type, int width, int height, double gamma,
    } else {
       this->root = root;
       this->type = type;
-      this->width = width;
-      this->height = height;
+      this->width = origWidth = width;
+      this->height = origHeight = height;
       this->gamma = gamma;
 
       DBG_OBJ_SET_NUM ("width", width);
@@ -138,9 +139,20 @@ void FltkImgbuf::init (Type type, int width, int height, double gamma,
       _MSG("FltkImgbuf::init this=%p width=%d height=%d bpp=%d gamma=%g\n",
            this, width, height, bpp, gamma);
       rawdata = new uchar[bpp * width * height];
+      if (!isRoot())
+         scaledMemSize += (long) bpp * width * height;
       // Set light-gray as interim background color.
       memset(rawdata, 222, width*height*bpp);
 
+      // Indexed pixels are only expanded to RGB when they are drawn or
+      // scaled down, so the root buffer keeps the colormap. Until
+      // setCMap() is called, all colors are the interim light-gray.
+      if (type == INDEXED && isRoot()) {
+         cmap = new uchar[3 * 256];
+         memset(cmap, 222, 3 * 256);
+      } else
+         cmap = NULL;
+
       refCount = 1;
       deleteOnUnref = true;
       copiedRows = new lout::misc::BitSet (height);
@@ -171,10 +183,13 @@ FltkImgbuf::~FltkImgbuf ()
 {
    _MSG ("FltkImgbuf::~FltkImgbuf\n");
 
-   if (!isRoot())
+   if (!isRoot()) {
+      scaledMemSize -= (long) bpp * width * height;
       root->detachScaledBuf (this);
+   }
 
    delete[] rawdata;
+   delete[] cmap;
    delete copiedRows;
 
    if (scaledBuffers)
@@ -203,15 +218,50 @@ void FltkImgbuf::detachScaledBuf (FltkImgbuf *scaledBuf)
 
 void FltkImgbuf::setCMap (int *colors, int num_colors)
 {
+   assert (isRoot());
+
+   if (cmap) {
+      for (int i = 0; i < lout::misc::min (num_colors, 256); i++) {
+         cmap[3 * i]     = (colors[i] >> 16) & 0xff;
+         cmap[3 * i + 1] = (colors[i] >> 8) & 0xff;
+         cmap[3 * i + 2] = colors[i] & 0xff;
+      }
+   }
+}
+
+/**
+ * \brief Expand \em n indexed pixels to RGB, with the colormap of the root
+ *    buffer.
+ */
+inline void FltkImgbuf::expandIndexed (const core::byte *src, int n,
+                                       core::byte *dest)
+{
+   const uchar *map = colorMap ();
+
+   for (int i = 0; i < n; i++)
+      memcpy (dest + 3 * i, map + 3 * src[i], 3);
 }
 
 inline void FltkImgbuf::scaleRow (int row, const core::byte *data)
 {
    if (row < root->height) {
-      if (scaleMode == SIMPLE)
+      core::byte *rgb = NULL;
+
+      // A scaled buffer of an indexed root buffer is RGB, unless it only
+      // repeats pixels (see getScaledBuf). When it is scaled down in
+      // height, scaleRowBeautiful reads the root rows itself.
+      if (root->bpp != bpp && (scaleMode == SIMPLE || height > root->height)) {
+         rgb = new core::byte[3 * root->width];
+         expandIndexed (data, root->width, rgb);
+         data = rgb;
+      }
+
+      if (scaleMode == SIMPLE || type == INDEXED)
          scaleRowSimple (row, data);
       else
          scaleRowBeautiful (row, data);
+
+      delete[] rgb;
    }
 }
 
@@ -276,10 +326,18 @@ inline void FltkImgbuf::scaleRowBeautiful (int row, const core::byte *data)
       // a larger area than a single row may be accessed here.
       for (int r=row1; (allRootRows=root->copiedRows->get(r)) && ++r < row2; );
       if (allRootRows) {
-         scaleBuffer (root->rawdata + row1 * root->width * bpp,
-                      root->width, row2 - row1,
+         const core::byte *src = root->rawdata + row1 * root->width * root->bpp;
+         core::byte *rgb = NULL;
+
+         if (root->bpp != bpp) {
+            rgb = new core::byte[3 * root->width * (row2 - row1)];
+            expandIndexed (src, root->width * (row2 - row1), rgb);
+            src = rgb;
+         }
+         scaleBuffer (src, root->width, row2 - row1,
                       rawdata + sr1 * width * bpp, width, 1,
                       bpp, gamma);
+         delete[] rgb;
          // Mark scaled row done
          copiedRows->set (sr1, true);
 
@@ -392,6 +450,17 @@ void FltkImgbuf::newScan ()
    }
 }
 
+void FltkImgbuf::setOrigSize (int width, int height)
+{
+   assert (isRoot());
+
+   if (!excessiveImageDimensions (width, height) &&
+       width <= MAX_WIDTH && height <= MAX_HEIGHT) {
+      origWidth = width;
+      origHeight = height;
+   }
+}
+
 core::Imgbuf* FltkImgbuf::getScaledBuf (int width, int height)
 {
    if (!isRoot())
@@ -431,7 +500,13 @@ core::Imgbuf* FltkImgbuf::getScaledBuf (int width, int height)
    }
 
    // This size is not yet used, so a new buffer has to be created.
-   FltkImgbuf *sb = new FltkImgbuf (type, width, height, gamma, this);
+   // Indexed pixels can't be averaged, so an indexed image stays indexed
+   // only when it is scaled up, by repeating pixels.
+   Type scaledType = type;
+   if (type == INDEXED && (width < this->width || height < this->height))
+      scaledType = RGB;
+
+   FltkImgbuf *sb = new FltkImgbuf (scaledType, width, height, gamma, this);
    scaledBuffers->append (sb);
    DBG_OBJ_ASSOC_CHILD (sb);
 
@@ -470,17 +545,21 @@ void FltkImgbuf::getRowArea (int row, dw::core::Rectangle *area)
 
 int FltkImgbuf::getRootWidth ()
 {
-   return root ? root->width : width;
+   return root ? root->origWidth : origWidth;
 }
 
 int FltkImgbuf::getRootHeight ()
 {
-   return root ? root->height : height;
+   return root ? root->origHeight : origHeight;
 }
 
 core::Imgbuf *FltkImgbuf::createSimilarBuf (int width, int height)
 {
-   return new FltkImgbuf (type, width, height, gamma);
+   FltkImgbuf *buf = new FltkImgbuf (type, width, height, gamma);
+
+   if (type == INDEXED)
+      memcpy (buf->cmap, colorMap (), 3 * 256);
+   return buf;
 }
 
 void FltkImgbuf::copyTo (Imgbuf *dest, int xDestRoot, int yDestRoot,
@@ -509,6 +588,22 @@ void FltkImgbuf::copyTo (Imgbuf *dest, int xDestRoot, int yDestRoot,
       }
 }
 
+long FltkImgbuf::getMemSize ()
+{
+   long size = (long) bpp * width * height + (cmap ? 3 * 256 : 0);
+
+   if (scaledBuffers)
+      for (Iterator <FltkImgbuf> it = scaledBuffers->iterator();
+           it.hasNext(); )
+         size += it.getNext()->getMemSize ();
+   return size;
+}
+
+core::Imgbuf *FltkImgbuf::getRoot ()
+{
+   return root ? root : this;
+}
+
 void FltkImgbuf::ref ()
 {
    refCount++;
@@ -603,9 +698,31 @@ void FltkImgbuf::draw (Fl_Widget *target, int xRoot, int yRoot,
       height = this->height - y;
    }
 
-   fl_draw_image(rawdata+bpp*(y*this->width + x), xRoot + x, yRoot + y, width,
-                 height, bpp, this->width * bpp);
+   if (type == INDEXED) {
+      // Only the area that is shown gets expanded to RGB.
+      DrawArea area = { this, x, y };
+      fl_draw_image(drawIndexedRow, &area, xRoot + x, yRoot + y, width, height,
+                    3);
+   } else
+      fl_draw_image(rawdata+bpp*(y*this->width + x), xRoot + x, yRoot + y,
+                    width, height, bpp, this->width * bpp);
+}
 
+/**
+ * \brief Supply fl_draw_image() with a row of an indexed buffer, as RGB.
+ *
+ * Rows which have not arrived yet are light-gray.
+ */
+void FltkImgbuf::drawIndexedRow (void *data, int x, int y, int w, uchar *buf)
+{
+   DrawArea *area = (DrawArea*) data;
+   FltkImgbuf *ib = area->imgbuf;
+   int row = area->y + y;
+
+   if (ib->copiedRows->get (row))
+      ib->expandIndexed (ib->rawdata + row * ib->width + area->x + x, w, buf);
+   else
+      memset (buf, 222, 3 * w);
 }
 
 } // namespace fltk
@@ -18,12 +18,20 @@ private:
       uchar map[256];
    };
 
+   // Where draw() expands an indexed buffer, for the row callback.
+   struct DrawArea
+   {
+      FltkImgbuf *imgbuf;
+      int x, y;
+   };
+
    FltkImgbuf *root;
    int refCount;
    bool deleteOnUnref;
    lout::container::typed::List <FltkImgbuf> *scaledBuffers;
 
    int width, height;
+   int origWidth, origHeight;  // of the image, for a reduced root buffer
    Type type;
    double gamma;
 
@@ -32,6 +40,9 @@ private:
    uchar *rawdata;
 //}
 
+   // The colormap of an INDEXED root buffer, as 256 RGB triplets.
+   uchar *cmap;
+
    // This is just for testing drawing, it has to be replaced by
    // the image buffer.
    lout::misc::BitSet *copiedRows;
@@ -39,6 +50,9 @@ private:
    static lout::container::typed::Vector <GammaCorrectionTable>
       *gammaCorrectionTables;
 
+   // What the scaled buffers of all the root buffers take up, in bytes.
+   static long scaledMemSize;
+
    static uchar *findGammaCorrectionTable (double gamma);
    static bool excessiveImageDimensions (int width, int height);
 
@@ -49,6 +63,9 @@ private:
    int backscaledY(int yScaled);
    int isRoot() { return (root == NULL); }
    void detachScaledBuf (FltkImgbuf *scaledBuf);
+   uchar *colorMap () { return root ? root->cmap : cmap; }
+   inline void expandIndexed (const core::byte *src, int n, core::byte *dest);
+   static void drawIndexedRow (void *data, int x, int y, int w, uchar *buf);
 
 protected:
    ~FltkImgbuf ();
@@ -57,6 +74,7 @@ public:
    FltkImgbuf (Type type, int width, int height, double gamma);
 
    static void freeall ();
+   static long getScaledMemSize () { return scaledMemSize; }
 
    void setCMap (int *colors, int num_colors);
    inline void scaleRow (int row, const core::byte *data);
@@ -68,6 +86,7 @@ public:
                                    double gamma);
 
    void newScan ();
+   void setOrigSize (int width, int height);
    void copyRow (int row, const core::byte *data);
    core::Imgbuf* getScaledBuf (int width, int height);
    void getRowArea (int row, dw::core::Rectangle *area);
@@ -76,6 +95,8 @@ public:
    core::Imgbuf *createSimilarBuf (int width, int height);
    void copyTo (Imgbuf *dest, int xDestRoot, int yDestRoot,
                 int xSrc, int ySrc, int widthSrc, int heightSrc);
+   long getMemSize ();
+   core::Imgbuf *getRoot ();
    void ref ();
    void unref ();
 
@@ -150,6 +150,7 @@ Image::Image(const char *altText)
    altTextWidth = -1; // not yet calculated
    buffer = NULL;
    bufWidth = bufHeight = -1;
+   dropWidth = dropHeight = -1;
    clicking = false;
    currLink = -1;
    mapList = NULL;
@@ -176,9 +177,9 @@ void Image::sizeRequestImpl (core::Requisition *requisition)
 {
    DBG_OBJ_ENTER0 ("resize", 0, "sizeRequestImpl");
 
-   if (buffer) {
-      requisition->width = buffer->getRootWidth ();
-      requisition->ascent = buffer->getRootHeight ();
+   if (hasRootSize ()) {
+      requisition->width = rootWidth ();
+      requisition->ascent = rootHeight ();
       requisition->descent = 0;
    } else {
       if (altText && altText[0]) {
@@ -202,7 +203,7 @@ void Image::sizeRequestImpl (core::Requisition *requisition)
 
    correctRequisition (requisition, core::splitHeightPreserveDescent);
 
-   if (buffer) {
+   if (hasRootSize ()) {
       // If one dimension is set, preserve the aspect ratio (without
       // extraSpace/margin/border/padding). Notice that
       // requisition->descent could have been changed in
@@ -222,11 +223,11 @@ void Image::sizeRequestImpl (core::Requisition *requisition)
       if (!widthSpecified && heightSpecified)
          requisition->width =
             (requisition->ascent + requisition->descent - boxDiffHeight ())
-            * buffer->getRootWidth () / buffer->getRootHeight ()
+            * rootWidth () / rootHeight ()
             + boxDiffWidth ();
       else if (widthSpecified && !heightSpecified) {
          requisition->ascent = (requisition->width + boxDiffWidth ())
-            * buffer->getRootHeight () / buffer->getRootWidth ()
+            * rootHeight () / rootWidth ()
             + boxOffsetY ();
          requisition->descent = boxRestHeight ();
       }
@@ -240,8 +241,8 @@ void Image::sizeRequestImpl (core::Requisition *requisition)
 void Image::getExtremesImpl (core::Extremes *extremes)
 {
    int contentWidth;
-   if (buffer)
-      contentWidth = buffer->getRootWidth ();
+   if (hasRootSize ())
+      contentWidth = rootWidth ();
    else {
       if (altText && altText[0]) {
          if (altTextWidth == -1)
@@ -427,7 +428,7 @@ void Image::draw (core::View *view, core::Rectangle *area)
                           allocation.x + dx, allocation.y + dy,
                           intersection.x - dx, intersection.y - dy,
                           intersection.width, intersection.height);
-   } else {
+   } else if (dropWidth == -1) {
       core::View *clippingView;
 
       if (altText && altText[0]) {
@@ -495,11 +496,12 @@ void Image::setBuffer (core::Imgbuf *buffer, bool resize)
       bufHeight = getContentHeight ();
       this->buffer = buffer->getScaledBuf (bufWidth, bufHeight);
    } else {
-      this->buffer = buffer;
+      // (A root buffer decoded at a reduced size still gets scaled.)
       bufWidth = buffer->getRootWidth ();
       bufHeight = buffer->getRootHeight ();
-      buffer->ref ();
+      this->buffer = buffer->getScaledBuf (bufWidth, bufHeight);
    }
+   dropWidth = dropHeight = -1;
    queueResize (0, true);
 
    DBG_OBJ_ASSOC_CHILD (this->buffer);
@@ -510,11 +512,33 @@ void Image::setBuffer (core::Imgbuf *buffer, bool resize)
       oldBuf->unref ();
 }
 
+/**
+ * \brief Let go of the image data, to save memory while the image is far
+ *    from the viewport. The image keeps its size, and shows nothing until
+ *    setBuffer() is called again.
+ */
+void Image::dropBuffer ()
+{
+   if (buffer) {
+      dropWidth = buffer->getRootWidth ();
+      dropHeight = buffer->getRootHeight ();
+      buffer->unref ();
+      buffer = NULL;
+      bufWidth = bufHeight = -1;
+
+      DBG_OBJ_SET_NUM ("bufWidth", bufWidth);
+      DBG_OBJ_SET_NUM ("bufHeight", bufHeight);
+      queueDraw ();
+   }
+}
+
 void Image::drawRow (int row)
 {
    core::Rectangle area;
 
-   assert (buffer != NULL);
+   // (Rows may still arrive for a buffer that was dropped.)
+   if (buffer == NULL)
+      return;
 
    buffer->getRowArea (row, &area);
    if (area.width && area.height)
@@ -528,6 +552,74 @@ void Image::finish ()
    // Nothing to do; images are always drawn line by line.
 }
 
+/**
+ * \brief Tell the size the image is going to be shown at, as far as the
+ *    style tells it: absolute lengths, and percentages of the width this
+ *    widget was already allocated. Maximal sizes limit the natural size.
+ *
+ * The result is an upper bound; when only one dimension is known, the
+ * other one follows the aspect ratio.
+ */
+bool Image::getDisplaySize (int width, int height, int *dispWidth,
+                            int *dispHeight)
+{
+   core::style::Style *style = getStyle ();
+   int w = -1, h = -1;
+
+   if (style == NULL || width <= 0 || height <= 0)
+      return false;
+
+   if (core::style::isAbsLength (style->width))
+      w = core::style::absLengthVal (style->width);
+   else if (core::style::isPerLength (style->width) && wasAllocated ())
+      w = getContentWidth ();
+   if (core::style::isAbsLength (style->height))
+      h = core::style::absLengthVal (style->height);
+
+   if (w == -1 && core::style::isAbsLength (style->maxWidth))
+      w = misc::min (width, core::style::absLengthVal (style->maxWidth));
+   if (h == -1 && core::style::isAbsLength (style->maxHeight))
+      h = misc::min (height, core::style::absLengthVal (style->maxHeight));
+
+   if (w == -1 && h == -1)
+      return false;
+   if (w == -1)
+      w = (int) ((long long) h * width / height);
+   else if (h == -1)
+      h = (int) ((long long) w * height / width);
+
+   *dispWidth = w;
+   *dispHeight = h;
+   return true;
+}
+
+/**
+ * \brief Tell how far, in canvas pixels, the image is from the viewport:
+ *    0 when it is (partly) visible, -1 when it was not allocated yet.
+ */
+int Image::getViewportDistance ()
+{
+   int vx, vy, dx, dy;
+
+   if (!wasAllocated ())
+      return -1;
+
+   vx = layout->getScrollPosX ();
+   vy = layout->getScrollPosY ();
+
+   if (allocation.x + allocation.width < vx)
+      dx = vx - (allocation.x + allocation.width);
+   else
+      dx = misc::max (allocation.x - (vx + layout->getWidthViewport ()), 0);
+
+   if (allocation.y + getHeight () < vy)
+      dy = vy - (allocation.y + getHeight ());
+   else
+      dy = misc::max (allocation.y - (vy + layout->getHeightViewport ()), 0);
+
+   return misc::max (dx, dy);
+}
+
 void Image::fatal ()
 {
    // Could display an error.
@@ -122,6 +122,7 @@ private:
    char *altText;
    core::Imgbuf *buffer;
    int bufWidth, bufHeight;
+   int dropWidth, dropHeight;  // root size while the buffer is dropped
    int altTextWidth;
    bool clicking;
    int currLink;
@@ -129,6 +130,12 @@ private:
    Object *mapKey;
    bool isMap;
 
+   inline bool hasRootSize () { return buffer || dropWidth > 0; }
+   inline int rootWidth ()
+   { return buffer ? buffer->getRootWidth () : dropWidth; }
+   inline int rootHeight ()
+   { return buffer ? buffer->getRootHeight () : dropHeight; }
+
 protected:
    void sizeRequestImpl (core::Requisition *requisition);
    void getExtremesImpl (core::Extremes *extremes);
@@ -161,11 +168,15 @@ public:
 
    inline core::Imgbuf *getBuffer () { return buffer; }
    void setBuffer (core::Imgbuf *buffer, bool resize = false);
+   void dropBuffer ();
 
    void drawRow (int row);
 
    void finish ();
    void fatal ();
+   bool getDisplaySize (int width, int height, int *dispWidth,
+                        int *dispHeight);
+   int getViewportDistance ();
 
    void setIsMap ();
    void setUseMap (ImageMapsList *list, Object *key);
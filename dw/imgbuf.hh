@@ -177,6 +177,13 @@ public:
    virtual void copyRow (int row, const byte *data) = 0;
    virtual void newScan () = 0;
 
+   /**
+    * The image was decoded at a reduced size: the root buffer holds fewer
+    * pixels, but the image is still laid out with the original size,
+    * \em width x \em height, which getRootWidth and getRootHeight return.
+    */
+   virtual void setOrigSize (int width, int height) = 0;
+
    /*
     * Methods called from dw::Image
     */
@@ -199,6 +206,17 @@ public:
    virtual void copyTo (Imgbuf *dest, int xDestRoot, int yDestRoot,
                         int xSrc, int ySrc, int widthSrc, int heightSrc) = 0;
 
+   /**
+    * Returns the memory the image data takes up, in bytes. For a root
+    * buffer, this includes its scaled buffers.
+    */
+   virtual long getMemSize () = 0;
+
+   /**
+    * Returns the root buffer of a scaled buffer, or the buffer itself.
+    */
+   virtual Imgbuf *getRoot () = 0;
+
    /*
     * Reference counting.
     */
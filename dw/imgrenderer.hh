@@ -47,6 +47,16 @@ public:
     * The implementation may use this to indicate an error.
     */
    virtual void fatal () = 0;
+
+   /**
+    * \brief The size at which an image of \em width x \em height pixels is
+    *    going to be shown, if it is known before the image is laid out.
+    *
+    * Decoders may use this to decode large images at a reduced size. By
+    * default it is not known, and false is returned.
+    */
+   virtual bool getDisplaySize (int width, int height, int *dispWidth,
+                                int *dispHeight) { return false; }
 };
 
 /**
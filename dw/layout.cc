@@ -99,6 +99,10 @@ void Layout::Receiver::canvasSizeChanged (int width, int ascent, int descent)
 {
 }
 
+void Layout::Receiver::viewportChanged (int x, int y, int width, int height)
+{
+}
+
 // ----------------------------------------------------------------------
 
 bool Layout::Emitter::emitToReceiver (lout::signal::Receiver *receiver,
@@ -118,6 +122,13 @@ bool Layout::Emitter::emitToReceiver (lout::signal::Receiver *receiver,
       layoutReceiver->resizeQueued (((Boolean*)argv[0])->getValue ());
       break;
 
+   case VIEWPORT_CHANGED:
+      layoutReceiver->viewportChanged (((Integer*)argv[0])->getValue (),
+                                       ((Integer*)argv[1])->getValue (),
+                                       ((Integer*)argv[2])->getValue (),
+                                       ((Integer*)argv[3])->getValue ());
+      break;
+
    default:
       misc::assertNotReached ();
    }
@@ -140,6 +151,14 @@ void Layout::Emitter::emitCanvasSizeChanged (int width,
    emitVoid (CANVAS_SIZE_CHANGED, 3, argv);
 }
 
+void Layout::Emitter::emitViewportChanged (int x, int y,
+                                           int width, int height)
+{
+   Integer ix (x), iy (y), w (width), h (height);
+   Object *argv[4] = { &ix, &iy, &w, &h };
+   emitVoid (VIEWPORT_CHANGED, 4, argv);
+}
+
 // ----------------------------------------------------------------------
 
 bool Layout::LinkReceiver::enter (Widget *widget, int link, int img,
@@ -609,6 +628,8 @@ void Layout::scrollIdle ()
          drawAfterScrollReq = false;
          view->queueDrawTotal ();
       }
+      emitter.emitViewportChanged (scrollX, scrollY,
+                                   viewportWidth, viewportHeight);
    }
 
    scrollIdleId = -1;
@@ -1262,6 +1283,8 @@ void Layout::scrollPosChanged (View *view, int x, int y)
 
       setAnchor (NULL);
       updateAnchor ();
+      emitter.emitViewportChanged (scrollX, scrollY,
+                                   viewportWidth, viewportHeight);
    }
 }
 
@@ -1299,6 +1322,8 @@ void Layout::viewportSizeChanged (View *view, int width, int height)
    DBG_OBJ_SET_NUM ("viewportHeight", viewportHeight);
 
    containerSizeChanged ();
+   emitter.emitViewportChanged (scrollX, scrollY,
+                                viewportWidth, viewportHeight);
 
    DBG_OBJ_LEAVE ();
 }
@@ -49,6 +49,7 @@ public:
    public:
       virtual void resizeQueued (bool extremesChanged);
       virtual void canvasSizeChanged (int width, int ascent, int descent);
+      virtual void viewportChanged (int x, int y, int width, int height);
    };
 
    class LinkReceiver: public lout::signal::Receiver
@@ -127,7 +128,7 @@ private:
    class Emitter: public lout::signal::Emitter
    {
    private:
-      enum { RESIZE_QUEUED, CANVAS_SIZE_CHANGED };
+      enum { RESIZE_QUEUED, CANVAS_SIZE_CHANGED, VIEWPORT_CHANGED };
 
    protected:
       bool emitToReceiver (lout::signal::Receiver *receiver, int signalNo,
@@ -138,6 +139,7 @@ private:
 
       void emitResizeQueued (bool extremesChanged);
       void emitCanvasSizeChanged (int width, int ascent, int descent);
+      void emitViewportChanged (int x, int y, int width, int height);
    };
 
    Emitter emitter;
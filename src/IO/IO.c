@@ -159,23 +159,28 @@ static void IO_close_fd(IOData_t *io, int CloseCode)
  */
 static bool_t IO_read(IOData_t *io)
 {
-   char Buf[IOBufLen];
+   char *Buf;
    ssize_t St;
+   size_t room;
    bool_t ret = FALSE;
    int io_key = io->Key;
    void *conn = a_Tls_connection(io->FD);
 
    _MSG("  IO_read\n");
 
-   /* this is a new read-buffer */
+   /* this is a new read-buffer (its allocated room is kept between reads) */
    dStr_truncate(io->Buf, 0);
    io->Status = 0;
 
    while (1) {
-      St = conn ? a_Tls_read(conn, Buf, IOBufLen)
-                : read(io->FD, Buf, IOBufLen);
+      /* read straight into io->Buf, there's no intermediate buffer */
+      Buf = dStr_reserve_l(io->Buf, IOBufLen);
+      room = io->Buf->sz - io->Buf->len - 1;
+      St = conn ? a_Tls_read(conn, Buf, room)
+                : read(io->FD, Buf, room);
       if (St > 0) {
-         dStr_append_l(io->Buf, Buf, St);
+         io->Buf->len += St;
+         io->Buf->str[io->Buf->len] = 0;
          continue;
       } else if (St < 0) {
          if (errno == EINTR) {
@@ -329,12 +334,14 @@ static void IO_submit(IOData_t *r_io)
    fcntl(r_io->FD, F_SETFL, O_NONBLOCK | fcntl(r_io->FD, F_GETFL));
    fcntl(r_io->FD, F_SETFD, FD_CLOEXEC | fcntl(r_io->FD, F_GETFD));
 
+   /* IO_read and IO_write loop until EAGAIN, so edge-triggered
+    * notification is enough for them */
    if (r_io->Op == IORead) {
-      a_IOwatch_add_fd(r_io->FD, DIO_READ,
+      a_IOwatch_add_fd(r_io->FD, DIO_READ | DIO_EDGE,
                        IO_fd_read_cb, INT2VOIDP(r_io->Key));
 
    } else if (r_io->Op == IOWrite) {
-      a_IOwatch_add_fd(r_io->FD, DIO_WRITE,
+      a_IOwatch_add_fd(r_io->FD, DIO_WRITE | DIO_EDGE,
                        IO_fd_write_cb, INT2VOIDP(r_io->Key));
    }
 }
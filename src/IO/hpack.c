@@ -0,0 +1,548 @@
+/*
+ * File: hpack.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * HPACK: header compression for HTTP/2 (RFC 7541)
+ */
+
+#include <string.h>
+#include "hpack.h"
+
+/* RFC 7541, Appendix A */
+static const char *const Hpack_static[][2] = {
+   { ":authority", "" },
+   { ":method", "GET" },
+   { ":method", "POST" },
+   { ":path", "/" },
+   { ":path", "/index.html" },
+   { ":scheme", "http" },
+   { ":scheme", "https" },
+   { ":status", "200" },
+   { ":status", "204" },
+   { ":status", "206" },
+   { ":status", "304" },
+   { ":status", "400" },
+   { ":status", "404" },
+   { ":status", "500" },
+   { "accept-charset", "" },
+   { "accept-encoding", "gzip, deflate" },
+   { "accept-language", "" },
+   { "accept-ranges", "" },
+   { "accept", "" },
+   { "access-control-allow-origin", "" },
+   { "age", "" },
+   { "allow", "" },
+   { "authorization", "" },
+   { "cache-control", "" },
+   { "content-disposition", "" },
+   { "content-encoding", "" },
+   { "content-language", "" },
+   { "content-length", "" },
+   { "content-location", "" },
+   { "content-range", "" },
+   { "content-type", "" },
+   { "cookie", "" },
+   { "date", "" },
+   { "etag", "" },
+   { "expect", "" },
+   { "expires", "" },
+   { "from", "" },
+   { "host", "" },
+   { "if-match", "" },
+   { "if-modified-since", "" },
+   { "if-none-match", "" },
+   { "if-range", "" },
+   { "if-unmodified-since", "" },
+   { "last-modified", "" },
+   { "link", "" },
+   { "location", "" },
+   { "max-forwards", "" },
+   { "proxy-authenticate", "" },
+   { "proxy-authorization", "" },
+   { "range", "" },
+   { "referer", "" },
+   { "refresh", "" },
+   { "retry-after", "" },
+   { "server", "" },
+   { "set-cookie", "" },
+   { "strict-transport-security", "" },
+   { "transfer-encoding", "" },
+   { "user-agent", "" },
+   { "vary", "" },
+   { "via", "" },
+   { "www-authenticate", "" }
+};
+#define HPACK_STATIC_LEN (int)(sizeof(Hpack_static) / sizeof(Hpack_static[0]))
+
+/* RFC 7541, Appendix B: the code for each byte value, and EOS (256) */
+static const uint32_t Hpack_huff_code[257] = {
+   0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6,
+   0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea,
+   0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee, 0xfffffef,
+   0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3, 0xffffff4,
+   0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa,
+   0xffffffb, 0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa,
+   0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18, 0x0, 0x1, 0x2, 0x19, 0x1a,
+   0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+   0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66,
+   0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+   0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22, 0x7ffd, 0x3,
+   0x23, 0x4, 0x24, 0x5, 0x25, 0x26, 0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a,
+   0x7, 0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78, 0x79, 0x7a, 0x7b,
+   0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc, 0xfffe6, 0x3fffd2, 0xfffe7,
+   0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9, 0x3fffd6, 0x7fffda,
+   0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf, 0xffffec,
+   0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+   0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7,
+   0xffffef, 0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8,
+   0x7fffe9, 0x1fffde, 0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf,
+   0x3fffdf, 0x7fffeb, 0x7fffec, 0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2,
+   0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef, 0xfffea, 0x3fffe2, 0x3fffe3,
+   0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1, 0x3ffffe0, 0x3ffffe1,
+   0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec, 0x3ffffe2,
+   0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1,
+   0x1ffffed, 0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7,
+   0x7ffffe2, 0xfffff2, 0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd,
+   0x7ffffe3, 0x7ffffe4, 0x7ffffe5, 0xfffec, 0xfffff3, 0xfffed, 0x1fffe6,
+   0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3, 0x3fffea, 0x3fffeb, 0x1ffffee,
+   0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4, 0x3ffffeb, 0x7ffffe6,
+   0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+   0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef,
+   0x7fffff0, 0x3ffffee, 0x3fffffff
+};
+
+static const uchar_t Hpack_huff_len[257] = {
+   13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+   28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+    5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+   13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+    7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+   15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+    6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+   20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+   24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+   22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+   21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+   26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+   19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+   20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+   26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+   30
+};
+
+#define HPACK_HUFF_EOS 256
+#define HPACK_HUFF_MAXLEN 30
+
+/*
+ * The code is canonical, so decoding only needs, for each length, its
+ * first code and where its symbols start in a list sorted by code.
+ */
+static uint32_t huff_first[HPACK_HUFF_MAXLEN + 1];
+static int huff_count[HPACK_HUFF_MAXLEN + 1];
+static int huff_offset[HPACK_HUFF_MAXLEN + 1];
+static ushort_t huff_syms[257];
+static bool_t huff_ready = FALSE;
+
+static void Hpack_huff_init(void)
+{
+   int i, len, n = 0;
+
+   for (len = 1; len <= HPACK_HUFF_MAXLEN; len++) {
+      huff_first[len] = 0xffffffff;
+      for (i = 0; i < 257; i++) {
+         if (Hpack_huff_len[i] == len) {
+            huff_count[len]++;
+            if (Hpack_huff_code[i] < huff_first[len])
+               huff_first[len] = Hpack_huff_code[i];
+         }
+      }
+      huff_offset[len] = n;
+      n += huff_count[len];
+   }
+   for (i = 0; i < 257; i++) {
+      len = Hpack_huff_len[i];
+      huff_syms[huff_offset[len] + Hpack_huff_code[i] - huff_first[len]] = i;
+   }
+   huff_ready = TRUE;
+}
+
+/*
+ * Decode a Huffman coded string.
+ * Return a new string, or NULL on error.
+ */
+static char *Hpack_huff_decode(const uchar_t *buf, size_t len)
+{
+   Dstr *ds = dStr_sized_new(len + len / 2 + 1);
+   uint32_t code = 0;
+   int bit, clen = 0, sym;
+   size_t i;
+   char *str;
+
+   if (!huff_ready)
+      Hpack_huff_init();
+
+   for (i = 0; i < len; i++) {
+      for (bit = 7; bit >= 0; bit--) {
+         code = (code << 1) | ((buf[i] >> bit) & 1);
+         if (++clen > HPACK_HUFF_MAXLEN)
+            goto error;
+         if (code >= huff_first[clen] &&
+             code - huff_first[clen] < (uint32_t)huff_count[clen]) {
+            sym = huff_syms[huff_offset[clen] + code - huff_first[clen]];
+            if (sym == HPACK_HUFF_EOS || sym == 0)
+               goto error;
+            dStr_append_c(ds, sym);
+            code = 0;
+            clen = 0;
+         }
+      }
+   }
+   /* Padding: less than a byte of the most significant bits of EOS */
+   if (clen > 7 || code != (1U << clen) - 1)
+      goto error;
+
+   str = ds->str;
+   dStr_free(ds, 0);
+   return str;
+error:
+   dStr_free(ds, 1);
+   return NULL;
+}
+
+/*
+ * Decode an integer with an N-bit prefix (RFC 7541, 5.1).
+ * Return 0 on success, -1 on error.
+ */
+static int Hpack_int_decode(const uchar_t **p, const uchar_t *end, int prefix,
+                            size_t *val)
+{
+   size_t mask = (1 << prefix) - 1, v;
+   int shift = 0;
+
+   v = *(*p)++ & mask;
+   if (v < mask) {
+      *val = v;
+      return 0;
+   }
+   while (*p < end && shift <= 28) {
+      uchar_t b = *(*p)++;
+
+      v += (size_t)(b & 0x7f) << shift;
+      shift += 7;
+      if (!(b & 0x80)) {
+         *val = v;
+         return 0;
+      }
+   }
+   return -1;
+}
+
+/*
+ * Decode a string literal (RFC 7541, 5.2).
+ * Return a new string, or NULL on error.
+ */
+static char *Hpack_str_decode(const uchar_t **p, const uchar_t *end)
+{
+   bool_t huffman;
+   size_t len;
+   char *str;
+
+   if (*p >= end)
+      return NULL;
+   huffman = (**p & 0x80) != 0;
+   if (Hpack_int_decode(p, end, 7, &len) || len > (size_t)(end - *p))
+      return NULL;
+   if (huffman) {
+      str = Hpack_huff_decode(*p, len);
+   } else if (memchr(*p, 0, len)) {
+      str = NULL;
+   } else {
+      str = dStrndup((const char *)*p, len);
+   }
+   *p += len;
+   return str;
+}
+
+static void Hpack_int_encode(Dstr *out, int first, int prefix, size_t v)
+{
+   size_t mask = (1 << prefix) - 1;
+
+   if (v < mask) {
+      dStr_append_c(out, first | v);
+   } else {
+      dStr_append_c(out, first | mask);
+      for (v -= mask; v >= 128; v >>= 7)
+         dStr_append_c(out, (v & 0x7f) | 0x80);
+      dStr_append_c(out, v);
+   }
+}
+
+/*
+ * Encode a string literal, Huffman coded when that makes it shorter.
+ */
+static void Hpack_str_encode(Dstr *out, const char *str)
+{
+   const uchar_t *s = (const uchar_t *)str;
+   size_t i, len = strlen(str), bits = 0;
+
+   for (i = 0; i < len; i++)
+      bits += Hpack_huff_len[s[i]];
+
+   if ((bits + 7) / 8 < len) {
+      uint64_t acc = 0;
+      int n = 0;
+
+      Hpack_int_encode(out, 0x80, 7, (bits + 7) / 8);
+      for (i = 0; i < len; i++) {
+         acc = (acc << Hpack_huff_len[s[i]]) | Hpack_huff_code[s[i]];
+         for (n += Hpack_huff_len[s[i]]; n >= 8; n -= 8)
+            dStr_append_c(out, (acc >> (n - 8)) & 0xff);
+      }
+      if (n > 0)
+         dStr_append_c(out, ((acc << (8 - n)) | (0xff >> n)) & 0xff);
+   } else {
+      Hpack_int_encode(out, 0, 7, len);
+      dStr_append_l(out, str, len);
+   }
+}
+
+/* - Dynamic table - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+static size_t Hpack_field_size(const HpackField_t *f)
+{
+   return strlen(f->name) + strlen(f->value) + 32;
+}
+
+static void Hpack_field_free(HpackField_t *f)
+{
+   dFree(f->name);
+   dFree(f->value);
+   dFree(f);
+}
+
+/*
+ * Evict the oldest entries until the table fits in 'size'.
+ */
+static void Hpack_evict(Hpack_t *hp, size_t size)
+{
+   HpackField_t *f;
+
+   while (hp->size > size &&
+          (f = dList_nth_data(hp->table, dList_length(hp->table) - 1))) {
+      hp->size -= Hpack_field_size(f);
+      dList_remove(hp->table, f);
+      Hpack_field_free(f);
+   }
+}
+
+static void Hpack_table_add(Hpack_t *hp, const char *name, const char *value)
+{
+   HpackField_t *f = dNew(HpackField_t, 1);
+   size_t size;
+
+   f->name = dStrdup(name);
+   f->value = dStrdup(value);
+   size = Hpack_field_size(f);
+   if (size > hp->max_size) {
+      /* it empties the table, and doesn't fit */
+      Hpack_evict(hp, 0);
+      Hpack_field_free(f);
+   } else {
+      Hpack_evict(hp, hp->max_size - size);
+      dList_prepend(hp->table, f);
+      hp->size += size;
+   }
+}
+
+/*
+ * Get the name and value at 'idx' in the static + dynamic index space.
+ * Return 0 on success, -1 if there's no such entry.
+ */
+static int Hpack_lookup(Hpack_t *hp, size_t idx, const char **name,
+                        const char **value)
+{
+   HpackField_t *f;
+
+   if (idx >= 1 && idx <= HPACK_STATIC_LEN) {
+      *name = Hpack_static[idx - 1][0];
+      *value = Hpack_static[idx - 1][1];
+      return 0;
+   } else if (idx > HPACK_STATIC_LEN &&
+              (f = dList_nth_data(hp->table, idx - HPACK_STATIC_LEN - 1))) {
+      *name = f->name;
+      *value = f->value;
+      return 0;
+   }
+   return -1;
+}
+
+/*
+ * Create a compression context with a dynamic table of 'max_size' bytes
+ */
+Hpack_t *a_Hpack_new(size_t max_size)
+{
+   Hpack_t *hp = dNew0(Hpack_t, 1);
+
+   hp->table = dList_new(16);
+   hp->max_size = hp->limit = max_size;
+   return hp;
+}
+
+void a_Hpack_free(Hpack_t *hp)
+{
+   if (hp) {
+      Hpack_evict(hp, 0);
+      dList_free(hp->table);
+      dFree(hp);
+   }
+}
+
+/*
+ * Decode a header block, appending HpackField_t's to 'fields'.
+ * Return 0 on success, -1 on a compression error (fatal to the connection).
+ */
+int a_Hpack_decode(Hpack_t *hp, const uchar_t *buf, size_t len,
+                   Dlist *fields)
+{
+   const uchar_t *p = buf, *end = buf + len;
+   const char *name, *value;
+   char *new_name, *new_value;
+   HpackField_t *f;
+   size_t idx;
+
+   while (p < end) {
+      if (*p & 0x80) {
+         /* Indexed header field */
+         if (Hpack_int_decode(&p, end, 7, &idx) ||
+             Hpack_lookup(hp, idx, &name, &value))
+            return -1;
+         f = dNew(HpackField_t, 1);
+         f->name = dStrdup(name);
+         f->value = dStrdup(value);
+         dList_append(fields, f);
+      } else if ((*p & 0xe0) == 0x20) {
+         /* Dynamic table size update */
+         if (Hpack_int_decode(&p, end, 5, &idx) || idx > hp->limit)
+            return -1;
+         hp->max_size = idx;
+         Hpack_evict(hp, hp->max_size);
+      } else {
+         /* Literal header field, with incremental indexing (01), without
+          * indexing (0000) or never indexed (0001) */
+         bool_t incremental = (*p & 0x40) != 0;
+
+         if (Hpack_int_decode(&p, end, incremental ? 6 : 4, &idx))
+            return -1;
+         if (idx) {
+            if (Hpack_lookup(hp, idx, &name, &value))
+               return -1;
+            new_name = dStrdup(name);
+         } else if (!(new_name = Hpack_str_decode(&p, end))) {
+            return -1;
+         }
+         if (!(new_value = Hpack_str_decode(&p, end))) {
+            dFree(new_name);
+            return -1;
+         }
+         if (incremental)
+            Hpack_table_add(hp, new_name, new_value);
+         f = dNew(HpackField_t, 1);
+         f->name = new_name;
+         f->value = new_value;
+         dList_append(fields, f);
+      }
+   }
+   return 0;
+}
+
+/*
+ * Free a list of decoded fields (and the list)
+ */
+void a_Hpack_fields_free(Dlist *fields)
+{
+   HpackField_t *f;
+
+   while ((f = dList_nth_data(fields, 0))) {
+      dList_remove_fast(fields, f);
+      Hpack_field_free(f);
+   }
+   dList_free(fields);
+}
+
+/*
+ * The peer changed the size of the table we encode for.
+ * (The change is announced at the beginning of the next header block)
+ */
+void a_Hpack_set_max_size(Hpack_t *hp, size_t max_size)
+{
+   max_size = MIN(max_size, HPACK_TABLE_SIZE);
+   if (max_size != hp->max_size) {
+      hp->max_size = max_size;
+      Hpack_evict(hp, hp->max_size);
+      hp->size_update = TRUE;
+   }
+}
+
+/*
+ * Append the representation of a header field to 'out'.
+ * 'name' must be lowercase. Fields that repeat from query to query go into
+ * the dynamic table, so they cost a byte or two after the first time.
+ */
+void a_Hpack_encode(Hpack_t *hp, Dstr *out, const char *name,
+                    const char *value)
+{
+   int i, n, name_idx = 0;
+   HpackField_t *f;
+   size_t size;
+
+   if (hp->size_update) {
+      Hpack_int_encode(out, 0x20, 5, hp->max_size);
+      hp->size_update = FALSE;
+   }
+
+   for (i = 0; i < HPACK_STATIC_LEN; i++) {
+      if (!strcmp(name, Hpack_static[i][0])) {
+         if (!strcmp(value, Hpack_static[i][1])) {
+            Hpack_int_encode(out, 0x80, 7, i + 1);
+            return;
+         }
+         if (!name_idx)
+            name_idx = i + 1;
+      }
+   }
+   n = dList_length(hp->table);
+   for (i = 0; i < n; i++) {
+      f = dList_nth_data(hp->table, i);
+      if (!strcmp(name, f->name)) {
+         if (!strcmp(value, f->value)) {
+            Hpack_int_encode(out, 0x80, 7, HPACK_STATIC_LEN + i + 1);
+            return;
+         }
+         if (!name_idx)
+            name_idx = HPACK_STATIC_LEN + i + 1;
+      }
+   }
+
+   size = strlen(name) + strlen(value) + 32;
+   if (!strcmp(name, "cookie") || !strcmp(name, "authorization") ||
+       !strcmp(name, "proxy-authorization")) {
+      /* never indexed, not even by intermediaries */
+      Hpack_int_encode(out, 0x10, 4, name_idx);
+   } else if (!strcmp(name, ":path") || size > hp->max_size / 2) {
+      /* unlikely to repeat */
+      Hpack_int_encode(out, 0x00, 4, name_idx);
+   } else {
+      Hpack_int_encode(out, 0x40, 6, name_idx);
+      Hpack_table_add(hp, name, value);
+   }
+   if (!name_idx)
+      Hpack_str_encode(out, name);
+   Hpack_str_encode(out, value);
+}
@@ -0,0 +1,42 @@
+#ifndef __IO_HPACK_H__
+#define __IO_HPACK_H__
+
+#include "../../dlib/dlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Default size of the dynamic table (RFC 7541, SETTINGS_HEADER_TABLE_SIZE) */
+#define HPACK_TABLE_SIZE 4096
+
+typedef struct {
+   char *name;
+   char *value;
+} HpackField_t;
+
+/* Header compression context for one direction of a connection */
+typedef struct {
+   Dlist *table;           /* dynamic table, newest entry first */
+   size_t size;            /* sum of the entry sizes */
+   size_t max_size;        /* current size limit */
+   size_t limit;           /* decoder: max_size may not go beyond this */
+   bool_t size_update;     /* encoder: max_size is still to be announced */
+} Hpack_t;
+
+Hpack_t *a_Hpack_new(size_t max_size);
+void a_Hpack_free(Hpack_t *hp);
+
+int a_Hpack_decode(Hpack_t *hp, const uchar_t *buf, size_t len,
+                   Dlist *fields);
+void a_Hpack_fields_free(Dlist *fields);
+
+void a_Hpack_set_max_size(Hpack_t *hp, size_t max_size);
+void a_Hpack_encode(Hpack_t *hp, Dstr *out, const char *name,
+                    const char *value);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __IO_HPACK_H__ */
@@ -25,9 +25,12 @@
 #include <sys/socket.h>         /* for lots of socket stuff */
 #include <netinet/in.h>         /* for ntohl and stuff */
 #include <arpa/inet.h>          /* for inet_ntop */
+#include <time.h>
 
 #include "IO.h"
+#include "iowatch.hh"
 #include "tls.h"
+#include "http2.h"
 #include "Url.h"
 #include "../msg.h"
 #include "../klist.h"
@@ -37,8 +40,11 @@
 #include "../auth.h"
 #include "../prefs.h"
 #include "../misc.h"
+#include "../cache.h"
+#include "../decode.h"
 
 #include "../uicmd.hh"
+#include "../timeout.hh"
 
 /* Used to send a message to the bw's status bar */
 #define MSG_BW(web, root, ...)                                        \
@@ -53,6 +59,24 @@ static const int HTTP_SOCKET_USE_PROXY   = 0x1;
 static const int HTTP_SOCKET_QUEUED      = 0x2;
 static const int HTTP_SOCKET_TO_BE_FREED = 0x4;
 static const int HTTP_SOCKET_TLS         = 0x8;
+static const int HTTP_SOCKET_PIPELINED   = 0x10;
+static const int HTTP_SOCKET_RECEIVING   = 0x20;
+static const int HTTP_SOCKET_PRECONNECT  = 0x40;
+static const int HTTP_SOCKET_TCP_ONLY    = 0x80;
+
+/* Max number of queries waiting for their reply on a pipelined connection
+ * (besides the one being received) */
+#define HTTP_PIPELINE_DEPTH 4
+
+/* Head start of each connection attempt before racing it with the next
+ * address (seconds) */
+#define HTTP_CONNECT_ATTEMPT_DELAY 0.25
+
+/* How many hosts to remember the best address family for */
+#define HTTP_HOST_AFS_MAX 100
+
+/* Seconds a connection made in advance is kept unused */
+#define HTTP_WARM_IDLE 10
 
 /* 'web' is just a reference (no need to deallocate it here). */
 typedef struct {
@@ -60,11 +84,18 @@ typedef struct {
    uint_t flags;
    DilloWeb *web;          /* reference to client's web structure */
    DilloUrl *url;
-   Dlist *addr_list;       /* Holds the DNS answer */
+   Dlist *addr_list;       /* Holds (a copy of) the DNS answer */
    ChainLink *Info;        /* Used for CCC asynchronous operations */
    char *connected_to;     /* Used for per-server connection limit */
    uint_t connect_port;
    Dstr *https_proxy_reply;
+   ChainLink *InfoRecv;    /* Answer branch (set when it gets the FD) */
+   Dlist *pipeline;        /* Sockets whose queries follow ours on this FD */
+   ChainLink *PipeInfo;    /* IO writer for the pipelined queries */
+   Http2Conn_t *h2conn;    /* Our query is a stream on this connection */
+   Dlist *race_addrs;      /* Addresses not tried yet */
+   Dlist *race_fds;        /* Connection attempts in progress */
+   int race_timers;        /* Pending "try the next address" timeouts */
 } SocketData_t;
 
 /* Data structures and functions to queue sockets that need to be
@@ -78,6 +109,9 @@ typedef struct {
   int active_conns;
   int running_the_queue;
   Dlist *queue;
+  bool_t no_pipelining;   /* the server didn't cope with pipelined queries */
+  Http2Conn_t *h2;        /* HTTP/2 connection, shared by all the queries */
+  Dlist *warm;            /* Connections made in advance, waiting for use */
 } Server_t;
 
 typedef struct {
@@ -85,13 +119,38 @@ typedef struct {
    int skey;
 } FdMapEntry_t;
 
+typedef struct {
+   char *host;
+   int af;                 /* address family that connected first */
+} HostAf_t;
+
+typedef struct {
+   int fd;
+   bool_t tls;             /* the TLS handshake is done */
+   time_t since;
+} WarmSock_t;
+
 static void Http_socket_enqueue(Server_t *srv, SocketData_t* sock);
+static Server_t *Http_server_find(const char *host, uint_t port,
+                                  bool_t https);
 static Server_t *Http_server_get(const char *host, uint_t port, bool_t https);
 static void Http_server_remove(Server_t *srv);
 static void Http_connect_socket(ChainLink *Info);
+static void Http_connect_attempt_cb(int fd, void *data);
+static void Http_connect_timeout_cb(void *data);
+static void Http_connect_race_end(SocketData_t *S, int keep_fd);
+static void Http_socket_abort(SocketData_t *S);
+static void Http_warm_add(SocketData_t *sd);
+static bool_t Http_warm_use(Server_t *srv, SocketData_t *sd);
+static void Http_warm_close(Server_t *srv, WarmSock_t *ws);
 static char *Http_get_connect_str(const DilloUrl *url);
 static void Http_send_query(SocketData_t *S);
 static void Http_socket_free(int SKey);
+static void Http_socket_dealloc(SocketData_t *S);
+static void Http_pipeline_requeue(Server_t *srv, SocketData_t *sd);
+static void Http_h2_start(SocketData_t *sd);
+static void Http_h2_stream_start(Server_t *srv, SocketData_t *sd);
+static void Http_h2_stream_free(SocketData_t *sd, int SKey);
 
 /*
  * Local data
@@ -102,6 +161,13 @@ static DilloUrl *HTTP_Proxy = NULL;
 static char *HTTP_Proxy_Auth_base64 = NULL;
 static char *HTTP_Language_hdr = NULL;
 static Dlist *servers;
+static Dlist *host_afs;
+
+/* Connections made in advance */
+static Dlist *preconnects;         /* sockets still connecting */
+static int warm_socks;             /* connected, in the servers' pools */
+static bool_t warm_timeout_set;
+static int preconnects_made, warm_used, warm_expired;
 
 /* TODO: If fd_map will stick around in its present form (FDs and SocketData_t)
  * then consider whether having both this and ValidSocks is necessary.
@@ -133,6 +199,8 @@ int a_Http_init(void)
 
    servers = dList_new(5);
    fd_map = dList_new(20);
+   host_afs = dList_new(20);
+   preconnects = dList_new(4);
 
    return 0;
 }
@@ -217,7 +285,12 @@ void a_Http_connect_done(int fd, bool_t success)
       ChainLink *info = sd->Info;
       bool_t valid_web = a_Web_valid(sd->web);
 
-      if (success && valid_web) {
+      if (success && (sd->flags & HTTP_SOCKET_PRECONNECT)) {
+         Http_warm_add(sd);
+      } else if (success && valid_web && (sd->flags & HTTP_SOCKET_TLS) &&
+          a_Tls_alpn_h2(fd)) {
+         Http_h2_start(sd);
+      } else if (success && valid_web) {
          a_Chain_bfcb(OpSend, info, &sd->SockFD, "FD");
          Http_send_query(sd);
       } else {
@@ -225,9 +298,7 @@ void a_Http_connect_done(int fd, bool_t success)
             MSG_BW(sd->web, 1, "Could not establish connection.");
          MSG("fd %d is done and failed\n", sd->SockFD);
          dClose(fd);
-         Http_socket_free(VOIDP2INT(info->LocalKey)); /* free sd */
-         a_Chain_bfcb(OpAbort, info, NULL, "Both");
-         dFree(info);
+         Http_socket_abort(sd);
       }
    } else {
       MSG("**** but no luck with fme %p or sd\n", fme);
@@ -251,28 +322,49 @@ static void Http_connect_queued_sockets(Server_t *srv)
 
    for (i = 0;
         (i < dList_length(srv->queue) &&
-         srv->active_conns < prefs.http_max_conns);
+         (srv->h2 ? a_Http2_conn_usable(srv->h2) :
+                    srv->active_conns < prefs.http_max_conns));
         i++) {
       sd = dList_nth_data(srv->queue, i);
 
       if (sd->flags & HTTP_SOCKET_TO_BE_FREED) {
          dList_remove(srv->queue, sd);
-         dFree(sd);
+         Http_socket_dealloc(sd);
          i--;
       } else {
          int connect_ready = TLS_CONNECT_READY;
 
-         if (sd->flags & HTTP_SOCKET_TLS)
+         if ((sd->flags & HTTP_SOCKET_TLS) &&
+             !(sd->flags & HTTP_SOCKET_TCP_ONLY))
             connect_ready = a_Tls_connect_ready(sd->url);
 
-         if (connect_ready == TLS_CONNECT_NEVER || !a_Web_valid(sd->web)) {
+         if (sd->flags & HTTP_SOCKET_PRECONNECT) {
+            if (srv->h2 || connect_ready != TLS_CONNECT_READY) {
+               /* no use for it */
+               dList_remove(srv->queue, sd);
+               sd->flags &= ~HTTP_SOCKET_QUEUED;
+               Http_socket_abort(sd);
+            } else {
+               Http_socket_activate(srv, sd);
+               Http_connect_socket(sd->Info);
+            }
+            i--;
+         } else if (connect_ready == TLS_CONNECT_NEVER ||
+                    !a_Web_valid(sd->web)) {
             int SKey = VOIDP2INT(sd->Info->LocalKey);
 
             Http_socket_free(SKey);
          } else if (connect_ready == TLS_CONNECT_READY) {
             i--;
-            Http_socket_activate(srv, sd);
-            Http_connect_socket(sd->Info);
+            if (srv->h2) {
+               dList_remove(srv->queue, sd);
+               sd->flags &= ~HTTP_SOCKET_QUEUED;
+               Http_h2_stream_start(srv, sd);
+            } else {
+               Http_socket_activate(srv, sd);
+               if (!Http_warm_use(srv, sd))
+                  Http_connect_socket(sd->Info);
+            }
          }
       }
    }
@@ -281,7 +373,7 @@ static void Http_connect_queued_sockets(Server_t *srv)
         srv->port, dList_length(srv->queue));
 
    if (--srv->running_the_queue == 0) {
-      if (srv->active_conns == 0)
+      if (srv->active_conns == 0 && dList_length(srv->warm) == 0)
          Http_server_remove(srv);
    }
 }
@@ -297,28 +389,60 @@ static void Http_socket_free(int SKey)
       a_Klist_remove(ValidSocks, SKey);
 
       dStr_free(S->https_proxy_reply, 1);
+      if (S->flags & HTTP_SOCKET_PRECONNECT)
+         dList_remove(preconnects, S);
 
-      if (S->flags & HTTP_SOCKET_QUEUED) {
+      if (S->flags & (HTTP_SOCKET_QUEUED | HTTP_SOCKET_PIPELINED)) {
+         /* it's in a server queue or in another socket's pipeline list */
          S->flags |= HTTP_SOCKET_TO_BE_FREED;
          a_Url_free(S->url);
       } else {
          if (S->SockFD != -1)
             Http_fd_map_remove_entry(S->SockFD);
+         Http_connect_race_end(S, -1);
          a_Tls_reset_server_state(S->url);
-         if (S->connected_to) {
-            a_Tls_close_by_fd(S->SockFD);
-
+         if (S->h2conn) {
+            Http_h2_stream_free(S, SKey);
+         } else if (S->connected_to) {
             Server_t *srv = Http_server_get(S->connected_to, S->connect_port,
                                             (S->flags & HTTP_SOCKET_TLS));
+            /* Queries sent after ours won't be answered on this FD */
+            Http_pipeline_requeue(srv, S);
+            a_Tls_close_by_fd(S->SockFD);
+
             srv->active_conns--;
             Http_connect_queued_sockets(srv);
          }
          a_Url_free(S->url);
-         dFree(S);
+         Http_socket_dealloc(S);
       }
    }
 }
 
+/*
+ * Free the memory of a socket that's out of every list
+ */
+static void Http_socket_dealloc(SocketData_t *S)
+{
+   if (S->addr_list)
+      a_Dns_addr_list_free(S->addr_list);
+   dFree(S);
+}
+
+/*
+ * Free the socket, and abort its CCC chain
+ */
+static void Http_socket_abort(SocketData_t *S)
+{
+   ChainLink *info = S->Info;
+   bool_t chained = !(S->flags & HTTP_SOCKET_PRECONNECT);
+
+   Http_socket_free(VOIDP2INT(info->LocalKey));
+   if (chained)
+      a_Chain_bfcb(OpAbort, info, NULL, "Both");
+   dFree(info);
+}
+
 /*
  * Make the HTTP header's Referer line according to preferences
  * (default is "host" i.e. "scheme://hostname/" )
@@ -373,7 +497,7 @@ static Dstr *Http_make_content_type(const DilloUrl *url)
  */
 static Dstr *Http_make_query_str(DilloWeb *web, bool_t use_proxy)
 {
-   char *ptr, *cookies, *referer, *auth;
+   char *ptr, *cookies, *referer, *auth, *validators = NULL;
    const DilloUrl *url = web->url;
    Dstr *query      = dStr_new(""),
         *request_uri = dStr_new(""),
@@ -417,7 +541,7 @@ static Dstr *Http_make_query_str(DilloWeb *web, bool_t use_proxy)
          "User-Agent: %s\r\n"
          "Accept: %s\r\n"
          "%s" /* language */
-         "Accept-Encoding: gzip, deflate\r\n"
+         "Accept-Encoding: %s\r\n"
          "%s" /* auth */
          "DNT: 1\r\n"
          "%s" /* proxy auth */
@@ -428,12 +552,15 @@ static Dstr *Http_make_query_str(DilloWeb *web, bool_t use_proxy)
          "%s" /* cookies */
          "\r\n",
          request_uri->str, URL_AUTHORITY(url), prefs.http_user_agent,
-         accept_hdr_value, HTTP_Language_hdr, auth ? auth : "",
+         accept_hdr_value, HTTP_Language_hdr, a_Decode_content_encodings(),
+         auth ? auth : "",
          proxy_auth->str, referer, connection_hdr_val, content_type->str,
          (long)URL_DATA(url)->len, cookies);
       dStr_append_l(query, URL_DATA(url)->str, URL_DATA(url)->len);
       dStr_free(content_type, TRUE);
    } else {
+      if (!(URL_FLAGS(url) & URL_E2EQuery))
+         validators = a_Cache_validators(url);
       dStr_sprintfa(
          query,
          "GET %s HTTP/1.1\r\n"
@@ -441,22 +568,25 @@ static Dstr *Http_make_query_str(DilloWeb *web, bool_t use_proxy)
          "User-Agent: %s\r\n"
          "Accept: %s\r\n"
          "%s" /* language */
-         "Accept-Encoding: gzip, deflate\r\n"
+         "Accept-Encoding: %s\r\n"
          "%s" /* auth */
          "DNT: 1\r\n"
          "%s" /* proxy auth */
          "%s" /* referer */
          "Connection: %s\r\n"
          "%s" /* cache control */
+         "%s" /* validators */
          "%s" /* cookies */
          "\r\n",
          request_uri->str, URL_AUTHORITY(url), prefs.http_user_agent,
-         accept_hdr_value, HTTP_Language_hdr, auth ? auth : "",
+         accept_hdr_value, HTTP_Language_hdr, a_Decode_content_encodings(),
+         auth ? auth : "",
          proxy_auth->str, referer, connection_hdr_val,
          (URL_FLAGS(url) & URL_E2EQuery) ?
             "Pragma: no-cache\r\nCache-Control: no-cache\r\n" : "",
-         cookies);
+         validators ? validators : "", cookies);
    }
+   dFree(validators);
    dFree(referer);
    dFree(cookies);
    dFree(auth);
@@ -509,18 +639,135 @@ static void Http_connect_tls(ChainLink *info)
       dFree(dbuf);
       dFree(connect_str);
    } else {
-      a_Tls_handshake(S->SockFD, S->url);
+      a_Tls_handshake(S->SockFD, S->url, prefs.http2);
    }
 }
 
 /*
- * This function is called after the DNS succeeds in solving a hostname.
- * Task: Finish socket setup and start connecting the socket.
+ * Remember which address family connected first to 'host', so that it's
+ * tried first next time.
  */
-static void Http_connect_socket(ChainLink *Info)
+static void Http_host_af_set(const char *host, int af)
 {
-   int i, status;
-   SocketData_t *S;
+   HostAf_t *ha;
+   int i;
+
+   for (i = 0; (ha = dList_nth_data(host_afs, i)); i++) {
+      if (!dStrAsciiCasecmp(ha->host, host)) {
+         ha->af = af;
+         return;
+      }
+   }
+   if (dList_length(host_afs) >= HTTP_HOST_AFS_MAX) {
+      ha = dList_nth_data(host_afs, 0);
+      dList_remove(host_afs, ha);
+      dFree(ha->host);
+      dFree(ha);
+   }
+   ha = dNew(HostAf_t, 1);
+   ha->host = dStrdup(host);
+   ha->af = af;
+   dList_append(host_afs, ha);
+}
+
+static int Http_host_af_get(const char *host)
+{
+   HostAf_t *ha;
+   int i;
+
+   for (i = 0; (ha = dList_nth_data(host_afs, i)); i++)
+      if (!dStrAsciiCasecmp(ha->host, host))
+         return ha->af;
+   return AF_UNSPEC;
+}
+
+/*
+ * Return the DNS answer in the order to try it: starting with the family
+ * 'af' (if there's any address of it), and then alternating families.
+ */
+static Dlist *Http_connect_order(Dlist *addr_list, int af)
+{
+   Dlist *order = dList_new(8), *others = dList_new(8);
+   DilloHost *dh, *first = dList_nth_data(addr_list, 0);
+   int i;
+
+   if (af == AF_UNSPEC && first)
+      af = first->af;
+   for (i = 0; (dh = dList_nth_data(addr_list, i)); i++) {
+      if (dh->af == af)
+         dList_append(order, dh);
+      else
+         dList_append(others, dh);
+   }
+   for (i = 0; (dh = dList_nth_data(others, i)); i++) {
+      int pos = 2 * i + 1;
+
+      if (pos < dList_length(order))
+         dList_insert_pos(order, dh, pos);
+      else
+         dList_append(order, dh);
+   }
+   dList_free(others);
+   return order;
+}
+
+/*
+ * Stop racing, closing every attempt but 'keep_fd'.
+ */
+static void Http_connect_race_end(SocketData_t *S, int keep_fd)
+{
+   int i, fd;
+
+   if (S->race_fds) {
+      for (i = 0; i < dList_length(S->race_fds); i++) {
+         fd = VOIDP2INT(dList_nth_data(S->race_fds, i));
+         a_IOwatch_remove_fd(fd, DIO_WRITE);
+         if (fd != keep_fd)
+            dClose(fd);
+      }
+      dList_free(S->race_fds);
+      S->race_fds = NULL;
+      dList_free(S->race_addrs);
+      S->race_addrs = NULL;
+   }
+}
+
+/*
+ * An attempt connected: carry on with it.
+ */
+static void Http_connect_won(SocketData_t *S, int fd, int af)
+{
+   Http_connect_race_end(S, fd);
+   S->SockFD = fd;
+   Http_fd_map_add_entry(S);
+   if (S->connected_to)
+      Http_host_af_set(S->connected_to, af);
+
+   if ((S->flags & HTTP_SOCKET_TLS) && !(S->flags & HTTP_SOCKET_TCP_ONLY)) {
+      Http_connect_tls(S->Info);
+   } else {
+      a_Http_connect_done(S->SockFD, TRUE);
+   }
+}
+
+/*
+ * Every address failed.
+ */
+static void Http_connect_lost(SocketData_t *S)
+{
+   Http_connect_race_end(S, -1);
+   MSG_BW(S->web, 1, "Could not establish connection.");
+   Http_socket_abort(S);
+}
+
+/*
+ * Start connecting to the next address (and keep going down the list
+ * while they fail right away). When there's no address left and no
+ * attempt in progress, give up.
+ */
+static void Http_connect_next(SocketData_t *S)
+{
+   int fd, status, SKey = VOIDP2INT(S->Info->LocalKey);
    DilloHost *dh;
 #ifdef ENABLE_IPV6
    struct sockaddr_in6 name;
@@ -528,20 +775,18 @@ static void Http_connect_socket(ChainLink *Info)
    struct sockaddr_in name;
 #endif
    socklen_t socket_len = 0;
+   char buf[128];
 
-   S = a_Klist_get_data(ValidSocks, VOIDP2INT(Info->LocalKey));
-
-   /* TODO: iterate this address list until success, or end-of-list */
-   for (i = 0; (dh = dList_nth_data(S->addr_list, i)); ++i) {
-      if ((S->SockFD = socket(dh->af, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+   while ((dh = dList_nth_data(S->race_addrs, 0))) {
+      dList_remove(S->race_addrs, dh);
+      if ((fd = socket(dh->af, SOCK_STREAM, IPPROTO_TCP)) < 0) {
          MSG("Http_connect_socket ERROR: %s\n", dStrerror(errno));
          continue;
       }
-      Http_fd_map_add_entry(S);
 
       /* set NONBLOCKING and close on exec. */
-      fcntl(S->SockFD, F_SETFL, O_NONBLOCK | fcntl(S->SockFD, F_GETFL));
-      fcntl(S->SockFD, F_SETFD, FD_CLOEXEC | fcntl(S->SockFD, F_GETFD));
+      fcntl(fd, F_SETFL, O_NONBLOCK | fcntl(fd, F_GETFL));
+      fcntl(fd, F_SETFD, FD_CLOEXEC | fcntl(fd, F_GETFD));
 
       /* Some OSes require this...  */
       memset(&name, 0, sizeof(name));
@@ -554,39 +799,107 @@ static void Http_connect_socket(ChainLink *Info)
          sin->sin_family = dh->af;
          sin->sin_port = htons(S->connect_port);
          memcpy(&sin->sin_addr, dh->data, (size_t)dh->alen);
-         if (a_Web_valid(S->web) && (S->web->flags & WEB_RootUrl))
-            MSG("Connecting to %s:%u\n", inet_ntoa(sin->sin_addr),
-                S->connect_port);
          break;
       }
 #ifdef ENABLE_IPV6
       case AF_INET6:
       {
-         char buf[128];
          struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&name;
          socket_len = sizeof(struct sockaddr_in6);
          sin6->sin6_family = dh->af;
          sin6->sin6_port = htons(S->connect_port);
          memcpy(&sin6->sin6_addr, dh->data, dh->alen);
-         inet_ntop(dh->af, dh->data, buf, sizeof(buf));
-         if (a_Web_valid(S->web) && (S->web->flags & WEB_RootUrl))
-            MSG("Connecting to %s:%u\n", buf, S->connect_port);
          break;
       }
 #endif
       }/*switch*/
-      MSG_BW(S->web, 1, "Contacting host...");
-      status = connect(S->SockFD, (struct sockaddr *)&name, socket_len);
-      if (status == -1 && errno != EINPROGRESS) {
-         MSG("Http_connect_socket ERROR: %s\n", dStrerror(errno));
-         a_Http_connect_done(S->SockFD, FALSE);
-      } else if (S->flags & HTTP_SOCKET_TLS) {
-         Http_connect_tls(Info);
+      if (a_Web_valid(S->web) && (S->web->flags & WEB_RootUrl)) {
+         a_Dns_dillohost_to_string(dh, buf, sizeof(buf));
+         MSG("Connecting to %s:%u\n", buf, S->connect_port);
+      }
+      status = connect(fd, (struct sockaddr *)&name, socket_len);
+      if (status == 0) {
+         Http_connect_won(S, fd, dh->af);
+         return;
+      } else if (errno == EINPROGRESS) {
+         dList_append(S->race_fds, INT2VOIDP(fd));
+         a_IOwatch_add_fd(fd, DIO_WRITE, Http_connect_attempt_cb,
+                          INT2VOIDP(SKey));
+         if (dList_length(S->race_addrs) > 0) {
+            /* Give it a head start before trying the next one */
+            S->race_timers++;
+            a_Timeout_add(HTTP_CONNECT_ATTEMPT_DELAY, Http_connect_timeout_cb,
+                          INT2VOIDP(SKey));
+         }
+         return;
       } else {
-         a_Http_connect_done(S->SockFD, TRUE);
+         MSG("Http_connect_socket ERROR: %s\n", dStrerror(errno));
+         dClose(fd);
       }
+   }
+   if (dList_length(S->race_fds) == 0)
+      Http_connect_lost(S);
+}
+
+/*
+ * An attempt has finished connecting, for better or worse.
+ */
+static void Http_connect_attempt_cb(int fd, void *data)
+{
+   SocketData_t *S = a_Klist_get_data(ValidSocks, VOIDP2INT(data));
+   int err = 0;
+   socklen_t len = sizeof(err);
+   struct sockaddr_storage name;
+   socklen_t name_len = sizeof(name);
+
+   a_IOwatch_remove_fd(fd, DIO_WRITE);
+   if (!S || !S->race_fds) {
+      /* the race was over already */
       return;
    }
+   if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+      err = errno;
+   if (err == 0 && getpeername(fd, (struct sockaddr *)&name, &name_len) == 0) {
+      Http_connect_won(S, fd, name.ss_family);
+   } else {
+      MSG("Http_connect_socket ERROR: %s\n", dStrerror(err ? err : errno));
+      dList_remove(S->race_fds, INT2VOIDP(fd));
+      dClose(fd);
+      /* no need to wait for the delay */
+      Http_connect_next(S);
+   }
+}
+
+/*
+ * The latest attempt had its head start; try the next address too.
+ */
+static void Http_connect_timeout_cb(void *data)
+{
+   SocketData_t *S = a_Klist_get_data(ValidSocks, VOIDP2INT(data));
+
+   /* Only the last timeout that was set is current, and as they all have
+    * the same delay, it's the last one to fire. */
+   if (S && --S->race_timers == 0 && S->race_fds)
+      Http_connect_next(S);
+}
+
+/*
+ * This function is called after the DNS succeeds in solving a hostname.
+ * Task: Finish socket setup and start connecting the socket.
+ *
+ * The addresses are raced, Happy Eyeballs style (RFC 8305): each attempt
+ * gets a short head start, then the next address is tried too, and the
+ * first one to connect wins.
+ */
+static void Http_connect_socket(ChainLink *Info)
+{
+   SocketData_t *S = a_Klist_get_data(ValidSocks, VOIDP2INT(Info->LocalKey));
+   int af = S->connected_to ? Http_host_af_get(S->connected_to) : AF_UNSPEC;
+
+   S->race_addrs = Http_connect_order(S->addr_list, af);
+   S->race_fds = dList_new(4);
+   MSG_BW(S->web, 1, "Contacting host...");
+   Http_connect_next(S);
 }
 
 /*
@@ -677,11 +990,14 @@ static void Http_dns_cb(int Status, Dlist *addr_list, void *data)
    if (S) {
       const char *host = URL_HOST((S->flags & HTTP_SOCKET_USE_PROXY) ?
                                   HTTP_Proxy : S->url);
-      if (a_Web_valid(S->web)) {
+      if (a_Web_valid(S->web) || (S->flags & HTTP_SOCKET_PRECONNECT)) {
          if (Status == 0 && addr_list) {
 
-            /* Successful DNS answer; save the IP */
-            S->addr_list = addr_list;
+            /* Successful DNS answer; save the IP (the DNS cache may drop
+             * its own list before we're done with it) */
+            if (S->addr_list)
+               a_Dns_addr_list_free(S->addr_list);
+            S->addr_list = a_Dns_addr_list_copy(addr_list);
             clean_up = FALSE;
             srv = Http_server_get(host, S->connect_port,
                                  (S->flags & HTTP_SOCKET_TLS));
@@ -692,13 +1008,8 @@ static void Http_dns_cb(int Status, Dlist *addr_list, void *data)
             MSG_BW(S->web, 0, "ERROR: DNS can't resolve %s", host);
          }
       }
-      if (clean_up) {
-         ChainLink *info = S->Info;
-
-         Http_socket_free(SKey);
-         a_Chain_bfcb(OpAbort, info, NULL, "Both");
-         dFree(info);
-      }
+      if (clean_up)
+         Http_socket_abort(S);
    }
 }
 
@@ -745,6 +1056,171 @@ static int Http_get(ChainLink *Info, void *Data1)
    return 0;
 }
 
+/*
+ * Close a connection of the server's pool
+ */
+static void Http_warm_close(Server_t *srv, WarmSock_t *ws)
+{
+   dList_remove(srv->warm, ws);
+   warm_socks--;
+   if (ws->tls) {
+      a_Tls_close_by_fd(ws->fd);
+   }
+   dClose(ws->fd);
+   dFree(ws);
+}
+
+/*
+ * Close the connections that have been waiting in the pools for too long
+ */
+static void Http_warm_timeout_cb(void *data)
+{
+   time_t now = time(NULL);
+   Server_t *srv;
+   WarmSock_t *ws;
+   int i, j;
+
+   for (i = 0; (srv = dList_nth_data(servers, i)); i++) {
+      for (j = 0; (ws = dList_nth_data(srv->warm, j)); j++) {
+         if (now - ws->since >= HTTP_WARM_IDLE) {
+            _MSG("Preconnect to %s expired\n", srv->host);
+            Http_warm_close(srv, ws);
+            warm_expired++;
+            j--;
+         }
+      }
+      if (dList_length(srv->warm) == 0 && srv->active_conns == 0 &&
+          dList_length(srv->queue) == 0 && srv->running_the_queue == 0) {
+         Http_server_remove(srv);
+         i--;
+      }
+   }
+   if (warm_socks > 0) {
+      a_Timeout_repeat(1.0, Http_warm_timeout_cb, NULL);
+   } else {
+      warm_timeout_set = FALSE;
+      a_Timeout_remove();
+   }
+}
+
+/*
+ * The connection made in advance by 'sd' is ready: leave it in the
+ * server's pool.
+ */
+static void Http_warm_add(SocketData_t *sd)
+{
+   Server_t *srv = Http_server_get(sd->connected_to, sd->connect_port,
+                                   (sd->flags & HTTP_SOCKET_TLS));
+   WarmSock_t *ws = dNew(WarmSock_t, 1);
+
+   ws->fd = sd->SockFD;
+   ws->tls = !(sd->flags & HTTP_SOCKET_TCP_ONLY) &&
+             (sd->flags & HTTP_SOCKET_TLS);
+   ws->since = time(NULL);
+   dList_append(srv->warm, ws);
+   warm_socks++;
+   _MSG("Preconnected to %s:%u%s\n", srv->host, srv->port,
+        ws->tls ? " (TLS)" : "");
+
+   Http_fd_map_remove_entry(sd->SockFD);
+   sd->SockFD = -1;
+   Http_socket_abort(sd);
+
+   if (!warm_timeout_set) {
+      warm_timeout_set = TRUE;
+      a_Timeout_add(1.0, Http_warm_timeout_cb, NULL);
+   }
+}
+
+/*
+ * Give 'sd' a connection from the server's pool, if there's one that is
+ * still open.
+ * Return value: whether it got one.
+ */
+static bool_t Http_warm_use(Server_t *srv, SocketData_t *sd)
+{
+   WarmSock_t *ws;
+   ssize_t n;
+   char c;
+
+   while ((ws = dList_nth_data(srv->warm, 0))) {
+      n = recv(ws->fd, &c, 1, MSG_PEEK);
+      if ((n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ||
+          (n > 0 && ws->tls)) {
+         /* no EOF (the TLS library may have data of its own to read) */
+         dList_remove(srv->warm, ws);
+         warm_socks--;
+         warm_used++;
+         sd->SockFD = ws->fd;
+         Http_fd_map_add_entry(sd);
+         MSG("Using a connection made in advance for %s\n",
+             URL_STR(sd->url));
+         if ((sd->flags & HTTP_SOCKET_TLS) && !ws->tls) {
+            Http_connect_tls(sd->Info);
+         } else {
+            a_Http_connect_done(sd->SockFD, TRUE);
+         }
+         dFree(ws);
+         return TRUE;
+      }
+      /* the server closed it */
+      Http_warm_close(srv, ws);
+      warm_expired++;
+   }
+   return FALSE;
+}
+
+/*
+ * A query for 'url' is likely to come soon: resolve its host, and connect
+ * to the server in advance. The TLS handshake is only done if the server's
+ * certificate was already found to be fine, as a problem with it should be
+ * reported when the user follows the link, not before.
+ */
+void a_Http_preconnect(const DilloUrl *url)
+{
+   const DilloUrl *conn_url = url;
+   bool_t https = !dStrAsciiCasecmp(URL_SCHEME(url), "https");
+   SocketData_t *S;
+   uint_t port;
+   int i, SKey;
+
+   if (dList_length(preconnects) + warm_socks >= prefs.http_preconnect)
+      return;
+   if (Http_must_use_proxy(URL_HOST(url))) {
+      if (https)
+         return;
+      conn_url = HTTP_Proxy;
+   }
+   port = URL_PORT(conn_url);
+   if (Http_server_find(URL_HOST(conn_url), port, https))
+      return;   /* already connected, or connecting */
+   for (i = 0; (S = dList_nth_data(preconnects, i)); i++) {
+      if (S->connect_port == port &&
+          https == ((S->flags & HTTP_SOCKET_TLS) != 0) &&
+          !dStrAsciiCasecmp(URL_HOST(conn_url), URL_HOST(S->url)))
+         return;
+   }
+
+   SKey = Http_sock_new();
+   S = a_Klist_get_data(ValidSocks, SKey);
+   S->flags = HTTP_SOCKET_PRECONNECT;
+   if (conn_url != url)
+      S->flags |= HTTP_SOCKET_USE_PROXY;
+   if (https) {
+      S->flags |= HTTP_SOCKET_TLS;
+      if (!a_Tls_certificate_is_clean(url))
+         S->flags |= HTTP_SOCKET_TCP_ONLY;
+   }
+   S->url = a_Url_dup(conn_url);
+   S->connect_port = port;
+   S->Info = dNew0(ChainLink, 1);
+   S->Info->LocalKey = INT2VOIDP(SKey);
+   dList_append(preconnects, S);
+   preconnects_made++;
+
+   a_Dns_resolve(URL_HOST(conn_url), Http_dns_cb, S->Info->LocalKey);
+}
+
 /*
  * Can the old socket's fd be reused for the new socket?
  *
@@ -767,15 +1243,189 @@ static bool_t Http_socket_reuse_compatible(SocketData_t *old,
    return FALSE;
 }
 
+/*
+ * End the IO writer used for the pipelined queries of 'sd'.
+ */
+static void Http_pipeline_writer_end(SocketData_t *sd)
+{
+   if (sd->PipeInfo) {
+      a_Chain_bcb(OpEnd, sd->PipeInfo, NULL, NULL);
+      dFree(sd->PipeInfo);
+      sd->PipeInfo = NULL;
+   }
+}
+
+/*
+ * Put the sockets in the pipeline of 'sd' back at the head of the server
+ * queue, so that they get a connection (and send their queries) again.
+ */
+static void Http_pipeline_requeue(Server_t *srv, SocketData_t *sd)
+{
+   SocketData_t *p;
+   int i;
+
+   Http_pipeline_writer_end(sd);
+   for (i = dList_length(sd->pipeline) - 1; i >= 0; i--) {
+      p = dList_nth_data(sd->pipeline, i);
+      p->flags &= ~HTTP_SOCKET_PIPELINED;
+      if (p->flags & HTTP_SOCKET_TO_BE_FREED) {
+         Http_socket_dealloc(p);
+      } else {
+         p->flags |= HTTP_SOCKET_QUEUED;
+         dList_insert_pos(srv->queue, p, 0);
+      }
+   }
+   dList_free(sd->pipeline);
+   sd->pipeline = NULL;
+}
+
+/*
+ * Pipelining: once the reply to 'sd' starts arriving (i.e. its query is
+ * out), send the queries of compatible queued sockets on the same
+ * connection. Their replies will follow this one, in order.
+ */
+static void Http_pipeline_fill(SocketData_t *sd)
+{
+   Server_t *srv;
+   SocketData_t *p;
+   Dstr *queries;
+   DataBuf *dbuf;
+   int i;
+
+   if (!prefs.http_pipelining || !prefs.http_persistent_conns ||
+       !sd->connected_to || sd->pipeline ||
+       (sd->flags & HTTP_SOCKET_USE_PROXY) ||
+       (URL_FLAGS(sd->url) & URL_Post))
+      return;
+
+   srv = Http_server_get(sd->connected_to, sd->connect_port,
+                         (sd->flags & HTTP_SOCKET_TLS));
+   if (srv->no_pipelining)
+      return;
+
+   queries = dStr_new("");
+   for (i = 0; (i < dList_length(srv->queue) &&
+                dList_length(sd->pipeline) < HTTP_PIPELINE_DEPTH); i++) {
+      p = dList_nth_data(srv->queue, i);
+
+      /* Only idempotent requests */
+      if (!(p->flags & (HTTP_SOCKET_TO_BE_FREED | HTTP_SOCKET_USE_PROXY)) &&
+          !(URL_FLAGS(p->url) & URL_Post) &&
+          Http_socket_reuse_compatible(sd, p)) {
+         Dstr *query = Http_make_query_str(p->web, FALSE);
+
+         dStr_append_l(queries, query->str, query->len);
+         dStr_free(query, 1);
+
+         dList_remove(srv->queue, p);
+         i--;
+         p->flags &= ~HTTP_SOCKET_QUEUED;
+         p->flags |= HTTP_SOCKET_PIPELINED;
+         if (!sd->pipeline)
+            sd->pipeline = dList_new(HTTP_PIPELINE_DEPTH);
+         dList_append(sd->pipeline, p);
+      }
+   }
+
+   if (sd->pipeline) {
+      /* The queries get a writer of their own, as the writer of each
+       * socket is ended when its reply is complete. */
+      sd->PipeInfo = a_Chain_new();
+      sd->PipeInfo->LocalKey = sd->Info->LocalKey;
+      a_Chain_link_new(sd->PipeInfo, a_Http_ccc, BCK, a_IO_ccc, 1, 1);
+      a_Chain_bcb(OpStart, sd->PipeInfo, NULL, NULL);
+      a_Chain_bcb(OpSend, sd->PipeInfo, &sd->SockFD, "FD");
+      dbuf = a_Chain_dbuf_new(queries->str, queries->len, 0);
+      a_Chain_bcb(OpSend, sd->PipeInfo, dbuf, NULL);
+      dFree(dbuf);
+      _MSG("Pipelined %d queries on fd %d\n",
+           dList_length(sd->pipeline), sd->SockFD);
+   }
+   dStr_free(queries, 1);
+}
+
+/*
+ * The reply to the socket 'SKey' is complete, and the next socket in its
+ * pipeline takes over the connection. 'surplus' is what was read past the
+ * reply (NULL if unknown); it's the beginning of the next reply.
+ */
+static void Http_pipeline_next(int SKey, Dstr *surplus)
+{
+   int fd, NKey;
+   SocketData_t *new_sd, *old_sd = a_Klist_get_data(ValidSocks, SKey);
+   Server_t *srv = Http_server_get(old_sd->connected_to, old_sd->connect_port,
+                                   (old_sd->flags & HTTP_SOCKET_TLS));
+
+   new_sd = dList_nth_data(old_sd->pipeline, 0);
+   if (!surplus || (new_sd->flags & HTTP_SOCKET_TO_BE_FREED)) {
+      /* We can't tell where the next reply starts, or nobody wants it */
+      if (!surplus) {
+         MSG("Pipelining to %s lost track of the replies; disabling it.\n",
+             srv->host);
+         srv->no_pipelining = TRUE;
+      }
+      fd = old_sd->SockFD;
+      Http_socket_free(SKey);   /* requeues the pipeline */
+      dClose(fd);
+      return;
+   }
+
+   dList_remove(old_sd->pipeline, new_sd);
+   if (dList_length(old_sd->pipeline)) {
+      new_sd->pipeline = old_sd->pipeline;
+      new_sd->PipeInfo = old_sd->PipeInfo;
+      new_sd->PipeInfo->LocalKey = new_sd->Info->LocalKey;
+   } else {
+      /* all the queries are out (we're getting the replies) */
+      Http_pipeline_writer_end(old_sd);
+      dList_free(old_sd->pipeline);
+   }
+   old_sd->pipeline = NULL;
+   old_sd->PipeInfo = NULL;
+
+   new_sd->SockFD = old_sd->SockFD;
+   old_sd->connected_to = NULL;
+   srv->active_conns--;
+   Http_socket_free(SKey);
+
+   new_sd->flags &= ~HTTP_SOCKET_PIPELINED;
+   srv->active_conns++;
+   new_sd->connected_to = srv->host;
+   Http_fd_map_add_entry(new_sd);
+
+   _MSG("Pipelined reply on fd %d for %s\n", new_sd->SockFD,
+        URL_STR(new_sd->url));
+   NKey = VOIDP2INT(new_sd->Info->LocalKey);
+   a_Chain_bfcb(OpSend, new_sd->Info, &new_sd->SockFD, "FD");
+   if (surplus->len > 0 &&
+       (new_sd = a_Klist_get_data(ValidSocks, NKey)) && new_sd->InfoRecv) {
+      DataBuf *dbuf = a_Chain_dbuf_new(surplus->str, surplus->len, 0);
+
+      a_Http_ccc(OpSend, 2, FWD, new_sd->InfoRecv, dbuf, NULL);
+      dFree(dbuf);
+   }
+}
+
 /*
  * If any entry in the socket data queue can reuse our connection, set it up
  * and send off a new query.
+ * 'surplus' is what was read past the end of the reply (NULL if unknown).
  */
-static void Http_socket_reuse(int SKey)
+static void Http_socket_reuse(int SKey, Dstr *surplus)
 {
    SocketData_t *new_sd, *old_sd = a_Klist_get_data(ValidSocks, SKey);
 
-   if (old_sd) {
+   if (old_sd && old_sd->h2conn) {
+      /* the stream is over, the connection stays with the server */
+      Http_socket_free(SKey);
+   } else if (old_sd && old_sd->pipeline) {
+      Http_pipeline_next(SKey, surplus);
+   } else if (old_sd && surplus && surplus->len > 0) {
+      MSG_HTTP("Unexpected data after the reply to %s; closing the "
+               "connection.\n", URL_STR(old_sd->url));
+      dClose(old_sd->SockFD);
+      Http_socket_free(SKey);
+   } else if (old_sd) {
       Server_t *srv = Http_server_get(old_sd->connected_to,
                                       old_sd->connect_port,
                                       (old_sd->flags & HTTP_SOCKET_TLS));
@@ -806,6 +1456,161 @@ static void Http_socket_reuse(int SKey)
    }
 }
 
+/*
+ * The server chose HTTP/2 for the connection of 'sd': it becomes the
+ * server's connection for all of its queries, starting with this one.
+ */
+static void Http_h2_start(SocketData_t *sd)
+{
+   Server_t *srv = Http_server_get(sd->connected_to, sd->connect_port, TRUE);
+   int fd = sd->SockFD;
+
+   Http_fd_map_remove_entry(fd);
+   sd->SockFD = -1;
+   sd->connected_to = NULL;
+   if (!srv->h2) {
+      _MSG("Using HTTP/2 on fd %d for %s\n", fd, srv->host);
+      srv->h2 = a_Http2_conn_new(fd);
+   } else {
+      /* Another connection got there first, this one isn't needed */
+      a_Tls_close_by_fd(fd);
+      dClose(fd);
+      srv->active_conns--;
+   }
+   if (a_Http2_conn_usable(srv->h2)) {
+      Http_h2_stream_start(srv, sd);
+   } else {
+      sd->flags |= HTTP_SOCKET_QUEUED;
+      dList_insert_pos(srv->queue, sd, 0);
+   }
+   Http_connect_queued_sockets(srv);
+}
+
+/*
+ * Send the query of 'sd' on a new stream of the server's HTTP/2 connection
+ */
+static void Http_h2_stream_start(Server_t *srv, SocketData_t *sd)
+{
+   int SKey = VOIDP2INT(sd->Info->LocalKey);
+   Dstr *query = Http_make_query_str(sd->web, FALSE);
+
+   /* The chains pass the FD around, but a stream has none. This one maps
+    * back to the socket, and can't clash with a real FD. */
+   sd->SockFD = -2 - SKey;
+   Http_fd_map_add_entry(sd);
+   sd->h2conn = srv->h2;
+   if (a_Http2_stream_new(srv->h2, SKey, query,
+                          (sd->web->flags & WEB_Image) ? 32 : 256) == 0) {
+      a_Chain_fcb(OpSend, sd->Info, &sd->SockFD, "FD");
+   } else {
+      ChainLink *info = sd->Info;
+
+      MSG_BW(sd->web, 1, "Can't get %s", URL_STR(sd->url));
+      sd->h2conn = NULL;
+      Http_socket_free(SKey);
+      a_Chain_bfcb(OpAbort, info, NULL, "Both");
+      dFree(info);
+   }
+   dStr_free(query, 1);
+}
+
+/*
+ * The stream of socket 'SKey' is no longer needed. Let queued sockets have
+ * its place, or close the connection if it's left idle.
+ */
+static void Http_h2_stream_free(SocketData_t *sd, int SKey)
+{
+   Http2Conn_t *h2 = sd->h2conn;
+   Server_t *srv = Http_server_find(URL_HOST(sd->url), sd->connect_port,
+                                    TRUE);
+
+   sd->h2conn = NULL;
+   a_Http2_stream_cancel(h2, SKey);
+   if (srv && srv->h2 == h2) {
+      Http_connect_queued_sockets(srv);
+      if (srv->h2 == h2 && a_Http2_conn_streams(h2) == 0) {
+         srv->h2 = NULL;
+         a_Http2_conn_close(h2);
+         srv->active_conns--;
+         Http_connect_queued_sockets(srv);
+      }
+   }
+}
+
+/*
+ * Data for the stream of socket 'SKey' (the reply, HTTP/1.1 style)
+ */
+void a_Http_h2_data(int SKey, const char *buf, int len)
+{
+   SocketData_t *sd = a_Klist_get_data(ValidSocks, SKey);
+
+   if (sd && sd->InfoRecv) {
+      DataBuf *dbuf = a_Chain_dbuf_new((void *)buf, len, 0);
+
+      a_Http_ccc(OpSend, 2, FWD, sd->InfoRecv, dbuf, NULL);
+      dFree(dbuf);
+   }
+}
+
+/*
+ * The stream of socket 'SKey' is over
+ */
+void a_Http_h2_end(int SKey, bool_t ok)
+{
+   SocketData_t *sd = a_Klist_get_data(ValidSocks, SKey);
+   ChainLink *info;
+
+   if (sd) {
+      if (!ok)
+         MSG_BW(sd->web, 1, "Can't get %s", URL_STR(sd->url));
+      /* both branches end from the answer one, as with IO */
+      info = sd->InfoRecv ? sd->InfoRecv : sd->Info;
+      Http_socket_free(SKey);
+      a_Chain_bfcb(ok ? OpEnd : OpAbort, info, NULL, ok ? NULL : "Both");
+      dFree(info);
+   }
+}
+
+/*
+ * The server didn't process the stream of socket 'SKey', so its query can
+ * be sent again, on another connection.
+ */
+void a_Http_h2_retry(int SKey)
+{
+   SocketData_t *sd = a_Klist_get_data(ValidSocks, SKey);
+   Server_t *srv;
+
+   if (sd && !a_Web_valid(sd->web)) {
+      a_Http_h2_end(SKey, FALSE);
+   } else if (sd) {
+      _MSG("Retrying %s\n", URL_STR(sd->url));
+      Http_fd_map_remove_entry(sd->SockFD);
+      sd->SockFD = -1;
+      sd->h2conn = NULL;
+      srv = Http_server_get(URL_HOST(sd->url), sd->connect_port, TRUE);
+      Http_socket_enqueue(srv, sd);
+      Http_connect_queued_sockets(srv);
+   }
+}
+
+/*
+ * The HTTP/2 connection 'h2' takes no more queries
+ */
+void a_Http_h2_closed(Http2Conn_t *h2)
+{
+   Server_t *srv;
+   int i;
+
+   for (i = 0; (srv = dList_nth_data(servers, i)); i++) {
+      if (srv->h2 == h2) {
+         srv->h2 = NULL;
+         srv->active_conns--;
+         Http_connect_queued_sockets(srv);
+         break;
+      }
+   }
+}
+
 /*
  * CCC function for the HTTP module
  */
@@ -852,7 +1657,20 @@ void a_Http_ccc(int Op, int Branch, int Dir, ChainLink *Info,
          switch (Op) {
          case OpAbort:
             MSG("ABORT 1F\n");
-            if ((sd = a_Klist_get_data(ValidSocks, SKey)))
+            if ((sd = a_Klist_get_data(ValidSocks, SKey)) &&
+                sd->PipeInfo == Info) {
+               /* The writer of pipelined queries failed, and took the
+                * connection down with it. */
+               ChainLink *info = sd->Info;
+
+               sd->PipeInfo = NULL;
+               dFree(Info);
+               Http_socket_free(SKey);
+               a_Chain_bfcb(OpAbort, info, NULL, "Both");
+               dFree(info);
+               break;
+            }
+            if (sd)
                MSG_BW(sd->web, 1, "Can't get %s", URL_STR(sd->url));
             Http_socket_free(SKey);
             a_Chain_fcb(OpAbort, Info, NULL, "Both");
@@ -881,7 +1699,7 @@ void a_Http_ccc(int Op, int Branch, int Dir, ChainLink *Info,
                          sd->https_proxy_reply->str);
                      dStr_free(sd->https_proxy_reply, 1);
                      sd->https_proxy_reply = NULL;
-                     a_Tls_handshake(sd->SockFD, sd->url);
+                     a_Tls_handshake(sd->SockFD, sd->url, FALSE);
                   } else {
                      MSG_BW(sd->web, 1, "Can't connect through proxy to %s",
                             URL_HOST(sd->url));
@@ -893,6 +1711,10 @@ void a_Http_ccc(int Op, int Branch, int Dir, ChainLink *Info,
                   }
                }
             } else {
+               if (!(sd->flags & HTTP_SOCKET_RECEIVING)) {
+                  sd->flags |= HTTP_SOCKET_RECEIVING;
+                  Http_pipeline_fill(sd);
+               }
                /* Data1 = dbuf */
                a_Chain_fcb(OpSend, Info, Data1, "send_page_2eof");
             }
@@ -906,6 +1728,14 @@ void a_Http_ccc(int Op, int Branch, int Dir, ChainLink *Info,
                Http_socket_free(SKey);
                a_Chain_bfcb(OpAbort, Info, NULL, "Both");
             } else {
+               if (sd->pipeline && sd->connected_to) {
+                  /* The server closed with pipelined queries pending */
+                  Server_t *srv =
+                     Http_server_get(sd->connected_to, sd->connect_port,
+                                     (sd->flags & HTTP_SOCKET_TLS));
+                  MSG("Pipelining to %s failed; disabling it.\n", srv->host);
+                  srv->no_pipelining = TRUE;
+               }
                Http_socket_free(SKey);
                a_Chain_fcb(OpEnd, Info, NULL, NULL);
             }
@@ -928,10 +1758,23 @@ void a_Http_ccc(int Op, int Branch, int Dir, ChainLink *Info,
                   FdMapEntry_t *fme = dList_find_custom(fd_map, INT2VOIDP(fd),
                                                         Http_fd_map_cmp);
                   Info->LocalKey = INT2VOIDP(fme->skey);
-                  a_Chain_bcb(OpSend, Info, Data1, Data2);
+                  if ((sd = a_Klist_get_data(ValidSocks, fme->skey)))
+                     sd->InfoRecv = Info;
+                  /* (HTTP/2 streams don't use the IO reader) */
+                  if (!sd || !sd->h2conn)
+                     a_Chain_bcb(OpSend, Info, Data1, Data2);
                } else if (!strcmp(Data2, "reply_complete")) {
+                  /* Data1 = bytes read past the reply (NULL if unknown).
+                   * Keep a copy, as ending the reader frees its buffer. */
+                  Dstr *surplus = NULL;
+
+                  if ((dbuf = Data1)) {
+                     surplus = dStr_sized_new(dbuf->Size);
+                     dStr_append_l(surplus, dbuf->Buf, dbuf->Size);
+                  }
                   a_Chain_bfcb(OpEnd, Info, NULL, NULL);
-                  Http_socket_reuse(SKey);
+                  Http_socket_reuse(SKey, surplus);
+                  dStr_free(surplus, 1);
                   dFree(Info);
                }
             }
@@ -957,7 +1800,8 @@ static void Http_socket_enqueue(Server_t *srv, SocketData_t* sock)
 {
    sock->flags |= HTTP_SOCKET_QUEUED;
 
-   if ((sock->web->flags & WEB_Image) == 0) {
+   if (!(sock->flags & HTTP_SOCKET_PRECONNECT) &&
+       (sock->web->flags & WEB_Image) == 0) {
       int i, n = dList_length(srv->queue);
 
       for (i = 0; i < n; i++) {
@@ -972,7 +1816,8 @@ static void Http_socket_enqueue(Server_t *srv, SocketData_t* sock)
    dList_append(srv->queue, sock);
 }
 
-static Server_t *Http_server_get(const char *host, uint_t port, bool_t https)
+static Server_t *Http_server_find(const char *host, uint_t port,
+                                  bool_t https)
 {
    int i;
    Server_t *srv;
@@ -984,9 +1829,19 @@ static Server_t *Http_server_get(const char *host, uint_t port, bool_t https)
           !dStrAsciiCasecmp(host, srv->host))
          return srv;
    }
+   return NULL;
+}
+
+static Server_t *Http_server_get(const char *host, uint_t port, bool_t https)
+{
+   Server_t *srv;
+
+   if ((srv = Http_server_find(host, port, https)))
+      return srv;
 
    srv = dNew0(Server_t, 1);
    srv->queue = dList_new(10);
+   srv->warm = dList_new(2);
    srv->running_the_queue = 0;
    srv->host = dStrdup(host);
    srv->port = port;
@@ -999,12 +1854,16 @@ static Server_t *Http_server_get(const char *host, uint_t port, bool_t https)
 static void Http_server_remove(Server_t *srv)
 {
    SocketData_t *sd;
+   WarmSock_t *ws;
 
    while ((sd = dList_nth_data(srv->queue, 0))) {
       dList_remove_fast(srv->queue, sd);
-      dFree(sd);
+      Http_socket_dealloc(sd);
    }
    dList_free(srv->queue);
+   while ((ws = dList_nth_data(srv->warm, 0)))
+      Http_warm_close(srv, ws);
+   dList_free(srv->warm);
    dList_remove_fast(servers, srv);
    dFree(srv->host);
    dFree(srv);
@@ -1019,7 +1878,7 @@ static void Http_servers_remove_all()
       srv = (Server_t*) dList_nth_data(servers, 0);
       while ((sd = dList_nth_data(srv->queue, 0))) {
          dList_remove(srv->queue, sd);
-         dFree(sd);
+         Http_socket_dealloc(sd);
       }
       Http_server_remove(srv);
    }
@@ -1044,9 +1903,21 @@ static void Http_fd_map_remove_all()
  */
 void a_Http_freeall(void)
 {
+   HostAf_t *ha;
+
    Http_servers_remove_all();
    Http_fd_map_remove_all();
    a_Klist_free(&ValidSocks);
+   while ((ha = dList_nth_data(host_afs, 0))) {
+      dList_remove_fast(host_afs, ha);
+      dFree(ha->host);
+      dFree(ha);
+   }
+   dList_free(host_afs);
+   dList_free(preconnects);
+   if (preconnects_made)
+      MSG("Preconnects: %d made, %d used, %d expired unused\n",
+          preconnects_made, warm_used, warm_expired);
    a_Url_free(HTTP_Proxy);
    dFree(HTTP_Proxy_Auth_base64);
    dFree(HTTP_Language_hdr);
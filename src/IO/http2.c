@@ -0,0 +1,982 @@
+/*
+ * File: http2.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * HTTP/2 connections (RFC 9113)
+ *
+ * When the TLS handshake negotiates "h2", http.c hands the connection over
+ * to this module, and every query to that server becomes a stream on it.
+ * Queries come in as the HTTP/1.1 text that http.c makes, and replies go
+ * back out in the same form, so nothing past http.c needs to know.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "../msg.h"
+#include "../klist.h"
+#include "../timeout.hh"
+#include "IO.h"
+#include "iowatch.hh"
+#include "tls.h"
+#include "hpack.h"
+#include "http2.h"
+
+#define H2_FRAME_HDR_LEN    9
+#define H2_MAX_FRAME        16384      /* the largest frame we accept */
+#define H2_MAX_HEADER_BLOCK (1 << 18)
+#define H2_DEFAULT_WINDOW   65535
+#define H2_STREAM_WINDOW    (1 << 20)  /* our receive window per stream */
+#define H2_CONN_WINDOW      (1 << 24)  /* and for the whole connection */
+
+/* Frame types */
+#define H2_DATA          0x0
+#define H2_HEADERS       0x1
+#define H2_PRIORITY      0x2
+#define H2_RST_STREAM    0x3
+#define H2_SETTINGS      0x4
+#define H2_PUSH_PROMISE  0x5
+#define H2_PING          0x6
+#define H2_GOAWAY        0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION  0x9
+
+/* Frame flags */
+#define H2_FLAG_END_STREAM  0x1
+#define H2_FLAG_ACK         0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED      0x8
+#define H2_FLAG_PRIORITY    0x20
+
+/* Settings */
+#define H2_SETTINGS_HEADER_TABLE_SIZE      0x1
+#define H2_SETTINGS_ENABLE_PUSH            0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE    0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE         0x5
+
+/* Error codes */
+#define H2_NO_ERROR          0x0
+#define H2_PROTOCOL_ERROR    0x1
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_FRAME_SIZE_ERROR  0x6
+#define H2_REFUSED_STREAM    0x7
+#define H2_CANCEL            0x8
+#define H2_COMPRESSION_ERROR 0x9
+
+typedef struct {
+   uint32_t id;
+   int SKey;               /* the socket in http.c */
+   int32_t send_window;
+   int32_t recv_unacked;   /* received since our last WINDOW_UPDATE */
+   Dstr *body;             /* query body still to be sent (POST) */
+   bool_t got_reply;       /* the (final) reply header came */
+   bool_t remote_closed;   /* the server ended the stream */
+} Http2Stream_t;
+
+struct Http2Conn {
+   int key;                /* in ValidConns */
+   int fd;
+   void *tls;
+   Dstr *in, *out;
+   Dlist *streams;
+   uint32_t next_id;
+   Hpack_t *enc, *dec;
+   Dstr *hdr_block;        /* header block waiting for CONTINUATIONs */
+   uint32_t hdr_stream;
+   int hdr_flags;
+   uint32_t max_frame;     /* the server's settings */
+   uint32_t max_streams;
+   int32_t initial_window;
+   int32_t send_window;
+   int32_t recv_unacked;
+   bool_t attached;        /* http.c still sends new queries here */
+   bool_t goaway;          /* no new streams */
+   bool_t dead;            /* the connection is gone */
+   bool_t writing;         /* waiting to write */
+   int busy;               /* don't free, we're using it */
+};
+
+/*
+ * Local data
+ */
+static Klist_t *ValidConns = NULL;
+
+static void Http2_fail_cb(void *data);
+
+
+/* - Frames out - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+static void Http2_put16(Dstr *ds, uint_t v)
+{
+   dStr_append_c(ds, (v >> 8) & 0xff);
+   dStr_append_c(ds, v & 0xff);
+}
+
+static void Http2_put32(Dstr *ds, uint32_t v)
+{
+   Http2_put16(ds, v >> 16);
+   Http2_put16(ds, v & 0xffff);
+}
+
+static uint32_t Http2_get32(const uchar_t *p)
+{
+   return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void Http2_frame_hdr(Dstr *out, uint32_t len, int type, int flags,
+                            uint32_t id)
+{
+   dStr_append_c(out, (len >> 16) & 0xff);
+   Http2_put16(out, len & 0xffff);
+   dStr_append_c(out, type);
+   dStr_append_c(out, flags);
+   Http2_put32(out, id & 0x7fffffff);
+}
+
+static void Http2_window_update(Http2Conn_t *h2, uint32_t id, uint32_t inc)
+{
+   Http2_frame_hdr(h2->out, 4, H2_WINDOW_UPDATE, 0, id);
+   Http2_put32(h2->out, inc);
+}
+
+static void Http2_rst_stream(Http2Conn_t *h2, uint32_t id, uint32_t code)
+{
+   Http2_frame_hdr(h2->out, 4, H2_RST_STREAM, 0, id);
+   Http2_put32(h2->out, code);
+}
+
+static void Http2_goaway(Http2Conn_t *h2, uint32_t code)
+{
+   /* we never accept streams from the server */
+   Http2_frame_hdr(h2->out, 8, H2_GOAWAY, 0, 0);
+   Http2_put32(h2->out, 0);
+   Http2_put32(h2->out, code);
+}
+
+/*
+ * Send as much of a query body as flow control allows
+ */
+static void Http2_send_body(Http2Conn_t *h2, Http2Stream_t *st)
+{
+   int32_t n;
+
+   while (st->body) {
+      n = MIN(st->body->len, (int32_t)h2->max_frame);
+      n = MIN(n, MIN(h2->send_window, st->send_window));
+      if (n <= 0 && st->body->len > 0)
+         break;
+      Http2_frame_hdr(h2->out, n, H2_DATA,
+                      n == st->body->len ? H2_FLAG_END_STREAM : 0, st->id);
+      dStr_append_l(h2->out, st->body->str, n);
+      dStr_erase(st->body, 0, n);
+      h2->send_window -= n;
+      st->send_window -= n;
+      if (st->body->len == 0) {
+         dStr_free(st->body, 1);
+         st->body = NULL;
+      }
+   }
+}
+
+static void Http2_send_bodies(Http2Conn_t *h2)
+{
+   Http2Stream_t *st;
+   int i;
+
+   for (i = 0; (st = dList_nth_data(h2->streams, i)); i++)
+      Http2_send_body(h2, st);
+}
+
+static void Http2_write_cb(int fd, void *data);
+
+/*
+ * Write out what we can, and watch the FD for the rest
+ */
+static void Http2_flush(Http2Conn_t *h2)
+{
+   ssize_t St;
+
+   while (h2->out->len > 0 && !h2->dead) {
+      St = h2->tls ? a_Tls_write(h2->tls, h2->out->str, h2->out->len)
+                   : write(h2->fd, h2->out->str, h2->out->len);
+      if (St > 0) {
+         dStr_erase(h2->out, 0, St);
+      } else if (St < 0 && errno == EINTR) {
+         continue;
+      } else if (St < 0 && errno == EAGAIN) {
+         break;
+      } else {
+         /* Let the reader find out about it, or fail on our own soon */
+         MSG("HTTP/2: can't write to fd %d: %s\n", h2->fd,
+             St < 0 ? dStrerror(errno) : "connection closed");
+         dStr_truncate(h2->out, 0);
+         h2->goaway = TRUE;
+         a_Timeout_add(0.0, Http2_fail_cb, INT2VOIDP(h2->key));
+         break;
+      }
+   }
+   if (h2->out->len > 0 && !h2->writing) {
+      a_IOwatch_add_fd(h2->fd, DIO_WRITE, Http2_write_cb,
+                       INT2VOIDP(h2->key));
+      h2->writing = TRUE;
+   } else if (h2->out->len == 0 && h2->writing) {
+      a_IOwatch_remove_fd(h2->fd, DIO_WRITE);
+      h2->writing = FALSE;
+   }
+}
+
+static void Http2_write_cb(int fd, void *data)
+{
+   Http2Conn_t *h2 = a_Klist_get_data(ValidConns, VOIDP2INT(data));
+
+   if (h2)
+      Http2_flush(h2);
+   else
+      a_IOwatch_remove_fd(fd, DIO_WRITE);
+}
+
+/* - Connections and streams - - - - - - - - - - - - - - - - - - - - - - - */
+
+static Http2Stream_t *Http2_stream_by_id(Http2Conn_t *h2, uint32_t id)
+{
+   Http2Stream_t *st;
+   int i;
+
+   for (i = 0; (st = dList_nth_data(h2->streams, i)); i++)
+      if (st->id == id)
+         return st;
+   return NULL;
+}
+
+static Http2Stream_t *Http2_stream_by_key(Http2Conn_t *h2, int SKey)
+{
+   Http2Stream_t *st;
+   int i;
+
+   for (i = 0; (st = dList_nth_data(h2->streams, i)); i++)
+      if (st->SKey == SKey)
+         return st;
+   return NULL;
+}
+
+static void Http2_stream_free(Http2Conn_t *h2, Http2Stream_t *st)
+{
+   dList_remove(h2->streams, st);
+   dStr_free(st->body, 1);
+   dFree(st);
+}
+
+/*
+ * The stream is over: tell http.c.
+ * 'retry' means the server didn't process the query, so it can be sent
+ * again on another connection.
+ */
+static void Http2_stream_end(Http2Conn_t *h2, Http2Stream_t *st, bool_t ok,
+                             bool_t retry)
+{
+   int SKey = st->SKey;
+
+   Http2_stream_free(h2, st);
+   h2->busy++;
+   if (retry)
+      a_Http_h2_retry(SKey);
+   else
+      a_Http_h2_end(SKey, ok);
+   h2->busy--;
+}
+
+/*
+ * Stop taking new queries
+ */
+static void Http2_detach(Http2Conn_t *h2)
+{
+   h2->goaway = TRUE;
+   if (h2->attached) {
+      h2->attached = FALSE;
+      h2->busy++;
+      a_Http_h2_closed(h2);
+      h2->busy--;
+   }
+}
+
+static void Http2_conn_free(Http2Conn_t *h2)
+{
+   Http2Stream_t *st;
+
+   _MSG("HTTP/2: closing fd %d\n", h2->fd);
+   /* a last try, for the GOAWAY */
+   Http2_flush(h2);
+   while ((st = dList_nth_data(h2->streams, 0)))
+      Http2_stream_free(h2, st);
+   dList_free(h2->streams);
+   a_IOwatch_remove_fd(h2->fd, -1);
+   a_Tls_close_by_fd(h2->fd);
+   dClose(h2->fd);
+   a_Klist_remove(ValidConns, h2->key);
+   a_Hpack_free(h2->enc);
+   a_Hpack_free(h2->dec);
+   dStr_free(h2->hdr_block, 1);
+   dStr_free(h2->in, 1);
+   dStr_free(h2->out, 1);
+   dFree(h2);
+}
+
+/*
+ * Free the connection if it's done
+ */
+static void Http2_conn_check(Http2Conn_t *h2)
+{
+   if (h2->busy == 0 &&
+       (h2->dead || (!h2->attached && dList_length(h2->streams) == 0)))
+      Http2_conn_free(h2);
+}
+
+/*
+ * The connection is lost: end all of its streams
+ */
+static void Http2_conn_fail(Http2Conn_t *h2)
+{
+   Http2Stream_t *st;
+
+   h2->busy++;
+   h2->dead = TRUE;
+   Http2_detach(h2);
+   while ((st = dList_nth_data(h2->streams, 0)))
+      Http2_stream_end(h2, st, FALSE, FALSE);
+   h2->busy--;
+}
+
+/*
+ * A write failed: fail the connection, but not from within Http2_flush
+ */
+static void Http2_fail_cb(void *data)
+{
+   Http2Conn_t *h2 = a_Klist_get_data(ValidConns, VOIDP2INT(data));
+
+   if (h2) {
+      Http2_conn_fail(h2);
+      Http2_conn_check(h2);
+   }
+}
+
+/*
+ * A connection error: tell the server why, and give up
+ */
+static void Http2_error(Http2Conn_t *h2, uint32_t code, const char *what)
+{
+   MSG("HTTP/2: protocol error on fd %d: %s\n", h2->fd, what);
+   Http2_goaway(h2, code);
+   Http2_flush(h2);
+   Http2_conn_fail(h2);
+}
+
+/* - Frames in - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+/*
+ * Strip the padding of a PADDED frame.
+ * Return 0 on success, -1 if the padding doesn't fit.
+ */
+static int Http2_unpad(int flags, const uchar_t **payload, uint32_t *len)
+{
+   if (flags & H2_FLAG_PADDED) {
+      if (*len < 1 || (*payload)[0] >= *len)
+         return -1;
+      *len -= 1 + (*payload)[0];
+      (*payload)++;
+   }
+   return 0;
+}
+
+static void Http2_deliver(Http2Conn_t *h2, int SKey, const char *buf, int len)
+{
+   h2->busy++;
+   a_Http_h2_data(SKey, buf, len);
+   h2->busy--;
+}
+
+/*
+ * A reply header for a stream: pass it on as an HTTP/1.1 header
+ */
+static void Http2_reply_header(Http2Conn_t *h2, Http2Stream_t *st,
+                               Dlist *fields)
+{
+   const char *status = NULL;
+   HpackField_t *f;
+   Dstr *header;
+   int i;
+
+   for (i = 0; (f = dList_nth_data(fields, i)); i++) {
+      if (!strcmp(f->name, ":status"))
+         status = f->value;
+      else if (f->name[0] == ':' || strpbrk(f->name, "\r\n:") ||
+               strpbrk(f->value, "\r\n"))
+         break;
+   }
+   if (f || !status || strlen(status) != 3) {
+      /* malformed */
+      Http2_rst_stream(h2, st->id, H2_PROTOCOL_ERROR);
+      Http2_stream_end(h2, st, FALSE, FALSE);
+   } else if (status[0] != '1') {
+      /* (1xx replies are interim, the real one follows) */
+      header = dStr_sized_new(512);
+      dStr_sprintfa(header, "HTTP/1.1 %s \r\n", status);
+      for (i = 0; (f = dList_nth_data(fields, i)); i++)
+         if (f->name[0] != ':')
+            dStr_sprintfa(header, "%s: %s\r\n", f->name, f->value);
+      dStr_append(header, "\r\n");
+      st->got_reply = TRUE;
+      Http2_deliver(h2, st->SKey, header->str, header->len);
+      dStr_free(header, 1);
+   }
+}
+
+/*
+ * A complete header block (HEADERS + CONTINUATIONs)
+ */
+static void Http2_header_block(Http2Conn_t *h2, uint32_t id, int flags,
+                               const uchar_t *block, uint32_t len)
+{
+   Dlist *fields = dList_new(16);
+   Http2Stream_t *st;
+
+   /* Decode it even if nobody wants it, to keep the table in sync */
+   if (a_Hpack_decode(h2->dec, block, len, fields)) {
+      a_Hpack_fields_free(fields);
+      Http2_error(h2, H2_COMPRESSION_ERROR, "bad header block");
+      return;
+   }
+   if ((st = Http2_stream_by_id(h2, id))) {
+      if (flags & H2_FLAG_END_STREAM)
+         st->remote_closed = TRUE;
+      if (!st->got_reply)
+         Http2_reply_header(h2, st, fields);
+      /* else it's a trailer, which we don't use */
+   }
+   a_Hpack_fields_free(fields);
+
+   if ((flags & H2_FLAG_END_STREAM) && (st = Http2_stream_by_id(h2, id)))
+      Http2_stream_end(h2, st, st->got_reply, FALSE);
+}
+
+static void Http2_headers(Http2Conn_t *h2, int flags, uint32_t id,
+                          const uchar_t *payload, uint32_t len)
+{
+   if (id == 0 || Http2_unpad(flags, &payload, &len) ||
+       ((flags & H2_FLAG_PRIORITY) && len < 5)) {
+      Http2_error(h2, H2_PROTOCOL_ERROR, "bad HEADERS");
+   } else {
+      if (flags & H2_FLAG_PRIORITY) {
+         payload += 5;
+         len -= 5;
+      }
+      if (flags & H2_FLAG_END_HEADERS) {
+         Http2_header_block(h2, id, flags, payload, len);
+      } else {
+         h2->hdr_block = dStr_sized_new(2 * len + 1);
+         dStr_append_l(h2->hdr_block, (const char *)payload, len);
+         h2->hdr_stream = id;
+         h2->hdr_flags = flags;
+      }
+   }
+}
+
+static void Http2_continuation(Http2Conn_t *h2, int flags, uint32_t id,
+                               const uchar_t *payload, uint32_t len)
+{
+   Dstr *block = h2->hdr_block;
+
+   if (!block || id != h2->hdr_stream) {
+      Http2_error(h2, H2_PROTOCOL_ERROR, "unexpected CONTINUATION");
+   } else if (block->len + len > H2_MAX_HEADER_BLOCK) {
+      Http2_error(h2, H2_PROTOCOL_ERROR, "header block too large");
+   } else {
+      dStr_append_l(block, (const char *)payload, len);
+      if (flags & H2_FLAG_END_HEADERS) {
+         h2->hdr_block = NULL;
+         Http2_header_block(h2, id, h2->hdr_flags, (uchar_t *)block->str,
+                            block->len);
+         dStr_free(block, 1);
+      }
+   }
+}
+
+static void Http2_data(Http2Conn_t *h2, int flags, uint32_t id,
+                       const uchar_t *payload, uint32_t len)
+{
+   Http2Stream_t *st;
+   uint32_t flow_len = len;   /* padding counts for flow control */
+
+   if (id == 0 || Http2_unpad(flags, &payload, &len)) {
+      Http2_error(h2, H2_PROTOCOL_ERROR, "bad DATA");
+      return;
+   }
+   h2->recv_unacked += flow_len;
+   if (h2->recv_unacked >= H2_CONN_WINDOW / 2) {
+      Http2_window_update(h2, 0, h2->recv_unacked);
+      h2->recv_unacked = 0;
+   }
+   if (!(st = Http2_stream_by_id(h2, id)))
+      return;   /* e.g., one that we canceled */
+
+   if (!st->got_reply) {
+      Http2_rst_stream(h2, id, H2_PROTOCOL_ERROR);
+      Http2_stream_end(h2, st, FALSE, FALSE);
+      return;
+   }
+   if (flags & H2_FLAG_END_STREAM) {
+      st->remote_closed = TRUE;
+   } else if ((st->recv_unacked += flow_len) >= H2_STREAM_WINDOW / 2) {
+      Http2_window_update(h2, id, st->recv_unacked);
+      st->recv_unacked = 0;
+   }
+   if (len > 0)
+      Http2_deliver(h2, st->SKey, (const char *)payload, len);
+
+   /* The stream may be gone already, if the reply had a length */
+   if ((flags & H2_FLAG_END_STREAM) && (st = Http2_stream_by_id(h2, id)))
+      Http2_stream_end(h2, st, TRUE, FALSE);
+}
+
+static void Http2_settings(Http2Conn_t *h2, int flags, uint32_t id,
+                           const uchar_t *p, uint32_t len)
+{
+   Http2Stream_t *st;
+   uint32_t value;
+   int i;
+
+   if (id != 0) {
+      Http2_error(h2, H2_PROTOCOL_ERROR, "SETTINGS on a stream");
+      return;
+   } else if ((flags & H2_FLAG_ACK) ? len != 0 : len % 6 != 0) {
+      Http2_error(h2, H2_FRAME_SIZE_ERROR, "bad SETTINGS size");
+      return;
+   } else if (flags & H2_FLAG_ACK) {
+      return;
+   }
+
+   for ( ; len >= 6; p += 6, len -= 6) {
+      value = Http2_get32(p + 2);
+      switch ((p[0] << 8) | p[1]) {
+      case H2_SETTINGS_HEADER_TABLE_SIZE:
+         a_Hpack_set_max_size(h2->enc, value);
+         break;
+      case H2_SETTINGS_MAX_CONCURRENT_STREAMS:
+         h2->max_streams = value;
+         break;
+      case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+         if (value > 0x7fffffff) {
+            Http2_error(h2, H2_FLOW_CONTROL_ERROR, "window too large");
+            return;
+         }
+         /* it applies to the streams that are open already, too */
+         for (i = 0; (st = dList_nth_data(h2->streams, i)); i++)
+            st->send_window += (int32_t)value - h2->initial_window;
+         h2->initial_window = value;
+         break;
+      case H2_SETTINGS_MAX_FRAME_SIZE:
+         if (value < H2_MAX_FRAME || value > 0xffffff) {
+            Http2_error(h2, H2_PROTOCOL_ERROR, "bad frame size setting");
+            return;
+         }
+         h2->max_frame = value;
+         break;
+      default:
+         break;
+      }
+   }
+   Http2_frame_hdr(h2->out, 0, H2_SETTINGS, H2_FLAG_ACK, 0);
+   Http2_send_bodies(h2);
+}
+
+static void Http2_window(Http2Conn_t *h2, uint32_t id, const uchar_t *p,
+                         uint32_t len)
+{
+   Http2Stream_t *st;
+   uint32_t inc;
+
+   if (len != 4) {
+      Http2_error(h2, H2_FRAME_SIZE_ERROR, "bad WINDOW_UPDATE size");
+      return;
+   }
+   inc = Http2_get32(p) & 0x7fffffff;
+   if (id == 0) {
+      if (inc == 0 || (int64_t)h2->send_window + inc > 0x7fffffff) {
+         Http2_error(h2, H2_FLOW_CONTROL_ERROR, "bad window increment");
+         return;
+      }
+      h2->send_window += inc;
+   } else if ((st = Http2_stream_by_id(h2, id))) {
+      if (inc == 0 || (int64_t)st->send_window + inc > 0x7fffffff) {
+         Http2_rst_stream(h2, id, H2_FLOW_CONTROL_ERROR);
+         Http2_stream_end(h2, st, FALSE, FALSE);
+         return;
+      }
+      st->send_window += inc;
+   }
+   Http2_send_bodies(h2);
+}
+
+static void Http2_goaway_in(Http2Conn_t *h2, uint32_t id, const uchar_t *p,
+                            uint32_t len)
+{
+   Http2Stream_t *st;
+   uint32_t last, code;
+   int i;
+
+   if (id != 0 || len < 8) {
+      Http2_error(h2, H2_PROTOCOL_ERROR, "bad GOAWAY");
+      return;
+   }
+   last = Http2_get32(p) & 0x7fffffff;
+   code = Http2_get32(p + 4);
+   if (code != H2_NO_ERROR)
+      MSG("HTTP/2: the server closes fd %d (error %u)\n", h2->fd, code);
+   Http2_detach(h2);
+
+   /* The server won't process these: they go to another connection */
+   for (i = 0; (st = dList_nth_data(h2->streams, i)); ) {
+      if (st->id > last)
+         Http2_stream_end(h2, st, FALSE, TRUE);
+      else
+         i++;
+   }
+}
+
+static void Http2_frame(Http2Conn_t *h2, int type, int flags, uint32_t id,
+                        const uchar_t *payload, uint32_t len)
+{
+   Http2Stream_t *st;
+
+   if (h2->hdr_block && type != H2_CONTINUATION) {
+      Http2_error(h2, H2_PROTOCOL_ERROR, "expected CONTINUATION");
+      return;
+   }
+   switch (type) {
+   case H2_DATA:
+      Http2_data(h2, flags, id, payload, len);
+      break;
+   case H2_HEADERS:
+      Http2_headers(h2, flags, id, payload, len);
+      break;
+   case H2_CONTINUATION:
+      Http2_continuation(h2, flags, id, payload, len);
+      break;
+   case H2_RST_STREAM:
+      if (id == 0 || len != 4) {
+         Http2_error(h2, H2_PROTOCOL_ERROR, "bad RST_STREAM");
+      } else if ((st = Http2_stream_by_id(h2, id))) {
+         uint32_t code = Http2_get32(payload);
+
+         _MSG("HTTP/2: stream %u reset (error %u)\n", id, code);
+         st->remote_closed = TRUE;
+         Http2_stream_end(h2, st, FALSE,
+                          code == H2_REFUSED_STREAM && !st->got_reply);
+      }
+      break;
+   case H2_SETTINGS:
+      Http2_settings(h2, flags, id, payload, len);
+      break;
+   case H2_PUSH_PROMISE:
+      /* we said no with SETTINGS_ENABLE_PUSH */
+      Http2_error(h2, H2_PROTOCOL_ERROR, "unexpected PUSH_PROMISE");
+      break;
+   case H2_PING:
+      if (id != 0 || len != 8) {
+         Http2_error(h2, H2_PROTOCOL_ERROR, "bad PING");
+      } else if (!(flags & H2_FLAG_ACK)) {
+         Http2_frame_hdr(h2->out, 8, H2_PING, H2_FLAG_ACK, 0);
+         dStr_append_l(h2->out, (const char *)payload, 8);
+      }
+      break;
+   case H2_GOAWAY:
+      Http2_goaway_in(h2, id, payload, len);
+      break;
+   case H2_WINDOW_UPDATE:
+      Http2_window(h2, id, payload, len);
+      break;
+   default:
+      /* PRIORITY, and frame types we don't know, are ignored */
+      break;
+   }
+}
+
+/*
+ * Handle the complete frames in the input buffer
+ */
+static void Http2_process(Http2Conn_t *h2)
+{
+   const uchar_t *p;
+   uint32_t len;
+   size_t pos = 0;
+
+   while (!h2->dead && h2->in->len - pos >= H2_FRAME_HDR_LEN) {
+      p = (const uchar_t *)h2->in->str + pos;
+      len = (p[0] << 16) | (p[1] << 8) | p[2];
+      if (len > H2_MAX_FRAME) {
+         Http2_error(h2, H2_FRAME_SIZE_ERROR, "frame too large");
+         break;
+      }
+      if (h2->in->len - pos < H2_FRAME_HDR_LEN + len)
+         break;
+      Http2_frame(h2, p[3], p[4], Http2_get32(p + 5) & 0x7fffffff,
+                  p + H2_FRAME_HDR_LEN, len);
+      pos += H2_FRAME_HDR_LEN + len;
+   }
+   dStr_erase(h2->in, 0, pos);
+}
+
+static void Http2_read_cb(int fd, void *data)
+{
+   Http2Conn_t *h2 = a_Klist_get_data(ValidConns, VOIDP2INT(data));
+   ssize_t St;
+   char *buf;
+
+   if (!h2) {
+      a_IOwatch_remove_fd(fd, DIO_READ);
+      return;
+   }
+
+   h2->busy++;
+   while (!h2->dead) {
+      buf = dStr_reserve_l(h2->in, IOBufLen);
+      St = h2->tls ? a_Tls_read(h2->tls, buf, h2->in->sz - h2->in->len - 1)
+                   : read(fd, buf, h2->in->sz - h2->in->len - 1);
+      if (St > 0) {
+         h2->in->len += St;
+         h2->in->str[h2->in->len] = 0;
+         Http2_process(h2);
+      } else if (St < 0 && errno == EINTR) {
+         continue;
+      } else if (St < 0 && errno == EAGAIN) {
+         break;
+      } else {
+         if (St < 0 || dList_length(h2->streams))
+            MSG("HTTP/2: connection on fd %d lost: %s\n", fd,
+                St < 0 ? dStrerror(errno) : "closed by the server");
+         Http2_conn_fail(h2);
+      }
+   }
+   h2->busy--;
+   Http2_flush(h2);
+   Http2_conn_check(h2);
+}
+
+/*
+ * Turn the HTTP/1.1 query made by http.c into HTTP/2 header fields,
+ * and encode them into 'block'.
+ * Return the offset of the query body, or -1 if the query makes no sense.
+ */
+static int Http2_query_encode(Http2Conn_t *h2, Dstr *query, Dstr *block)
+{
+   static const char *const skip[] = {
+      "host", "connection", "keep-alive", "proxy-connection",
+      "transfer-encoding", "upgrade"
+   };
+   char *end, *line, *eol, *sp1, *sp2, *colon, *host = NULL, *name, *value;
+   uint_t i;
+
+   if (!(end = strstr(query->str, "\r\n\r\n")) ||
+       !(eol = strstr(query->str, "\r\n")) ||
+       !(sp1 = memchr(query->str, ' ', eol - query->str)) ||
+       !(sp2 = memchr(sp1 + 1, ' ', eol - sp1 - 1)))
+      return -1;
+
+   for (line = eol + 2; line < end; line = eol + 2) {
+      eol = strstr(line, "\r\n");
+      if (!dStrnAsciiCasecmp(line, "Host:", 5)) {
+         for (value = line + 5; *value == ' '; value++) ;
+         host = dStrndup(value, eol - value);
+      }
+   }
+   if (!host)
+      return -1;
+
+   name = dStrndup(query->str, sp1 - query->str);
+   a_Hpack_encode(h2->enc, block, ":method", name);
+   dFree(name);
+   a_Hpack_encode(h2->enc, block, ":scheme", "https");
+   a_Hpack_encode(h2->enc, block, ":authority", host);
+   dFree(host);
+   value = dStrndup(sp1 + 1, sp2 - sp1 - 1);
+   a_Hpack_encode(h2->enc, block, ":path", value);
+   dFree(value);
+
+   eol = strstr(query->str, "\r\n");
+   for (line = eol + 2; line < end; line = eol + 2) {
+      eol = strstr(line, "\r\n");
+      if (!(colon = memchr(line, ':', eol - line)))
+         continue;
+      name = dStrndup(line, colon - line);
+      for (i = 0; name[i]; i++)
+         name[i] = D_ASCII_TOLOWER(name[i]);
+      for (i = 0; i < sizeof(skip) / sizeof(skip[0]); i++)
+         if (!strcmp(name, skip[i]))
+            break;
+      if (i == sizeof(skip) / sizeof(skip[0])) {
+         for (value = colon + 1; *value == ' '; value++) ;
+         value = dStrndup(value, eol - value);
+         a_Hpack_encode(h2->enc, block, name, value);
+         dFree(value);
+      }
+      dFree(name);
+   }
+   return end + 4 - query->str;
+}
+
+/*
+ * Send the header block of a new stream, with its priority
+ */
+static void Http2_send_headers(Http2Conn_t *h2, Http2Stream_t *st,
+                               Dstr *block, int weight)
+{
+   int flags = H2_FLAG_PRIORITY | (st->body ? 0 : H2_FLAG_END_STREAM);
+   uint32_t n = MIN((uint32_t)block->len, h2->max_frame - 5), pos;
+
+   if (n == (uint32_t)block->len)
+      flags |= H2_FLAG_END_HEADERS;
+   Http2_frame_hdr(h2->out, n + 5, H2_HEADERS, flags, st->id);
+   Http2_put32(h2->out, 0);                 /* no dependency */
+   dStr_append_c(h2->out, MAX(1, MIN(weight, 256)) - 1);
+   dStr_append_l(h2->out, block->str, n);
+
+   for (pos = n; pos < (uint32_t)block->len; pos += n) {
+      n = MIN(block->len - pos, h2->max_frame);
+      Http2_frame_hdr(h2->out, n, H2_CONTINUATION,
+                      pos + n == (uint32_t)block->len ?
+                      H2_FLAG_END_HEADERS : 0, st->id);
+      dStr_append_l(h2->out, block->str + pos, n);
+   }
+}
+
+/* - Interface - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+/*
+ * Start HTTP/2 on a connected TLS socket
+ */
+Http2Conn_t *a_Http2_conn_new(int fd)
+{
+   Http2Conn_t *h2 = dNew0(Http2Conn_t, 1);
+
+   h2->fd = fd;
+   h2->tls = a_Tls_connection(fd);
+   h2->in = dStr_sized_new(IOBufLen);
+   h2->out = dStr_sized_new(1024);
+   h2->streams = dList_new(16);
+   h2->next_id = 1;
+   h2->enc = a_Hpack_new(HPACK_TABLE_SIZE);
+   h2->dec = a_Hpack_new(HPACK_TABLE_SIZE);
+   h2->max_frame = H2_MAX_FRAME;
+   h2->max_streams = 100;   /* until the server tells */
+   h2->initial_window = h2->send_window = H2_DEFAULT_WINDOW;
+   h2->attached = TRUE;
+   h2->key = a_Klist_insert(&ValidConns, h2);
+
+   /* Preface, our settings, and a larger window */
+   dStr_append_l(h2->out, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24);
+   Http2_frame_hdr(h2->out, 12, H2_SETTINGS, 0, 0);
+   Http2_put16(h2->out, H2_SETTINGS_ENABLE_PUSH);
+   Http2_put32(h2->out, 0);
+   Http2_put16(h2->out, H2_SETTINGS_INITIAL_WINDOW_SIZE);
+   Http2_put32(h2->out, H2_STREAM_WINDOW);
+   Http2_window_update(h2, 0, H2_CONN_WINDOW - H2_DEFAULT_WINDOW);
+
+   /* Http2_read_cb reads until EAGAIN */
+   a_IOwatch_add_fd(fd, DIO_READ | DIO_EDGE, Http2_read_cb,
+                    INT2VOIDP(h2->key));
+   Http2_flush(h2);
+   return h2;
+}
+
+/*
+ * Can a new stream be opened?
+ */
+bool_t a_Http2_conn_usable(Http2Conn_t *h2)
+{
+   return (!h2->goaway && !h2->dead && h2->next_id < 0x7fffffff &&
+           dList_length(h2->streams) < (int)MIN(h2->max_streams, 1000));
+}
+
+int a_Http2_conn_streams(Http2Conn_t *h2)
+{
+   return dList_length(h2->streams);
+}
+
+/*
+ * http.c is done with the connection: close it when its streams are over
+ */
+void a_Http2_conn_close(Http2Conn_t *h2)
+{
+   h2->attached = FALSE;
+   if (!h2->goaway) {
+      h2->goaway = TRUE;
+      Http2_goaway(h2, H2_NO_ERROR);
+      Http2_flush(h2);
+   }
+   Http2_conn_check(h2);
+}
+
+/*
+ * Send a query on a new stream. 'weight' (1-256) is its share of the
+ * connection, relative to the other streams.
+ * Return 0 on success, -1 on error.
+ */
+int a_Http2_stream_new(Http2Conn_t *h2, int SKey, Dstr *query, int weight)
+{
+   Http2Stream_t *st;
+   Dstr *block;
+   int body;
+
+   if (!a_Http2_conn_usable(h2))
+      return -1;
+   block = dStr_sized_new(256);
+   if ((body = Http2_query_encode(h2, query, block)) < 0) {
+      MSG_ERR("HTTP/2: can't make sense of the query\n");
+      dStr_free(block, 1);
+      return -1;
+   }
+
+   st = dNew0(Http2Stream_t, 1);
+   st->id = h2->next_id;
+   h2->next_id += 2;
+   st->SKey = SKey;
+   st->send_window = h2->initial_window;
+   if (body < query->len) {
+      st->body = dStr_sized_new(query->len - body);
+      dStr_append_l(st->body, query->str + body, query->len - body);
+   }
+   dList_append(h2->streams, st);
+   _MSG("HTTP/2: stream %u on fd %d\n", st->id, h2->fd);
+
+   Http2_send_headers(h2, st, block, weight);
+   Http2_send_body(h2, st);
+   Http2_flush(h2);
+   dStr_free(block, 1);
+   return 0;
+}
+
+/*
+ * http.c doesn't want the stream of 'SKey' anymore
+ */
+void a_Http2_stream_cancel(Http2Conn_t *h2, int SKey)
+{
+   Http2Stream_t *st = Http2_stream_by_key(h2, SKey);
+
+   if (st) {
+      if (!st->remote_closed && !h2->dead) {
+         Http2_rst_stream(h2, st->id, H2_CANCEL);
+         Http2_flush(h2);
+      }
+      Http2_stream_free(h2, st);
+   }
+   Http2_conn_check(h2);
+}
@@ -0,0 +1,29 @@
+#ifndef __IO_HTTP2_H__
+#define __IO_HTTP2_H__
+
+#include "../../dlib/dlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+typedef struct Http2Conn Http2Conn_t;
+
+Http2Conn_t *a_Http2_conn_new(int fd);
+bool_t a_Http2_conn_usable(Http2Conn_t *h2);
+int a_Http2_conn_streams(Http2Conn_t *h2);
+void a_Http2_conn_close(Http2Conn_t *h2);
+int a_Http2_stream_new(Http2Conn_t *h2, int SKey, Dstr *query, int weight);
+void a_Http2_stream_cancel(Http2Conn_t *h2, int SKey);
+
+/* What happens to the streams, reported to http.c */
+void a_Http_h2_data(int SKey, const char *buf, int len);
+void a_Http_h2_end(int SKey, bool_t ok);
+void a_Http_h2_retry(int SKey);
+void a_Http_h2_closed(Http2Conn_t *h2);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __IO_HTTP2_H__ */
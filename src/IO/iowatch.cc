@@ -10,18 +10,222 @@
  */
 
 // Simple ADT for watching file descriptor activity
+//
+// When epoll is available, every watched FD goes into a single epoll set,
+// and only the epoll FD itself is handed to FLTK. A wakeup then costs
+// O(ready FDs) instead of FLTK's O(watched FDs) select/poll scan.
+// Without epoll (or if creating the set fails) we fall back to Fl::add_fd.
+
+#include <config.h>
 
 #include <FL/Fl.H>
 #include "iowatch.hh"
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "../msg.h"
+#include "../../dlib/dlib.h"
+
+/* Max number of events dispatched per wakeup (the rest wait for the next
+ * FLTK loop iteration, as the epoll FD stays readable) */
+#define IOW_MAX_EVENTS 64
+
+#define DIO_EVENTS (DIO_READ | DIO_WRITE | DIO_EXCEPT)
+
+typedef struct {
+   int events;                /* DIO_* events being watched */
+   int edge;                  /* DIO_* events that asked for DIO_EDGE */
+   unsigned gen;              /* bumped on (re)registration */
+   CbFunction_t rcb, wcb, ecb;
+   void *rdata, *wdata, *edata;
+} IOwatch_t;
+
+/*
+ * Local data
+ */
+static int epoll_fd = -1;
+static bool_t epoll_tried = FALSE;
+static IOwatch_t *watches = NULL;   /* indexed by fd */
+static int watches_size = 0;
+
+/*
+ * Translate DIO_* events into the epoll mask for a watch
+ */
+static uint32_t IOwatch_epoll_mask(IOwatch_t *w)
+{
+   uint32_t mask = 0;
+
+   if (w->events & DIO_READ)
+      mask |= EPOLLIN;
+   if (w->events & DIO_WRITE)
+      mask |= EPOLLOUT;
+   if (w->events & DIO_EXCEPT)
+      mask |= EPOLLPRI;
+   /* Edge triggering only when every watcher on this FD drains it */
+   if (w->events && (w->edge & w->events) == w->events)
+      mask |= EPOLLET;
+   return mask;
+}
+
+/*
+ * Dispatch ready FDs (called by FLTK when the epoll FD is readable)
+ */
+static void IOwatch_epoll_cb(int fd, void *data)
+{
+   struct epoll_event evs[IOW_MAX_EVENTS];
+   int i, n;
+
+   do {
+      n = epoll_wait(epoll_fd, evs, IOW_MAX_EVENTS, 0);
+   } while (n < 0 && errno == EINTR);
+
+   for (i = 0; i < n; ++i) {
+      int wfd = (int)(evs[i].data.u64 & 0xffffffff);
+      unsigned gen = (unsigned)(evs[i].data.u64 >> 32);
+      uint32_t ev = evs[i].events;
+      IOwatch_t *w;
+
+      /* Callbacks may remove or re-add any FD, so the watch is looked up
+       * again before each call, and stale events (the FD was closed and
+       * reused within this batch) are dropped by comparing generations. */
+      w = &watches[wfd];
+      if (w->gen == gen && (w->events & DIO_READ) &&
+          (ev & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+         w->rcb(wfd, w->rdata);
+      w = &watches[wfd];
+      if (w->gen == gen && (w->events & DIO_WRITE) &&
+          (ev & (EPOLLOUT | EPOLLHUP | EPOLLERR)))
+         w->wcb(wfd, w->wdata);
+      w = &watches[wfd];
+      if (w->gen == gen && (w->events & DIO_EXCEPT) && (ev & EPOLLPRI))
+         w->ecb(wfd, w->edata);
+   }
+}
+
+/*
+ * Create the epoll set and hook it into FLTK (once).
+ * Return TRUE if the epoll backend is usable.
+ */
+static bool_t IOwatch_epoll_init()
+{
+   if (!epoll_tried) {
+      epoll_tried = TRUE;
+      if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+         MSG_WARN("IOwatch: epoll_create1: %s, using select.\n",
+                  dStrerror(errno));
+      } else {
+         Fl::add_fd(epoll_fd, FL_READ, IOwatch_epoll_cb, NULL);
+      }
+   }
+   return (epoll_fd >= 0);
+}
+
+/*
+ * Make sure 'fd' has a slot in the watches table
+ */
+static void IOwatch_grow(int fd)
+{
+   if (fd >= watches_size) {
+      int old_size = watches_size;
+
+      watches_size = MAX(fd + 1, MAX(64, 2 * watches_size));
+      watches = (IOwatch_t *) dRealloc(watches,
+                                       watches_size * sizeof(IOwatch_t));
+      memset(watches + old_size, 0,
+             (watches_size - old_size) * sizeof(IOwatch_t));
+   }
+}
+
+/*
+ * Push the watch's event mask into the kernel
+ */
+static void IOwatch_epoll_update(int fd, int old_events)
+{
+   IOwatch_t *w = &watches[fd];
+   struct epoll_event ev;
+   int op;
+
+   ev.events = IOwatch_epoll_mask(w);
+   if (!w->events) {
+      op = EPOLL_CTL_DEL;
+   } else if (!old_events) {
+      op = EPOLL_CTL_ADD;
+      w->gen++;
+   } else {
+      op = EPOLL_CTL_MOD;
+   }
+   ev.data.u64 = ((uint64_t)w->gen << 32) | (uint32_t)fd;
+
+   if (epoll_ctl(epoll_fd, op, fd, &ev) == 0)
+      return;
+
+   if (op == EPOLL_CTL_MOD && errno == ENOENT) {
+      /* The FD was closed (and maybe reused) behind our back: what's left
+       * in its slot belongs to a dead descriptor. */
+      w->gen++;
+      ev.data.u64 = ((uint64_t)w->gen << 32) | (uint32_t)fd;
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0)
+         return;
+   } else if (op == EPOLL_CTL_ADD && errno == EEXIST) {
+      /* Registered but forgotten (e.g. closed and reused) */
+      w->gen++;
+      ev.data.u64 = ((uint64_t)w->gen << 32) | (uint32_t)fd;
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0)
+         return;
+   } else if (op == EPOLL_CTL_DEL && (errno == EBADF || errno == ENOENT)) {
+      /* Already closed: the kernel dropped it from the set */
+      w->gen++;
+      return;
+   }
+   MSG_ERR("IOwatch: epoll_ctl on FD %d: %s\n", fd, dStrerror(errno));
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
+
 //
 // Hook a Callback for a certain activities in a FD
+// (DIO_EDGE requests edge-triggered notification: the callback must then
+//  drain the FD until EAGAIN)
 //
 void a_IOwatch_add_fd(int fd, int when, Fl_FD_Handler Callback,
                       void *usr_data = 0)
 {
-   if (fd >= 0)
-      Fl::add_fd(fd, when, Callback, usr_data);
+   if (fd < 0)
+      return;
+
+#ifdef HAVE_SYS_EPOLL_H
+   if (IOwatch_epoll_init()) {
+      IOwatch_t *w;
+      int old_events;
+
+      IOwatch_grow(fd);
+      w = &watches[fd];
+      old_events = w->events;
+      if (when & DIO_READ) {
+         w->rcb = Callback;
+         w->rdata = usr_data;
+      }
+      if (when & DIO_WRITE) {
+         w->wcb = Callback;
+         w->wdata = usr_data;
+      }
+      if (when & DIO_EXCEPT) {
+         w->ecb = Callback;
+         w->edata = usr_data;
+      }
+      w->events |= (when & DIO_EVENTS);
+      if (when & DIO_EDGE)
+         w->edge |= (when & DIO_EVENTS);
+      else
+         w->edge &= ~(when & DIO_EVENTS);
+      IOwatch_epoll_update(fd, old_events);
+      return;
+   }
+#endif
+   Fl::add_fd(fd, when & ~DIO_EDGE, Callback, usr_data);
 }
 
 //
@@ -29,7 +233,24 @@ void a_IOwatch_add_fd(int fd, int when, Fl_FD_Handler Callback,
 //
 void a_IOwatch_remove_fd(int fd, int when)
 {
-   if (fd >= 0)
-      Fl::remove_fd(fd, when);
-}
+   if (fd < 0)
+      return;
+
+#ifdef HAVE_SYS_EPOLL_H
+   if (epoll_fd >= 0) {
+      IOwatch_t *w;
+      int old_events;
 
+      if (fd >= watches_size || !watches[fd].events)
+         return;
+      w = &watches[fd];
+      old_events = w->events;
+      w->events &= ~when;
+      w->edge &= w->events;
+      if (w->events != old_events)
+         IOwatch_epoll_update(fd, old_events);
+      return;
+   }
+#endif
+   Fl::remove_fd(fd, when);
+}
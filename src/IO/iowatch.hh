@@ -7,6 +7,8 @@
 #define DIO_READ    1
 #define DIO_WRITE   4
 #define DIO_EXCEPT  8
+/* Edge-triggered notification (only honored by the epoll backend) */
+#define DIO_EDGE    0x100
 
 typedef void (*CbFunction_t)(int fd, void *data);
 
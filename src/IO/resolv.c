@@ -0,0 +1,947 @@
+/*
+ * File: resolv.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * DNS stub resolver, driven by the IO loop (RFC 1035)
+ *
+ * Names are looked up in the hosts file first. Otherwise, the name servers
+ * of resolv.conf are asked: the A and AAAA queries go out in parallel over
+ * UDP, they're retransmitted (to the next server) when no answer comes in
+ * time, and repeated over TCP when the answer was truncated. The "search"
+ * and "ndots" settings decide which names are tried.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../msg.h"
+#include "../dns.h"
+#include "../timeout.hh"
+#include "iowatch.hh"
+#include "resolv.h"
+
+#define RESOLV_MAX_SERVERS  3
+#define RESOLV_MAX_SEARCH   6
+#define RESOLV_MAX_CNAMES   8
+#define RESOLV_UDP_SIZE     512        /* without EDNS */
+
+#define DNS_PORT            53
+#define DNS_HDR_LEN         12
+#define DNS_MAX_NAME        255
+#define DNS_TYPE_A          1
+#define DNS_TYPE_CNAME      5
+#define DNS_TYPE_SOA        6
+#define DNS_TYPE_AAAA       28
+#define DNS_CLASS_IN        1
+
+#define DNS_FLAG_QR         0x8000
+#define DNS_FLAG_TC         0x0200
+#define DNS_FLAG_RD         0x0100
+#define DNS_RCODE(flags)    ((flags) & 0xf)
+#define DNS_RCODE_OK        0
+#define DNS_RCODE_SERVFAIL  2
+#define DNS_RCODE_NXDOMAIN  3
+
+typedef struct {
+   struct sockaddr_storage addr;
+   socklen_t addrlen;
+} ResolvServer_t;
+
+typedef struct {
+   char *name;
+   Dlist *addr_list;
+} HostsEntry_t;
+
+typedef struct Lookup Lookup_t;
+
+/* One question (A or AAAA) about one name */
+typedef struct {
+   int key;                /* for the timeouts */
+   Lookup_t *lookup;
+   int type;
+   int fd;                 /* -1 when not waiting for an answer */
+   bool_t tcp;
+   int server;             /* the server asked last */
+   int tries;              /* transmissions so far */
+   int timers;             /* pending timeouts */
+   uint_t id;
+   Dstr *msg;              /* the query */
+   Dstr *tcp_buf;          /* TCP: the reply as it comes */
+   int tcp_sent;           /* TCP: bytes of the query sent */
+   bool_t done;
+   int status;
+   Dlist *addr_list;
+   long ttl;               /* of the answer, or -1 */
+} Query_t;
+
+struct Lookup {
+   char *names[RESOLV_MAX_SEARCH + 1];   /* to try, in order */
+   int nnames;
+   int name;                             /* the one being tried */
+   Query_t *queries[2];
+   int nqueries;
+   long neg_ttl;                         /* of the names not found so far */
+   ResolvCallback_t cb;
+   void *cb_data;
+};
+
+/*
+ * Local data
+ */
+static ResolvServer_t servers[RESOLV_MAX_SERVERS];
+static int nservers;
+static char *search[RESOLV_MAX_SEARCH];
+static int nsearch;
+static int opt_timeout = 5, opt_attempts = 2, opt_ndots = 1;
+static Dlist *hosts;                     /* HostsEntry_t */
+static Dlist *queries;                   /* Query_t in progress */
+static int query_key;
+static uint32_t rand_state;
+
+static void Resolv_query_send(Query_t *q);
+static void Resolv_lookup_next(Lookup_t *lk);
+
+
+/*
+ * A random 16-bit query ID (xorshift32)
+ */
+static uint_t Resolv_random_id(void)
+{
+   rand_state ^= rand_state << 13;
+   rand_state ^= rand_state >> 17;
+   rand_state ^= rand_state << 5;
+   return rand_state & 0xffff;
+}
+
+/*
+ * Make a DilloHost for a numeric address (no brackets)
+ */
+static DilloHost *Resolv_host_new(const char *addr)
+{
+   DilloHost *dh = dNew0(DilloHost, 1);
+
+   if (inet_pton(AF_INET, addr, dh->data) == 1) {
+      dh->af = AF_INET;
+      dh->alen = sizeof(struct in_addr);
+#ifdef ENABLE_IPV6
+   } else if (inet_pton(AF_INET6, addr, dh->data) == 1) {
+      dh->af = AF_INET6;
+      dh->alen = sizeof(struct in6_addr);
+#endif
+   } else {
+      dFree(dh);
+      dh = NULL;
+   }
+   return dh;
+}
+
+static Dlist *Resolv_hosts_copy(Dlist *list)
+{
+   Dlist *copy = dList_new(4);
+   DilloHost *dh;
+   int i;
+
+   for (i = 0; (dh = dList_nth_data(list, i)); i++) {
+      DilloHost *c = dNew(DilloHost, 1);
+
+      *c = *dh;
+      dList_append(copy, c);
+   }
+   return copy;
+}
+
+static void Resolv_hosts_free(Dlist *list)
+{
+   void *dh;
+
+   while ((dh = dList_nth_data(list, 0))) {
+      dList_remove_fast(list, dh);
+      dFree(dh);
+   }
+   dList_free(list);
+}
+
+/*
+ * Parse a "nameserver" value: an address, or "[address]:port"
+ */
+static void Resolv_server_add(const char *str)
+{
+   ResolvServer_t *srv = &servers[nservers];
+   struct sockaddr_in *sin = (struct sockaddr_in *)&srv->addr;
+   struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&srv->addr;
+   char *addr = dStrdup(str), *p;
+   int port = DNS_PORT;
+
+   if (addr[0] == '[' && (p = strchr(addr, ']'))) {
+      *p = '\0';
+      if (p[1] == ':')
+         port = strtol(p + 2, NULL, 10);
+      memmove(addr, addr + 1, strlen(addr));
+   }
+   memset(srv, 0, sizeof(*srv));
+   if (inet_pton(AF_INET, addr, &sin->sin_addr) == 1) {
+      sin->sin_family = AF_INET;
+      sin->sin_port = htons(port);
+      srv->addrlen = sizeof(*sin);
+      nservers++;
+   } else if (inet_pton(AF_INET6, addr, &sin6->sin6_addr) == 1) {
+      sin6->sin6_family = AF_INET6;
+      sin6->sin6_port = htons(port);
+      srv->addrlen = sizeof(*sin6);
+      nservers++;
+   } else {
+      MSG("resolv: bad nameserver \"%s\"\n", str);
+   }
+   dFree(addr);
+}
+
+/*
+ * Read the name servers, the search list and the options
+ */
+static void Resolv_conf_load(const char *filename)
+{
+   FILE *fp;
+   char *line, *p, *tok;
+
+   if ((fp = fopen(filename, "r"))) {
+      while ((line = dGetline(fp))) {
+         if ((p = strpbrk(line, "#;")))
+            *p = '\0';
+         p = line;
+         if (!(tok = dStrsep(&p, " \t\n")) || !*tok) {
+            /* empty line */
+         } else if (!strcmp(tok, "nameserver")) {
+            while ((tok = dStrsep(&p, " \t\n")) && !*tok) ;
+            if (tok && nservers < RESOLV_MAX_SERVERS)
+               Resolv_server_add(tok);
+         } else if (!strcmp(tok, "search") || !strcmp(tok, "domain")) {
+            /* the last one of these wins */
+            while (nsearch > 0)
+               dFree(search[--nsearch]);
+            while ((tok = dStrsep(&p, " \t\n")))
+               if (*tok && nsearch < RESOLV_MAX_SEARCH)
+                  search[nsearch++] = dStrdup(tok);
+         } else if (!strcmp(tok, "options")) {
+            while ((tok = dStrsep(&p, " \t\n"))) {
+               if (!strncmp(tok, "timeout:", 8))
+                  opt_timeout = MAX(1, strtol(tok + 8, NULL, 10));
+               else if (!strncmp(tok, "attempts:", 9))
+                  opt_attempts = MAX(1, strtol(tok + 9, NULL, 10));
+               else if (!strncmp(tok, "ndots:", 6))
+                  opt_ndots = MAX(0, strtol(tok + 6, NULL, 10));
+            }
+         }
+         dFree(line);
+      }
+      fclose(fp);
+   }
+   if (nservers == 0) {
+      /* as the C library does */
+      Resolv_server_add("127.0.0.1");
+   }
+}
+
+/*
+ * Read the hosts file
+ */
+static void Resolv_hosts_load(const char *filename)
+{
+   FILE *fp;
+   char *line, *p, *tok;
+   DilloHost *dh;
+
+   hosts = dList_new(8);
+   if (!(fp = fopen(filename, "r")))
+      return;
+   while ((line = dGetline(fp))) {
+      if ((p = strchr(line, '#')))
+         *p = '\0';
+      p = line;
+      while ((tok = dStrsep(&p, " \t\n")) && !*tok) ;
+      if (tok && (dh = Resolv_host_new(tok))) {
+         while ((tok = dStrsep(&p, " \t\n"))) {
+            HostsEntry_t *he;
+            DilloHost *c;
+            int i;
+
+            if (!*tok)
+               continue;
+            for (i = 0; (he = dList_nth_data(hosts, i)); i++)
+               if (!dStrAsciiCasecmp(he->name, tok))
+                  break;
+            if (!he) {
+               he = dNew(HostsEntry_t, 1);
+               he->name = dStrdup(tok);
+               he->addr_list = dList_new(2);
+               dList_append(hosts, he);
+            }
+            c = dNew(DilloHost, 1);
+            *c = *dh;
+            dList_append(he->addr_list, c);
+         }
+         dFree(dh);
+      }
+      dFree(line);
+   }
+   fclose(fp);
+}
+
+/*
+ * Initialize the resolver
+ */
+void a_Resolv_init(const char *resolv_conf, const char *hosts_file)
+{
+   FILE *fp;
+
+   opt_timeout = 5;
+   opt_attempts = 2;
+   opt_ndots = 1;
+   Resolv_conf_load(resolv_conf);
+   Resolv_hosts_load(hosts_file);
+   queries = dList_new(8);
+
+   rand_state = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+   if ((fp = fopen("/dev/urandom", "rb"))) {
+      if (fread(&rand_state, sizeof(rand_state), 1, fp) != 1)
+         rand_state ^= (uint32_t)clock();
+      fclose(fp);
+   }
+   if (rand_state == 0)
+      rand_state = 1;
+   _MSG("resolv: %d servers, %d search domains, timeout %d, attempts %d, "
+        "ndots %d\n", nservers, nsearch, opt_timeout, opt_attempts, opt_ndots);
+}
+
+/* ----------------------------------------------------------------------
+ *  Messages
+ */
+
+/*
+ * Build a query for 'name'.
+ * Return value: 0 on success, -1 if the name can't be asked.
+ */
+static int Resolv_msg_build(Dstr *msg, uint_t id, const char *name, int type)
+{
+   const char *p, *dot;
+   size_t len;
+
+   dStr_truncate(msg, 0);
+   dStr_append_c(msg, id >> 8);
+   dStr_append_c(msg, id & 0xff);
+   dStr_append_c(msg, DNS_FLAG_RD >> 8);
+   dStr_append_c(msg, 0);
+   dStr_append_l(msg, "\0\1\0\0\0\0\0\0", 8);   /* one question */
+
+   for (p = name; *p; p = dot + 1) {
+      dot = strchr(p, '.');
+      len = dot ? (size_t)(dot - p) : strlen(p);
+      if (len == 0 || len > 63)
+         return -1;
+      dStr_append_c(msg, len);
+      dStr_append_l(msg, p, len);
+      if (!dot)
+         break;
+   }
+   dStr_append_c(msg, 0);
+   if (msg->len - DNS_HDR_LEN > DNS_MAX_NAME)
+      return -1;
+   dStr_append_c(msg, 0);
+   dStr_append_c(msg, type);
+   dStr_append_c(msg, 0);
+   dStr_append_c(msg, DNS_CLASS_IN);
+   return 0;
+}
+
+static uint_t Resolv_get16(const uchar_t *p)
+{
+   return (p[0] << 8) | p[1];
+}
+
+static long Resolv_get32(const uchar_t *p)
+{
+   return (long)(((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+}
+
+/*
+ * Keep the shortest TTL in 'ttl'
+ */
+static void Resolv_ttl_min(long *ttl, long new_ttl)
+{
+   if (new_ttl >= 0 && (*ttl < 0 || new_ttl < *ttl))
+      *ttl = new_ttl;
+}
+
+/*
+ * Read the (maybe compressed) name at 'off' into 'name', as dotted text.
+ * Return value: the offset past the name, or -1 if it's malformed.
+ */
+static int Resolv_name_read(const uchar_t *msg, int len, int off, char *name)
+{
+   int end = -1, jumps = 0, n = 0;
+
+   while (off < len) {
+      int l = msg[off];
+
+      if (l == 0) {
+         name[n ? n - 1 : 0] = '\0';
+         return (end == -1) ? off + 1 : end;
+      } else if ((l & 0xc0) == 0xc0) {
+         if (off + 1 >= len || ++jumps > 64)
+            break;
+         if (end == -1)
+            end = off + 2;
+         off = ((l & 0x3f) << 8) | msg[off + 1];
+      } else if ((l & 0xc0) == 0 && off + 1 + l < len &&
+                 n + l + 1 <= DNS_MAX_NAME) {
+         memcpy(name + n, msg + off + 1, l);
+         n += l;
+         name[n++] = '.';
+         off += l + 1;
+      } else {
+         break;
+      }
+   }
+   return -1;
+}
+
+/*
+ * Do two names match? (case-insensitively, and the root dot not minding)
+ */
+static bool_t Resolv_name_eq(const char *a, const char *b)
+{
+   size_t la = strlen(a), lb = strlen(b);
+
+   if (la && a[la - 1] == '.')
+      la--;
+   if (lb && b[lb - 1] == '.')
+      lb--;
+   return la == lb && !dStrnAsciiCasecmp(a, b, la);
+}
+
+/*
+ * How long may a negative answer be cached? (RFC 2308: the TTL of the
+ * SOA record in the authority section, or its MINIMUM field if lower)
+ * Return value: the TTL, or -1 if there's no SOA record.
+ */
+static long Resolv_msg_soa_ttl(const uchar_t *msg, int len, int off,
+                               uint_t ancount, uint_t nscount)
+{
+   char name[DNS_MAX_NAME + 1];
+   uint_t i, rdlen;
+   long ttl = -1;
+
+   for (i = 0; i < ancount + nscount; i++) {
+      if ((off = Resolv_name_read(msg, len, off, name)) < 0 || off + 10 > len)
+         return -1;
+      rdlen = Resolv_get16(msg + off + 8);
+      if (off + 10 + (int)rdlen > len)
+         return -1;
+      if (i >= ancount && Resolv_get16(msg + off) == DNS_TYPE_SOA &&
+          rdlen >= 22) {
+         ttl = Resolv_get32(msg + off + 4);
+         Resolv_ttl_min(&ttl, Resolv_get32(msg + off + 10 + rdlen - 4));
+         break;
+      }
+      off += 10 + rdlen;
+   }
+   return ttl;
+}
+
+/*
+ * Take the addresses for the query's name out of a reply (following
+ * CNAMEs), and how long they're good for. Return value: the DNS rcode, or
+ * -1 if the reply is malformed or not for this query.
+ */
+static int Resolv_msg_parse(Query_t *q, const uchar_t *msg, int len)
+{
+   char qname[DNS_MAX_NAME + 1], owner[DNS_MAX_NAME + 1],
+        target[DNS_MAX_NAME + 1];
+   const char *asked = q->lookup->names[q->lookup->name];
+   uint_t flags, ancount, nscount, type, rdlen;
+   int i, off, answers, pass, cnames = 0;
+   bool_t changed;
+
+   if (len < DNS_HDR_LEN || Resolv_get16(msg) != q->id)
+      return -1;
+   flags = Resolv_get16(msg + 2);
+   if (!(flags & DNS_FLAG_QR) || Resolv_get16(msg + 4) != 1)
+      return -1;
+   ancount = Resolv_get16(msg + 6);
+   nscount = Resolv_get16(msg + 8);
+   if ((off = Resolv_name_read(msg, len, DNS_HDR_LEN, qname)) < 0 ||
+       off + 4 > len || !Resolv_name_eq(qname, asked) ||
+       Resolv_get16(msg + off) != (uint_t)q->type)
+      return -1;
+   answers = off + 4;
+
+   if (DNS_RCODE(flags) != DNS_RCODE_OK) {
+      if (DNS_RCODE(flags) == DNS_RCODE_NXDOMAIN)
+         q->ttl = Resolv_msg_soa_ttl(msg, len, answers, ancount, nscount);
+      return DNS_RCODE(flags);
+   }
+
+   /* Pass 0 follows the CNAME chain, pass 1 gets the addresses */
+   strcpy(qname, asked);
+   for (pass = 0; pass < 2; pass++) {
+      do {
+         changed = FALSE;
+         for (off = answers, i = 0; i < (int)ancount; i++) {
+            if ((off = Resolv_name_read(msg, len, off, owner)) < 0 ||
+                off + 10 > len)
+               return -1;
+            type = Resolv_get16(msg + off);
+            rdlen = Resolv_get16(msg + off + 8);
+            off += 10;
+            if (off + (int)rdlen > len)
+               return -1;
+            if (Resolv_get16(msg + off - 8) == DNS_CLASS_IN &&
+                Resolv_name_eq(owner, qname)) {
+               if (pass == 0 && type == DNS_TYPE_CNAME &&
+                   Resolv_name_read(msg, len, off, target) > 0 &&
+                   cnames++ < RESOLV_MAX_CNAMES) {
+                  strcpy(qname, target);
+                  Resolv_ttl_min(&q->ttl, Resolv_get32(msg + off - 6));
+                  changed = TRUE;
+               } else if (pass == 1 && type == (uint_t)q->type &&
+                          ((type == DNS_TYPE_A && rdlen == 4) ||
+                           (type == DNS_TYPE_AAAA && rdlen == 16))) {
+                  DilloHost *dh = dNew0(DilloHost, 1);
+
+                  dh->af = (type == DNS_TYPE_A) ? AF_INET : AF_INET6;
+                  dh->alen = rdlen;
+                  memcpy(dh->data, msg + off, rdlen);
+                  dList_append(q->addr_list, dh);
+                  Resolv_ttl_min(&q->ttl, Resolv_get32(msg + off - 6));
+               }
+            }
+            off += rdlen;
+         }
+      } while (changed && pass == 0);
+   }
+   if (dList_length(q->addr_list) == 0)
+      q->ttl = Resolv_msg_soa_ttl(msg, len, answers, ancount, nscount);
+   return DNS_RCODE_OK;
+}
+
+/* ----------------------------------------------------------------------
+ *  Queries
+ */
+
+static Query_t *Resolv_query_by_key(int key)
+{
+   Query_t *q;
+   int i;
+
+   for (i = 0; (q = dList_nth_data(queries, i)); i++)
+      if (q->key == key)
+         return q;
+   return NULL;
+}
+
+/*
+ * Stop waiting on the query's socket
+ */
+static void Resolv_query_close(Query_t *q)
+{
+   if (q->fd != -1) {
+      a_IOwatch_remove_fd(q->fd, -1);
+      dClose(q->fd);
+      q->fd = -1;
+   }
+}
+
+static void Resolv_query_free(Query_t *q)
+{
+   Resolv_query_close(q);
+   dList_remove(queries, q);
+   dStr_free(q->msg, 1);
+   dStr_free(q->tcp_buf, 1);
+   if (q->addr_list)
+      Resolv_hosts_free(q->addr_list);
+   dFree(q);
+}
+
+/*
+ * The query has its answer (or won't have one)
+ */
+static void Resolv_query_done(Query_t *q, int status)
+{
+   Lookup_t *lk = q->lookup;
+   int i;
+
+   Resolv_query_close(q);
+   q->done = TRUE;
+   q->status = status;
+
+   for (i = 0; i < lk->nqueries; i++)
+      if (!lk->queries[i]->done)
+         return;
+   Resolv_lookup_next(lk);
+}
+
+/*
+ * Deal with a reply
+ */
+static void Resolv_query_reply(Query_t *q, const uchar_t *msg, int len)
+{
+   int rcode;
+
+   if (!q->tcp && len >= DNS_HDR_LEN && Resolv_get16(msg) == q->id &&
+       (Resolv_get16(msg + 2) & DNS_FLAG_TC)) {
+      /* truncated: ask the same server over TCP */
+      _MSG("resolv: truncated reply, using TCP\n");
+      Resolv_query_close(q);
+      q->tcp = TRUE;
+      q->tries--;
+      q->server = (q->server + nservers - 1) % nservers;
+      Resolv_query_send(q);
+      return;
+   }
+   rcode = Resolv_msg_parse(q, msg, len);
+   if (rcode == -1) {
+      /* not an answer to this query; keep waiting (UDP) */
+      if (q->tcp)
+         Resolv_query_done(q, RESOLV_NO_ANSWER);
+   } else if (rcode == DNS_RCODE_OK || rcode == DNS_RCODE_NXDOMAIN) {
+      Resolv_query_done(q, dList_length(q->addr_list) ? RESOLV_OK :
+                                                        RESOLV_NOT_FOUND);
+   } else if (q->tries < opt_attempts * nservers) {
+      /* SERVFAIL, REFUSED...: the next server may do better */
+      Resolv_query_close(q);
+      Resolv_query_send(q);
+   } else {
+      Resolv_query_done(q, RESOLV_NO_ANSWER);
+   }
+}
+
+static void Resolv_udp_cb(int fd, void *data)
+{
+   Query_t *q;
+   uchar_t buf[RESOLV_UDP_SIZE];
+   ssize_t n;
+
+   /* (a reply may end the query) */
+   while ((q = Resolv_query_by_key(VOIDP2INT(data))) && q->fd == fd &&
+          (n = recv(fd, buf, sizeof(buf), 0)) >= 0)
+      Resolv_query_reply(q, buf, n);
+}
+
+static void Resolv_tcp_cb(int fd, void *data)
+{
+   Query_t *q = Resolv_query_by_key(VOIDP2INT(data));
+   char buf[4096];
+   ssize_t n;
+
+   if (!q || q->fd != fd)
+      return;
+
+   if (q->tcp_sent < q->msg->len) {
+      n = write(fd, q->msg->str + q->tcp_sent, q->msg->len - q->tcp_sent);
+      if (n < 0 && errno != EAGAIN && errno != EINTR) {
+         Resolv_query_close(q);   /* the timeout will move on */
+      } else if (n > 0 && (q->tcp_sent += n) == q->msg->len) {
+         a_IOwatch_remove_fd(fd, DIO_WRITE);
+         a_IOwatch_add_fd(fd, DIO_READ, Resolv_tcp_cb, data);
+      }
+      return;
+   }
+   while ((n = read(fd, buf, sizeof(buf))) > 0)
+      dStr_append_l(q->tcp_buf, buf, n);
+   if (q->tcp_buf->len >= 2) {
+      int len = Resolv_get16((uchar_t *)q->tcp_buf->str);
+
+      if (q->tcp_buf->len >= len + 2) {
+         Resolv_query_reply(q, (uchar_t *)q->tcp_buf->str + 2, len);
+         return;
+      }
+   }
+   if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+      Resolv_query_close(q);   /* the timeout will move on */
+}
+
+/*
+ * No answer in time: try again, or give up
+ */
+static void Resolv_timeout_cb(void *data)
+{
+   Query_t *q = Resolv_query_by_key(VOIDP2INT(data));
+
+   /* Only the timeout that was set last is current, and as they all have
+    * the same delay, it's the last one to fire. */
+   if (q && --q->timers == 0 && !q->done) {
+      Resolv_query_close(q);
+      if (q->tries < opt_attempts * nservers) {
+         Resolv_query_send(q);
+      } else {
+         MSG("resolv: no answer for %s\n", q->lookup->names[q->lookup->name]);
+         Resolv_query_done(q, RESOLV_NO_ANSWER);
+      }
+   }
+}
+
+/*
+ * (Re)transmit the query to the next server
+ */
+static void Resolv_query_send(Query_t *q)
+{
+   ResolvServer_t *srv;
+   int fd;
+
+   q->server = (q->tries++ == 0) ? 0 : (q->server + 1) % nservers;
+   q->ttl = -1;
+   srv = &servers[q->server];
+   q->id = Resolv_random_id();
+   Resolv_msg_build(q->msg, q->id, q->lookup->names[q->lookup->name],
+                    q->type);
+
+   fd = socket(srv->addr.ss_family, q->tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+   if (fd >= 0) {
+      fcntl(fd, F_SETFL, O_NONBLOCK | fcntl(fd, F_GETFL));
+      fcntl(fd, F_SETFD, FD_CLOEXEC | fcntl(fd, F_GETFD));
+      /* a connected UDP socket only gets datagrams from the server */
+      if (connect(fd, (struct sockaddr *)&srv->addr, srv->addrlen) == -1 &&
+          errno != EINPROGRESS) {
+         dClose(fd);
+         fd = -1;
+      }
+   }
+   if (fd >= 0 && q->tcp) {
+      uint_t len = q->msg->len;
+
+      dStr_insert_l(q->msg, 0, "\0\0", 2);
+      q->msg->str[0] = len >> 8;
+      q->msg->str[1] = len & 0xff;
+      q->tcp_sent = 0;
+      dStr_truncate(q->tcp_buf, 0);
+      q->fd = fd;
+      a_IOwatch_add_fd(fd, DIO_WRITE, Resolv_tcp_cb, INT2VOIDP(q->key));
+   } else if (fd >= 0) {
+      if (send(fd, q->msg->str, q->msg->len, 0) == q->msg->len) {
+         q->fd = fd;
+         a_IOwatch_add_fd(fd, DIO_READ, Resolv_udp_cb, INT2VOIDP(q->key));
+      } else {
+         dClose(fd);
+      }
+   }
+   /* even when it couldn't be sent, wait before trying again */
+   q->timers++;
+   a_Timeout_add(opt_timeout, Resolv_timeout_cb, INT2VOIDP(q->key));
+}
+
+static Query_t *Resolv_query_new(Lookup_t *lk, int type)
+{
+   Query_t *q = dNew0(Query_t, 1);
+
+   q->key = ++query_key;
+   q->lookup = lk;
+   q->type = type;
+   q->fd = -1;
+   q->msg = dStr_sized_new(64);
+   q->tcp_buf = dStr_new("");
+   q->addr_list = dList_new(4);
+   q->ttl = -1;
+   dList_append(queries, q);
+   return q;
+}
+
+/* ----------------------------------------------------------------------
+ *  Lookups
+ */
+
+static void Resolv_lookup_free(Lookup_t *lk)
+{
+   int i;
+
+   for (i = 0; i < lk->nqueries; i++)
+      Resolv_query_free(lk->queries[i]);
+   for (i = 0; i < lk->nnames; i++)
+      dFree(lk->names[i]);
+   dFree(lk);
+}
+
+/*
+ * Ask the questions about the name that's next in the list.
+ */
+static void Resolv_lookup_start(Lookup_t *lk)
+{
+   int i, types[] = {
+#ifdef ENABLE_IPV6
+      DNS_TYPE_AAAA,
+#endif
+      DNS_TYPE_A
+   };
+
+   lk->nqueries = sizeof(types) / sizeof(types[0]);
+   for (i = 0; i < lk->nqueries; i++)
+      lk->queries[i] = Resolv_query_new(lk, types[i]);
+   for (i = 0; i < lk->nqueries; i++)
+      Resolv_query_send(lk->queries[i]);
+}
+
+/*
+ * All the queries about the current name are done: finish with their
+ * addresses, or try the next name.
+ */
+static void Resolv_lookup_next(Lookup_t *lk)
+{
+   Dlist *addr_list = NULL;
+   int i, status = RESOLV_NOT_FOUND;
+   long ttl = -1;
+   DilloHost *dh;
+
+   for (i = 0; i < lk->nqueries; i++) {
+      Query_t *q = lk->queries[i];
+
+      if (q->status == RESOLV_OK) {
+         Resolv_ttl_min(&ttl, q->ttl);
+         if (!addr_list)
+            addr_list = dList_new(4);
+         while ((dh = dList_nth_data(q->addr_list, 0))) {
+            dList_remove(q->addr_list, dh);
+            dList_append(addr_list, dh);
+         }
+         status = RESOLV_OK;
+      } else if (q->status == RESOLV_NO_ANSWER && status != RESOLV_OK) {
+         status = RESOLV_NO_ANSWER;
+      } else if (q->status == RESOLV_NOT_FOUND) {
+         /* no TTL means no caching */
+         lk->neg_ttl = (q->ttl < 0) ? -1 : MIN(lk->neg_ttl, q->ttl);
+      }
+   }
+   for (i = 0; i < lk->nqueries; i++)
+      Resolv_query_free(lk->queries[i]);
+   lk->nqueries = 0;
+
+   if (status == RESOLV_NOT_FOUND)
+      ttl = (lk->neg_ttl == LONG_MAX) ? -1 : lk->neg_ttl;
+   if (status == RESOLV_NOT_FOUND && ++lk->name < lk->nnames) {
+      Resolv_lookup_start(lk);
+   } else {
+      ResolvCallback_t cb = lk->cb;
+      void *cb_data = lk->cb_data;
+
+      Resolv_lookup_free(lk);
+      cb(status, addr_list, status == RESOLV_NO_ANSWER ? -1 : ttl, cb_data);
+   }
+}
+
+/*
+ * Can 'name' be asked? (labels of 1 to 63 bytes, 255 bytes in all)
+ */
+static bool_t Resolv_name_ok(const char *name)
+{
+   Dstr *msg = dStr_sized_new(64);
+   bool_t ok = (Resolv_msg_build(msg, 0, name, DNS_TYPE_A) == 0);
+
+   dStr_free(msg, 1);
+   return ok;
+}
+
+static void Resolv_lookup_add_name(Lookup_t *lk, char *name)
+{
+   if (Resolv_name_ok(name))
+      lk->names[lk->nnames++] = name;
+   else
+      dFree(name);
+}
+
+/*
+ * Look 'hostname' up, and give the answer to 'cb' (right away, if it's an
+ * address or it's in the hosts file, or it can't be a name).
+ */
+void a_Resolv_lookup(const char *hostname, ResolvCallback_t cb, void *data)
+{
+   Lookup_t *lk;
+   HostsEntry_t *he;
+   DilloHost *dh;
+   const char *p;
+   size_t len = strlen(hostname);
+   int i, dots = 0;
+
+   if ((dh = Resolv_host_new(hostname))) {
+      Dlist *list = dList_new(1);
+
+      dList_append(list, dh);
+      cb(RESOLV_OK, list, -1, data);
+      return;
+   }
+   for (i = 0; (he = dList_nth_data(hosts, i)); i++) {
+      if (Resolv_name_eq(he->name, hostname)) {
+         cb(RESOLV_OK, Resolv_hosts_copy(he->addr_list), -1, data);
+         return;
+      }
+   }
+
+   lk = dNew0(Lookup_t, 1);
+   lk->cb = cb;
+   lk->cb_data = data;
+   lk->neg_ttl = LONG_MAX;
+   for (p = hostname; *p; p++)
+      dots += (*p == '.');
+   if (len && hostname[len - 1] == '.') {
+      /* fully qualified */
+      Resolv_lookup_add_name(lk, dStrndup(hostname, len - 1));
+   } else {
+      if (dots >= opt_ndots)
+         Resolv_lookup_add_name(lk, dStrdup(hostname));
+      for (i = 0; i < nsearch; i++)
+         Resolv_lookup_add_name(lk, dStrconcat(hostname, ".", search[i],
+                                               NULL));
+      if (dots < opt_ndots)
+         Resolv_lookup_add_name(lk, dStrdup(hostname));
+   }
+   if (lk->nnames == 0) {
+      Resolv_lookup_free(lk);
+      cb(RESOLV_NOT_FOUND, NULL, -1, data);
+   } else {
+      Resolv_lookup_start(lk);
+   }
+}
+
+/*
+ * Free the resolver's memory. Lookups in progress never call back.
+ * (Call this one at exit time)
+ */
+void a_Resolv_freeall(void)
+{
+   Query_t *q;
+   HostsEntry_t *he;
+   int i;
+
+   while ((q = dList_nth_data(queries, 0))) {
+      Lookup_t *lk = q->lookup;
+
+      for (i = 0; i < lk->nqueries; i++)
+         Resolv_query_free(lk->queries[i]);
+      lk->nqueries = 0;
+      Resolv_lookup_free(lk);
+   }
+   dList_free(queries);
+   queries = NULL;
+   while ((he = dList_nth_data(hosts, 0))) {
+      dList_remove_fast(hosts, he);
+      dFree(he->name);
+      Resolv_hosts_free(he->addr_list);
+      dFree(he);
+   }
+   dList_free(hosts);
+   while (nsearch > 0)
+      dFree(search[--nsearch]);
+   nservers = 0;
+}
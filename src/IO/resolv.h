@@ -0,0 +1,32 @@
+#ifndef __IO_RESOLV_H__
+#define __IO_RESOLV_H__
+
+#include "../../dlib/dlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Lookup status */
+#define RESOLV_OK         0
+#define RESOLV_NOT_FOUND  1   /* the name doesn't exist, or has no address */
+#define RESOLV_NO_ANSWER  2   /* the name servers didn't answer properly */
+
+/*
+ * 'addr_list' holds DilloHost structures (see dns.h), and belongs to the
+ * callee. It is NULL unless status is RESOLV_OK.
+ * 'ttl' is how long (in seconds) the answer may be cached, or -1 when the
+ * answer didn't tell (e.g., it comes from the hosts file).
+ */
+typedef void (*ResolvCallback_t)(int status, Dlist *addr_list, long ttl,
+                                 void *data);
+
+void a_Resolv_init(const char *resolv_conf, const char *hosts_file);
+void a_Resolv_lookup(const char *hostname, ResolvCallback_t cb, void *data);
+void a_Resolv_freeall(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __IO_RESOLV_H__ */
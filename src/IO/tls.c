@@ -46,6 +46,10 @@ void a_Tls_init()
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <ctype.h>            /* tolower for wget stuff */
 #include <stdio.h>
@@ -68,10 +72,17 @@ void a_Tls_init()
 #define CERT_STATUS_BAD 3
 #define CERT_STATUS_USER_ACCEPTED 4
 
+/* How long a clean certificate check is trusted for repeat connections */
+#define CERT_CHECK_CACHE_TIME (60 * 60)
+
 typedef struct {
    char *hostname;
    int port;
    int cert_status;
+   SSL_SESSION *session;   /* to resume, instead of a full handshake */
+   uchar_t cert_md[EVP_MAX_MD_SIZE]; /* digest of the checked certificate */
+   uint_t cert_md_len;               /* (0 if none) */
+   time_t cert_checked_until;
 } Server_t;
 
 typedef struct {
@@ -87,6 +98,7 @@ typedef struct {
    DilloUrl *url;
    SSL *ssl;
    bool_t connecting;
+   struct timeval start;   /* when the handshake began */
 } Conn_t;
 
 /* List of active TLS connections */
@@ -99,7 +111,13 @@ static SSL_CTX *ssl_context;
 static Dlist *servers;
 static Dlist *fd_map;
 
+/* Handshake counts and their total time in ms (reported at exit) */
+static uint_t full_handshakes, resumed_handshakes;
+static double full_handshakes_ms, resumed_handshakes_ms;
+
 static void Tls_connect_cb(int fd, void *vconnkey);
+static int Tls_servers_cmp(const void *v1, const void *v2);
+static int Tls_servers_by_url_cmp(const void *v1, const void *v2);
 
 /*
  * Compare by FD.
@@ -173,6 +191,8 @@ static int Tls_conn_new(int fd, const DilloUrl *url, SSL *ssl)
    conn->url = a_Url_dup(url);
    conn->ssl = ssl;
    conn->connecting = TRUE;
+   gettimeofday(&conn->start, NULL);
+   SSL_set_app_data(ssl, conn);
 
    key = a_Klist_insert(&conn_list, conn);
 
@@ -249,6 +269,106 @@ static void Tls_load_certificates()
       ;
 }
 
+/*
+ * OpenSSL has a new session for us (with TLS 1.3, this may come after the
+ * handshake). Keep the latest one of each server.
+ * Return: 1 if we took the reference, 0 otherwise.
+ */
+static int Tls_new_session_cb(SSL *ssl, SSL_SESSION *session)
+{
+   Conn_t *conn = SSL_get_app_data(ssl);
+   Server_t *s;
+
+   if (conn &&
+       (s = dList_find_sorted(servers, conn->url, Tls_servers_by_url_cmp))) {
+      if (s->session)
+         SSL_SESSION_free(s->session);
+      s->session = session;
+      return 1;
+   }
+   return 0;
+}
+
+static bool_t Tls_session_expired(SSL_SESSION *session)
+{
+   return (SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) <
+           time(NULL));
+}
+
+/*
+ * Load the sessions saved by the last run (see tls_save_sessions in dillorc).
+ * The file holds a "host port" line followed by a PEM session, for each
+ * server.
+ */
+static void Tls_sessions_load()
+{
+   char *filename = dStrconcat(dGethomedir(), "/.dillo/tls_sessions", NULL);
+   char line[256], host[256];
+   SSL_SESSION *session;
+   Server_t *s;
+   FILE *fp;
+   int port;
+
+   if ((fp = fopen(filename, "r"))) {
+      while (fgets(line, sizeof(line), fp)) {
+         if (sscanf(line, "%255s %d", host, &port) != 2 || host[0] == '#')
+            continue;
+         if (!(session = PEM_read_SSL_SESSION(fp, NULL, NULL, NULL)))
+            break;
+         if (Tls_session_expired(session)) {
+            SSL_SESSION_free(session);
+            continue;
+         }
+         s = dNew0(Server_t, 1);
+         s->hostname = dStrdup(host);
+         s->port = port;
+         s->cert_status = CERT_STATUS_NONE;
+         s->session = session;
+         if (dList_find_sorted(servers, s, Tls_servers_cmp)) {
+            SSL_SESSION_free(session);
+            dFree(s->hostname);
+            dFree(s);
+         } else {
+            dList_insert_sorted(servers, s, Tls_servers_cmp);
+         }
+      }
+      fclose(fp);
+      ERR_clear_error();
+   }
+   dFree(filename);
+}
+
+/*
+ * Save the sessions that can still be resumed. They're as good as keys
+ * to the connections, so the file is for the user's eyes only.
+ */
+static void Tls_sessions_save()
+{
+   char *filename = dStrconcat(dGethomedir(), "/.dillo/tls_sessions", NULL);
+   Server_t *s;
+   FILE *fp;
+   int i, fd;
+
+   if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1 ||
+       !(fp = fdopen(fd, "w"))) {
+      MSG("TLS: can't save the sessions in %s: %s\n", filename,
+          dStrerror(errno));
+      if (fd != -1)
+         close(fd);
+   } else {
+      fprintf(fp, "# Dillo TLS sessions, written on exit\n");
+      for (i = 0; (s = dList_nth_data(servers, i)); i++) {
+         if (s->session && s->cert_status != CERT_STATUS_BAD &&
+             !Tls_session_expired(s->session)) {
+            fprintf(fp, "%s %d\n", s->hostname, s->port);
+            PEM_write_SSL_SESSION(fp, s->session);
+         }
+      }
+      fclose(fp);
+   }
+   dFree(filename);
+}
+
 /*
  * Initialize the OpenSSL library.
  */
@@ -290,10 +410,20 @@ void a_Tls_init(void)
    /* This lets us deal with self-signed certificates */
    SSL_CTX_set_verify(ssl_context, SSL_VERIFY_NONE, NULL);
 
+   /* Buffers that we write from may grow while a write is pending */
+   SSL_CTX_set_mode(ssl_context, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+   /* Sessions (tickets, or TLS 1.3 PSKs) are kept by server, in 'servers' */
+   SSL_CTX_set_session_cache_mode(ssl_context, SSL_SESS_CACHE_CLIENT |
+                                  SSL_SESS_CACHE_NO_INTERNAL_STORE);
+   SSL_CTX_sess_set_new_cb(ssl_context, Tls_new_session_cb);
+
    Tls_load_certificates();
 
    fd_map = dList_new(20);
    servers = dList_new(8);
+   if (prefs.tls_save_sessions)
+      Tls_sessions_load();
 }
 
 /*
@@ -392,7 +522,7 @@ int a_Tls_connect_ready(const DilloUrl *url)
       if (s->cert_status == CERT_STATUS_NONE)
          s->cert_status = CERT_STATUS_RECEIVING;
    } else {
-      s = dNew(Server_t, 1);
+      s = dNew0(Server_t, 1);
 
       s->hostname = dStrdup(URL_HOST(url));
       s->port = URL_PORT(url);
@@ -1014,6 +1144,63 @@ static int Tls_examine_certificate(SSL *ssl, Server_t *srv)
    return ret;
 }
 
+/*
+ * Is the server presenting the very certificate that passed all of our
+ * checks a while ago?
+ */
+static bool_t Tls_cert_check_cached(SSL *ssl, Server_t *srv)
+{
+   uchar_t md[EVP_MAX_MD_SIZE];
+   uint_t md_len;
+   X509 *cert;
+   bool_t ret = FALSE;
+
+   if (srv->cert_status == CERT_STATUS_CLEAN && srv->cert_md_len > 0 &&
+       time(NULL) < srv->cert_checked_until &&
+       (cert = SSL_get_peer_certificate(ssl))) {
+      ret = (X509_digest(cert, EVP_sha256(), md, &md_len) &&
+             md_len == srv->cert_md_len &&
+             !memcmp(md, srv->cert_md, md_len));
+      X509_free(cert);
+   }
+   return ret;
+}
+
+/*
+ * Remember that the server's certificate passed the checks. This holds
+ * for CERT_CHECK_CACHE_TIME at most, and never past the certificate's
+ * expiration.
+ */
+static void Tls_cert_check_cache(SSL *ssl, Server_t *srv)
+{
+   X509 *cert = SSL_get_peer_certificate(ssl);
+   int days, secs;
+
+   srv->cert_md_len = 0;
+   if (cert) {
+      if (X509_digest(cert, EVP_sha256(), srv->cert_md, &srv->cert_md_len) &&
+          ASN1_TIME_diff(&days, &secs, NULL, X509_get_notAfter(cert))) {
+         srv->cert_checked_until = time(NULL) +
+            MIN(days * 86400L + secs, CERT_CHECK_CACHE_TIME);
+      } else {
+         srv->cert_md_len = 0;
+      }
+      X509_free(cert);
+   }
+}
+
+/*
+ * Forget the last certificate check, so that the next connection checks it
+ * in full. For when something went wrong with the server.
+ */
+static void Tls_cert_check_forget(Server_t *srv)
+{
+   if (srv) {
+      srv->cert_md_len = 0;
+      srv->cert_checked_until = 0;
+   }
+}
+
 /*
  * If the connection was closed before we got the certificate, we need to
  * reset state so that we'll try again.
@@ -1056,6 +1243,29 @@ static void Tls_close_by_key(int connkey)
    }
 }
 
+/*
+ * Account for a completed handshake
+ */
+static void Tls_count_handshake(Conn_t *conn)
+{
+   struct timeval now;
+   double ms;
+
+   gettimeofday(&now, NULL);
+   ms = (now.tv_sec - conn->start.tv_sec) * 1000.0 +
+        (now.tv_usec - conn->start.tv_usec) / 1000.0;
+   if (SSL_session_reused(conn->ssl)) {
+      resumed_handshakes++;
+      resumed_handshakes_ms += ms;
+   } else {
+      full_handshakes++;
+      full_handshakes_ms += ms;
+   }
+   _MSG("TLS: %s handshake with %s in %.1f ms\n",
+        SSL_session_reused(conn->ssl) ? "resumed" : "full",
+        URL_AUTHORITY(conn->url), ms);
+}
+
 /*
  * Connect, set a callback if it's still not completed. If completed, check
  * the certificate and report back to http.
@@ -1123,19 +1333,27 @@ static void Tls_connect(int fd, int connkey)
       Server_t *srv = dList_find_sorted(servers, conn->url,
                                         Tls_servers_by_url_cmp);
 
+      Tls_count_handshake(conn);
       if (srv->cert_status == CERT_STATUS_RECEIVING) {
          /* Making first connection with the server. Show cipher used. */
          SSL *ssl = conn->ssl;
          const char *version = SSL_get_version(ssl);
          const SSL_CIPHER *cipher = SSL_get_current_cipher(ssl);
 
-         MSG("%s: %s, cipher %s\n", URL_AUTHORITY(conn->url), version,
-             SSL_CIPHER_get_name(cipher));
+         MSG("%s: %s, cipher %s%s\n", URL_AUTHORITY(conn->url), version,
+             SSL_CIPHER_get_name(cipher),
+             SSL_session_reused(ssl) ? " (resumed session)" : "");
       }
 
       if (srv->cert_status == CERT_STATUS_USER_ACCEPTED ||
-          (Tls_examine_certificate(conn->ssl, srv) != -1)) {
+          Tls_cert_check_cached(conn->ssl, srv)) {
+         failed = FALSE;
+      } else if (Tls_examine_certificate(conn->ssl, srv) != -1) {
          failed = FALSE;
+         if (srv->cert_status == CERT_STATUS_CLEAN)
+            Tls_cert_check_cache(conn->ssl, srv);
+         else
+            Tls_cert_check_forget(srv);
       }
    }
 
@@ -1148,6 +1366,14 @@ static void Tls_connect(int fd, int connkey)
       if (a_Klist_get_data(conn_list, connkey)) {
          conn->connecting = FALSE;
          if (failed) {
+            /* Don't offer its session again, nor trust the last check */
+            Server_t *srv = dList_find_sorted(servers, conn->url,
+                                              Tls_servers_by_url_cmp);
+            if (srv && srv->session) {
+               SSL_SESSION_free(srv->session);
+               srv->session = NULL;
+            }
+            Tls_cert_check_forget(srv);
             Tls_close_by_key(connkey);
          }
          a_IOwatch_remove_fd(fd, DIO_READ|DIO_WRITE);
@@ -1165,8 +1391,9 @@ static void Tls_connect_cb(int fd, void *vconnkey)
 
 /*
  * Perform the TLS handshake on an open socket.
+ * 'http2' offers HTTP/2 to the server, see a_Tls_alpn_h2().
  */
-void a_Tls_handshake(int fd, const DilloUrl *url)
+void a_Tls_handshake(int fd, const DilloUrl *url, bool_t http2)
 {
    SSL *ssl;
    bool_t success = TRUE;
@@ -1198,8 +1425,14 @@ void a_Tls_handshake(int fd, const DilloUrl *url)
       success = FALSE;
    }
 
-   if (success)
+   if (success) {
+      Server_t *srv = dList_find_sorted(servers, url, Tls_servers_by_url_cmp);
+
+      /* Try to resume the last session with this server */
+      if (srv && srv->session && !Tls_session_expired(srv->session))
+         SSL_set_session(ssl, srv->session);
       connkey = Tls_conn_new(fd, url, ssl);
+   }
 
 #ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
    /* Server Name Indication. From the openssl changelog, it looks like this
@@ -1209,7 +1442,16 @@ void a_Tls_handshake(int fd, const DilloUrl *url)
       SSL_set_tlsext_host_name(ssl, URL_HOST(url));
 #endif
 
+#ifdef TLSEXT_TYPE_application_layer_protocol_negotiation
+   /* ALPN: the server picks the protocol from our list, in its order */
+   if (success && http2)
+      SSL_set_alpn_protos(ssl, (const uchar_t *)"\x02h2\x08http/1.1", 12);
+#endif
+
    if (!success) {
+      if (servers)
+         Tls_cert_check_forget(dList_find_sorted(servers, url,
+                                                 Tls_servers_by_url_cmp));
       a_Tls_reset_server_state(url);
       a_Http_connect_done(fd, success);
    } else {
@@ -1217,6 +1459,25 @@ void a_Tls_handshake(int fd, const DilloUrl *url)
    }
 }
 
+/*
+ * Did the server choose HTTP/2 in the handshake?
+ */
+bool_t a_Tls_alpn_h2(int fd)
+{
+   bool_t ret = FALSE;
+#ifdef TLSEXT_TYPE_application_layer_protocol_negotiation
+   Conn_t *conn = a_Tls_connection(fd);
+   const uchar_t *proto;
+   uint_t len;
+
+   if (conn) {
+      SSL_get0_alpn_selected(conn->ssl, &proto, &len);
+      ret = (len == 2 && !memcmp(proto, "h2", 2));
+   }
+#endif
+   return ret;
+}
+
 /*
  * Read data from an open TLS connection.
  */
@@ -1253,6 +1514,8 @@ static void Tls_servers_freeall()
 
       for (i = 0; i < n; i++) {
          s = (Server_t *) dList_nth_data(servers, i);
+         if (s->session)
+            SSL_SESSION_free(s->session);
          dFree(s->hostname);
          dFree(s);
       }
@@ -1279,6 +1542,15 @@ static void Tls_fd_map_remove_all()
  */
 void a_Tls_freeall(void)
 {
+   if (full_handshakes + resumed_handshakes > 0)
+      MSG("TLS: %u full handshakes (%.0f ms average), "
+          "%u resumed (%.0f ms average)\n",
+          full_handshakes,
+          full_handshakes ? full_handshakes_ms / full_handshakes : 0.0,
+          resumed_handshakes,
+          resumed_handshakes ? resumed_handshakes_ms/resumed_handshakes : 0.0);
+   if (ssl_context && prefs.tls_save_sessions)
+      Tls_sessions_save();
    if (ssl_context)
       SSL_CTX_free(ssl_context);
    Tls_fd_map_remove_all();
@@ -20,7 +20,8 @@ int a_Tls_connect_ready(const DilloUrl *url);
 void a_Tls_reset_server_state(const DilloUrl *url);
 
 /* Use to initiate a TLS connection. */
-void a_Tls_handshake(int fd, const DilloUrl *url);
+void a_Tls_handshake(int fd, const DilloUrl *url, bool_t http2);
+bool_t a_Tls_alpn_h2(int fd);
 
 void *a_Tls_connection(int fd);
 
@@ -34,7 +35,8 @@ int a_Tls_write(void *conn, void *buf, size_t len);
 #define a_Tls_certificate_is_clean(host) 0
 #define a_Tls_connect_ready(url) TLS_CONNECT_NEVER
 #define a_Tls_reset_server_state(url) ;
-#define a_Tls_handshake(fd, url) ;
+#define a_Tls_handshake(fd, url, http2) ;
+#define a_Tls_alpn_h2(fd) FALSE
 #define a_Tls_connection(fd) NULL
 #define a_Tls_freeall() ;
 #define a_Tls_close_by_fd(fd) ;
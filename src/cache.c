@@ -18,6 +18,7 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "msg.h"
 #include "IO/Url.h"
@@ -27,6 +28,9 @@
 #include "nav.h"
 #include "cookies.h"
 #include "hsts.h"
+#include "dns.h"
+#include "diskcache.h"
+#include "cachebody.h"
 #include "misc.h"
 #include "capi.h"
 #include "decode.h"
@@ -35,8 +39,6 @@
 #include "timeout.hh"
 #include "uicmd.hh"
 
-/* Maximum initial size for the automatically-growing data buffer */
-#define MAX_INIT_BUF  1024*1024
 /* Maximum filesize for a URL, before offering a download */
 #define HUGE_FILESIZE 15*1024*1024
 
@@ -44,8 +46,13 @@
  *  Local data types
  */
 
-typedef struct {
+typedef struct CacheEntry CacheEntry_t;
+
+struct CacheEntry {
    const DilloUrl *Url;      /* Cached Url. Url is used as a primary Key */
+   uint_t Hash;              /* a_Url_hash(Url) */
+   CacheEntry_t *Next;       /* Next entry in the same CachedURLs bucket */
+   Dlist *Clients;           /* The clients that this entry feeds */
    char *TypeDet;            /* MIME type string (detected from data) */
    char *TypeHdr;            /* MIME type string as from the HTTP Header */
    char *TypeMeta;           /* MIME type string from META HTTP-EQUIV */
@@ -53,25 +60,48 @@ typedef struct {
    Dstr *Header;             /* HTTP header */
    const DilloUrl *Location; /* New URI for redirects */
    Dlist *Auth;              /* Authentication fields */
-   Dstr *Data;               /* Pointer to raw data */
-   Dstr *UTF8Data;           /* Data after charset translation */
-   int DataRefcount;         /* Reference count */
+   CacheBody *Data;          /* Pointer to raw data */
+   Dstr *UTF8Data;           /* Window of the data after charset
+                              * translation (see Cache_view_update) */
+   int UTF8Start;            /* Offset of UTF8Data in the translation */
+   int UTF8Done;             /* Bytes of Data translated so far */
+   int DataRefcount;         /* Users of the whole buffer (a_Cache_get_buf) */
    DecodeTransfer *TransferDecoder;  /* Transfer decoder (e.g., chunked) */
    Decode *ContentDecoder;   /* Data decoder (e.g., gzip) */
    Decode *CharsetDecoder;   /* Translates text to UTF-8 encoding */
    int ExpectedSize;         /* Goal size of the HTTP transfer (0 if unknown)*/
    int TransferSize;         /* Actual length of the HTTP transfer */
+   time_t ResponseTime;      /* When the header was received */
+   long Age;                 /* Age of the response when received */
+   long Lifetime;            /* Freshness lifetime (-1 if the response
+                              * doesn't tell) */
+   char *ETag;               /* Validators */
+   char *LastModified;
+   Dstr *StoredBody;         /* Body of a 304 reply, from the disk cache */
+   CacheBody *Encoded;       /* The body as it came, when kept compressed
+                              * (prefs.memory_cache_compressed) */
+   char *Encoding;           /* Its Content-Encoding */
+   Decode *Inflater;         /* Inflates Encoded into Data again */
+   int EncodedDone;          /* Bytes of Encoded inflated so far */
+   int InflatedSize;         /* Size of the whole Data */
+   long Size;                /* Bytes counted in CacheMem.bytes */
+   uint_t LastUse;           /* CacheMem.clock when last used */
    uint_t Flags;             /* See Flag Defines in cache.h */
-} CacheEntry_t;
+};
 
 
 /*
  *  Local data
  */
-/* A sorted list for cached data. Holds pointers to CacheEntry_t structs */
-static Dlist *CachedURLs;
-
-/* A list for cache clients.
+/* A hash table for cached data, keyed by URL. Its buckets chain
+ * CacheEntry_t structs, and it doubles when it gets full */
+static struct {
+   CacheEntry_t **Buckets;
+   int Size;                 /* number of buckets (a power of two) */
+   int Len;                  /* number of entries */
+} CachedURLs;
+
+/* A list for cache clients, sorted by Key (each entry has its own too).
  * Although implemented as a list, we'll call it ClientQueue  --Jcid */
 static Dlist *ClientQueue;
 
@@ -80,6 +110,42 @@ static Dlist *ClientQueue;
 static Dlist *DelayedQueue;
 static uint_t DelayedQueueIdleId = 0;
 
+/* Stale responses set aside while they are revalidated: their header
+ * (as the disk tier stores it) and body, for a 304 reply to reuse */
+typedef struct {
+   DilloUrl *Url;
+   char *Header;
+   Dstr *Body;
+} CacheStale_t;
+
+static Dlist *StaleURLs;
+
+/* How well transfers are saved (see "about:cache") */
+static struct {
+   int disk_fresh;      /* responses loaded from disk, without a connection */
+   int stale;           /* stale responses in memory sent to revalidation */
+   int revalidated;     /* 304 replies completed with a stored body */
+} CacheUse;
+
+/* What the entries hold in memory (Header, Data and UTF8Data, except the
+ * shared bodies, which a_Cachebody_shared_stats counts once), and how the
+ * memory budget (prefs.memory_cache_size) is doing */
+static struct {
+   long bytes, max_bytes;
+   uint_t clock;        /* ticks on every use of an entry, for LRU order */
+   int hits, misses;    /* requests served from memory or not */
+   int evictions;       /* entries dropped for the budget */
+   int demotions;       /* of those, the ones handed to the disk tier */
+} CacheMem;
+
+/* The entries kept compressed whose Data is whole, as the most recently
+ * used of them stay so (see Cache_bodies_pack) */
+static struct {
+   Dlist *inflated;
+   int packs;           /* bodies dropped for the compressed ones */
+   int inflations;      /* bodies inflated again */
+} CacheZip;
+
 
 /*
  *  Forward declarations
@@ -88,27 +154,10 @@ static CacheEntry_t *Cache_process_queue(CacheEntry_t *entry);
 static void Cache_delayed_process_queue(CacheEntry_t *entry);
 static void Cache_auth_entry(CacheEntry_t *entry, BrowserWindow *bw);
 static void Cache_entry_inject(const DilloUrl *Url, Dstr *data_ds);
-
-/*
- * Determine if two cache entries are equal (used by CachedURLs)
- */
-static int Cache_entry_cmp(const void *v1, const void *v2)
-{
-   const CacheEntry_t *d1 = v1, *d2 = v2;
-
-   return a_Url_cmp(d1->Url, d2->Url);
-}
-
-/*
- * Determine if two cache entries are equal, using a URL as key.
- */
-static int Cache_entry_by_url_cmp(const void *v1, const void *v2)
-{
-   const DilloUrl *u1 = ((CacheEntry_t*)v1)->Url;
-   const DilloUrl *u2 = v2;
-
-   return a_Url_cmp(u1, u2);
-}
+static char *Cache_parse_field(const char *header, const char *fieldname);
+static CacheEntry_t *Cache_entry_search(const DilloUrl *Url);
+static void Cache_view_trim(CacheEntry_t *entry);
+static bool_t Cache_body_inflate(CacheEntry_t *entry, int step);
 
 /*
  * Initialize cache data
@@ -117,7 +166,12 @@ void a_Cache_init(void)
 {
    ClientQueue = dList_new(32);
    DelayedQueue = dList_new(32);
-   CachedURLs = dList_new(256);
+   CachedURLs.Size = 256;
+   CachedURLs.Buckets = dNew0(CacheEntry_t *, CachedURLs.Size);
+   CachedURLs.Len = 0;
+   StaleURLs = dList_new(8);
+   CacheZip.inflated = dList_new(8);
+   a_Diskcache_init();
 
    /* inject the splash screen in the cache */
    {
@@ -132,11 +186,19 @@ void a_Cache_init(void)
 /* Client operations ------------------------------------------------------ */
 
 /*
- * Add a client to ClientQueue.
+ * Compare function for keeping ClientQueue sorted by key
+ */
+static int Cache_client_cmp(const void *client1, const void *client2)
+{
+   return ((CacheClient_t *)client1)->Key - ((CacheClient_t *)client2)->Key;
+}
+
+/*
+ * Add a client to ClientQueue, and to the clients of 'entry'.
  *  - Every client-field is just a reference (except 'Web').
  *  - Return a unique number for identifying the client.
  */
-static int Cache_client_enqueue(const DilloUrl *Url, DilloWeb *Web,
+static int Cache_client_enqueue(CacheEntry_t *entry, DilloWeb *Web,
                                  CA_Callback_t Callback, void *CbData)
 {
    static int ClientKey = 0; /* Provide a primary key for each client */
@@ -149,15 +211,18 @@ static int Cache_client_enqueue(const DilloUrl *Url, DilloWeb *Web,
 
    NewClient = dNew(CacheClient_t, 1);
    NewClient->Key = ClientKey;
-   NewClient->Url = Url;
+   NewClient->Url = entry->Url;
    NewClient->Version = 0;
    NewClient->Buf = NULL;
    NewClient->BufSize = 0;
+   NewClient->BufStart = 0;
+   NewClient->BufParsed = 0;
    NewClient->Callback = Callback;
    NewClient->CbData = CbData;
    NewClient->Web    = Web;
 
-   dList_append(ClientQueue, NewClient);
+   dList_insert_sorted(ClientQueue, NewClient, Cache_client_cmp);
+   dList_append(entry->Clients, NewClient);
 
    return ClientKey;
 }
@@ -170,12 +235,27 @@ static int Cache_client_by_key_cmp(const void *client, const void *key)
    return ((CacheClient_t *)client)->Key - VOIDP2INT(key);
 }
 
+/*
+ * Find a client by its key
+ */
+static CacheClient_t *Cache_client_search(int Key)
+{
+   return dList_find_sorted(ClientQueue, INT2VOIDP(Key),
+                            Cache_client_by_key_cmp);
+}
+
 /*
  * Remove a client from the queue
  */
 static void Cache_client_dequeue(CacheClient_t *Client)
 {
+   CacheEntry_t *entry;
+
    if (Client) {
+      if ((entry = Cache_entry_search(Client->Url))) {
+         dList_remove(entry->Clients, Client);
+         Cache_view_trim(entry);
+      }
       dList_remove(ClientQueue, Client);
       a_Web_free(Client->Web);
       dFree(Client);
@@ -191,6 +271,9 @@ static void Cache_client_dequeue(CacheClient_t *Client)
 static void Cache_entry_init(CacheEntry_t *NewEntry, const DilloUrl *Url)
 {
    NewEntry->Url = a_Url_dup(Url);
+   NewEntry->Hash = a_Url_hash(Url);
+   NewEntry->Next = NULL;
+   NewEntry->Clients = dList_new(4);
    NewEntry->TypeDet = NULL;
    NewEntry->TypeHdr = NULL;
    NewEntry->TypeMeta = NULL;
@@ -198,14 +281,27 @@ static void Cache_entry_init(CacheEntry_t *NewEntry, const DilloUrl *Url)
    NewEntry->Header = dStr_new("");
    NewEntry->Location = NULL;
    NewEntry->Auth = NULL;
-   NewEntry->Data = dStr_sized_new(8*1024);
+   NewEntry->Data = a_Cachebody_new(8*1024);
    NewEntry->UTF8Data = NULL;
+   NewEntry->UTF8Start = NewEntry->UTF8Done = 0;
    NewEntry->DataRefcount = 0;
    NewEntry->TransferDecoder = NULL;
    NewEntry->ContentDecoder = NULL;
    NewEntry->CharsetDecoder = NULL;
    NewEntry->ExpectedSize = 0;
    NewEntry->TransferSize = 0;
+   NewEntry->ResponseTime = 0;
+   NewEntry->Age = 0;
+   NewEntry->Lifetime = -1;
+   NewEntry->ETag = NULL;
+   NewEntry->LastModified = NULL;
+   NewEntry->StoredBody = NULL;
+   NewEntry->Encoded = NULL;
+   NewEntry->Encoding = NULL;
+   NewEntry->Inflater = NULL;
+   NewEntry->EncodedDone = NewEntry->InflatedSize = 0;
+   NewEntry->Size = 0;
+   NewEntry->LastUse = ++CacheMem.clock;
    NewEntry->Flags = CA_IsEmpty | CA_KeepAlive;
 }
 
@@ -215,7 +311,59 @@ static void Cache_entry_init(CacheEntry_t *NewEntry, const DilloUrl *Url)
  */
 static CacheEntry_t *Cache_entry_search(const DilloUrl *Url)
 {
-   return dList_find_sorted(CachedURLs, Url, Cache_entry_by_url_cmp);
+   uint_t h = a_Url_hash(Url);
+   CacheEntry_t *entry;
+
+   for (entry = CachedURLs.Buckets[h & (CachedURLs.Size - 1)]; entry;
+        entry = entry->Next) {
+      if (entry->Hash == h && !a_Url_cmp(entry->Url, Url))
+         break;
+   }
+   return entry;
+}
+
+/*
+ * Add an entry to CachedURLs, doubling the table when it's full
+ */
+static void Cache_table_insert(CacheEntry_t *entry)
+{
+   CacheEntry_t **buckets, *e, *next;
+   int i, size;
+
+   if (CachedURLs.Len >= CachedURLs.Size) {
+      size = CachedURLs.Size * 2;
+      buckets = dNew0(CacheEntry_t *, size);
+      for (i = 0; i < CachedURLs.Size; i++) {
+         for (e = CachedURLs.Buckets[i]; e; e = next) {
+            next = e->Next;
+            e->Next = buckets[e->Hash & (size - 1)];
+            buckets[e->Hash & (size - 1)] = e;
+         }
+      }
+      dFree(CachedURLs.Buckets);
+      CachedURLs.Buckets = buckets;
+      CachedURLs.Size = size;
+   }
+   i = entry->Hash & (CachedURLs.Size - 1);
+   entry->Next = CachedURLs.Buckets[i];
+   CachedURLs.Buckets[i] = entry;
+   CachedURLs.Len++;
+}
+
+/*
+ * Unlink an entry from CachedURLs
+ */
+static void Cache_table_remove(CacheEntry_t *entry)
+{
+   CacheEntry_t **p = &CachedURLs.Buckets[entry->Hash & (CachedURLs.Size-1)];
+
+   for ( ; *p; p = &(*p)->Next) {
+      if (*p == entry) {
+         *p = entry->Next;
+         CachedURLs.Len--;
+         break;
+      }
+   }
 }
 
 /*
@@ -242,6 +390,33 @@ static CacheEntry_t *Cache_entry_search_with_redirect(const DilloUrl *Url)
    return entry;
 }
 
+/*
+ * Bytes that the entries hold in memory, shared bodies included
+ */
+static long Cache_memory_bytes(void)
+{
+   long shared, saved;
+   int bodies;
+
+   a_Cachebody_shared_stats(&bodies, &shared, &saved);
+   return CacheMem.bytes + shared;
+}
+
+/*
+ * Update the bytes that 'entry' counts against the memory budget.
+ */
+static void Cache_entry_account(CacheEntry_t *entry)
+{
+   long size = entry->Header->len +
+               (entry->Data->refs ? 0 : entry->Data->len) +
+               (entry->Encoded ? entry->Encoded->len : 0) +
+               (entry->UTF8Data ? entry->UTF8Data->sz : 0);
+
+   CacheMem.bytes += size - entry->Size;
+   CacheMem.max_bytes = MAX(CacheMem.max_bytes, Cache_memory_bytes());
+   entry->Size = size;
+}
+
 /*
  * Allocate and set a new entry in the cache list
  */
@@ -251,18 +426,18 @@ static CacheEntry_t *Cache_entry_add(const DilloUrl *Url)
 
    if ((old_entry = Cache_entry_search(Url))) {
       MSG_WARN("Cache_entry_add, leaking an entry.\n");
-      dList_remove(CachedURLs, old_entry);
+      Cache_table_remove(old_entry);
    }
 
    new_entry = dNew(CacheEntry_t, 1);
    Cache_entry_init(new_entry, Url);  /* Set safe values */
-   dList_insert_sorted(CachedURLs, new_entry, Cache_entry_cmp);
+   Cache_table_insert(new_entry);
    return new_entry;
 }
 
 /*
  * Inject full page content directly into the cache.
- * Used for "about:splash". May be used for "about:cache" too.
+ * Used for "about:splash", "about:dns" and "about:cache".
  */
 static void Cache_entry_inject(const DilloUrl *Url, Dstr *data_ds)
 {
@@ -273,10 +448,11 @@ static void Cache_entry_inject(const DilloUrl *Url, Dstr *data_ds)
    entry->Flags |= CA_GotData + CA_GotHeader + CA_GotLength + CA_InternalUrl;
    if (data_ds->len)
       entry->Flags &= ~CA_IsEmpty;
-   dStr_truncate(entry->Data, 0);
-   dStr_append_l(entry->Data, data_ds->str, data_ds->len);
-   dStr_fit(entry->Data);
+   a_Cachebody_truncate(entry->Data, 0);
+   a_Cachebody_append(entry->Data, data_ds->str, data_ds->len);
+   a_Cachebody_fit(entry->Data);
    entry->ExpectedSize = entry->TransferSize = entry->Data->len;
+   Cache_entry_account(entry);
 }
 
 /*
@@ -296,7 +472,9 @@ static void Cache_auth_free(Dlist *auth)
  */
 static void Cache_entry_free(CacheEntry_t *entry)
 {
+   CacheMem.bytes -= entry->Size;
    a_Url_free((DilloUrl *)entry->Url);
+   dList_free(entry->Clients);
    dFree(entry->TypeDet);
    dFree(entry->TypeHdr);
    dFree(entry->TypeMeta);
@@ -304,8 +482,16 @@ static void Cache_entry_free(CacheEntry_t *entry)
    dStr_free(entry->Header, TRUE);
    a_Url_free((DilloUrl *)entry->Location);
    Cache_auth_free(entry->Auth);
-   dStr_free(entry->Data, 1);
+   a_Cachebody_free(entry->Data);
    dStr_free(entry->UTF8Data, 1);
+   dFree(entry->ETag);
+   dFree(entry->LastModified);
+   dStr_free(entry->StoredBody, 1);
+   dList_remove(CacheZip.inflated, entry);
+   a_Cachebody_free(entry->Encoded);
+   dFree(entry->Encoding);
+   if (entry->Inflater)
+      a_Decode_free(entry->Inflater);
    if (entry->CharsetDecoder)
       a_Decode_free(entry->CharsetDecoder);
    if (entry->TransferDecoder)
@@ -315,6 +501,14 @@ static void Cache_entry_free(CacheEntry_t *entry)
    dFree(entry);
 }
 
+/*
+ * Is any client waiting on, or being fed by, this entry?
+ */
+static bool_t Cache_entry_has_clients(CacheEntry_t *entry)
+{
+   return dList_length(entry->Clients) > 0;
+}
+
 /*
  * Remove an entry, from the cache.
  * All the entry clients are removed too! (it may stop rendering of this
@@ -322,7 +516,6 @@ static void Cache_entry_free(CacheEntry_t *entry)
  */
 static void Cache_entry_remove(CacheEntry_t *entry, DilloUrl *url)
 {
-   int i;
    CacheClient_t *Client;
 
    if (!entry && !(entry = Cache_entry_search(url)))
@@ -331,12 +524,8 @@ static void Cache_entry_remove(CacheEntry_t *entry, DilloUrl *url)
       return;
 
    /* remove all clients for this entry */
-   for (i = 0; (Client = dList_nth_data(ClientQueue, i)); ++i) {
-      if (Client->Url == entry->Url) {
-         a_Cache_stop_client(Client->Key);
-         --i;
-      }
-   }
+   while ((Client = dList_nth_data(entry->Clients, 0)))
+      a_Cache_stop_client(Client->Key);
 
    /* remove from DelayedQueue */
    dList_remove(DelayedQueue, entry);
@@ -345,7 +534,7 @@ static void Cache_entry_remove(CacheEntry_t *entry, DilloUrl *url)
    a_Dicache_invalidate_entry(entry->Url);
 
    /* remove from cache */
-   dList_remove(CachedURLs, entry);
+   Cache_table_remove(entry);
    Cache_entry_free(entry);
 }
 
@@ -357,6 +546,688 @@ void a_Cache_entry_remove_by_url(DilloUrl *url)
    Cache_entry_remove(NULL, url);
 }
 
+/* Freshness and the disk tier -------------------------------------------- */
+
+/*
+ * Header fields that aren't stored: they describe the transfer rather
+ * than the resource, or must not be replayed.
+ */
+static const char *const Cache_unstored_fields[] = {
+   "Connection", "Keep-Alive", "Transfer-Encoding", "Content-Encoding",
+   "Content-Length", "Set-Cookie", "Set-Cookie2", "Strict-Transport-Security",
+   NULL
+};
+
+/*
+ * Header fields of a 304 reply that don't update the stored header
+ * (the reply has no body, so they don't describe the stored one).
+ */
+static const char *const Cache_304_ignored_fields[] = {
+   "Content-Length", "Content-Type", "Content-Encoding", "Transfer-Encoding",
+   NULL
+};
+
+/*
+ * Are responses for 'url' kept beyond their transfer? Only GETs over
+ * HTTP(S) are.
+ */
+static bool_t Cache_storable_url(const DilloUrl *url)
+{
+   return !(URL_FLAGS(url) & URL_Post) &&
+          (!dStrAsciiCasecmp(URL_SCHEME(url), "http") ||
+           !dStrAsciiCasecmp(URL_SCHEME(url), "https"));
+}
+
+/*
+ * Return the disk cache key for 'url', or NULL if its responses aren't
+ * stored.
+ */
+static char *Cache_disk_key(const DilloUrl *url)
+{
+   if (!a_Diskcache_enabled() || !Cache_storable_url(url))
+      return NULL;
+   return dStrconcat(URL_SCHEME(url), "://", URL_AUTHORITY(url),
+                     URL_PATH_(url) ? URL_PATH(url) : "/",
+                     URL_QUERY_(url) ? "?" : "", URL_QUERY(url), NULL);
+}
+
+/*
+ * Is 'line' a header field named in 'names'?
+ */
+static bool_t Cache_field_in(const char *line, const char *const names[])
+{
+   size_t n;
+   int i;
+
+   for (i = 0; names[i]; i++) {
+      n = strlen(names[i]);
+      if (!dStrnAsciiCasecmp(line, names[i], n) && line[n] == ':')
+         return TRUE;
+   }
+   return FALSE;
+}
+
+/*
+ * Append the fields of 'header' (not the status line, nor the final empty
+ * line) to 'ds', but those in 'skip' and those that 'other' has too
+ * (either may be NULL).
+ */
+static void Cache_copy_fields(Dstr *ds, const char *header,
+                              const char *const skip[], const char *other)
+{
+   const char *line = strchr(header, '\n'), *end;
+   char *name, *field;
+
+   for ( ; line && *++line && *line != '\n'; line = end) {
+      if (!(end = strchr(line, '\n')))
+         break;
+      if (skip && Cache_field_in(line, skip))
+         continue;
+      if (other) {
+         name = dStrndup(line, strcspn(line, ":\n"));
+         field = Cache_parse_field(other, name);
+         dFree(name);
+         if (field) {
+            dFree(field);
+            continue;
+         }
+      }
+      dStr_append_l(ds, line, end - line + 1);
+   }
+}
+
+/*
+ * Look for 'directive' in a Cache-Control field value. If found, return
+ * TRUE and set 'value' to its numeric argument (-1 if there's none).
+ */
+static bool_t Cache_control_directive(const char *cc, const char *directive,
+                                      long *value)
+{
+   size_t n = strlen(directive);
+   const char *p;
+
+   for (p = cc; p && *p; p = strchr(p, ',')) {
+      p += strspn(p, ", \t");
+      if (!dStrnAsciiCasecmp(p, directive, n) &&
+          (!p[n] || strchr("=, \t", p[n]))) {
+         if (value) {
+            p += n;
+            *value = (*p == '=') ? strtol(p + 1 + (p[1] == '"'), NULL, 10)
+                                 : -1;
+         }
+         return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+/*
+ * How long (in seconds) a response stays fresh (RFC 7234, 4.2.1):
+ * max-age, else Expires, else a tenth of the time since Last-Modified,
+ * up to a day. Return -1 if the header doesn't tell.
+ */
+static long Cache_freshness_lifetime(const char *header)
+{
+   char *cc = Cache_parse_field(header, "Cache-Control"),
+        *str = Cache_parse_field(header, "Date");
+   time_t date = a_Misc_parse_http_date(str), expires, modified;
+   long lifetime = -1, max_age;
+
+   dFree(str);
+   if (cc && (Cache_control_directive(cc, "no-cache", NULL) ||
+              Cache_control_directive(cc, "no-store", NULL))) {
+      lifetime = 0;
+   } else if (cc && Cache_control_directive(cc, "max-age", &max_age) &&
+              max_age >= 0) {
+      lifetime = max_age;
+   } else if ((str = Cache_parse_field(header, "Expires"))) {
+      /* an invalid date means the response has already expired */
+      expires = a_Misc_parse_http_date(str);
+      lifetime = (expires != -1 && date != -1) ? MAX(expires - date, 0) : 0;
+      dFree(str);
+   } else if ((str = Cache_parse_field(header, "Last-Modified"))) {
+      modified = a_Misc_parse_http_date(str);
+      if (modified != -1 && date != -1 && date > modified)
+         lifetime = MIN((date - modified) / 10, 24 * 60 * 60);
+      dFree(str);
+   }
+   dFree(cc);
+   return lifetime;
+}
+
+/*
+ * Is a response received at 'response_time' still fresh?
+ */
+static bool_t Cache_is_fresh(const char *header, time_t response_time)
+{
+   char *str = Cache_parse_field(header, "Age");
+   long age = str ? MAX(strtol(str, NULL, 10), 0) : 0;
+
+   dFree(str);
+   age += time(NULL) - response_time;
+   return age < Cache_freshness_lifetime(header);
+}
+
+/*
+ * Make the header that a stored response gets: without the fields about
+ * the transfer, and telling the size of the (decoded) body.
+ */
+static Dstr *Cache_stored_header(CacheEntry_t *entry)
+{
+   const char *header = entry->Header->str;
+   Dstr *ds = dStr_sized_new(entry->Header->len);
+
+   dStr_append_l(ds, header, strcspn(header, "\n") + 1);
+   Cache_copy_fields(ds, header, Cache_unstored_fields, NULL);
+   dStr_sprintfa(ds, "Content-Length: %d\n\n", entry->Data->len);
+   return ds;
+}
+
+/*
+ * May the disk tier keep this response? It must be complete, and not
+ * say otherwise.
+ */
+static bool_t Cache_disk_storable(CacheEntry_t *entry)
+{
+   const char *header = entry->Header->str;
+   char *cc, *vary;
+   bool_t store;
+
+   if (!a_Diskcache_enabled() || !Cache_storable_url(entry->Url) ||
+       (entry->Flags & (CA_FromDisk | CA_InternalUrl)) ||
+       entry->Header->len < 12 || strncmp(header + 9, "200", 3) ||
+       ((entry->Flags & CA_GotLength) &&
+        entry->ExpectedSize != entry->TransferSize) ||
+       (entry->TransferDecoder &&
+        !a_Decode_transfer_finished(entry->TransferDecoder)))
+      return FALSE;
+
+   cc = Cache_parse_field(header, "Cache-Control");
+   vary = Cache_parse_field(header, "Vary");
+   /* the body is decoded, so it doesn't vary with Accept-Encoding */
+   store = !(cc && Cache_control_directive(cc, "no-store", NULL)) &&
+           !(vary && dStrAsciiCasecmp(vary, "Accept-Encoding"));
+   dFree(vary);
+   dFree(cc);
+   return store;
+}
+
+/*
+ * Hand a response over to the disk tier, if it was marked for it when
+ * complete (CA_DiskStore). This is done as the entry leaves memory.
+ */
+static void Cache_disk_store(CacheEntry_t *entry)
+{
+   char *key;
+   Dstr *ds;
+
+   if ((entry->Flags & CA_DiskStore) && (key = Cache_disk_key(entry->Url))) {
+      Cache_body_inflate(entry, 0);
+      ds = Cache_stored_header(entry);
+      a_Diskcache_store(key, ds->str, entry->ResponseTime, entry->Data->str,
+                        entry->Data->len);
+      dStr_free(ds, 1);
+      dFree(key);
+   }
+   entry->Flags &= ~CA_DiskStore;
+}
+
+static int Cache_stale_by_url_cmp(const void *v1, const void *v2)
+{
+   return a_Url_cmp(((CacheStale_t *)v1)->Url, (const DilloUrl *)v2);
+}
+
+static int Cache_stale_cmp(const void *v1, const void *v2)
+{
+   return a_Url_cmp(((CacheStale_t *)v1)->Url, ((CacheStale_t *)v2)->Url);
+}
+
+static CacheStale_t *Cache_stale_search(const DilloUrl *url)
+{
+   return dList_find_sorted(StaleURLs, url, Cache_stale_by_url_cmp);
+}
+
+static void Cache_stale_free(CacheStale_t *stale)
+{
+   dList_remove(StaleURLs, stale);
+   a_Url_free(stale->Url);
+   dFree(stale->Header);
+   dStr_free(stale->Body, 1);
+   dFree(stale);
+}
+
+/*
+ * Forget the stale response for 'url', once its revalidation has an
+ * answer (or failed).
+ */
+static void Cache_stale_drop(const DilloUrl *url)
+{
+   CacheStale_t *stale = Cache_stale_search(url);
+
+   if (stale)
+      Cache_stale_free(stale);
+}
+
+/*
+ * Does a memory entry need revalidation before it's used again?
+ * Only complete 200 responses to GETs are revalidated, and those that
+ * tell neither a lifetime nor validators stay good for the session.
+ */
+static bool_t Cache_entry_is_stale(CacheEntry_t *entry)
+{
+   if (!(entry->Flags & CA_GotData) || (entry->Flags & CA_InternalUrl) ||
+       entry->DataRefcount > 0 || !Cache_storable_url(entry->Url) ||
+       entry->Header->len < 12 || strncmp(entry->Header->str + 9, "200", 3))
+      return FALSE;
+   if (entry->Lifetime < 0 && !entry->ETag && !entry->LastModified)
+      return FALSE;
+   if (entry->Age + (time(NULL) - entry->ResponseTime) <
+       MAX(entry->Lifetime, 0))
+      return FALSE;
+   return !Cache_entry_has_clients(entry);   /* unless still in use */
+}
+
+/*
+ * Set a stale memory entry aside, for the request that revalidates it.
+ */
+static void Cache_stale_add(CacheEntry_t *entry)
+{
+   CacheStale_t *stale;
+   Dstr *ds;
+
+   Cache_stale_drop(entry->Url);
+   Cache_body_inflate(entry, 0);
+   stale = dNew(CacheStale_t, 1);
+   stale->Url = a_Url_dup(entry->Url);
+   ds = Cache_stored_header(entry);
+   stale->Header = ds->str;
+   dStr_free(ds, 0);
+   stale->Body = dStr_sized_new(entry->Data->len + 1);
+   dStr_append_l(stale->Body, entry->Data->str, entry->Data->len);
+   dList_insert_sorted(StaleURLs, stale, Cache_stale_cmp);
+}
+
+/*
+ * A 304 (Not Modified) came for a response that we have set aside, or
+ * that the disk tier has: make the entry's header the stored one, updated
+ * with the fields of the 304, and keep the stored body for
+ * a_Cache_process_dbuf.
+ */
+static void Cache_not_modified(CacheEntry_t *entry)
+{
+   CacheStale_t *stale = Cache_stale_search(entry->Url);
+   char *key = NULL;
+   const char *stored = NULL, *header = entry->Header->str;
+   Dstr *body = NULL, *update, *ds;
+
+   if (stale) {
+      stored = stale->Header;
+      body = stale->Body;
+      stale->Body = NULL;
+   } else if ((key = Cache_disk_key(entry->Url)) &&
+              (body = a_Diskcache_body(key))) {
+      /* (the body goes first, as a lost body drops the entry) */
+      stored = a_Diskcache_header(key, NULL);
+   }
+   if (stored && body) {
+      /* the fields of the 304 that count, after an empty "status line" */
+      update = dStr_new("\n");
+      Cache_copy_fields(update, header, Cache_304_ignored_fields, NULL);
+      ds = dStr_sized_new(strlen(stored) + entry->Header->len);
+      /* the protocol version is the connection's, the status the stored */
+      dStr_append_l(ds, header, 8);
+      dStr_append_l(ds, stored + 8, strcspn(stored, "\n") - 7);
+      Cache_copy_fields(ds, stored, NULL, update->str);
+      dStr_append(ds, update->str + 1);
+      dStr_append_c(ds, '\n');
+      dStr_free(update, 1);
+      dStr_free(entry->Header, 1);
+      entry->Header = ds;
+      entry->StoredBody = body;
+      CacheUse.revalidated++;
+   } else {
+      dStr_free(body, 1);
+   }
+   dFree(key);
+}
+
+/*
+ * Bring a fresh response for 'url' from the disk tier into memory, so that
+ * it's served without a connection. A stale one stays on disk, to be
+ * revalidated (see a_Cache_validators).
+ */
+static void Cache_load_from_disk(const DilloUrl *url)
+{
+   char *key;
+   const char *header;
+   time_t response_time;
+   CacheEntry_t *entry;
+   Dstr *ds, *body;
+
+   if (!(key = Cache_disk_key(url)))
+      return;
+   if ((header = a_Diskcache_header(key, &response_time)) &&
+       Cache_is_fresh(header, response_time)) {
+      ds = dStr_new(header);
+      if ((body = a_Diskcache_body(key))) {
+         dStr_append_l(ds, body->str, body->len);
+         dStr_free(body, 1);
+         /* the stored response takes the way of one from the network */
+         entry = Cache_entry_add(url);
+         entry->Flags |= CA_FromDisk;
+         a_Cache_process_dbuf(IORead, ds->str, ds->len, url, NULL);
+         if (!(entry->Flags & CA_GotData))
+            a_Cache_process_dbuf(IOClose, NULL, 0, url, NULL);
+         entry->ResponseTime = response_time;
+         CacheUse.disk_fresh++;
+      }
+      dStr_free(ds, 1);
+   }
+   dFree(key);
+}
+
+/*
+ * Make sure that what the cache has for 'url' may be used without asking
+ * the server: bring a fresh response from the disk tier if there's none
+ * in memory, and set a stale one in memory aside (unless 'stale_ok', as
+ * for history navigation), so that the request revalidates it.
+ */
+void a_Cache_check_freshness(const DilloUrl *url, bool_t stale_ok)
+{
+   CacheEntry_t *entry = Cache_entry_search(url);
+
+   if (!entry) {
+      CacheMem.misses++;
+      Cache_load_from_disk(url);
+   } else if (!stale_ok && Cache_entry_is_stale(entry)) {
+      _MSG("Cache: revalidating %s\n", URL_STR(url));
+      Cache_stale_add(entry);
+      Cache_disk_store(entry);
+      Cache_entry_remove(entry, NULL);
+      CacheUse.stale++;
+      CacheMem.misses++;
+   } else if (!(entry->Flags & CA_InternalUrl)) {
+      CacheMem.hits++;
+   }
+}
+
+/*
+ * Return the header fields that make a request for 'url' conditional on
+ * the response that we have set aside, or that the disk tier has, being
+ * outdated. NULL if there's none.
+ */
+char *a_Cache_validators(const DilloUrl *url)
+{
+   CacheStale_t *stale = Cache_stale_search(url);
+   char *key = NULL, *etag, *modified, *ret = NULL;
+   const char *header = NULL;
+   Dstr *ds;
+
+   if (stale)
+      header = stale->Header;
+   else if ((key = Cache_disk_key(url)))
+      header = a_Diskcache_header(key, NULL);
+   if (header) {
+      ds = dStr_new("");
+      if ((etag = Cache_parse_field(header, "ETag")))
+         dStr_sprintfa(ds, "If-None-Match: %s\r\n", etag);
+      if ((modified = Cache_parse_field(header, "Last-Modified")))
+         dStr_sprintfa(ds, "If-Modified-Since: %s\r\n", modified);
+      dFree(etag);
+      dFree(modified);
+      if (ds->len)
+         ret = ds->str;
+      dStr_free(ds, ret == NULL);
+   }
+   dFree(key);
+   return ret;
+}
+
+/* Memory budget ---------------------------------------------------------- */
+
+/*
+ * May 'entry' leave memory? Only complete ones that nobody uses may.
+ */
+static bool_t Cache_entry_evictable(CacheEntry_t *entry)
+{
+   return (entry->Flags & CA_GotData) && !(entry->Flags & CA_InternalUrl) &&
+          entry->DataRefcount == 0 && !dList_find(DelayedQueue, entry) &&
+          !Cache_entry_has_clients(entry);
+}
+
+/*
+ * Share the whole Data of 'entry' with the entries that have the same
+ * (see a_Cachebody_share).
+ */
+static void Cache_body_share(CacheEntry_t *entry)
+{
+   /* (a_Cache_get_buf users hold on to the data they got) */
+   if (!(entry->Flags & CA_InternalUrl) && entry->DataRefcount == 0) {
+      entry->Data = a_Cachebody_share(entry->Data);
+      Cache_entry_account(entry);
+   }
+}
+
+/*
+ * Inflated bytes of the bodies kept compressed that may stay in memory
+ * too, for the ones most recently used
+ */
+#define CACHE_INFLATED_MAX  (4*1024*1024)
+
+/*
+ * Keep the compressed body that came for 'entry', if it's worth it,
+ * now that its Data is whole.
+ */
+static void Cache_body_keep_encoded(CacheEntry_t *entry)
+{
+   if (!entry->Encoded)
+      return;
+   if (entry->Encoded->len < entry->Data->len &&
+       !(entry->TransferDecoder &&
+         !a_Decode_transfer_finished(entry->TransferDecoder))) {
+      a_Cachebody_fit(entry->Encoded);
+      entry->InflatedSize = entry->Data->len;
+      entry->LastUse = ++CacheMem.clock;
+      dList_append(CacheZip.inflated, entry);
+   } else {
+      a_Cachebody_free(entry->Encoded);
+      entry->Encoded = NULL;
+      dFree(entry->Encoding);
+      entry->Encoding = NULL;
+   }
+   Cache_entry_account(entry);
+}
+
+/*
+ * Drop the Data of 'entry', which is kept compressed.
+ */
+static void Cache_body_pack(CacheEntry_t *entry)
+{
+   dList_remove(CacheZip.inflated, entry);
+   a_Cachebody_free(entry->Data);
+   entry->Data = a_Cachebody_new(0);
+   entry->Flags |= CA_Packed;
+   CacheZip.packs++;
+   Cache_entry_account(entry);
+}
+
+/*
+ * Inflate the next 'step' bytes (all of them if 0) of the compressed body
+ * of a packed entry back into its Data.
+ * Return whether there's more to inflate.
+ */
+static bool_t Cache_body_inflate(CacheEntry_t *entry, int step)
+{
+   Dstr *dstr;
+   int len;
+
+   if (!(entry->Flags & CA_Packed))
+      return FALSE;
+   if (!entry->Inflater) {
+      if (!(entry->Inflater = a_Decode_content_init(entry->Encoding))) {
+         MSG_ERR("Cache_body_inflate: can't decode '%s'\n", entry->Encoding);
+         entry->Flags &= ~CA_Packed;
+         return FALSE;
+      }
+      a_Cachebody_free(entry->Data);
+      entry->Data = a_Cachebody_new(entry->InflatedSize);
+      entry->EncodedDone = 0;
+      CacheZip.inflations++;
+   }
+   do {
+      len = entry->Encoded->len - entry->EncodedDone;
+      if (step > 0)
+         len = MIN(len, step);
+      dstr = a_Decode_process(entry->Inflater,
+                              entry->Encoded->str + entry->EncodedDone, len);
+      a_Cachebody_append(entry->Data, dstr->str, dstr->len);
+      dStr_free(dstr, 1);
+      entry->EncodedDone += len;
+   } while (step <= 0 && entry->EncodedDone < entry->Encoded->len);
+
+   if (entry->EncodedDone == entry->Encoded->len) {
+      a_Decode_free(entry->Inflater);
+      entry->Inflater = NULL;
+      entry->Flags &= ~CA_Packed;
+      a_Cachebody_fit(entry->Data);
+      Cache_body_share(entry);
+      entry->LastUse = ++CacheMem.clock;
+      dList_append(CacheZip.inflated, entry);
+   }
+   Cache_entry_account(entry);
+   return (entry->Flags & CA_Packed) != 0;
+}
+
+/*
+ * Drop the Data of the bodies kept compressed, least recently used first,
+ * until those left whole fit in CACHE_INFLATED_MAX. The ones in use stay.
+ */
+static void Cache_bodies_pack(void)
+{
+   CacheEntry_t *entry, *lru;
+   long bytes;
+   int i;
+
+   while (1) {
+      bytes = 0;
+      lru = NULL;
+      for (i = 0; (entry = dList_nth_data(CacheZip.inflated, i)); i++) {
+         bytes += entry->Data->len;
+         if (Cache_entry_evictable(entry) &&
+             (!lru || entry->LastUse < lru->LastUse))
+            lru = entry;
+      }
+      if (bytes <= CACHE_INFLATED_MAX || !lru)
+         break;
+      Cache_body_pack(lru);
+   }
+}
+
+/*
+ * Bring the memory held by the entries within prefs.memory_cache_size,
+ * dropping the least recently used ones that may go (but 'keep'). Those
+ * that the disk tier takes are handed over to it.
+ */
+static void Cache_make_room(CacheEntry_t *keep)
+{
+   long limit = prefs.memory_cache_size * 1024L * 1024L;
+   CacheEntry_t *entry, *lru;
+   int i;
+
+   /* dropping inflated bodies costs less than dropping entries */
+   Cache_bodies_pack();
+
+   while (limit > 0 && Cache_memory_bytes() > limit) {
+      lru = NULL;
+      for (i = 0; i < CachedURLs.Size; i++) {
+         for (entry = CachedURLs.Buckets[i]; entry; entry = entry->Next) {
+            if (entry != keep && (!lru || entry->LastUse < lru->LastUse) &&
+                Cache_entry_evictable(entry))
+               lru = entry;
+         }
+      }
+      if (!lru)
+         break;   /* everything is in use */
+      _MSG("Cache: evicting %s (%ld bytes)\n", URL_STR(lru->Url), lru->Size);
+      if (lru->Flags & CA_DiskStore) {
+         Cache_disk_store(lru);
+         CacheMem.demotions++;
+      }
+      Cache_entry_remove(lru, NULL);
+      CacheMem.evictions++;
+   }
+}
+
+/*
+ * Bytes that the entries hold in memory
+ */
+long a_Cache_memory_bytes(void)
+{
+   return Cache_memory_bytes();
+}
+
+/*
+ * Make the "about:cache" page
+ */
+static Dstr *Cache_stats_page(void)
+{
+   DiskcacheStats_t st;
+   int total = CacheMem.hits + CacheMem.misses, files, shared;
+   long mapped, shared_bytes, saved;
+   char budget[32];
+   Dstr *ds = dStr_new("");
+
+   a_Diskcache_stats(&st);
+   a_Cachebody_stats(&files, &mapped);
+   a_Cachebody_shared_stats(&shared, &shared_bytes, &saved);
+   if (prefs.memory_cache_size > 0)
+      snprintf(budget, sizeof(budget), "%d MB", prefs.memory_cache_size);
+   else
+      snprintf(budget, sizeof(budget), "none");
+   dStr_sprintfa(ds,
+      "<!DOCTYPE HTML PUBLIC '-//W3C//DTD HTML 4.01//EN'>\n"
+      "<html><head><title>Cache</title></head><body>\n"
+      "<h2>Cache</h2>\n<table border='1' cellpadding='3'>\n"
+      "<tr><td>URLs in memory<td>%d\n"
+      "<tr><td>Memory held<td>%ld KB (at most %ld KB so far, budget %s)\n"
+      "<tr><td>Large bodies in temporary files<td>%d (%ld KB)\n"
+      "<tr><td>Bodies shared by their contents<td>%d (%ld KB, "
+      "%ld KB of copies saved)\n"
+      "<tr><td>Compressed bodies inflated again<td>%d (%d dropped, "
+      "%d whole now)\n"
+      "<tr><td>Hit rate<td>%d%% (%d of %d requests)\n"
+      "<tr><td>Evicted<td>%d (%d moved to disk)\n"
+      "<tr><td>Stale ones sent to revalidation<td>%d\n"
+      "<tr><td>Revalidated (304 Not Modified)<td>%d\n"
+      "</table>\n<h3>Disk cache</h3>\n",
+      CachedURLs.Len, Cache_memory_bytes() / 1024,
+      CacheMem.max_bytes / 1024, budget, files, mapped / 1024,
+      shared, shared_bytes / 1024, saved / 1024,
+      CacheZip.inflations, CacheZip.packs, dList_length(CacheZip.inflated),
+      total ? 100 * CacheMem.hits / total : 0, CacheMem.hits, total,
+      CacheMem.evictions, CacheMem.demotions,
+      CacheUse.stale, CacheUse.revalidated);
+   if (!a_Diskcache_enabled()) {
+      dStr_append(ds, "<p>Disabled (see disk_cache_size in dillorc).\n");
+   } else {
+      dStr_sprintfa(ds,
+         "<table border='1' cellpadding='3'>\n"
+         "<tr><td>URLs stored<td>%d\n"
+         "<tr><td>Body files<td>%d (%ld KB, at most %ld KB)\n"
+         "<tr><td>Loaded fresh, without a connection<td>%d\n"
+         "<tr><td>Responses stored<td>%d (%ld KB written)\n"
+         "<tr><td>Bodies read<td>%d (%ld KB)\n"
+         "<tr><td>Evicted<td>%d\n"
+         "</table>\n",
+         st.entries, st.files, st.bytes / 1024, st.limit / 1024,
+         CacheUse.disk_fresh, st.stores,
+         st.bytes_written / 1024, st.bodies_read, st.bytes_read / 1024,
+         st.evictions);
+   }
+   dStr_append(ds, "</body></html>\n");
+   return ds;
+}
+
 /* Misc. operations ------------------------------------------------------- */
 
 /*
@@ -383,16 +1254,27 @@ int a_Cache_open_url(void *web, CA_Callback_t Call, void *CbData)
       Cache_entry_remove(NULL, Url);
    }
 
+   if (!dStrAsciiCasecmp(URL_STR(Url), "about:dns") ||
+       !dStrAsciiCasecmp(URL_STR(Url), "about:cache")) {
+      /* the statistics pages are made afresh every time */
+      Dstr *ds = (URL_STR(Url)[6] == 'd') ? a_Dns_stats_page() :
+                                            Cache_stats_page();
+
+      Cache_entry_inject(Url, ds);
+      dStr_free(ds, 1);
+   }
+
    if ((entry = Cache_entry_search(Url))) {
       /* URL is cached: feed our client with cached data */
-      ClientKey = Cache_client_enqueue(entry->Url, Web, Call, CbData);
+      entry->LastUse = ++CacheMem.clock;
+      ClientKey = Cache_client_enqueue(entry, Web, Call, CbData);
       Cache_delayed_process_queue(entry);
 
    } else {
       /* URL not cached: create an entry, send our client to the queue,
        * and open a new connection */
       entry = Cache_entry_add(Url);
-      ClientKey = Cache_client_enqueue(entry->Url, Web, Call, CbData);
+      ClientKey = Cache_client_enqueue(entry, Web, Call, CbData);
    }
 
    return ClientKey;
@@ -416,6 +1298,96 @@ uint_t a_Cache_get_flags_with_redirection(const DilloUrl *url)
    return (entry ? entry->Flags : 0);
 }
 
+/* Charset translation --------------------------------------------------- */
+
+/*
+ * Text in other charsets reaches the parsers translated to UTF-8, but the
+ * translation isn't kept alongside the data. It's made as the parsers ask
+ * for it, into a window (UTF8Data) that starts where the most behind of
+ * them is (their BufParsed) and reaches as far as Data has been
+ * translated. Whole buffers (a_Cache_get_buf) keep all of it until
+ * they're unreferenced.
+ */
+
+/*
+ * Bytes of Data translated (or of a compressed body inflated) in one go,
+ * when it's all there already
+ */
+#define CACHE_VIEW_STEP  (64*1024)
+
+/*
+ * Translate the next bytes of Data into the view of 'entry', starting it
+ * over if what begins at 'from' has already left it.
+ * Return whether there's more Data to translate.
+ */
+static bool_t Cache_view_update(CacheEntry_t *entry, int from)
+{
+   Dstr *dstr;
+   int len;
+
+   if (entry->UTF8Data && from < entry->UTF8Start) {
+      dStr_free(entry->UTF8Data, 1);
+      entry->UTF8Data = NULL;
+   }
+   if (!entry->UTF8Data) {
+      entry->UTF8Data = dStr_new("");
+      entry->UTF8Start = entry->UTF8Done = 0;
+      a_Decode_charset_reset(entry->CharsetDecoder);
+   }
+   if ((len = MIN(entry->Data->len - entry->UTF8Done, CACHE_VIEW_STEP)) > 0) {
+      dstr = a_Decode_process(entry->CharsetDecoder,
+                              entry->Data->str + entry->UTF8Done, len);
+      dStr_append_l(entry->UTF8Data, dstr->str, dstr->len);
+      dStr_free(dstr, 1);
+      entry->UTF8Done += len;
+      Cache_entry_account(entry);
+   }
+   return entry->UTF8Done < entry->Data->len;
+}
+
+/*
+ * Drop the part of the view that no parser needs anymore, or all of it
+ * when there's no one left to read it.
+ */
+static void Cache_view_trim(CacheEntry_t *entry)
+{
+   CacheClient_t *Client;
+   int i, n, start = INT_MAX;
+
+   if (!entry->UTF8Data || entry->DataRefcount > 0)
+      return;
+   for (i = 0; (Client = dList_nth_data(entry->Clients, i)); ++i)
+      if (!(((DilloWeb *)Client->Web)->flags & WEB_Download))
+         start = MIN(start, (int)Client->BufParsed);
+   if (start == INT_MAX) {
+      dStr_free(entry->UTF8Data, 1);
+      entry->UTF8Data = NULL;
+   } else if (start > entry->UTF8Start) {
+      n = MIN(start - entry->UTF8Start, entry->UTF8Data->len);
+      dStr_erase(entry->UTF8Data, 0, n);
+      entry->UTF8Start += n;
+   }
+   Cache_entry_account(entry);
+}
+
+/*
+ * Point 'Client' at the data it reads: the view for those that read the
+ * translation, Data itself for the rest.
+ */
+static void Cache_client_set_buf(CacheEntry_t *entry, CacheClient_t *Client)
+{
+   if (entry->UTF8Data &&
+       !(((DilloWeb *)Client->Web)->flags & WEB_Download)) {
+      Client->Buf = entry->UTF8Data->str;
+      Client->BufStart = entry->UTF8Start;
+      Client->BufSize = entry->UTF8Data->len;
+   } else {
+      Client->Buf = entry->Data->str;
+      Client->BufStart = 0;
+      Client->BufSize = entry->Data->len;
+   }
+}
+
 /*
  * Reference the cache data.
  */
@@ -424,13 +1396,8 @@ static void Cache_ref_data(CacheEntry_t *entry)
    if (entry) {
       entry->DataRefcount++;
       _MSG("DataRefcount++: %d\n", entry->DataRefcount);
-      if (entry->CharsetDecoder &&
-          (!entry->UTF8Data || entry->DataRefcount == 1)) {
-         dStr_free(entry->UTF8Data, 1);
-         entry->UTF8Data = a_Decode_process(entry->CharsetDecoder,
-                                            entry->Data->str,
-                                            entry->Data->len);
-      }
+      if (entry->CharsetDecoder)
+         while (Cache_view_update(entry, 0)) ;
    }
 }
 
@@ -443,15 +1410,11 @@ static void Cache_unref_data(CacheEntry_t *entry)
       entry->DataRefcount--;
       _MSG("DataRefcount--: %d\n", entry->DataRefcount);
 
-      if (entry->CharsetDecoder) {
-         if (entry->DataRefcount == 0) {
-            dStr_free(entry->UTF8Data, 1);
-            entry->UTF8Data = NULL;
-         } else if (entry->DataRefcount < 0) {
-            MSG_ERR("Cache_unref_data: negative refcount\n");
-            entry->DataRefcount = 0;
-         }
+      if (entry->DataRefcount < 0) {
+         MSG_ERR("Cache_unref_data: negative refcount\n");
+         entry->DataRefcount = 0;
       }
+      Cache_view_trim(entry);
    }
 }
 
@@ -465,21 +1428,41 @@ static const char *Cache_current_content_type(CacheEntry_t *entry)
 }
 
 /*
- * Get current Content-Type for cache entry found by URL.
+ * Get the digest and size of the body of 'url' if it's whole and shared
+ * (see a_Cachebody_share). Return whether it is.
+ * Different data can have the same digest: a_Cache_same_body() tells.
  */
-const char *a_Cache_get_content_type(const DilloUrl *url)
+bool_t a_Cache_get_digest(const DilloUrl *url, uint64_t *digest, int *size)
 {
    CacheEntry_t *entry = Cache_entry_search_with_redirect(url);
 
-   return (entry) ? Cache_current_content_type(entry) : NULL;
+   if (!entry || !entry->Data->refs)
+      return FALSE;
+   *digest = entry->Data->digest;
+   *size = entry->Data->len;
+   return TRUE;
 }
 
 /*
- * Get pointer to entry's data.
+ * Do 'url' and 'other' have the very same shared body?
  */
-static Dstr *Cache_data(CacheEntry_t *entry)
+bool_t a_Cache_same_body(const DilloUrl *url, const DilloUrl *other)
 {
-   return entry->UTF8Data ? entry->UTF8Data : entry->Data;
+   CacheEntry_t *entry = Cache_entry_search_with_redirect(url),
+                *other_entry = Cache_entry_search_with_redirect(other);
+
+   return (entry && other_entry && entry->Data->refs &&
+           entry->Data == other_entry->Data);
+}
+
+/*
+ * Get current Content-Type for cache entry found by URL.
+ */
+const char *a_Cache_get_content_type(const DilloUrl *url)
+{
+   CacheEntry_t *entry = Cache_entry_search_with_redirect(url);
+
+   return (entry) ? Cache_current_content_type(entry) : NULL;
 }
 
 /*
@@ -528,9 +1511,10 @@ const char *a_Cache_set_content_type(const DilloUrl *url, const char *ctype,
             entry->CharsetDecoder = a_Decode_charset_init(charset);
             curr = Cache_current_content_type(entry);
 
-            /* Invalidate UTF8Data */
+            /* Invalidate the translation */
             dStr_free(entry->UTF8Data, 1);
             entry->UTF8Data = NULL;
+            Cache_entry_account(entry);
          }
          dFree(major); dFree(minor); dFree(charset);
       }
@@ -546,11 +1530,16 @@ int a_Cache_get_buf(const DilloUrl *Url, char **PBuf, int *BufSize)
 {
    CacheEntry_t *entry = Cache_entry_search_with_redirect(Url);
    if (entry) {
-      Dstr *data;
+      entry->LastUse = ++CacheMem.clock;
+      Cache_body_inflate(entry, 0);
       Cache_ref_data(entry);
-      data = Cache_data(entry);
-      *PBuf = data->str;
-      *BufSize = data->len;
+      if (entry->UTF8Data) {
+         *PBuf = entry->UTF8Data->str;
+         *BufSize = entry->UTF8Data->len;
+      } else {
+         *PBuf = entry->Data->str;
+         *BufSize = entry->Data->len;
+      }
    } else {
       *PBuf = NULL;
       *BufSize = 0;
@@ -564,6 +1553,7 @@ int a_Cache_get_buf(const DilloUrl *Url, char **PBuf, int *BufSize)
 void a_Cache_unref_buf(const DilloUrl *Url)
 {
    Cache_unref_data(Cache_entry_search_with_redirect(Url));
+   Cache_make_room(NULL);
 }
 
 
@@ -652,9 +1642,9 @@ static Dlist *Cache_parse_multiple_fields(const char *header,
  */
 static void Cache_parse_header(CacheEntry_t *entry)
 {
-   char *header = entry->Header->str;
-   bool_t server1point0 = !strncmp(entry->Header->str, "HTTP/1.0", 8);
-   char *Length, *Type, *location_str, *encoding, *connection, *hsts;
+   char *header;
+   bool_t server1point0;
+   char *Length, *Type, *location_str, *encoding, *connection, *hsts, *age;
 #ifndef DISABLE_COOKIES
    Dlist *Cookies;
 #endif
@@ -664,6 +1654,11 @@ static void Cache_parse_header(CacheEntry_t *entry)
 
    _MSG("Cache_parse_header\n");
 
+   if (entry->Header->len > 12 && !strncmp(entry->Header->str + 9, "304", 3))
+      Cache_not_modified(entry);   /* may replace the header */
+   header = entry->Header->str;
+   server1point0 = !strncmp(header, "HTTP/1.0", 8);
+
    if (entry->Header->len > 12) {
       if (header[9] == '1' && header[10] == '0' && header[11] == '0') {
          /* 100: Continue. The "real" header has not come yet. */
@@ -759,19 +1754,17 @@ static void Cache_parse_header(CacheEntry_t *entry)
    if ((Cookies = Cache_parse_multiple_fields(header, "Set-Cookie"))) {
       CacheClient_t *client;
 
-      for (i = 0; (client = dList_nth_data(ClientQueue, i)); ++i) {
-         if (client->Url == entry->Url) {
-            DilloWeb *web = client->Web;
+      for (i = 0; (client = dList_nth_data(entry->Clients, i)); ++i) {
+         DilloWeb *web = client->Web;
 
-            if (!web->requester ||
-                a_Url_same_organization(entry->Url, web->requester)) {
-               /* If cookies are third party, don't even consider them. */
-               char *server_date = Cache_parse_field(header, "Date");
+         if (!web->requester ||
+             a_Url_same_organization(entry->Url, web->requester)) {
+            /* If cookies are third party, don't even consider them. */
+            char *server_date = Cache_parse_field(header, "Date");
 
-               a_Cookies_set(Cookies, entry->Url, server_date);
-               dFree(server_date);
-               break;
-            }
+            a_Cookies_set(Cookies, entry->Url, server_date);
+            dFree(server_date);
+            break;
          }
       }
       for (i = 0; (data = dList_nth_data(Cookies, i)); ++i)
@@ -785,17 +1778,24 @@ static void Cache_parse_header(CacheEntry_t *entry)
     */
    encoding = Cache_parse_field(header, "Content-Encoding");
    entry->ContentDecoder = a_Decode_content_init(encoding);
+   if (entry->ContentDecoder && prefs.memory_cache_compressed &&
+       !(entry->Flags & CA_InternalUrl)) {
+      /* keep the body as it comes too */
+      entry->Encoded = a_Cachebody_new(MIN(entry->ExpectedSize,
+                                           HUGE_FILESIZE));
+      entry->Encoding = dStrdup(encoding);
+   }
    dFree(encoding);
 
    if (entry->ExpectedSize > 0) {
       if (entry->ExpectedSize > HUGE_FILESIZE) {
          entry->Flags |= CA_HugeFile;
       }
-      /* Avoid some reallocs. With MAX_INIT_BUF we avoid a SEGFAULT
-       * with huge files (e.g. iso files).
+      /* Avoid reallocs. Large bodies get a temporary file, and those
+       * beyond HUGE_FILESIZE (e.g. iso files) are aborted anyway.
        * Note: the buffer grows automatically. */
-      dStr_free(entry->Data, 1);
-      entry->Data = dStr_sized_new(MIN(entry->ExpectedSize, MAX_INIT_BUF));
+      a_Cachebody_free(entry->Data);
+      entry->Data = a_Cachebody_new(MIN(entry->ExpectedSize, HUGE_FILESIZE));
    }
 
    /* Get Content-Type */
@@ -807,7 +1807,18 @@ static void Cache_parse_header(CacheEntry_t *entry)
       _MSG("TypeMeta {%s}\n", entry->TypeMeta);
       dFree(Type);
    }
-   Cache_ref_data(entry);
+
+   /* Freshness and validators, to tell when the response needs
+    * revalidation (see Cache_entry_is_stale) */
+   entry->Lifetime = Cache_freshness_lifetime(header);
+   if ((age = Cache_parse_field(header, "Age"))) {
+      entry->Age = MAX(strtol(age, NULL, 10), 0);
+      dFree(age);
+   }
+   entry->ETag = Cache_parse_field(header, "ETag");
+   entry->LastModified = Cache_parse_field(header, "Last-Modified");
+   /* whatever the reply, the revalidation is over */
+   Cache_stale_drop(entry->Url);
 }
 
 /*
@@ -838,6 +1849,7 @@ static int Cache_get_header(CacheEntry_t *entry,
       /* Got whole header */
       _MSG("Header [buf_size=%d]\n%s", i, hdr->str);
       entry->Flags |= CA_GotHeader;
+      entry->ResponseTime = time(NULL);
       dStr_fit(hdr);
       /* Return number of header bytes in 'buf' [1 based] */
       return i;
@@ -863,6 +1875,8 @@ static void Cache_finish_msg(CacheEntry_t *entry)
       MSG("Expected size: %d, Transfer size: %d\n",
           entry->ExpectedSize, entry->TransferSize);
    }
+   if (Cache_disk_storable(entry))
+      entry->Flags |= CA_DiskStore;
    entry->Flags |= CA_GotData;
    entry->Flags &= ~CA_Stopped;          /* it may catch up! */
    if (entry->TransferDecoder) {
@@ -873,13 +1887,31 @@ static void Cache_finish_msg(CacheEntry_t *entry)
       a_Decode_free(entry->ContentDecoder);
       entry->ContentDecoder = NULL;
    }
-   dStr_fit(entry->Data);                /* fit buffer size! */
+   a_Cachebody_fit(entry->Data);         /* fit buffer size! */
+   Cache_body_keep_encoded(entry);
+   Cache_body_share(entry);
 
-   if ((entry = Cache_process_queue(entry))) {
-      if (entry->Flags & CA_GotHeader) {
-         Cache_unref_data(entry);
-      }
+   entry = Cache_process_queue(entry);
+   /* (the caller may still use this entry) */
+   Cache_make_room(entry);
+}
+
+/*
+ * Store body data that arrived (after any transfer decoding)
+ */
+static void Cache_append_body(CacheEntry_t *entry, const char *str, int len)
+{
+   Dstr *dstr = NULL;
+
+   if (entry->Encoded)
+      a_Cachebody_append(entry->Encoded, str, len);
+   if (entry->ContentDecoder) {
+      dstr = a_Decode_process(entry->ContentDecoder, str, len);
+      str = dstr->str;
+      len = dstr->len;
    }
+   a_Cachebody_append(entry->Data, str, len);
+   dStr_free(dstr, 1);
 }
 
 /*
@@ -889,16 +1921,21 @@ static void Cache_finish_msg(CacheEntry_t *entry)
  * This function gets called whenever the IO has new data.
  *  'Op' is the operation to perform
  *  'VPtr' is a (void) pointer to the IO control structure
+ * When the message is complete (TRUE is returned) and 'surplus' is given,
+ * it's set to the number of trailing bytes in 'buf' that don't belong to
+ * this message (e.g. a pipelined reply), or -1 if that's unknown.
  */
 bool_t a_Cache_process_dbuf(int Op, const char *buf, size_t buf_size,
-                            const DilloUrl *Url)
+                            const DilloUrl *Url, int *surplus)
 {
-   int offset, len;
+   int offset, len, extra = 0;
    const char *str;
-   Dstr *dstr1, *dstr2, *dstr3;
    bool_t done = FALSE;
    CacheEntry_t *entry = Cache_entry_search(Url);
 
+   if (surplus)
+      *surplus = 0;
+
    /* Assert a valid entry (not aborted) */
    dReturn_val_if_fail (entry != NULL, FALSE);
 
@@ -915,36 +1952,62 @@ bool_t a_Cache_process_dbuf(int Op, const char *buf, size_t buf_size,
            Cache_parse_header(entry) ) {
          offset += len;
       }
+      Cache_entry_account(entry);
 
       if (entry->Flags & CA_GotHeader) {
          str = buf + offset;
          len = buf_size - offset;
+         if (entry->StoredBody) {
+            /* A 304 reply: the body is the stored one, and whatever
+             * comes after the header isn't ours */
+            extra = len;
+            str = entry->StoredBody->str;
+            len = entry->StoredBody->len;
+         } else if ((entry->Flags & CA_GotLength) &&
+             len > entry->ExpectedSize - entry->TransferSize) {
+            /* Whatever comes after the body isn't ours */
+            extra = len - MAX(entry->ExpectedSize - entry->TransferSize, 0);
+            len -= extra;
+         }
          entry->TransferSize += len;
-         dstr1 = dstr2 = dstr3 = NULL;
 
-         /* Decode arrived data (<= 3 stages) */
+         /* Decode arrived data (<= 2 stages) */
          if (entry->TransferDecoder) {
-            dstr1 = a_Decode_transfer_process(entry->TransferDecoder, str,len);
-            done = a_Decode_transfer_finished(entry->TransferDecoder);
-            str = dstr1->str;
-            len = dstr1->len;
-         }
-         if (entry->ContentDecoder) {
-            dstr2 = a_Decode_process(entry->ContentDecoder, str, len);
-            str = dstr2->str;
-            len = dstr2->len;
+            DecodeTransfer *td = entry->TransferDecoder;
+            Dstr *gathered = NULL;
+            const char *data;
+            int n;
+
+            /* The chunks are stored straight from the input, but the
+             * content decoder is better fed the whole read at once */
+            if (entry->ContentDecoder)
+               gathered = dStr_sized_new(len);
+            while ((n = a_Decode_transfer_next(td, &str, &len, &data))) {
+               if (gathered)
+                  dStr_append_l(gathered, data, n);
+               else
+                  Cache_append_body(entry, data, n);
+            }
+            if (gathered) {
+               Cache_append_body(entry, gathered->str, gathered->len);
+               dStr_free(gathered, 1);
+            }
+            if ((extra = a_Decode_transfer_surplus(td)) >= 0) {
+               /* the trailer has been seen too */
+               entry->TransferSize -= extra;
+               done = TRUE;
+            }
+         } else {
+            Cache_append_body(entry, str, len);
          }
-         dStr_append_l(entry->Data, str, len);
-         if (entry->CharsetDecoder && entry->UTF8Data) {
-            dstr3 = a_Decode_process(entry->CharsetDecoder, str, len);
-            dStr_append_l(entry->UTF8Data, dstr3->str, dstr3->len);
+         if (entry->StoredBody) {
+            dStr_free(entry->StoredBody, 1);
+            entry->StoredBody = NULL;
          }
-         dStr_free(dstr1, 1);
-         dStr_free(dstr2, 1);
-         dStr_free(dstr3, 1);
 
          if (entry->Data->len)
             entry->Flags &= ~CA_IsEmpty;
+         Cache_entry_account(entry);
 
          if ((entry->Flags & CA_GotLength) &&
              (entry->TransferSize >= entry->ExpectedSize)) {
@@ -959,21 +2022,20 @@ bool_t a_Cache_process_dbuf(int Op, const char *buf, size_t buf_size,
 
          if (entry && done)
             Cache_finish_msg(entry);
+         if (done && surplus)
+            *surplus = extra;
       }
    } else if (Op == IOClose) {
       Cache_finish_msg(entry);
    } else if (Op == IOAbort) {
-      int i;
       CacheClient_t *Client;
 
-      for (i = 0; (Client = dList_nth_data(ClientQueue, i)); ++i) {
-         if (Client->Url == entry->Url) {
-            DilloWeb *web = (DilloWeb *)Client->Web;
+      Cache_stale_drop(entry->Url);
+      while ((Client = dList_nth_data(entry->Clients, 0))) {
+         DilloWeb *web = (DilloWeb *)Client->Web;
 
-            a_Bw_remove_client(web->bw, Client->Key);
-            Cache_client_dequeue(Client);
-            --i; /* Keep the index value in the next iteration */
-         }
+         a_Bw_remove_client(web->bw, Client->Key);
+         Cache_client_dequeue(Client);
       }
    }
    return done;
@@ -1098,6 +2160,9 @@ static void Cache_null_client(int Op, CacheClient_t *Client)
 {
    DilloWeb *Web = Client->Web;
 
+   /* nothing to parse */
+   Client->BufParsed = Client->BufStart + Client->BufSize;
+
    /* make the stop button insensitive when done */
    if (Op == CA_Close) {
       if (Web->flags & WEB_RootUrl) {
@@ -1146,6 +2211,7 @@ static void Cache_provide_redirection_blocked_page(CacheEntry_t *entry,
                     URL_STR(entry->Location), "</a> based on your domainrc "
                     "settings.</body></html>", NULL);
    client->BufSize = strlen(client->Buf);
+   client->BufStart = 0;
    (client->Callback)(CA_Send, client);
    dFree(client->Buf);
 }
@@ -1167,11 +2233,11 @@ static CacheEntry_t *Cache_process_queue(CacheEntry_t *entry)
    uint_t i;
    int st;
    const char *Type;
-   Dstr *data;
    CacheClient_t *Client;
    DilloWeb *ClientWeb;
    BrowserWindow *Client_bw = NULL;
    static bool_t Busy = FALSE;
+   bool_t more;
    bool_t AbortEntry = FALSE;
    bool_t OfferDownload = FALSE;
    bool_t TypeMismatch = FALSE;
@@ -1181,6 +2247,7 @@ static CacheEntry_t *Cache_process_queue(CacheEntry_t *entry)
    if (!(entry->Flags & CA_GotHeader))
       return entry;
    if (!(entry->Flags & CA_GotContentType)) {
+      Cache_body_inflate(entry, 0);
       st = a_Misc_get_content_type_from_data(
               entry->Data->str, entry->Data->len, &Type);
       _MSG("Cache: detected Content-Type '%s'\n", Type);
@@ -1197,117 +2264,119 @@ static CacheEntry_t *Cache_process_queue(CacheEntry_t *entry)
    }
 
    Busy = TRUE;
-   for (i = 0; (Client = dList_nth_data(ClientQueue, i)); ++i) {
-      if (Client->Url == entry->Url) {
-         ClientWeb = Client->Web;    /* It was a (void*) */
-         Client_bw = ClientWeb->bw;  /* 'bw' in a local var */
-
-         if (ClientWeb->flags & WEB_RootUrl) {
-            if (!(entry->Flags & CA_MsgErased)) {
-               /* clear the "expecting for reply..." message */
-               a_UIcmd_set_msg(Client_bw, "");
-               entry->Flags |= CA_MsgErased;
-            }
-            if (TypeMismatch) {
-               a_UIcmd_set_msg(Client_bw,"HTTP warning: Content-Type '%s' "
-                               "doesn't match the real data.", entry->TypeHdr);
-               OfferDownload = TRUE;
-            }
-            if (entry->Flags & CA_Redirect) {
-               if (!Client->Callback) {
-                  Client->Callback = Cache_null_client;
-                  Client_bw->redirect_level++;
-               }
-            } else {
-               Client_bw->redirect_level = 0;
-            }
-            if (entry->Flags & CA_HugeFile) {
-               a_UIcmd_set_msg(Client_bw,"Huge file! (%dMB)",
-                               entry->ExpectedSize / (1024*1024));
-               AbortEntry = OfferDownload = TRUE;
+   for (i = 0; (Client = dList_nth_data(entry->Clients, i)); ++i) {
+      ClientWeb = Client->Web;    /* It was a (void*) */
+      Client_bw = ClientWeb->bw;  /* 'bw' in a local var */
+
+      if (ClientWeb->flags & WEB_RootUrl) {
+         if (!(entry->Flags & CA_MsgErased)) {
+            /* clear the "expecting for reply..." message */
+            a_UIcmd_set_msg(Client_bw, "");
+            entry->Flags |= CA_MsgErased;
+         }
+         if (TypeMismatch) {
+            a_UIcmd_set_msg(Client_bw,"HTTP warning: Content-Type '%s' "
+                            "doesn't match the real data.", entry->TypeHdr);
+            OfferDownload = TRUE;
+         }
+         if (entry->Flags & CA_Redirect) {
+            if (!Client->Callback) {
+               Client->Callback = Cache_null_client;
+               Client_bw->redirect_level++;
             }
          } else {
-            /* For non root URLs, ignore redirections and 404 answers */
-            if (entry->Flags & CA_Redirect || entry->Flags & CA_NotFound)
-               Client->Callback = Cache_null_client;
+            Client_bw->redirect_level = 0;
          }
-
-         /* Set the client function */
-         if (!Client->Callback) {
+         if (entry->Flags & CA_HugeFile) {
+            a_UIcmd_set_msg(Client_bw,"Huge file! (%dMB)",
+                            entry->ExpectedSize / (1024*1024));
+            AbortEntry = OfferDownload = TRUE;
+         }
+      } else {
+         /* For non root URLs, ignore redirections and 404 answers */
+         if (entry->Flags & CA_Redirect || entry->Flags & CA_NotFound)
             Client->Callback = Cache_null_client;
+      }
+
+      /* Set the client function */
+      if (!Client->Callback) {
+         Client->Callback = Cache_null_client;
 
-            if (entry->Location && !(entry->Flags & CA_Redirect)) {
-               /* Not following redirection, so don't display page body. */
+         if (entry->Location && !(entry->Flags & CA_Redirect)) {
+            /* Not following redirection, so don't display page body. */
+         } else {
+            if (TypeMismatch) {
+               AbortEntry = TRUE;
             } else {
-               if (TypeMismatch) {
-                  AbortEntry = TRUE;
-               } else {
-                  const char *curr_type = Cache_current_content_type(entry);
-                  st = a_Web_dispatch_by_type(curr_type, ClientWeb,
-                                              &Client->Callback,
-                                              &Client->CbData);
-                  if (st == -1) {
-                     /* MIME type is not viewable */
-                     if (ClientWeb->flags & WEB_RootUrl) {
-                        MSG("Content-Type '%s' not viewable.\n", curr_type);
-                        /* prepare a download offer... */
-                        AbortEntry = OfferDownload = TRUE;
-                     } else {
-                        /* TODO: Resource Type not handled.
-                         * Not aborted to avoid multiple connections on the
-                         * same resource. A better idea is to abort the
-                         * connection and to keep a failed-resource flag in
-                         * the cache entry. */
-                     }
+               const char *curr_type = Cache_current_content_type(entry);
+               st = a_Web_dispatch_by_type(curr_type, ClientWeb,
+                                           &Client->Callback,
+                                           &Client->CbData);
+               if (st == -1) {
+                  /* MIME type is not viewable */
+                  if (ClientWeb->flags & WEB_RootUrl) {
+                     MSG("Content-Type '%s' not viewable.\n", curr_type);
+                     /* prepare a download offer... */
+                     AbortEntry = OfferDownload = TRUE;
+                  } else {
+                     /* TODO: Resource Type not handled.
+                      * Not aborted to avoid multiple connections on the
+                      * same resource. A better idea is to abort the
+                      * connection and to keep a failed-resource flag in
+                      * the cache entry. */
                   }
                }
-               if (AbortEntry) {
-                  if (ClientWeb->flags & WEB_RootUrl)
-                     a_Nav_cancel_expect_if_eq(Client_bw, Client->Url);
-                  a_Bw_remove_client(Client_bw, Client->Key);
-                  Cache_client_dequeue(Client);
-                  --i; /* Keep the index value in the next iteration */
-                  continue;
-               }
+            }
+            if (AbortEntry) {
+               if (ClientWeb->flags & WEB_RootUrl)
+                  a_Nav_cancel_expect_if_eq(Client_bw, Client->Url);
+               a_Bw_remove_client(Client_bw, Client->Key);
+               Cache_client_dequeue(Client);
+               --i; /* Keep the index value in the next iteration */
+               continue;
             }
          }
+      }
 
-         /* Send data to our client */
-         if (ClientWeb->flags & WEB_Download) {
-            /* for download, always provide original data, not translated */
-            data = entry->Data;
-         } else {
-            data = Cache_data(entry);
-         }
-         if ((Client->BufSize = data->len) > 0) {
-            Client->Buf = data->str;
+      /* Send data to our client (for download, always provide original
+       * data, not translated; else a window of translation at a time).
+       * A body kept compressed is inflated as it's sent. */
+      do {
+         more = Cache_body_inflate(entry, CACHE_VIEW_STEP);
+         if (entry->CharsetDecoder && !(ClientWeb->flags & WEB_Download) &&
+             Cache_view_update(entry, Client->BufParsed))
+            more = TRUE;
+         Cache_client_set_buf(entry, Client);
+         if (Client->BufStart + Client->BufSize > Client->BufParsed) {
             (Client->Callback)(CA_Send, Client);
             if (ClientWeb->flags & WEB_RootUrl) {
                /* show size of page received */
                a_UIcmd_set_page_prog(Client_bw, entry->Data->len, 1);
             }
          }
-
-         /* Remove client when done */
-         if (entry->Flags & CA_GotData) {
-            /* Copy flags to a local var */
-            int flags = ClientWeb->flags;
-
-            if (ClientWeb->flags & WEB_RootUrl && entry->Location &&
-                !(entry->Flags & CA_Redirect)) {
-               Cache_provide_redirection_blocked_page(entry, Client);
-            }
-            /* We finished sending data, let the client know */
-            (Client->Callback)(CA_Close, Client);
-            if (ClientWeb->flags & WEB_RootUrl)
-               a_UIcmd_set_page_prog(Client_bw, 0, 0);
-            Cache_client_dequeue(Client);
-            --i; /* Keep the index value in the next iteration */
-
-            /* within CA_GotData, we assert just one redirect call */
-            if (entry->Flags & CA_Redirect)
-               Cache_redirect(entry, flags, Client_bw);
+         Cache_view_trim(entry);
+      } while (more);
+      Cache_client_set_buf(entry, Client);
+
+      /* Remove client when done */
+      if (entry->Flags & CA_GotData) {
+         /* Copy flags to a local var */
+         int flags = ClientWeb->flags;
+
+         if (ClientWeb->flags & WEB_RootUrl && entry->Location &&
+             !(entry->Flags & CA_Redirect)) {
+            Cache_provide_redirection_blocked_page(entry, Client);
          }
+         /* We finished sending data, let the client know */
+         (Client->Callback)(CA_Close, Client);
+         if (ClientWeb->flags & WEB_RootUrl)
+            a_UIcmd_set_page_prog(Client_bw, 0, 0);
+         Cache_client_dequeue(Client);
+         --i; /* Keep the index value in the next iteration */
+
+         /* within CA_GotData, we assert just one redirect call */
+         if (entry->Flags & CA_Redirect)
+            Cache_redirect(entry, flags, Client_bw);
       }
    } /* for */
 
@@ -1349,13 +2418,12 @@ static void Cache_delayed_process_queue_callback()
    CacheEntry_t *entry;
 
    while ((entry = (CacheEntry_t *)dList_nth_data(DelayedQueue, 0))) {
-      Cache_ref_data(entry);
-      if ((entry = Cache_process_queue(entry))) {
-         Cache_unref_data(entry);
+      if ((entry = Cache_process_queue(entry)))
          dList_remove(DelayedQueue, entry);
-      }
    }
    DelayedQueueIdleId = 0;
+   /* the bodies just inflated for the readers may be too many */
+   Cache_make_room(NULL);
    a_Timeout_remove();
 }
 
@@ -1382,16 +2450,13 @@ static void Cache_delayed_process_queue(CacheEntry_t *entry)
  */
 CacheClient_t *a_Cache_client_get_if_unique(int Key)
 {
-   int i, n = 0;
-   CacheClient_t *Client, *iClient;
+   int n = 0;
+   CacheClient_t *Client;
+   CacheEntry_t *entry;
 
-   if ((Client = dList_find_custom(ClientQueue, INT2VOIDP(Key),
-                                   Cache_client_by_key_cmp))) {
-      for (i = 0; (iClient = dList_nth_data(ClientQueue, i)); ++i) {
-         if (iClient->Url == Client->Url) {
-            ++n;
-         }
-      }
+   if ((Client = Cache_client_search(Key)) &&
+       (entry = Cache_entry_search(Client->Url))) {
+      n = dList_length(entry->Clients);
    }
    return (n == 1) ? Client : NULL;
 }
@@ -1406,9 +2471,11 @@ void a_Cache_stop_client(int Key)
    CacheEntry_t *entry;
    DICacheEntry *DicEntry;
 
+   /* It may be shown an image that the pool decodes */
+   a_Dicache_stop_client(Key);
+
    /* The client can be in both queues at the same time */
-   if ((Client = dList_find_custom(ClientQueue, INT2VOIDP(Key),
-                                   Cache_client_by_key_cmp))) {
+   if ((Client = Cache_client_search(Key))) {
       /* Dicache */
       if ((DicEntry = a_Dicache_get_entry(Client->Url, Client->Version)))
          a_Dicache_unref(Client->Url, Client->Version);
@@ -1432,17 +2499,29 @@ void a_Cache_stop_client(int Key)
 void a_Cache_freeall(void)
 {
    CacheClient_t *Client;
+   CacheEntry_t *entry;
    void *data;
+   int i;
 
    /* free the client queue */
    while ((Client = dList_nth_data(ClientQueue, 0)))
       Cache_client_dequeue(Client);
 
-   /* Remove every cache entry */
-   while ((data = dList_nth_data(CachedURLs, 0))) {
-      dList_remove_fast(CachedURLs, data);
-      Cache_entry_free(data);
+   /* Remove every cache entry, handing the disk tier what it lacks */
+   for (i = 0; i < CachedURLs.Size; i++) {
+      while ((entry = CachedURLs.Buckets[i])) {
+         CachedURLs.Buckets[i] = entry->Next;
+         Cache_disk_store(entry);
+         Cache_entry_free(entry);
+      }
    }
-   /* Remove the cache list */
-   dList_free(CachedURLs);
+   /* Remove the cache table */
+   dFree(CachedURLs.Buckets);
+
+   while ((data = dList_nth_data(StaleURLs, 0)))
+      Cache_stale_free(data);
+   dList_free(StaleURLs);
+   dList_free(CacheZip.inflated);
+
+   a_Diskcache_freeall();
 }
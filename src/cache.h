@@ -6,6 +6,8 @@ extern "C" {
 #endif /* __cplusplus */
 
 
+#include <stdint.h>
+
 #include "chain.h"
 #include "url.h"
 
@@ -34,6 +36,9 @@ extern "C" {
 #define CA_HugeFile     0x1000  /* URL content is too big */
 #define CA_IsEmpty      0x2000  /* True until a byte of content arrives */
 #define CA_KeepAlive    0x4000
+#define CA_FromDisk     0x8000  /* Response loaded from the disk cache */
+#define CA_DiskStore   0x10000  /* For the disk cache, when it leaves memory */
+#define CA_Packed      0x20000  /* Only the compressed body is in memory */
 
 typedef struct CacheClient CacheClient_t;
 
@@ -51,6 +56,8 @@ struct CacheClient {
    int Version;             /* Dicache version of this Url (0 if not used) */
    void *Buf;               /* Pointer to cache-data */
    uint_t BufSize;          /* Valid size of cache-data */
+   uint_t BufStart;         /* Offset of Buf within the data */
+   uint_t BufParsed;        /* Data the client is done with (set by it) */
    CA_Callback_t Callback;  /* Client function */
    void *CbData;            /* Client function data */
    void *Web;               /* Pointer to the Web structure of our client */
@@ -64,14 +71,19 @@ int a_Cache_open_url(void *Web, CA_Callback_t Call, void *CbData);
 int a_Cache_get_buf(const DilloUrl *Url, char **PBuf, int *BufSize);
 void a_Cache_unref_buf(const DilloUrl *Url);
 const char *a_Cache_get_content_type(const DilloUrl *url);
+bool_t a_Cache_get_digest(const DilloUrl *url, uint64_t *digest, int *size);
+bool_t a_Cache_same_body(const DilloUrl *url, const DilloUrl *other);
 const char *a_Cache_set_content_type(const DilloUrl *url, const char *ctype,
                                      const char *from);
 uint_t a_Cache_get_flags(const DilloUrl *url);
 uint_t a_Cache_get_flags_with_redirection(const DilloUrl *url);
 bool_t a_Cache_process_dbuf(int Op, const char *buf, size_t buf_size,
-                          const DilloUrl *Url);
+                            const DilloUrl *Url, int *surplus);
 int a_Cache_download_enabled(const DilloUrl *url);
 void a_Cache_entry_remove_by_url(DilloUrl *url);
+void a_Cache_check_freshness(const DilloUrl *url, bool_t stale_ok);
+char *a_Cache_validators(const DilloUrl *url);
+long a_Cache_memory_bytes(void);
 void a_Cache_freeall(void);
 CacheClient_t *a_Cache_client_get_if_unique(int Key);
 void a_Cache_stop_client(int Key);
@@ -0,0 +1,366 @@
+/*
+ * File: cachebody.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Storage for the bodies of cache entries.
+ *
+ * The consumers of a body (the HTML parser, the image decoders) read it
+ * as one contiguous buffer, so that's how it's kept. Small bodies live in
+ * the heap. A body that is announced or grows to CACHEBODY_SPILL bytes
+ * moves to an unlinked temporary file that is mapped in memory. From then
+ * on data is appended by writing the file, the mapping is widened
+ * without copying anything, and the pages are backed by the file rather
+ * than by swap.
+ *
+ * Sites serve the same bytes under many URLs (cache-busting queries,
+ * mirrors, spacer images), so whole bodies are shared by their contents:
+ * the first one with some data is kept, and the cache entries with the
+ * same data use it too.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "msg.h"
+#include "cachebody.h"
+
+/* Bodies this big go to a temporary file */
+#define CACHEBODY_SPILL  (1024*1024)
+
+/* The bodies in temporary files, and the room they take */
+static int mapped_files;
+static long mapped_bytes;
+
+/* The shared bodies, by digest. The table doubles when it gets full */
+static struct {
+   CacheBody **buckets;
+   int size;                /* number of buckets (a power of two) */
+   int len;                 /* number of bodies */
+   long bytes;              /* their data */
+   long saved;              /* the data of the extra users */
+} Shared;
+
+
+/*
+ * Create an unlinked temporary file. Return its descriptor, or -1.
+ */
+static int Cachebody_tmpfile(void)
+{
+   const char *dir = getenv("TMPDIR");
+   char *path;
+   int fd;
+
+   path = dStrconcat(dir && *dir ? dir : "/tmp", "/dillo-body.XXXXXX", NULL);
+   if ((fd = mkstemp(path)) != -1)
+      unlink(path);
+   else
+      MSG_WARN("Cachebody: can't create a temporary file in %s\n", path);
+   dFree(path);
+   return fd;
+}
+
+/*
+ * Write 'len' bytes at 'offset' of a file. Return 0, or -1 on error.
+ */
+static int Cachebody_write(int fd, const char *data, int len, off_t offset)
+{
+   ssize_t n;
+
+   while (len > 0) {
+      if ((n = pwrite(fd, data, len, offset)) > 0) {
+         data += n;
+         len -= n;
+         offset += n;
+      } else if (n == 0 || errno != EINTR) {
+         return -1;
+      }
+   }
+   return 0;
+}
+
+/*
+ * Map 'size' bytes (rounded up to pages) of the temporary file at 'str'.
+ * The file itself only grows as data is written to it.
+ * Return 0 on success, -1 if the body stays as it was.
+ */
+static int Cachebody_map(CacheBody *body, int size)
+{
+   long page = sysconf(_SC_PAGESIZE);
+   int fd = body->fd;
+   char *str;
+
+   size = (size + page - 1) / page * page;
+   if (fd == -1) {
+      /* the data moves there from the heap */
+      if ((fd = Cachebody_tmpfile()) == -1)
+         return -1;
+      if (Cachebody_write(fd, body->str ? body->str : "", body->len + 1, 0)) {
+         MSG_WARN("Cachebody: can't write a temporary file\n");
+         close(fd);
+         return -1;
+      }
+   }
+   /* (writable, as some consumers briefly edit the data in place) */
+   str = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (str == MAP_FAILED) {
+      MSG_WARN("Cachebody: can't map %d bytes\n", size);
+      if (body->fd == -1)
+         close(fd);
+      return -1;
+   }
+   if (body->fd == -1) {
+      dFree(body->str);
+      body->fd = fd;
+      mapped_files++;
+   } else {
+      munmap(body->str, body->sz);
+      mapped_bytes -= body->sz;
+   }
+   body->str = str;
+   body->sz = size;
+   mapped_bytes += size;
+   return 0;
+}
+
+/*
+ * Bring a mapped body back to the heap, with room for 'size' bytes.
+ */
+static void Cachebody_unmap(CacheBody *body, int size)
+{
+   char *str = dNew(char, size);
+
+   memcpy(str, body->str, body->len);
+   str[body->len] = '\0';
+   munmap(body->str, body->sz);
+   close(body->fd);
+   mapped_files--;
+   mapped_bytes -= body->sz;
+   body->fd = -1;
+   body->str = str;
+   body->sz = size;
+}
+
+/*
+ * Make room for at least 'size' bytes (the data and its terminator)
+ */
+static void Cachebody_grow(CacheBody *body, int size)
+{
+   size = MAX(size, body->sz * 2);
+   if (size >= CACHEBODY_SPILL && Cachebody_map(body, size) == 0)
+      return;
+   if (body->fd != -1) {
+      /* the mapping can't grow: go on in the heap */
+      Cachebody_unmap(body, size);
+   } else {
+      body->str = dRealloc(body->str, size);
+      body->sz = size;
+   }
+}
+
+/*
+ * Create an empty body, expecting about 'size_hint' bytes of data.
+ */
+CacheBody *a_Cachebody_new(int size_hint)
+{
+   CacheBody *body = dNew(CacheBody, 1);
+
+   body->str = NULL;
+   body->len = 0;
+   body->fd = -1;
+   body->refs = 0;
+   body->digest = 0;
+   body->next = NULL;
+   body->sz = MAX(size_hint, 0) + 1;
+   if (body->sz < CACHEBODY_SPILL || Cachebody_map(body, body->sz) != 0) {
+      body->sz = MIN(body->sz, CACHEBODY_SPILL);
+      body->str = dNew(char, body->sz);
+      body->str[0] = '\0';
+   }
+   return body;
+}
+
+void a_Cachebody_append(CacheBody *body, const char *data, int len)
+{
+   dReturn_if_fail(body->refs == 0);
+   if (len <= 0)
+      return;
+   if (body->len + len >= body->sz)
+      Cachebody_grow(body, body->len + len + 1);
+   if (body->fd != -1) {
+      /* (writing through the mapping would be much slower) */
+      if (Cachebody_write(body->fd, data, len, body->len) == 0 &&
+          Cachebody_write(body->fd, "", 1, body->len + len) == 0) {
+         body->len += len;
+         return;
+      }
+      MSG_WARN("Cachebody: can't write a temporary file\n");
+      Cachebody_unmap(body, body->len + len + 1);
+   }
+   memcpy(body->str + body->len, data, len);
+   body->len += len;
+   body->str[body->len] = '\0';
+}
+
+/*
+ * Cut the body down to 'len' bytes
+ */
+void a_Cachebody_truncate(CacheBody *body, int len)
+{
+   dReturn_if_fail(body->refs == 0);
+   if (len >= 0 && len < body->len) {
+      if (body->fd != -1)
+         Cachebody_unmap(body, len + 1);
+      body->len = len;
+      body->str[len] = '\0';
+   }
+}
+
+/*
+ * Give back the room that the data doesn't use
+ */
+void a_Cachebody_fit(CacheBody *body)
+{
+   if (body->refs) {
+      /* shared bodies were fit already */
+   } else if (body->fd != -1) {
+      Cachebody_map(body, body->len + 1);
+   } else if (body->sz > body->len + 1) {
+      body->sz = body->len + 1;
+      body->str = dRealloc(body->str, body->sz);
+   }
+}
+
+/*
+ * Digest of a body's data (64-bit FNV-1a, as for the disk cache files)
+ */
+static uint64_t Cachebody_digest(const char *data, int len)
+{
+   uint64_t h = 0xcbf29ce484222325ULL;
+   int i;
+
+   for (i = 0; i < len; i++) {
+      h ^= (unsigned char)data[i];
+      h *= 0x100000001b3ULL;
+   }
+   return h;
+}
+
+static void Cachebody_table_insert(CacheBody *body)
+{
+   CacheBody **buckets, *b, *next;
+   int i, size;
+
+   if (Shared.len >= Shared.size) {
+      size = MAX(Shared.size * 2, 64);
+      buckets = dNew0(CacheBody *, size);
+      for (i = 0; i < Shared.size; i++) {
+         for (b = Shared.buckets[i]; b; b = next) {
+            next = b->next;
+            b->next = buckets[b->digest & (size - 1)];
+            buckets[b->digest & (size - 1)] = b;
+         }
+      }
+      dFree(Shared.buckets);
+      Shared.buckets = buckets;
+      Shared.size = size;
+   }
+   i = body->digest & (Shared.size - 1);
+   body->next = Shared.buckets[i];
+   Shared.buckets[i] = body;
+   Shared.len++;
+   Shared.bytes += body->len;
+}
+
+static void Cachebody_table_remove(CacheBody *body)
+{
+   CacheBody **p = &Shared.buckets[body->digest & (Shared.size - 1)];
+
+   for ( ; *p; p = &(*p)->next) {
+      if (*p == body) {
+         *p = body->next;
+         Shared.len--;
+         Shared.bytes -= body->len;
+         break;
+      }
+   }
+}
+
+/*
+ * The body is whole and won't change anymore: share it by its contents.
+ * Return the body to use instead of 'body', which may be 'body' itself
+ * or one with the same data that was already shared ('body' is freed).
+ */
+CacheBody *a_Cachebody_share(CacheBody *body)
+{
+   CacheBody *b;
+   uint64_t digest;
+
+   if (body->refs || body->len == 0)
+      return body;
+   digest = Cachebody_digest(body->str, body->len);
+   if (Shared.size) {
+      for (b = Shared.buckets[digest & (Shared.size - 1)]; b; b = b->next) {
+         if (b->digest == digest && b->len == body->len &&
+             !memcmp(b->str, body->str, body->len)) {
+            a_Cachebody_free(body);
+            b->refs++;
+            Shared.saved += b->len;
+            return b;
+         }
+      }
+   }
+   body->digest = digest;
+   body->refs = 1;
+   Cachebody_table_insert(body);
+   return body;
+}
+
+void a_Cachebody_free(CacheBody *body)
+{
+   if (body && body->refs > 1) {
+      body->refs--;
+      Shared.saved -= body->len;
+   } else if (body) {
+      if (body->refs)
+         Cachebody_table_remove(body);
+      if (body->fd != -1) {
+         munmap(body->str, body->sz);
+         close(body->fd);
+         mapped_files--;
+         mapped_bytes -= body->sz;
+      } else {
+         dFree(body->str);
+      }
+      dFree(body);
+   }
+}
+
+/*
+ * How many bodies are in temporary files, and their size
+ */
+void a_Cachebody_stats(int *files, long *bytes)
+{
+   *files = mapped_files;
+   *bytes = mapped_bytes;
+}
+
+/*
+ * How many bodies are shared, their size, and the size of the copies
+ * that sharing them saves
+ */
+void a_Cachebody_shared_stats(int *bodies, long *bytes, long *saved)
+{
+   *bodies = Shared.len;
+   *bytes = Shared.bytes;
+   *saved = Shared.saved;
+}
@@ -0,0 +1,40 @@
+#ifndef __CACHEBODY_H__
+#define __CACHEBODY_H__
+
+#include <stdint.h>
+
+#include "d_size.h"
+#include "../dlib/dlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * The body of a cache entry. 'str' is always contiguous and
+ * NUL-terminated, whether it's in the heap or in a mapped file.
+ * A shared body (see a_Cachebody_share) must not change anymore.
+ */
+typedef struct CacheBody {
+   char *str;
+   int len;
+   int sz;                  /* room at 'str' */
+   int fd;                  /* the temporary file mapped at 'str', or -1 */
+   int refs;                /* users of a shared body (0 if not shared) */
+   uint64_t digest;         /* of the data, once shared */
+   struct CacheBody *next;  /* next shared body in the same bucket */
+} CacheBody;
+
+CacheBody *a_Cachebody_new(int size_hint);
+void a_Cachebody_append(CacheBody *body, const char *data, int len);
+void a_Cachebody_truncate(CacheBody *body, int len);
+void a_Cachebody_fit(CacheBody *body);
+CacheBody *a_Cachebody_share(CacheBody *body);
+void a_Cachebody_free(CacheBody *body);
+void a_Cachebody_stats(int *files, long *bytes);
+void a_Cachebody_shared_stats(int *bodies, long *bytes, long *saved);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* !__CACHEBODY_H__ */
@@ -29,6 +29,8 @@
 #include "dpiapi.h"
 #include "uicmd.hh"
 #include "domain.h"
+#include "prefs.h"
+#include "imgpool.h"
 #include "../dpip/dpip.h"
 
 /* for testing dpi chat */
@@ -331,6 +333,7 @@ static void Capi_dpi_send_source(BrowserWindow *bw, DilloUrl *url)
                              "start_send_page", URL_STR(url), size_str);
       a_Capi_dpi_send_cmd(NULL, bw, cmd, server, 0);
       a_Capi_dpi_send_data(url, bw, buf, buf_size, server, 0);
+      a_Capi_unref_buf(CapiVsUrl);
    } else {
       cmd = a_Dpip_build_cmd("cmd=%s msg=%s",
                              "DpiError", "Page is NOT cached");
@@ -396,6 +399,13 @@ int a_Capi_open_url(DilloWeb *web, CA_Callback_t Call, void *CbData)
    int safe = 0, ret = 0, use_cache = 0;
 
    if (Capi_request_permitted(web)) {
+      /* Serve fresh responses without a connection, and revalidate stale
+       * ones. Going through history shows what the cache has, though. */
+      if (!(URL_FLAGS(web->url) & URL_E2EQuery))
+         a_Cache_check_freshness(web->url,
+                                 (web->flags & WEB_History) ||
+                                 (URL_FLAGS(web->url) & URL_ReloadFromCache));
+
       /* reload test */
       reload = (!(a_Capi_get_flags(web->url) & CAPI_IsCached) ||
                 (URL_FLAGS(web->url) & URL_E2EQuery));
@@ -512,13 +522,24 @@ static int Capi_map_cache_flags(uint_t flags)
    return status;
 }
 
+static int Capi_get_flags_call(void *Url)
+{
+   return a_Capi_get_flags(Url);
+}
+
 /*
  * Return status information of an URL's content-transfer process.
  */
 int a_Capi_get_flags(const DilloUrl *Url)
 {
-   uint_t flags = a_Cache_get_flags(Url);
-   int status = flags ? Capi_map_cache_flags(flags) : 0;
+   uint_t flags;
+   int status;
+
+   /* the cache is the main thread's */
+   if (a_Imgpool_worker())
+      return a_Imgpool_call(Capi_get_flags_call, (void *)Url);
+   flags = a_Cache_get_flags(Url);
+   status = flags ? Capi_map_cache_flags(flags) : 0;
    return status;
 }
 
@@ -532,6 +553,23 @@ int a_Capi_get_flags_with_redirection(const DilloUrl *Url)
    return status;
 }
 
+/*
+ * The user may soon follow a link to 'url': if it isn't cached, have a
+ * connection to its server ready.
+ */
+void a_Capi_preconnect(const DilloUrl *url)
+{
+   const char *scheme = URL_SCHEME(url);
+
+   if (prefs.http_preconnect > 0 &&
+       (!dStrAsciiCasecmp(scheme, "http")
+#ifdef ENABLE_SSL
+        || !dStrAsciiCasecmp(scheme, "https")
+#endif
+       ) && !(a_Capi_get_flags_with_redirection(url) & CAPI_IsCached))
+      a_Http_preconnect(url);
+}
+
 /*
  * Get the cache's buffer for the URL, and its size.
  * Return: 1 cached, 0 not cached.
@@ -700,7 +738,7 @@ void a_Capi_ccc(int Op, int Branch, int Dir, ChainLink *Info,
          case OpAbort:
             conn = Info->LocalKey;
             conn->InfoSend = NULL;
-            a_Cache_process_dbuf(IOAbort, NULL, 0, conn->url);
+            a_Cache_process_dbuf(IOAbort, NULL, 0, conn->url, NULL);
             if (Data2) {
                if (!strcmp(Data2, "DpidERROR")) {
                   a_UIcmd_set_msg(conn->bw,
@@ -766,15 +804,22 @@ void a_Capi_ccc(int Op, int Branch, int Dir, ChainLink *Info,
             conn = Info->LocalKey;
             if (strcmp(Data2, "send_page_2eof") == 0) {
                /* Data1 = dbuf */
-               DataBuf *dbuf = Data1;
+               DataBuf *dbuf = Data1, *sbuf = NULL;
+               int surplus;
                bool_t finished = a_Cache_process_dbuf(IORead, dbuf->Buf,
-                                                      dbuf->Size, conn->url);
+                                                      dbuf->Size, conn->url,
+                                                      &surplus);
                if (finished && Capi_conn_valid(conn) && conn->InfoRecv) {
                   /* If we have a persistent connection where cache tells us
                    * that we've received the full response, and cache didn't
                    * trigger an abort and tear everything down, tell upstream.
+                   * Bytes past the response go along (NULL when unknown).
                    */
-                  a_Chain_bcb(OpSend, conn->InfoRecv, NULL, "reply_complete");
+                  if (surplus >= 0)
+                     sbuf = a_Chain_dbuf_new(dbuf->Buf + dbuf->Size - surplus,
+                                             surplus, 0);
+                  a_Chain_bcb(OpSend, conn->InfoRecv, sbuf, "reply_complete");
+                  dFree(sbuf);
                }
             } else if (strcmp(Data2, "send_status_message") == 0) {
                a_UIcmd_set_msg(conn->bw, "%s", Data1);
@@ -797,7 +842,7 @@ void a_Capi_ccc(int Op, int Branch, int Dir, ChainLink *Info,
             conn = Info->LocalKey;
             conn->InfoRecv = NULL;
 
-            a_Cache_process_dbuf(IOClose, NULL, 0, conn->url);
+            a_Cache_process_dbuf(IOClose, NULL, 0, conn->url, NULL);
 
             if (conn->InfoSend) {
                /* Propagate OpEnd to the sending branch too */
@@ -809,7 +854,7 @@ void a_Capi_ccc(int Op, int Branch, int Dir, ChainLink *Info,
          case OpAbort:
             conn = Info->LocalKey;
             conn->InfoRecv = NULL;
-            a_Cache_process_dbuf(IOAbort, NULL, 0, conn->url);
+            a_Cache_process_dbuf(IOAbort, NULL, 0, conn->url, NULL);
             if (Data2) {
                if (!strcmp(Data2, "Both") && conn->InfoSend) {
                   /* abort the other branch too */
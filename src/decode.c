@@ -9,10 +9,20 @@
  * (at your option) any later version.
  */
 
+#include <config.h>
+
 #include <zlib.h>
 #include <iconv.h>
 #include <errno.h>
-#include <stdlib.h>     /* strtol */
+#include <stdlib.h>
+#include <limits.h>
+
+#ifdef ENABLE_BROTLI
+#include <brotli/decode.h>
+#endif
+#ifdef ENABLE_ZSTD
+#include <zstd.h>
+#endif
 
 #include "decode.h"
 #include "utf8.hh"
@@ -20,66 +30,126 @@
 
 static const int bufsize = 8*1024;
 
+/* Where the chunked parser is */
+enum {
+   DT_SIZE,            /* in the chunk size */
+   DT_EXT,             /* in the rest of the chunk header line */
+   DT_DATA,            /* in the chunk data */
+   DT_DATA_END,        /* in the CRLF after the chunk data */
+   DT_TRAILER_BOL,     /* at the beginning of a trailer line */
+   DT_TRAILER_CR,      /* after a CR that began a trailer line */
+   DT_TRAILER_LINE,    /* in a (non-empty) trailer line */
+   DT_DONE
+};
+
+/* The value of each hexadecimal digit, or -1 */
+static const signed char Decode_hex[256] = {
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+   -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
 /*
- * Decode 'Transfer-Encoding: chunked' data
+ * Decode 'Transfer-Encoding: chunked' data without copying it.
+ *
+ * Parse the input at '*instr' ('*inlen' bytes) up to the next piece of
+ * chunk data, and return its length, with '*data' pointing to it (inside
+ * the input). '*instr' and '*inlen' are advanced past it, so calling this
+ * again goes on with the rest. Return 0 once the input is used up, or the
+ * end of the body has been reached (see a_Decode_transfer_surplus).
+ *
+ * The parser keeps its state between calls, so the input may be cut
+ * anywhere, even inside a chunk header. Lines are searched with memchr().
  */
-Dstr *a_Decode_transfer_process(DecodeTransfer *dc, const char *instr,
-                                int inlen)
+int a_Decode_transfer_next(DecodeTransfer *dc, const char **instr, int *inlen,
+                           const char **data)
 {
-   char *inputPtr, *eol;
-   int inputRemaining;
-   int chunkRemaining = *((int *)dc->state);
-   Dstr *output = dStr_sized_new(inlen);
-
-   dStr_append_l(dc->leftover, instr, inlen);
-   inputPtr = dc->leftover->str;
-   inputRemaining = dc->leftover->len;
-
-   while (inputRemaining > 0) {
-      if (chunkRemaining > 2) {
-         /* chunk body to copy */
-         int copylen = MIN(chunkRemaining - 2, inputRemaining);
-         dStr_append_l(output, inputPtr, copylen);
-         chunkRemaining -= copylen;
-         inputRemaining -= copylen;
-         inputPtr += copylen;
+   const char *p = *instr, *end = p + *inlen, *eol;
+   int d, n = 0;
+
+   while (p < end && !n && dc->state != DT_DONE) {
+      switch (dc->state) {
+      case DT_SIZE:
+         /* A chunk has a one-line header that begins with the chunk
+          * length in hexadecimal. */
+         if (!dc->remaining)
+            for ( ; p < end && (*p == ' ' || *p == '\t'); p++) ;
+         for ( ; p < end && (d = Decode_hex[(uchar_t)*p]) >= 0; p++) {
+            if (dc->remaining < (INT_MAX >> 4))
+               dc->remaining = (dc->remaining << 4) | d;
+         }
+         if (p < end)
+            dc->state = DT_EXT;
+         /* fall through */
+      case DT_EXT:
+         if (p + 1 < end && p[0] == '\r' && p[1] == '\n') {
+            eol = p + 1;          /* (the usual case) */
+         } else if (!(eol = memchr(p, '\n', end - p))) {
+            p = end;
+            break;
+         }
+         p = eol + 1;
+         /* A chunk length of 0 means we're done! */
+         dc->state = dc->remaining ? DT_DATA : DT_TRAILER_BOL;
+         dc->finished = !dc->remaining;
+         break;
+      case DT_DATA:
+         n = MIN(dc->remaining, end - p);
+         *data = p;
+         p += n;
+         if (!(dc->remaining -= n))
+            dc->state = DT_DATA_END;
+         break;
+      case DT_DATA_END:
+         if (p + 1 < end && p[0] == '\r' && p[1] == '\n') {
+            eol = p + 1;
+         } else if (!(eol = memchr(p, '\n', end - p))) {
+            p = end;
+            break;
+         }
+         p = eol + 1;
+         dc->state = DT_SIZE;
+         break;
+      case DT_TRAILER_BOL:
+      case DT_TRAILER_CR:
+         /* The trailer is a (possibly empty) list of header lines, ended
+          * by an empty line. */
+         if (*p == '\n') {
+            dc->state = DT_DONE;
+         } else {
+            dc->state = (*p == '\r' && dc->state == DT_TRAILER_BOL) ?
+                        DT_TRAILER_CR : DT_TRAILER_LINE;
+         }
+         p++;
+         break;
+      case DT_TRAILER_LINE:
+         if (!(eol = memchr(p, '\n', end - p))) {
+            p = end;
+         } else {
+            p = eol + 1;
+            dc->state = DT_TRAILER_BOL;
+         }
+         break;
       }
-
-      if ((chunkRemaining == 2) && (inputRemaining > 0)) {
-         /* CR to discard */
-         chunkRemaining--;
-         inputRemaining--;
-         inputPtr++;
-      }
-      if ((chunkRemaining == 1) && (inputRemaining > 0)) {
-         /* LF to discard */
-         chunkRemaining--;
-         inputRemaining--;
-         inputPtr++;
-      }
-
-      /*
-       * A chunk has a one-line header that begins with the chunk length
-       * in hexadecimal.
-       */
-      if (!(eol = (char *)memchr(inputPtr, '\n', inputRemaining))) {
-         break;   /* We don't have the whole line yet. */
-      }
-
-      if (!(chunkRemaining = strtol(inputPtr, NULL, 0x10))) {
-         dc->finished = TRUE;
-         break;   /* A chunk length of 0 means we're done! */
-      }
-      inputRemaining -= (eol - inputPtr) + 1;
-      inputPtr = eol + 1;
-      chunkRemaining += 2; /* CRLF at the end of every chunk */
    }
-
-   /* If we have a partial chunk header, save it for next time. */
-   dStr_erase(dc->leftover, 0, inputPtr - dc->leftover->str);
-
-   *(int *)dc->state = chunkRemaining;
-   return output;
+   if (dc->state == DT_DONE && dc->surplus == -1)
+      dc->surplus = end - p;
+   *instr = p;
+   *inlen = end - p;
+   return n;
 }
 
 bool_t a_Decode_transfer_finished(DecodeTransfer *dc)
@@ -87,10 +157,18 @@ bool_t a_Decode_transfer_finished(DecodeTransfer *dc)
    return dc->finished;
 }
 
+/*
+ * Number of bytes at the end of the last input that came after the chunked
+ * body (e.g. the next reply on a persistent connection), or -1 if the end of
+ * the body hasn't been completely seen.
+ */
+int a_Decode_transfer_surplus(DecodeTransfer *dc)
+{
+   return dc->surplus;
+}
+
 void a_Decode_transfer_free(DecodeTransfer *dc)
 {
-   dFree(dc->state);
-   dStr_free(dc->leftover, 1);
    dFree(dc);
 }
 
@@ -232,6 +310,76 @@ static Dstr *Decode_deflate(Decode *dc, const char *instr, int inlen)
    return output;
 }
 
+#ifdef ENABLE_BROTLI
+/*
+ * Decode Brotli compressed data
+ */
+static Dstr *Decode_brotli(Decode *dc, const char *instr, int inlen)
+{
+   BrotliDecoderState *st = (BrotliDecoderState *)dc->state;
+   BrotliDecoderResult rc;
+   const uint8_t *next_in = (const uint8_t *)instr;
+   size_t avail_in = inlen, avail_out;
+   uint8_t *next_out;
+   Dstr *output = dStr_new("");
+
+   do {
+      next_out = (uint8_t *)dc->buffer;
+      avail_out = bufsize;
+      rc = BrotliDecoderDecompressStream(st, &avail_in, &next_in,
+                                         &avail_out, &next_out, NULL);
+      dStr_append_l(output, dc->buffer, bufsize - avail_out);
+   } while (rc == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+
+   if (rc == BROTLI_DECODER_RESULT_ERROR)
+      MSG_ERR("brotli decompression error: %s\n",
+              BrotliDecoderErrorString(BrotliDecoderGetErrorCode(st)));
+   return output;
+}
+
+static void Decode_brotli_free(Decode *dc)
+{
+   BrotliDecoderDestroyInstance((BrotliDecoderState *)dc->state);
+   dFree(dc->buffer);
+}
+#endif /* ENABLE_BROTLI */
+
+#ifdef ENABLE_ZSTD
+/*
+ * Decode Zstandard compressed data
+ */
+static Dstr *Decode_zstd(Decode *dc, const char *instr, int inlen)
+{
+   ZSTD_inBuffer in;
+   ZSTD_outBuffer out;
+   size_t rc;
+   Dstr *output = dStr_new("");
+
+   in.src = instr;
+   in.size = inlen;
+   in.pos = 0;
+   do {
+      out.dst = dc->buffer;
+      out.size = bufsize;
+      out.pos = 0;
+      rc = ZSTD_decompressStream((ZSTD_DStream *)dc->state, &out, &in);
+      if (ZSTD_isError(rc)) {
+         MSG_ERR("zstd decompression error: %s\n", ZSTD_getErrorName(rc));
+         break;
+      }
+      dStr_append_l(output, dc->buffer, out.pos);
+      /* a full buffer may leave output behind */
+   } while (in.pos < in.size || out.pos == out.size);
+   return output;
+}
+
+static void Decode_zstd_free(Decode *dc)
+{
+   ZSTD_freeDStream((ZSTD_DStream *)dc->state);
+   dFree(dc->buffer);
+}
+#endif /* ENABLE_ZSTD */
+
 /*
  * Translate to desired character set (UTF-8)
  */
@@ -293,12 +441,11 @@ DecodeTransfer *a_Decode_transfer_init(const char *format)
    DecodeTransfer *dc = NULL;
 
    if (format && !dStrAsciiCasecmp(format, "chunked")) {
-      int *chunk_remaining = dNew(int, 1);
-      *chunk_remaining = 0;
       dc = dNew(DecodeTransfer, 1);
-      dc->leftover = dStr_new("");
-      dc->state = chunk_remaining;
+      dc->state = DT_SIZE;
+      dc->remaining = 0;
       dc->finished = FALSE;
+      dc->surplus = -1;
       _MSG("chunked!\n");
    }
    return dc;
@@ -322,7 +469,8 @@ static Decode *Decode_content_init_common()
 }
 
 /*
- * Initialize content decoder. Currently handles 'gzip' and 'deflate'.
+ * Initialize content decoder. Currently handles 'gzip' and 'deflate', and
+ * 'br' and 'zstd' when built with them (see a_Decode_content_encodings).
  */
 Decode *a_Decode_content_init(const char *format)
 {
@@ -348,6 +496,34 @@ Decode *a_Decode_content_init(const char *format)
          inflateInit(zs);
 
          dc->decode = Decode_deflate;
+#ifdef ENABLE_BROTLI
+      } else if (!dStrAsciiCasecmp(format, "br")) {
+         BrotliDecoderState *st = BrotliDecoderCreateInstance(NULL, NULL, NULL);
+
+         if (st) {
+            dc = dNew(Decode, 1);
+            dc->state = st;
+            dc->buffer = dNew(char, bufsize);
+            dc->leftover = NULL; /* not used */
+            dc->decode = Decode_brotli;
+            dc->free = Decode_brotli_free;
+         }
+#endif
+#ifdef ENABLE_ZSTD
+      } else if (!dStrAsciiCasecmp(format, "zstd")) {
+         ZSTD_DStream *zds = ZSTD_createDStream();
+
+         if (zds && !ZSTD_isError(ZSTD_initDStream(zds))) {
+            dc = dNew(Decode, 1);
+            dc->state = zds;
+            dc->buffer = dNew(char, bufsize);
+            dc->leftover = NULL; /* not used */
+            dc->decode = Decode_zstd;
+            dc->free = Decode_zstd_free;
+         } else if (zds) {
+            ZSTD_freeDStream(zds);
+         }
+#endif
       } else {
          MSG("Content-Encoding '%s' not recognized.\n", format);
       }
@@ -355,6 +531,22 @@ Decode *a_Decode_content_init(const char *format)
    return dc;
 }
 
+/*
+ * The content codings that a_Decode_content_init() handles, as for an
+ * Accept-Encoding header.
+ */
+const char *a_Decode_content_encodings(void)
+{
+   return "gzip, deflate"
+#ifdef ENABLE_BROTLI
+          ", br"
+#endif
+#ifdef ENABLE_ZSTD
+          ", zstd"
+#endif
+          ;
+}
+
 /*
  * Initialize decoder to translate from any character set known to iconv()
  * to UTF-8.
@@ -386,6 +578,15 @@ Decode *a_Decode_charset_init(const char *format)
    return dc;
 }
 
+/*
+ * Make a charset decoder start over, as for a new text.
+ */
+void a_Decode_charset_reset(Decode *dc)
+{
+   dStr_truncate(dc->leftover, 0);
+   (void)iconv((iconv_t)dc->state, NULL, NULL, NULL, NULL);
+}
+
 /*
  * Decode data.
  */
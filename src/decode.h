@@ -19,19 +19,24 @@ typedef struct Decode {
  * can evolve independently.
  */
 typedef struct DecodeTransfer {
-   Dstr *leftover;
-   void *state;
+   int state;          /* where the parser is */
+   int remaining;      /* bytes of the chunk size or data still to come */
    bool_t finished;    /* has the terminating chunk been seen? */
+   int surplus;        /* bytes of the last input past the end of the body
+                        * (-1 if the trailer hasn't been fully seen) */
 } DecodeTransfer;
 
 DecodeTransfer *a_Decode_transfer_init(const char *format);
-Dstr *a_Decode_transfer_process(DecodeTransfer *dc, const char *instr,
-                                int inlen);
+int a_Decode_transfer_next(DecodeTransfer *dc, const char **instr, int *inlen,
+                           const char **data);
 bool_t a_Decode_transfer_finished(DecodeTransfer *dc);
+int a_Decode_transfer_surplus(DecodeTransfer *dc);
 void a_Decode_transfer_free(DecodeTransfer *dc);
 
 Decode *a_Decode_content_init(const char *format);
+const char *a_Decode_content_encodings(void);
 Decode *a_Decode_charset_init(const char *format);
+void a_Decode_charset_reset(Decode *dc);
 Dstr *a_Decode_process(Decode *dc, const char *instr, int inlen);
 void a_Decode_free(Decode *dc);
 
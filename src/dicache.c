@@ -20,6 +20,7 @@
 #include "dpng.h"
 #include "dgif.h"
 #include "djpeg.h"
+#include "imgpool.h"
 
 
 enum {
@@ -28,6 +29,18 @@ enum {
    DIC_Jpeg
 };
 
+/*
+ * A cache client of an entry that the pool decodes. It's shown the rows
+ * as they come from the pool, and closed when the decoder closes, which
+ * may be after the cache is done with it.
+ */
+typedef struct {
+   DilloImage *Image;
+   BrowserWindow *bw;
+   int Key;
+   bool_t Closed;          /* The cache is done with it */
+} DicacheClient;
+
 
 /*
  * List of DICacheEntry. May hold several versions of the same image,
@@ -35,9 +48,18 @@ enum {
  */
 static Dlist *CachedIMGs = NULL;
 
-static uint_t dicache_size_total; /* invariant: dicache_size_total is
-                                   * the sum of the image sizes (3*w*h)
-                                   * of all the images in the dicache. */
+/* The entries that the pool decodes */
+static Dlist *DecodingIMGs = NULL;
+
+static long dicache_size_total; /* invariant: dicache_size_total is
+                                 * the sum of the TotalSize of all the
+                                 * entries in the dicache. */
+
+/* Ticks each time an entry is asked for, to find the least recently used */
+static uint_t dicache_clock;
+
+/* What the decoded images may take up (prefs.image_cache_size, in MB) */
+#define DICACHE_BUDGET ((long)prefs.image_cache_size * 1024 * 1024)
 
 /*
  * Compare function for image entries
@@ -62,7 +84,9 @@ static int Dicache_entry_cmp(const void *v1, const void *v2)
 void a_Dicache_init(void)
 {
    CachedIMGs = dList_new(256);
+   DecodingIMGs = dList_new(16);
    dicache_size_total = 0;
+   dicache_clock = 0;
 }
 
 /*
@@ -74,10 +98,11 @@ static DICacheEntry *Dicache_entry_new(void)
 
    entry->width = 0;
    entry->height = 0;
+   entry->OrigWidth = 0;
+   entry->OrigHeight = 0;
    entry->Flags = DIF_Valid;
-   entry->SurvCleanup = 0;
+   entry->LastUse = ++dicache_clock;
    entry->type = DILLO_IMG_TYPE_NOTSET;
-   entry->cmap = NULL;
    entry->v_imgbuf = NULL;
    entry->RefCount = 1;
    entry->TotalSize = 0;
@@ -85,10 +110,15 @@ static DICacheEntry *Dicache_entry_new(void)
    entry->BitVec = NULL;
    entry->State = DIC_Empty;
    entry->version = 1;
+   entry->DigestSize = 0;
+   entry->Twin = NULL;
+   entry->v_replaced = NULL;
 
    entry->Decoder = NULL;
    entry->DecoderData = NULL;
    entry->DecodedSize = 0;
+   entry->Job = NULL;
+   entry->Clients = NULL;
 
    return entry;
 }
@@ -138,6 +168,25 @@ DICacheEntry *a_Dicache_get_entry(const DilloUrl *Url, int version)
    return entry;
 }
 
+/*
+ * Stop the pool decoding 'entry', and forget its clients.
+ */
+static void Dicache_job_cancel(DICacheEntry *entry)
+{
+   DicacheClient *dc;
+
+   a_Imgpool_job_cancel(entry->Job);
+   entry->Job = NULL;
+   dList_remove(DecodingIMGs, entry);
+   while ((dc = dList_nth_data(entry->Clients, 0))) {
+      dList_remove_fast(entry->Clients, dc);
+      a_Image_unref(dc->Image);
+      dFree(dc);
+   }
+   dList_free(entry->Clients);
+   entry->Clients = NULL;
+}
+
 /*
  * Actually free a dicache entry, given the URL and the version number.
  */
@@ -159,12 +208,17 @@ static void Dicache_remove(const DilloUrl *Url, int version)
 
    /* entry cleanup */
    a_Url_free(entry->url);
-   dFree(entry->cmap);
    a_Bitvec_free(entry->BitVec);
-   a_Imgbuf_unref(entry->v_imgbuf);
+   a_Imgbuf_unref(entry->v_replaced);
+   if (entry->Twin)
+      a_Dicache_unref(entry->Twin->url, entry->Twin->version);
+   else
+      a_Imgbuf_unref(entry->v_imgbuf);
    if (entry->Decoder) {
       entry->Decoder(CA_Abort, entry->DecoderData);
    }
+   if (entry->Job)
+      Dicache_job_cancel(entry);
    dFree(entry);
 }
 
@@ -183,8 +237,14 @@ void a_Dicache_unref(const DilloUrl *Url, int version)
           entry->RefCount, entry->State,
           entry->v_imgbuf ? a_Imgbuf_last_reference(entry->v_imgbuf) : -1);
       if (entry->RefCount > 0) --entry->RefCount;
-      if (entry->RefCount == 0 && entry->v_imgbuf == NULL)
+      if (entry->RefCount == 0 && entry->v_imgbuf == NULL) {
          Dicache_remove(Url, version);
+      } else if (entry->RefCount == 0 && entry->Job) {
+         /* Nobody waits for the rest: stop decoding it */
+         Dicache_job_cancel(entry);
+         entry->State = DIC_Abort;
+         entry->Flags &= ~DIF_Valid;
+      }
    }
 }
 
@@ -197,10 +257,76 @@ DICacheEntry* a_Dicache_ref(const DilloUrl *Url, int version)
 
    if ((entry = a_Dicache_get_entry(Url, version))) {
       ++entry->RefCount;
+      entry->LastUse = ++dicache_clock;
    }
    return entry;
 }
 
+/*
+ * Find a whole image with the same data as 'entry', if its data is known
+ * to be whole too. Identical bodies are shared by the cache: the digests
+ * only narrow down the search, the shared body itself must be the same.
+ */
+static DICacheEntry *Dicache_find_twin(DICacheEntry *entry)
+{
+   DICacheEntry *e;
+   int i;
+
+   if (!entry->DigestSize &&
+       !a_Cache_get_digest(entry->url, &entry->Digest, &entry->DigestSize))
+      return NULL;
+   for (i = 0; (e = dList_nth_data(CachedIMGs, i)); ++i) {
+      if (e != entry && !e->Twin && (e->Flags & DIF_Valid) &&
+          e->State == DIC_Close && e->v_imgbuf &&
+          e->DigestSize == entry->DigestSize && e->Digest == entry->Digest &&
+          a_Cache_same_body(entry->url, e->url))
+         return e;
+   }
+   return NULL;
+}
+
+/*
+ * Is the data of 'entry' enough for 'Image'? It isn't when the entry was
+ * decoded at a reduced size, and the image is going to be shown larger.
+ */
+static bool_t Dicache_fits(DICacheEntry *entry, DilloImage *Image)
+{
+   uint_t w, h;
+
+   if (entry->width == entry->OrigWidth && entry->height == entry->OrigHeight)
+      return TRUE;
+   return a_Image_get_display_size(Image, entry->OrigWidth, entry->OrigHeight,
+                                   &w, &h) &&
+          w <= entry->width && h <= entry->height;
+}
+
+/*
+ * Make 'entry' show the imgbuf of 'twin' instead of its own.
+ * 'twin' stays while 'entry' refers to it.
+ */
+static void Dicache_share_twin(DICacheEntry *entry, DICacheEntry *twin)
+{
+   _MSG("Dicache: %s shows the image of %s\n", URL_STR(entry->url),
+        URL_STR(twin->url));
+   if (entry->v_imgbuf && !a_Imgbuf_last_reference(entry->v_imgbuf)) {
+      /* an image still shows it: it counts until it goes */
+      entry->v_replaced = entry->v_imgbuf;
+   } else {
+      a_Imgbuf_unref(entry->v_imgbuf);
+      dicache_size_total -= entry->TotalSize;
+      entry->TotalSize = 0;
+   }
+   entry->v_imgbuf = twin->v_imgbuf;
+   entry->width = twin->width;
+   entry->height = twin->height;
+   entry->OrigWidth = twin->OrigWidth;
+   entry->OrigHeight = twin->OrigHeight;
+   entry->type = twin->type;
+   entry->State = DIC_Close;
+   entry->Twin = twin;
+   ++twin->RefCount;
+}
+
 /*
  * Invalidate this entry. This is used for the reloading mechanism.
  * Can't erase current versions, but a_Dicache_get_entry(url, DIC_Last)
@@ -214,6 +340,41 @@ void a_Dicache_invalidate_entry(const DilloUrl *Url)
 }
 
 
+/*
+ * Write to 'Image' the rows of the entry that it lacks
+ */
+static void Dicache_update_image(DICacheEntry *DicEntry, DilloImage *Image)
+{
+   uint_t i;
+
+   if (Image->height == 0 && DicEntry->State >= DIC_SetParms) {
+      /* Set parms */
+      a_Image_set_parms(
+         Image, DicEntry->v_imgbuf, DicEntry->url,
+         DicEntry->version, DicEntry->width, DicEntry->height,
+         DicEntry->type);
+   }
+   if (DicEntry->State == DIC_Write) {
+      if (DicEntry->ScanNumber == Image->ScanNumber) {
+         for (i = 0; i < DicEntry->height; ++i)
+            if (a_Bitvec_get_bit(DicEntry->BitVec, (int)i) &&
+                !a_Bitvec_get_bit(Image->BitVec, (int)i) )
+               a_Image_write(Image, i);
+      } else {
+         for (i = 0; i < DicEntry->height; ++i) {
+            if (a_Bitvec_get_bit(DicEntry->BitVec, (int)i) ||
+                !a_Bitvec_get_bit(Image->BitVec, (int)i)   ||
+                DicEntry->ScanNumber > Image->ScanNumber + 1) {
+               a_Image_write(Image, i);
+            }
+            if (!a_Bitvec_get_bit(DicEntry->BitVec, (int)i))
+               a_Bitvec_clear_bit(Image->BitVec, (int)i);
+         }
+         Image->ScanNumber = DicEntry->ScanNumber;
+      }
+   }
+}
+
 /* ------------------------------------------------------------------------- */
 
 /*
@@ -228,6 +389,11 @@ void a_Dicache_set_parms(DilloUrl *url, int version, DilloImage *Image,
 {
    DICacheEntry *DicEntry;
 
+   if (a_Imgpool_worker()) {
+      /* a decoder in the pool: this is done in the main thread */
+      a_Imgpool_set_parms(width, height, type, gamma);
+      return;
+   }
    _MSG("a_Dicache_set_parms (%s)\n", URL_STR(url));
    dReturn_if_fail ( Image != NULL && width && height );
    /* Find the DicEntry for this Image */
@@ -238,14 +404,12 @@ void a_Dicache_set_parms(DilloUrl *url, int version, DilloImage *Image,
 
    _MSG("  RefCount=%d version=%d\n", DicEntry->RefCount, DicEntry->version);
 
-   /* BUG: there's just one image-type now */
-   #define I_RGB 0
+   /* Indexed and gray images take a byte per pixel, the rest are RGB */
    DicEntry->v_imgbuf =
-      a_Imgbuf_new(Image->layout, I_RGB, width, height, gamma);
-
-   DicEntry->TotalSize = width * height * 3;
-   DicEntry->width = width;
-   DicEntry->height = height;
+      a_Imgbuf_new(Image->layout, type, width, height, gamma);
+   DicEntry->TotalSize = a_Imgbuf_mem_size(DicEntry->v_imgbuf);
+   DicEntry->width = DicEntry->OrigWidth = width;
+   DicEntry->height = DicEntry->OrigHeight = height;
    DicEntry->type = type;
    DicEntry->BitVec = a_Bitvec_new((int)height);
    DicEntry->State = DIC_SetParms;
@@ -253,6 +417,29 @@ void a_Dicache_set_parms(DilloUrl *url, int version, DilloImage *Image,
    dicache_size_total += DicEntry->TotalSize;
 }
 
+/*
+ * The decoder reduced the image, whose size is 'width' x 'height', to the
+ * size it told a_Dicache_set_parms().
+ */
+void a_Dicache_set_orig_size(DilloUrl *url, int version,
+                             uint_t width, uint_t height)
+{
+   DICacheEntry *DicEntry;
+
+   if (a_Imgpool_worker()) {
+      a_Imgpool_set_orig_size(width, height);
+      return;
+   }
+   DicEntry = a_Dicache_get_entry(url, version);
+   dReturn_if_fail ( DicEntry != NULL && DicEntry->v_imgbuf != NULL );
+
+   _MSG("Dicache: %s decoded at %ux%u of %ux%u\n", URL_STR(url),
+        DicEntry->width, DicEntry->height, width, height);
+   DicEntry->OrigWidth = width;
+   DicEntry->OrigHeight = height;
+   a_Imgbuf_set_orig_size(DicEntry->v_imgbuf, width, height);
+}
+
 /*
  * Implement the set_cmap method for the Image
  */
@@ -260,19 +447,28 @@ void a_Dicache_set_cmap(DilloUrl *url, int version, int bg_color,
                         const uchar_t *cmap, uint_t num_colors,
                         int num_colors_max, int bg_index)
 {
-   DICacheEntry *DicEntry = a_Dicache_get_entry(url, version);
+   DICacheEntry *DicEntry;
+   uchar_t *map;
 
+   if (a_Imgpool_worker()) {
+      a_Imgpool_set_cmap(bg_color, cmap, num_colors, num_colors_max,
+                         bg_index);
+      return;
+   }
    _MSG("a_Dicache_set_cmap\n");
-   dReturn_if_fail ( DicEntry != NULL );
+   DicEntry = a_Dicache_get_entry(url, version);
+   dReturn_if_fail ( DicEntry != NULL && DicEntry->v_imgbuf != NULL );
 
-   dFree(DicEntry->cmap);
-   DicEntry->cmap = dNew0(uchar_t, 3 * num_colors_max);
-   memcpy(DicEntry->cmap, cmap, 3 * num_colors);
+   /* The imgbuf keeps its own copy */
+   map = dNew0(uchar_t, 3 * num_colors_max);
+   memcpy(map, cmap, 3 * num_colors);
    if (bg_index >= 0 && (uint_t)bg_index < num_colors) {
-      DicEntry->cmap[bg_index * 3]     = (bg_color >> 16) & 0xff;
-      DicEntry->cmap[bg_index * 3 + 1] = (bg_color >> 8) & 0xff;
-      DicEntry->cmap[bg_index * 3 + 2] = (bg_color) & 0xff;
+      map[bg_index * 3]     = (bg_color >> 16) & 0xff;
+      map[bg_index * 3 + 1] = (bg_color >> 8) & 0xff;
+      map[bg_index * 3 + 2] = (bg_color) & 0xff;
    }
+   a_Imgbuf_set_cmap(DicEntry->v_imgbuf, map, num_colors_max);
+   dFree(map);
 
    DicEntry->State = DIC_SetCmap;
 }
@@ -284,6 +480,10 @@ void a_Dicache_new_scan(const DilloUrl *url, int version)
 {
    DICacheEntry *DicEntry;
 
+   if (a_Imgpool_worker()) {
+      a_Imgpool_new_scan();
+      return;
+   }
    _MSG("a_Dicache_new_scan\n");
    dReturn_if_fail ( url != NULL );
    DicEntry = a_Dicache_get_entry(url, version);
@@ -307,6 +507,10 @@ void a_Dicache_write(DilloUrl *url, int version, const uchar_t *buf, uint_t Y)
 {
    DICacheEntry *DicEntry;
 
+   if (a_Imgpool_worker()) {
+      a_Imgpool_write(buf, Y);
+      return;
+   }
    _MSG("a_Dicache_write\n");
    DicEntry = a_Dicache_get_entry(url, version);
    dReturn_if_fail ( DicEntry != NULL );
@@ -314,20 +518,60 @@ void a_Dicache_write(DilloUrl *url, int version, const uchar_t *buf, uint_t Y)
 
    /* update the common buffer in the imgbuf */
    a_Imgbuf_update(DicEntry->v_imgbuf, buf, DicEntry->type,
-                   DicEntry->cmap, DicEntry->width, DicEntry->height, Y);
+                   DicEntry->width, DicEntry->height, Y);
 
    a_Bitvec_set_bit(DicEntry->BitVec, (int)Y);
    DicEntry->State = DIC_Write;
 }
 
+/*
+ * The pool decoded the whole image: show it to the clients of the entry,
+ * and close those the cache is done with.
+ */
+static void Dicache_job_close(DICacheEntry *DicEntry)
+{
+   DilloUrl *url = a_Url_dup(DicEntry->url);
+   int version = DicEntry->version, unrefs = 0;
+   Dlist *clients = DicEntry->Clients;
+   DicacheClient *dc;
+
+   a_Imgpool_job_cancel(DicEntry->Job);
+   DicEntry->Job = NULL;
+   DicEntry->Clients = NULL;
+   dList_remove(DecodingIMGs, DicEntry);
+
+   while ((dc = dList_nth_data(clients, 0))) {
+      dList_remove(clients, dc);
+      Dicache_update_image(DicEntry, dc->Image);
+      if (dc->Closed) {
+         a_Image_close(dc->Image);
+         a_Bw_close_client(dc->bw, dc->Key);
+         ++unrefs;
+      }
+      a_Image_unref(dc->Image);
+      dFree(dc);
+   }
+   dList_free(clients);
+
+   /* a_Dicache_unref() may free DicEntry */
+   while (unrefs-- > 0)
+      a_Dicache_unref(url, version);
+   a_Url_free(url);
+}
+
 /*
  * Implement the close method of the decoding process
+ * ('Client' is NULL when the decoder ran in the pool)
  */
 void a_Dicache_close(DilloUrl *url, int version, CacheClient_t *Client)
 {
-   DilloWeb *Web = Client->Web;
-   DICacheEntry *DicEntry = a_Dicache_get_entry(url, version);
+   DICacheEntry *DicEntry;
 
+   if (a_Imgpool_worker()) {
+      a_Imgpool_close();
+      return;
+   }
+   DicEntry = a_Dicache_get_entry(url, version);
    dReturn_if_fail ( DicEntry != NULL );
 
    /* a_Dicache_unref() may free DicEntry */
@@ -337,19 +581,86 @@ void a_Dicache_close(DilloUrl *url, int version, CacheClient_t *Client)
         DicEntry->v_imgbuf, DicEntry->Decoder, DicEntry->DecoderData);
 
    if (DicEntry->State < DIC_Close) {
+      DICacheEntry *twin;
+
       DicEntry->State = DIC_Close;
-      dFree(DicEntry->cmap);
-      DicEntry->cmap = NULL;
       DicEntry->Decoder = NULL;
       DicEntry->DecoderData = NULL;
+      /* The Image keeps the imgbuf it got, but those that come later will
+       * share the one of the same data, and this one can go. */
+      if (DicEntry->v_imgbuf && (twin = Dicache_find_twin(DicEntry)) &&
+          twin->width == DicEntry->width && twin->height == DicEntry->height)
+         Dicache_share_twin(DicEntry, twin);
+   }
+   if (DicEntry->Job) {
+      Dicache_job_close(DicEntry);
+      return;
    }
    a_Dicache_unref(url, version);
 
-   a_Bw_close_client(Web->bw, Client->Key);
+   a_Bw_close_client(((DilloWeb *)Client->Web)->bw, Client->Key);
+}
+
+/*
+ * Show what the pool decoded so far to the clients of the entry
+ */
+void a_Dicache_update(const DilloUrl *url, int version)
+{
+   DICacheEntry *DicEntry = a_Dicache_get_entry(url, version);
+   DicacheClient *dc;
+   int i;
+
+   dReturn_if (DicEntry == NULL || DicEntry->v_imgbuf == NULL);
+   for (i = 0; (dc = dList_nth_data(DicEntry->Clients, i)); ++i)
+      Dicache_update_image(DicEntry, dc->Image);
+}
+
+/*
+ * The cache stops client 'Key': forget it, if the pool decodes its image.
+ * (The cache unrefs the entries of the clients it still has.)
+ */
+void a_Dicache_stop_client(int Key)
+{
+   DICacheEntry *DicEntry;
+   DicacheClient *dc;
+   int i, j;
+
+   for (i = 0; (DicEntry = dList_nth_data(DecodingIMGs, i)); ++i) {
+      for (j = 0; (dc = dList_nth_data(DicEntry->Clients, j)); ++j) {
+         if (dc->Key == Key) {
+            dList_remove(DicEntry->Clients, dc);
+            a_Image_unref(dc->Image);
+            if (dc->Closed)
+               a_Dicache_unref(DicEntry->url, DicEntry->version);
+            dFree(dc);
+            return;
+         }
+      }
+   }
 }
 
 /* ------------------------------------------------------------------------- */
 
+/*
+ * Attach a decoder to a new entry. It runs in the pool, when there's one.
+ */
+static void Dicache_set_decoder(DICacheEntry *DicEntry, DilloImage *Image,
+                                void *(*decoder_new)(DilloImage *,
+                                                     DilloUrl *, int),
+                                CA_Callback_t decoder)
+{
+   DicEntry->Job = a_Imgpool_job_new(decoder_new, decoder, Image,
+                                     DicEntry->url, DicEntry->version);
+   if (DicEntry->Job) {
+      DicEntry->Clients = dList_new(4);
+      dList_append(DecodingIMGs, DicEntry);
+   } else {
+      DicEntry->Decoder = decoder;
+      DicEntry->DecoderData =
+         decoder_new(Image, DicEntry->url, DicEntry->version);
+   }
+}
+
 /*
  * Generic MIME handler for GIF, JPEG and PNG.
  * Sets a_Dicache_callback as the cache-client,
@@ -376,29 +687,35 @@ static void *Dicache_image(int ImgType, const char *MimeType, void *Ptr,
    }
 
    DicEntry = a_Dicache_get_entry(web->url, DIC_Last);
+   if (DicEntry && DicEntry->State == DIC_Close &&
+       !Dicache_fits(DicEntry, web->Image)) {
+      /* It was decoded smaller than this one is shown: decode it again */
+      a_Dicache_invalidate_entry(web->url);
+      DicEntry = NULL;
+   }
    if (!DicEntry) {
+      DICacheEntry *twin;
+
       /* Create an entry for this image... */
       DicEntry = Dicache_add_entry(web->url);
-      /* Attach a decoder */
-      if (ImgType == DIC_Jpeg) {
-         DicEntry->Decoder = (CA_Callback_t)a_Jpeg_callback;
-         DicEntry->DecoderData =
-            a_Jpeg_new(web->Image, DicEntry->url, DicEntry->version);
+      /* Show the image decoded from the same data, or attach a decoder */
+      if ((twin = Dicache_find_twin(DicEntry)) &&
+          Dicache_fits(twin, web->Image)) {
+         Dicache_share_twin(DicEntry, twin);
+      } else if (ImgType == DIC_Jpeg) {
+         Dicache_set_decoder(DicEntry, web->Image, a_Jpeg_new,
+                             (CA_Callback_t)a_Jpeg_callback);
       } else if (ImgType == DIC_Gif) {
-         DicEntry->Decoder = (CA_Callback_t)a_Gif_callback;
-         DicEntry->DecoderData =
-            a_Gif_new(web->Image, DicEntry->url, DicEntry->version);
+         Dicache_set_decoder(DicEntry, web->Image, a_Gif_new,
+                             (CA_Callback_t)a_Gif_callback);
       } else if (ImgType == DIC_Png) {
-         DicEntry->Decoder = (CA_Callback_t)a_Png_callback;
-         DicEntry->DecoderData =
-            a_Png_new(web->Image, DicEntry->url, DicEntry->version);
+         Dicache_set_decoder(DicEntry, web->Image, a_Png_new,
+                             (CA_Callback_t)a_Png_callback);
       }
    } else {
       /* Repeated image */
       a_Dicache_ref(DicEntry->url, DicEntry->version);
    }
-   /* Survive three cleanup passes (set to zero = old behaviour). */
-   DicEntry->SurvCleanup = 3;
 
    *Data = DicEntry->DecoderData;
    *Call = (CA_Callback_t) a_Dicache_callback;
@@ -433,12 +750,57 @@ void *a_Dicache_jpeg_image(const char *Type, void *Ptr, CA_Callback_t *Call,
    return Dicache_image(DIC_Jpeg, Type, Ptr, Call, Data);
 }
 
+/*
+ * a_Dicache_callback() for an entry that the pool decodes: the data goes
+ * to the job, and what it decoded so far to the image.
+ */
+static void Dicache_job_callback(int Op, CacheClient_t *Client,
+                                 DICacheEntry *DicEntry)
+{
+   DilloWeb *Web = Client->Web;
+   DicacheClient *dc;
+   int i;
+
+   for (i = 0; (dc = dList_nth_data(DicEntry->Clients, i)); ++i)
+      if (dc->Key == Client->Key)
+         break;
+   if (!dc) {
+      dc = dNew(DicacheClient, 1);
+      dc->Image = Web->Image;
+      a_Image_ref(dc->Image);
+      dc->bw = Web->bw;
+      dc->Key = Client->Key;
+      dc->Closed = FALSE;
+      dList_append(DicEntry->Clients, dc);
+   }
+
+   if (Op == CA_Send) {
+      if (DicEntry->DecodedSize < Client->BufSize) {
+         a_Imgpool_job_feed(DicEntry->Job,
+                            (char *)Client->Buf + DicEntry->DecodedSize,
+                            Client->BufSize - DicEntry->DecodedSize);
+         DicEntry->DecodedSize = Client->BufSize;
+      }
+      if (DicEntry->v_imgbuf)
+         Dicache_update_image(DicEntry, Web->Image);
+   } else if (Op == CA_Close) {
+      /* a_Dicache_close() closes it, when the job is done */
+      dc->Closed = TRUE;
+      a_Imgpool_job_finish(DicEntry->Job);
+   } else if (Op == CA_Abort) {
+      dList_remove(DicEntry->Clients, dc);
+      a_Image_unref(dc->Image);
+      dFree(dc);
+      a_Image_abort(Web->Image);
+      a_Bw_close_client(Web->bw, Client->Key);
+   }
+}
+
 /*
  * This function is a cache client; (but feeds its clients from dicache)
  */
 void a_Dicache_callback(int Op, CacheClient_t *Client)
 {
-   uint_t i;
    DilloWeb *Web = Client->Web;
    DilloImage *Image = Web->Image;
    DICacheEntry *DicEntry = a_Dicache_get_entry(Web->url, DIC_Last);
@@ -449,6 +811,11 @@ void a_Dicache_callback(int Op, CacheClient_t *Client)
    if (Client->Version == 0)
       Client->Version = DicEntry->version;
 
+   if (DicEntry->Job) {
+      Dicache_job_callback(Op, Client, DicEntry);
+      return;
+   }
+
    /* Only call the decoder when necessary */
    if (Op == CA_Send && DicEntry->State < DIC_Close &&
        DicEntry->DecodedSize < Client->BufSize) {
@@ -464,32 +831,7 @@ void a_Dicache_callback(int Op, CacheClient_t *Client)
 
    /* when the data stream is not an image 'v_imgbuf' remains NULL */
    if (Op == CA_Send && DicEntry->v_imgbuf) {
-      if (Image->height == 0 && DicEntry->State >= DIC_SetParms) {
-         /* Set parms */
-         a_Image_set_parms(
-            Image, DicEntry->v_imgbuf, DicEntry->url,
-            DicEntry->version, DicEntry->width, DicEntry->height,
-            DicEntry->type);
-      }
-      if (DicEntry->State == DIC_Write) {
-         if (DicEntry->ScanNumber == Image->ScanNumber) {
-            for (i = 0; i < DicEntry->height; ++i)
-               if (a_Bitvec_get_bit(DicEntry->BitVec, (int)i) &&
-                   !a_Bitvec_get_bit(Image->BitVec, (int)i) )
-                  a_Image_write(Image, i);
-         } else {
-            for (i = 0; i < DicEntry->height; ++i) {
-               if (a_Bitvec_get_bit(DicEntry->BitVec, (int)i) ||
-                   !a_Bitvec_get_bit(Image->BitVec, (int)i)   ||
-                   DicEntry->ScanNumber > Image->ScanNumber + 1) {
-                  a_Image_write(Image, i);
-               }
-               if (!a_Bitvec_get_bit(DicEntry->BitVec, (int)i))
-                  a_Bitvec_clear_bit(Image->BitVec, (int)i);
-            }
-            Image->ScanNumber = DicEntry->ScanNumber;
-         }
-      }
+      Dicache_update_image(DicEntry, Image);
    } else if (Op == CA_Close) {
       a_Image_close(Image);
       a_Bw_close_client(Web->bw, Client->Key);
@@ -502,26 +844,73 @@ void a_Dicache_callback(int Op, CacheClient_t *Client)
 /* ------------------------------------------------------------------------- */
 
 /*
- * Free the imgbuf (RGB data) of unused entries.
+ * Memory the decoded images take up: the imgbufs of the entries, and the
+ * scaled copies that are shown.
+ */
+static long Dicache_size(void)
+{
+   return dicache_size_total + a_Imgbuf_scaled_mem_size();
+}
+
+/*
+ * Nobody uses 'entry': no cache client, and nothing shows its imgbuf
+ * (nor the one its twin replaced).
+ */
+static bool_t Dicache_unused(DICacheEntry *entry)
+{
+   return entry->RefCount == 0 && !entry->Job && !entry->v_replaced &&
+          (!entry->v_imgbuf || a_Imgbuf_last_reference(entry->v_imgbuf));
+}
+
+/*
+ * Free the imgbufs (decoded data) of unused entries: those that can't be
+ * asked for anymore, and then the least recently used of the rest, while
+ * the images take up more than prefs.image_cache_size.
  */
 void a_Dicache_cleanup(void)
 {
+   DICacheEntry *entry, *lru;
    int i;
-   DICacheEntry *entry;
 
    for (i = 0; (entry = dList_nth_data(CachedIMGs, i)); ++i) {
-      _MSG(" SurvCleanup = %d\n", entry->SurvCleanup);
-      if (entry->RefCount == 0 &&
-          (!entry->v_imgbuf || a_Imgbuf_last_reference(entry->v_imgbuf))) {
-         if (--entry->SurvCleanup >= 0)
-            continue;  /* keep the entry one more pass */
-
-         /* free this unused entry */
+      if (entry->v_replaced && a_Imgbuf_last_reference(entry->v_replaced)) {
+         /* nothing shows the imgbuf its twin replaced anymore */
+         a_Imgbuf_unref(entry->v_replaced);
+         entry->v_replaced = NULL;
+         dicache_size_total -= entry->TotalSize;
+         entry->TotalSize = 0;
+      }
+      if (Dicache_unused(entry) &&
+          (entry->Flags & (DIF_Valid | DIF_Last)) != (DIF_Valid | DIF_Last)) {
+         /* invalidated, or an old version */
          Dicache_remove(entry->url, entry->version);
          --i; /* adjust counter */
       }
    }
-   MSG("a_Dicache_cleanup: length = %d\n", dList_length(CachedIMGs));
+
+   while (DICACHE_BUDGET > 0 && Dicache_size() > DICACHE_BUDGET) {
+      lru = NULL;
+      for (i = 0; (entry = dList_nth_data(CachedIMGs, i)); ++i)
+         if (Dicache_unused(entry) && (!lru || entry->LastUse < lru->LastUse))
+            lru = entry;
+      if (!lru)
+         break;
+      /* (a twin may become unused when the entries showing it go) */
+      Dicache_remove(lru->url, lru->version);
+   }
+
+   MSG("a_Dicache_cleanup: length = %d, size = %ld KB\n",
+       dList_length(CachedIMGs), Dicache_size() / 1024);
+}
+
+/*
+ * How much do the decoded images take up beyond prefs.image_cache_size?
+ * When they do, and cleaning up can't help, the pages should let go of
+ * the images they don't show (they're decoded again when needed).
+ */
+long a_Dicache_over_budget(void)
+{
+   return DICACHE_BUDGET > 0 ? MAX(Dicache_size() - DICACHE_BUDGET, 0) : 0;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -537,12 +926,16 @@ void a_Dicache_freeall(void)
    /* Remove all the dicache entries */
    while ((entry = dList_nth_data(CachedIMGs, dList_length(CachedIMGs)-1))) {
       dList_remove_fast(CachedIMGs, entry);
+      if (entry->Job)
+         Dicache_job_cancel(entry);
       a_Url_free(entry->url);
-      dFree(entry->cmap);
       a_Bitvec_free(entry->BitVec);
-      a_Imgbuf_unref(entry->v_imgbuf);
+      if (!entry->Twin)
+         a_Imgbuf_unref(entry->v_imgbuf);
+      a_Imgbuf_unref(entry->v_replaced);
       dicache_size_total -= entry->TotalSize;
       dFree(entry);
    }
    dList_free(CachedIMGs);
+   dList_free(DecodingIMGs);
 }
@@ -30,12 +30,12 @@ typedef enum {
 typedef struct DICacheEntry {
    DilloUrl *url;          /* Image URL for this entry */
    DilloImgType type;      /* Image type */
-   uint_t width, height;   /* As taken from image data */
+   uint_t width, height;   /* As decoded */
+   uint_t OrigWidth, OrigHeight; /* As taken from image data */
    short Flags;            /* See Flags */
-   short SurvCleanup;      /* Cleanup-pass survival for unused images */
-   uchar_t *cmap;          /* Color map */
+   uint_t LastUse;         /* When it was last asked for (LRU order) */
    void *v_imgbuf;         /* Void pointer to an Imgbuf object */
-   uint_t TotalSize;       /* Amount of memory the image takes up */
+   uint_t TotalSize;       /* Amount of memory its own imgbuf takes up */
    uint_t ScanNumber;      /* Current decoding scan */
    bitvec_t *BitVec;       /* Bit vector for decoded rows */
    DicEntryState State;    /* Current status for this entry */
@@ -43,9 +43,18 @@ typedef struct DICacheEntry {
    int version;            /* Version number, used for different
                               versions of the same URL image */
 
+   uint64_t Digest;        /* Of the image data, once it's whole */
+   int DigestSize;         /* Size of that data (0 if not known yet) */
+   struct DICacheEntry *Twin; /* Entry of identical image data whose
+                                 imgbuf this one shows, or NULL */
+   void *v_replaced;       /* Its own imgbuf, replaced by the twin's but
+                              still shown, or NULL (counted in TotalSize) */
+
    uint_t DecodedSize;     /* Size of already decoded data */
    CA_Callback_t Decoder;  /* Client function */
    void *DecoderData;      /* Client function data */
+   void *Job;              /* ImgpoolJob decoding it instead, or NULL */
+   Dlist *Clients;         /* Cache clients shown as the job decodes */
 } DICacheEntry;
 
 
@@ -64,17 +73,22 @@ void a_Dicache_callback(int Op, CacheClient_t *Client);
 void a_Dicache_set_parms(DilloUrl *url, int version, DilloImage *Image,
                          uint_t width, uint_t height, DilloImgType type,
                          double gamma);
+void a_Dicache_set_orig_size(DilloUrl *url, int version,
+                             uint_t width, uint_t height);
 void a_Dicache_set_cmap(DilloUrl *url, int version, int bg_color,
                         const uchar_t *cmap, uint_t num_colors,
                         int num_colors_max, int bg_index);
 void a_Dicache_new_scan(const DilloUrl *url, int version);
 void a_Dicache_write(DilloUrl *url, int version, const uchar_t *buf, uint_t Y);
 void a_Dicache_close(DilloUrl *url, int version, CacheClient_t *Client);
+void a_Dicache_update(const DilloUrl *url, int version);
+void a_Dicache_stop_client(int Key);
 
 void a_Dicache_invalidate_entry(const DilloUrl *Url);
 DICacheEntry* a_Dicache_ref(const DilloUrl *Url, int version);
 void a_Dicache_unref(const DilloUrl *Url, int version);
 void a_Dicache_cleanup(void);
+long a_Dicache_over_budget(void);
 void a_Dicache_freeall(void);
 
 
@@ -50,6 +50,7 @@
 #include "IO/mime.h"
 #include "capi.h"
 #include "dicache.h"
+#include "imgpool.h"
 #include "cookies.h"
 #include "hsts.h"
 #include "domain.h"
@@ -482,6 +483,7 @@ int main(int argc, char **argv)
    a_Mime_init();
    a_Capi_init();
    a_Dicache_init();
+   a_Imgpool_init();
    a_Bw_init();
    a_Cookies_init();
    a_Hsts_init(Paths::getPrefsFP(PATHS_HSTS_PRELOAD));
@@ -601,6 +603,7 @@ int main(int argc, char **argv)
    a_Hsts_freeall();
    a_Cache_freeall();
    a_Dicache_freeall();
+   a_Imgpool_freeall();
    a_Http_freeall();
    a_Tls_freeall();
    a_Dns_freeall();
@@ -0,0 +1,510 @@
+/*
+ * File: diskcache.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * The disk tier of the cache: HTTP responses that outlive the session.
+ *
+ * Everything lives in ~/.dillo/cache. Each body is a file named after a
+ * hash of its contents and its size, so the same body (e.g., a script
+ * served under several URLs) is stored once. The "index" file maps URLs
+ * to their stored header and body file. It is read at startup, kept in
+ * memory, and written back on exit. Files that no entry refers to are
+ * removed at startup.
+ *
+ * Keys are URL strings without the fragment; the memory cache (cache.c)
+ * decides what is worth storing and when a stored response is fresh.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+
+#include "msg.h"
+#include "diskcache.h"
+
+/* A body bigger than this share of the budget isn't worth a disk slot */
+#define DISKCACHE_MAX_SHARE 4
+
+typedef struct {
+   char name[24];           /* file name: hash and size, in hex */
+   long size;
+   int refs;                /* entries that use this body */
+} BodyFile_t;
+
+typedef struct {
+   char *key;
+   char *header;            /* '\r'-stripped, ending with an empty line */
+   BodyFile_t *body;
+   time_t response_time;    /* when the response was received */
+   time_t last_used;
+} DiskEntry_t;
+
+/*
+ * Local data
+ */
+static char *cache_dir = NULL;   /* NULL while the disk cache is off */
+static Dlist *entries;           /* DiskEntry_t, sorted by key */
+static Dlist *bodies;            /* BodyFile_t, sorted by name */
+static long total_size;          /* of the body files */
+static long size_limit;
+static DiskcacheStats_t stats;
+
+
+static int Diskcache_entry_cmp(const void *v1, const void *v2)
+{
+   return strcmp(((const DiskEntry_t *)v1)->key,
+                 ((const DiskEntry_t *)v2)->key);
+}
+
+static int Diskcache_entry_by_key_cmp(const void *v1, const void *v2)
+{
+   return strcmp(((const DiskEntry_t *)v1)->key, (const char *)v2);
+}
+
+static int Diskcache_body_cmp(const void *v1, const void *v2)
+{
+   return strcmp(((const BodyFile_t *)v1)->name,
+                 ((const BodyFile_t *)v2)->name);
+}
+
+static int Diskcache_body_by_name_cmp(const void *v1, const void *v2)
+{
+   return strcmp(((const BodyFile_t *)v1)->name, (const char *)v2);
+}
+
+/*
+ * Name a body after its contents (64-bit FNV-1a hash, and size)
+ */
+static void Diskcache_body_name(const char *body, size_t size, char *name)
+{
+   uint64_t h = 0xcbf29ce484222325ULL;
+   size_t i;
+
+   for (i = 0; i < size; i++) {
+      h ^= (unsigned char)body[i];
+      h *= 0x100000001b3ULL;
+   }
+   snprintf(name, sizeof(((BodyFile_t *)0)->name), "%08lx%08lx-%lx",
+            (unsigned long)(h >> 32), (unsigned long)(h & 0xffffffff),
+            (unsigned long)size);
+}
+
+static char *Diskcache_path(const char *name)
+{
+   return dStrconcat(cache_dir, "/", name, NULL);
+}
+
+/*
+ * Take a reference to the body file called 'name', adding it to the list
+ * if it's new.
+ */
+static BodyFile_t *Diskcache_body_ref(const char *name, long size)
+{
+   BodyFile_t *b = dList_find_sorted(bodies, name, Diskcache_body_by_name_cmp);
+
+   if (!b) {
+      b = dNew0(BodyFile_t, 1);
+      strncpy(b->name, name, sizeof(b->name) - 1);
+      b->size = size;
+      dList_insert_sorted(bodies, b, Diskcache_body_cmp);
+      total_size += size;
+   }
+   b->refs++;
+   return b;
+}
+
+/*
+ * Drop a reference to a body file, removing the file with the last one.
+ */
+static void Diskcache_body_unref(BodyFile_t *b)
+{
+   char *path;
+
+   if (--b->refs == 0) {
+      path = Diskcache_path(b->name);
+      if (unlink(path) == -1 && errno != ENOENT)
+         MSG("Diskcache: can't remove %s: %s\n", path, dStrerror(errno));
+      dFree(path);
+      total_size -= b->size;
+      dList_remove(bodies, b);
+      dFree(b);
+   }
+}
+
+static void Diskcache_entry_free(DiskEntry_t *e)
+{
+   dList_remove(entries, e);
+   Diskcache_body_unref(e->body);
+   dFree(e->key);
+   dFree(e->header);
+   dFree(e);
+}
+
+/*
+ * Find the least recently used entry other than 'keep'.
+ */
+static DiskEntry_t *Diskcache_get_LRU(DiskEntry_t *keep)
+{
+   int i, n = dList_length(entries);
+   DiskEntry_t *e, *lru = NULL;
+
+   for (i = 0; i < n; i++) {
+      e = dList_nth_data(entries, i);
+      if (e != keep && (!lru || e->last_used < lru->last_used))
+         lru = e;
+   }
+   return lru;
+}
+
+/*
+ * Evict the least recently used entries until the bodies fit the budget.
+ */
+static void Diskcache_make_room(DiskEntry_t *keep)
+{
+   DiskEntry_t *lru;
+
+   while (total_size > size_limit && (lru = Diskcache_get_LRU(keep))) {
+      _MSG("Diskcache: evicting %s\n", lru->key);
+      Diskcache_entry_free(lru);
+      stats.evictions++;
+   }
+}
+
+/*
+ * Write a body file. The contents go to a temporary file first, so that
+ * an interrupted write doesn't leave a truncated body under a good name.
+ */
+static int Diskcache_write_body(const char *name, const char *body,
+                                size_t size)
+{
+   char *path = Diskcache_path(name), *tmp = dStrconcat(path, ".tmp", NULL);
+   size_t done = 0;
+   ssize_t n = 0;
+   int fd, ret = -1;
+
+   if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) != -1) {
+      while (done < size) {
+         if ((n = write(fd, body + done, size - done)) > 0)
+            done += n;
+         else if (n == 0 || errno != EINTR)
+            break;
+      }
+      if (close(fd) == 0 && done == size && rename(tmp, path) == 0)
+         ret = 0;
+   }
+   if (ret == -1) {
+      MSG("Diskcache: can't write %s: %s\n", path, dStrerror(errno));
+      unlink(tmp);
+   }
+   dFree(tmp);
+   dFree(path);
+   return ret;
+}
+
+/*
+ * Store a response. 'header' is the '\r'-stripped HTTP header, ending in
+ * an empty line; 'body' is the decoded body, as the memory cache holds it.
+ * Storing the same URL again replaces the previous entry.
+ */
+void a_Diskcache_store(const char *key, const char *header,
+                       time_t response_time, const char *body, size_t size)
+{
+   char name[sizeof(((BodyFile_t *)0)->name)];
+   DiskEntry_t *e;
+   BodyFile_t *b;
+
+   if (!cache_dir || (long)size > size_limit / DISKCACHE_MAX_SHARE ||
+       strpbrk(key, " \r\n"))
+      return;
+
+   Diskcache_body_name(body, size, name);
+   if (!dList_find_sorted(bodies, name, Diskcache_body_by_name_cmp)) {
+      if (Diskcache_write_body(name, body, size) == -1)
+         return;
+      stats.bytes_written += size;
+   }
+   b = Diskcache_body_ref(name, (long)size);
+
+   if ((e = dList_find_sorted(entries, key, Diskcache_entry_by_key_cmp))) {
+      Diskcache_body_unref(e->body);
+      dFree(e->header);
+   } else {
+      e = dNew0(DiskEntry_t, 1);
+      e->key = dStrdup(key);
+      dList_insert_sorted(entries, e, Diskcache_entry_cmp);
+   }
+   e->header = dStrdup(header);
+   e->body = b;
+   e->response_time = response_time;
+   e->last_used = time(NULL);
+   stats.stores++;
+
+   Diskcache_make_room(e);
+}
+
+/*
+ * Return the stored header for 'key' (NULL if there's none), and the time
+ * of that response in 'response_time'.
+ */
+const char *a_Diskcache_header(const char *key, time_t *response_time)
+{
+   DiskEntry_t *e;
+
+   if (!cache_dir ||
+       !(e = dList_find_sorted(entries, key, Diskcache_entry_by_key_cmp)))
+      return NULL;
+   if (response_time)
+      *response_time = e->response_time;
+   return e->header;
+}
+
+/*
+ * Read the stored body for 'key'.
+ * Return value: a new Dstr, or NULL if the body isn't there (any more).
+ */
+Dstr *a_Diskcache_body(const char *key)
+{
+   DiskEntry_t *e;
+   Dstr *ds = NULL;
+   char *path, buf[8192];
+   FILE *fp;
+   size_t n;
+
+   if (!cache_dir ||
+       !(e = dList_find_sorted(entries, key, Diskcache_entry_by_key_cmp)))
+      return NULL;
+
+   path = Diskcache_path(e->body->name);
+   if ((fp = fopen(path, "r"))) {
+      ds = dStr_sized_new(e->body->size + 1);
+      while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+         dStr_append_l(ds, buf, n);
+      if (ds->len != e->body->size) {
+         dStr_free(ds, 1);
+         ds = NULL;
+      }
+      fclose(fp);
+   }
+   if (ds) {
+      e->last_used = time(NULL);
+      stats.bodies_read++;
+      stats.bytes_read += ds->len;
+   } else {
+      MSG("Diskcache: lost the body of %s\n", key);
+      Diskcache_entry_free(e);
+   }
+   dFree(path);
+   return ds;
+}
+
+/*
+ * Forget the stored response for 'key'.
+ */
+void a_Diskcache_remove(const char *key)
+{
+   DiskEntry_t *e;
+
+   if (cache_dir &&
+       (e = dList_find_sorted(entries, key, Diskcache_entry_by_key_cmp)))
+      Diskcache_entry_free(e);
+}
+
+/*
+ * Load the index. Each entry is a "URL key" line, a
+ * "BODY name size response_time last_used" line, and the header, which
+ * ends with an empty line. Entries whose body is gone are skipped.
+ */
+static void Diskcache_load_index(void)
+{
+   char *filename = Diskcache_path("index"), *line, *key = NULL, *path;
+   char name[sizeof(((BodyFile_t *)0)->name)];
+   long size = -1, rtime, utime;
+   Dstr *header = dStr_new("");
+   struct stat st;
+   DiskEntry_t *e;
+   FILE *fp;
+
+   if (!(fp = fopen(filename, "r"))) {
+      dFree(filename);
+      dStr_free(header, 1);
+      return;
+   }
+   while ((line = dGetline(fp))) {
+      if (!key) {
+         if (!strncmp(line, "URL ", 4)) {
+            key = dStrndup(line + 4, strcspn(line + 4, "\n"));
+            size = -1;
+            dStr_truncate(header, 0);
+         }
+      } else if (size == -1) {
+         if (sscanf(line, "BODY %23s %ld %ld %ld", name, &size, &rtime,
+                    &utime) != 4 || size < 0) {
+            dFree(key);
+            key = NULL;
+         }
+      } else if (line[0] != '\n') {
+         dStr_append(header, line);
+      } else {
+         path = Diskcache_path(name);
+         if (header->len && stat(path, &st) == 0 && st.st_size == size &&
+             !dList_find_sorted(entries, key, Diskcache_entry_by_key_cmp)) {
+            dStr_append_c(header, '\n');
+            e = dNew0(DiskEntry_t, 1);
+            e->key = key;
+            e->header = dStrdup(header->str);
+            e->body = Diskcache_body_ref(name, size);
+            e->response_time = (time_t)rtime;
+            e->last_used = (time_t)utime;
+            dList_insert_sorted(entries, e, Diskcache_entry_cmp);
+         } else {
+            dFree(key);
+         }
+         dFree(path);
+         key = NULL;
+      }
+      dFree(line);
+   }
+   dFree(key);
+   fclose(fp);
+   dStr_free(header, 1);
+   dFree(filename);
+}
+
+/*
+ * Write the index (through a temporary file, like the bodies).
+ */
+static void Diskcache_save_index(void)
+{
+   char *filename = Diskcache_path("index"),
+        *tmp = dStrconcat(filename, ".tmp", NULL);
+   DiskEntry_t *e;
+   FILE *fp;
+   int i, fd, err;
+
+   if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1 ||
+       !(fp = fdopen(fd, "w"))) {
+      MSG("Diskcache: can't save the index in %s: %s\n", tmp,
+          dStrerror(errno));
+      if (fd != -1)
+         close(fd);
+   } else {
+      fprintf(fp, "# Dillo disk cache index, written on exit\n");
+      for (i = 0; (e = dList_nth_data(entries, i)); ++i) {
+         fprintf(fp, "URL %s\nBODY %s %ld %ld %ld\n%s", e->key, e->body->name,
+                 e->body->size, (long)e->response_time, (long)e->last_used,
+                 e->header);
+      }
+      err = ferror(fp);
+      if (fclose(fp) != 0 || err || rename(tmp, filename) != 0) {
+         MSG("Diskcache: can't save the index in %s\n", filename);
+         unlink(tmp);
+      }
+   }
+   dFree(tmp);
+   dFree(filename);
+}
+
+/*
+ * Remove the files that no entry refers to: bodies of entries that were
+ * dropped from the index, and temporary files of interrupted writes.
+ */
+static void Diskcache_remove_orphans(void)
+{
+   struct dirent *de;
+   char *path;
+   DIR *dir;
+
+   if (!(dir = opendir(cache_dir)))
+      return;
+   while ((de = readdir(dir))) {
+      if (de->d_name[0] == '.' || !strcmp(de->d_name, "index") ||
+          dList_find_sorted(bodies, de->d_name, Diskcache_body_by_name_cmp))
+         continue;
+      path = Diskcache_path(de->d_name);
+      _MSG("Diskcache: removing orphan %s\n", path);
+      unlink(path);
+      dFree(path);
+   }
+   closedir(dir);
+}
+
+/*
+ * Initialize the disk cache (it's off unless prefs.disk_cache_size is set)
+ */
+void a_Diskcache_init(void)
+{
+   if (prefs.disk_cache_size <= 0)
+      return;
+
+   cache_dir = dStrconcat(dGethomedir(), "/.dillo/cache", NULL);
+   if (mkdir(cache_dir, 0700) == -1 && errno != EEXIST) {
+      MSG("Diskcache: can't create %s: %s\n", cache_dir, dStrerror(errno));
+      dFree(cache_dir);
+      cache_dir = NULL;
+      return;
+   }
+   entries = dList_new(64);
+   bodies = dList_new(64);
+   size_limit = prefs.disk_cache_size * 1024L * 1024L;
+   Diskcache_load_index();
+   Diskcache_remove_orphans();
+   Diskcache_make_room(NULL);
+   _MSG("Diskcache: %d entries, %ld bytes\n", dList_length(entries),
+        total_size);
+}
+
+bool_t a_Diskcache_enabled(void)
+{
+   return cache_dir != NULL;
+}
+
+void a_Diskcache_stats(DiskcacheStats_t *st)
+{
+   *st = stats;
+   st->entries = cache_dir ? dList_length(entries) : 0;
+   st->files = cache_dir ? dList_length(bodies) : 0;
+   st->bytes = total_size;
+   st->limit = size_limit;
+}
+
+/*
+ * Save the index and free memory
+ */
+void a_Diskcache_freeall(void)
+{
+   DiskEntry_t *e;
+
+   if (!cache_dir)
+      return;
+   Diskcache_save_index();
+   /* the files stay: only the in-memory references go */
+   while ((e = dList_nth_data(entries, 0))) {
+      dList_remove(entries, e);
+      dFree(e->key);
+      dFree(e->header);
+      dFree(e);
+   }
+   while (dList_length(bodies)) {
+      void *b = dList_nth_data(bodies, 0);
+      dList_remove(bodies, b);
+      dFree(b);
+   }
+   dList_free(entries);
+   dList_free(bodies);
+   dFree(cache_dir);
+   cache_dir = NULL;
+   total_size = 0;
+}
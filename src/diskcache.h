@@ -0,0 +1,35 @@
+#ifndef __DISKCACHE_H__
+#define __DISKCACHE_H__
+
+#include <time.h>
+
+#include "d_size.h"
+#include "../dlib/dlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+typedef struct {
+   int entries;            /* URLs in the index */
+   int files;              /* body files (bodies are shared among URLs) */
+   long bytes;             /* size of the body files */
+   long limit;             /* prefs.disk_cache_size, in bytes */
+   int bodies_read, stores, evictions;
+   long bytes_read, bytes_written;
+} DiskcacheStats_t;
+
+void a_Diskcache_init(void);
+bool_t a_Diskcache_enabled(void);
+void a_Diskcache_store(const char *key, const char *header,
+                       time_t response_time, const char *body, size_t size);
+const char *a_Diskcache_header(const char *key, time_t *response_time);
+Dstr *a_Diskcache_body(const char *key);
+void a_Diskcache_remove(const char *key);
+void a_Diskcache_stats(DiskcacheStats_t *stats);
+void a_Diskcache_freeall(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* !__DISKCACHE_H__ */
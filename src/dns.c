@@ -10,101 +10,75 @@
  */
 
 /*
- * Non blocking pthread-handled Dns scheme
- */
-
-
-/*
- * Uncomment the following line for debugging or gprof profiling.
+ * Non blocking Dns scheme: names are looked up by the stub resolver
+ * (IO/resolv.c), which runs within the IO loop.
+ *
+ * The answers are kept in a hash table for as long as their TTL says
+ * (names that don't exist too, but briefly), and may be saved on exit to
+ * be used by the next run.
  */
-/* #undef D_DNS_THREADED */
-
-#ifdef D_DNS_THREADED
-#  include <pthread.h>
-#endif
-
 
-#include <assert.h>
-#include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
-#include <fcntl.h>
 #include <errno.h>
-#include <unistd.h>
-#include <stdlib.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "msg.h"
 #include "dns.h"
 #include "list.h"
-#include "IO/iowatch.hh"
-
+#include "prefs.h"
+#include "IO/resolv.h"
 
-/* Maximum dns resolving threads */
-#ifdef D_DNS_THREADED
-#  define D_DNS_MAX_SERVERS 4
-#else
-#  define D_DNS_MAX_SERVERS 1
-#endif
+#define DNS_RESOLV_CONF "/etc/resolv.conf"
+#define DNS_HOSTS_FILE  "/etc/hosts"
 
-typedef enum {
-   DNS_SERVER_IDLE,
-   DNS_SERVER_PROCESSING,
-   DNS_SERVER_RESOLVED,
-} DnsServerState_t;
+#define DNS_CACHE_BUCKETS 256   /* a power of two */
+#define DNS_DEFAULT_TTL   300   /* for answers that come without one */
 
-typedef struct {
-   int channel;            /* Index of this channel [0 based] */
-   DnsServerState_t state;
-   Dlist *addr_list;       /* IP address */
-   char *hostname;         /* Address to resolve */
-   int status;             /* errno code for resolving function */
-#ifdef D_DNS_THREADED
-   pthread_t th1;          /* Thread id */
-#endif
-} DnsServer;
-
-typedef struct {
+typedef struct GDnsCache GDnsCache;
+struct GDnsCache {
    char *hostname;         /* host name for cache */
-   Dlist *addr_list;       /* addresses of host */
-} GDnsCache;
+   Dlist *addr_list;       /* addresses of host; NULL if it doesn't exist */
+   time_t expires;
+   uint_t last_used;       /* to find the least recently used entry */
+   GDnsCache *next;        /* in the bucket */
+};
 
 typedef struct {
-   int channel;            /* -2 if waiting, otherwise index to dns_server[] */
    char *hostname;         /* The one we're resolving */
    DnsCallback_t cb_func;  /* callback function */
    void *cb_data;          /* extra data for the callback function */
 } GDnsQueue;
 
 
-/*
- * Forward declarations
- */
-static void Dns_timeout_client(int fd, void *data);
-
 /*
  * Local Data
  */
-static DnsServer dns_server[D_DNS_MAX_SERVERS];
-static int num_servers;
-static GDnsCache *dns_cache;
-static int dns_cache_size, dns_cache_size_max;
+static GDnsCache *dns_cache[DNS_CACHE_BUCKETS];
+static int dns_cache_size;
+static uint_t dns_cache_clock;
 static GDnsQueue *dns_queue;
 static int dns_queue_size, dns_queue_size_max;
-static int dns_notify_pipe[2];
+
+static struct {
+   int hits, negative_hits, misses, expired, evicted, loaded;
+} dns_stats;
 
 
 /* ----------------------------------------------------------------------
  *  Dns queue functions
  */
-static void Dns_queue_add(int channel, const char *hostname,
-                          DnsCallback_t cb_func, void *cb_data)
+static void Dns_queue_add(const char *hostname, DnsCallback_t cb_func,
+                          void *cb_data)
 {
    a_List_add(dns_queue, dns_queue_size, dns_queue_size_max);
-   dns_queue[dns_queue_size].channel = channel;
    dns_queue[dns_queue_size].hostname = dStrdup(hostname);
    dns_queue[dns_queue_size].cb_func = cb_func;
    dns_queue[dns_queue_size].cb_data = cb_data;
@@ -144,351 +118,375 @@ static void Dns_queue_remove(int index)
    }
 }
 
-/*
- * Debug function
- *
-void Dns_queue_print()
+/* ----------------------------------------------------------------------
+ *  Dns cache functions
+ */
+
+static uint_t Dns_cache_hash(const char *hostname)
 {
-   int i;
+   uint_t h = 2166136261u;   /* FNV-1a */
 
-   MSG("Queue: [");
-   for (i = 0; i < dns_queue_size; i++)
-      MSG("%d:%s ", dns_queue[i].channel, dns_queue[i].hostname);
-   MSG("]\n");
+   for ( ; *hostname; hostname++)
+      h = (h ^ (uchar_t)D_ASCII_TOLOWER(*hostname)) * 16777619u;
+   return h & (DNS_CACHE_BUCKETS - 1);
 }
- */
 
 /*
- *  Add an IP/hostname pair to Dns-cache
+ * Copy an address list, for those who keep it after the callback
  */
-static void Dns_cache_add(char *hostname, Dlist *addr_list)
+Dlist *a_Dns_addr_list_copy(Dlist *addr_list)
 {
-   a_List_add(dns_cache, dns_cache_size, dns_cache_size_max);
-   dns_cache[dns_cache_size].hostname = dStrdup(hostname);
-   dns_cache[dns_cache_size].addr_list = addr_list;
-   ++dns_cache_size;
-   _MSG("Cache objects: %d\n", dns_cache_size);
+   Dlist *copy = dList_new(dList_length(addr_list) + 1);
+   DilloHost *dh;
+   int i;
+
+   for (i = 0; (dh = dList_nth_data(addr_list, i)); ++i) {
+      DilloHost *c = dNew(DilloHost, 1);
+
+      *c = *dh;
+      dList_append(copy, c);
+   }
+   return copy;
 }
 
+void a_Dns_addr_list_free(Dlist *addr_list)
+{
+   int i;
+
+   for (i = 0; i < dList_length(addr_list); ++i)
+      dFree(dList_nth_data(addr_list, i));
+   dList_free(addr_list);
+}
 
 /*
- *  Initializer function
+ * Unlink an entry from its bucket, and free it
  */
-void a_Dns_init(void)
+static void Dns_cache_remove(GDnsCache *entry)
 {
-   int res, i;
-
-#ifdef D_DNS_THREADED
-   MSG("dillo_dns_init: Here we go! (threaded)\n");
-#else
-   MSG("dillo_dns_init: Here we go! (not threaded)\n");
-#endif
-
-   dns_queue_size = 0;
-   dns_queue_size_max = 16;
-   dns_queue = dNew(GDnsQueue, dns_queue_size_max);
-
-   dns_cache_size = 0;
-   dns_cache_size_max = 16;
-   dns_cache = dNew(GDnsCache, dns_cache_size_max);
-
-   num_servers = D_DNS_MAX_SERVERS;
-
-   res = pipe(dns_notify_pipe);
-   assert(res == 0);
-   fcntl(dns_notify_pipe[0], F_SETFL, O_NONBLOCK);
-   a_IOwatch_add_fd(dns_notify_pipe[0], DIO_READ, Dns_timeout_client, NULL);
-
-   /* Initialize servers data */
-   for (i = 0; i < num_servers; ++i) {
-      dns_server[i].channel = i;
-      dns_server[i].state = DNS_SERVER_IDLE;
-      dns_server[i].addr_list = NULL;
-      dns_server[i].hostname = NULL;
-      dns_server[i].status = 0;
-#ifdef D_DNS_THREADED
-      dns_server[i].th1 = (pthread_t) -1;
-#endif
-   }
+   GDnsCache **p = &dns_cache[Dns_cache_hash(entry->hostname)];
+
+   while (*p != entry)
+      p = &(*p)->next;
+   *p = entry->next;
+   dFree(entry->hostname);
+   if (entry->addr_list)
+      a_Dns_addr_list_free(entry->addr_list);
+   dFree(entry);
+   --dns_cache_size;
+}
 
-#ifdef ENABLE_IPV6
-   /* IPv6 test */
-   {
-      /* If the IPv6 address family is not available there is no point
-         wasting time trying to connect to v6 addresses. */
-      int fd = socket(AF_INET6, SOCK_STREAM, 0);
-      if (fd >= 0)
-         dClose(fd);
+/*
+ * Find the current entry for hostname, if any
+ */
+static GDnsCache *Dns_cache_find(const char *hostname)
+{
+   GDnsCache *entry;
+
+   for (entry = dns_cache[Dns_cache_hash(hostname)]; entry;
+        entry = entry->next) {
+      if (!dStrAsciiCasecmp(hostname, entry->hostname)) {
+         if (entry->expires <= time(NULL)) {
+            dns_stats.expired++;
+            Dns_cache_remove(entry);
+            return NULL;
+         }
+         entry->last_used = ++dns_cache_clock;
+         return entry;
+      }
    }
-#endif
+   return NULL;
 }
 
 /*
- * Allocate a host structure and add it to the list
+ * Make room for a new entry: drop the expired ones, or else the least
+ * recently used one.
  */
-
-static void Dns_note_hosts(Dlist *list, struct addrinfo *res0)
+static void Dns_cache_make_room(void)
 {
-   struct addrinfo *res;
-   DilloHost *dh;
-
-   for (res = res0; res; res = res->ai_next) {
-
-      if (res->ai_family == AF_INET) {
-         struct sockaddr_in *in_addr;
-
-         if (res->ai_addrlen < sizeof(struct sockaddr_in)) {
-            continue;
+   GDnsCache *entry, *next, *lru = NULL;
+   time_t now = time(NULL);
+   int i, n = dns_cache_size;
+
+   for (i = 0; i < DNS_CACHE_BUCKETS; i++) {
+      for (entry = dns_cache[i]; entry; entry = next) {
+         next = entry->next;
+         if (entry->expires <= now) {
+            dns_stats.expired++;
+            Dns_cache_remove(entry);
+         } else if (!lru || entry->last_used < lru->last_used) {
+            lru = entry;
          }
+      }
+   }
+   if (n == dns_cache_size && lru) {
+      dns_stats.evicted++;
+      Dns_cache_remove(lru);
+   }
+}
 
-         dh = dNew0(DilloHost, 1);
-         dh->af = AF_INET;
+/*
+ * Add a hostname and its addresses (or NULL, for a name that doesn't exist)
+ * to the Dns-cache, to be kept until 'expires'.
+ * Return value: TRUE if the cache took 'addr_list'.
+ */
+static bool_t Dns_cache_add(const char *hostname, Dlist *addr_list,
+                            time_t expires)
+{
+   GDnsCache *entry;
+   uint_t h;
+
+   if (prefs.dns_cache_size <= 0 || expires <= time(NULL))
+      return FALSE;
+   if ((entry = Dns_cache_find(hostname)))
+      Dns_cache_remove(entry);
+   while (dns_cache_size >= prefs.dns_cache_size)
+      Dns_cache_make_room();
+
+   h = Dns_cache_hash(hostname);
+   entry = dNew(GDnsCache, 1);
+   entry->hostname = dStrdup(hostname);
+   entry->addr_list = addr_list;
+   entry->expires = expires;
+   entry->last_used = ++dns_cache_clock;
+   entry->next = dns_cache[h];
+   dns_cache[h] = entry;
+   ++dns_cache_size;
+   _MSG("Cache objects: %d\n", dns_cache_size);
+   return TRUE;
+}
 
-         in_addr = (struct sockaddr_in*) res->ai_addr;
-         dh->alen = sizeof (struct in_addr);
-         memcpy(&dh->data[0], &in_addr->sin_addr.s_addr, dh->alen);
+/*
+ * How long to keep an answer, given its TTL (-1 if it didn't have one)
+ */
+static long Dns_cache_ttl(int status, long ttl)
+{
+   if (status == RESOLV_OK) {
+      if (prefs.dns_cache_ttl > 0)
+         return prefs.dns_cache_ttl;
+      return (ttl < 0) ? DNS_DEFAULT_TTL : ttl;
+   } else if (status == RESOLV_NOT_FOUND) {
+      return (ttl < 0) ? prefs.dns_negative_ttl :
+                         MIN(ttl, prefs.dns_negative_ttl);
+   }
+   return 0;   /* the name servers may answer next time */
+}
 
-         dList_append(list, dh);
+/*
+ * Load the answers saved by the last run (see dns_save_cache in dillorc).
+ * The file holds an "expiry_time hostname address..." line for each name.
+ */
+static void Dns_cache_load(void)
+{
+   char *filename = dStrconcat(dGethomedir(), "/.dillo/dns_cache", NULL);
+   char *line, *p, *tok, *hostname;
+   time_t now = time(NULL);
+   long expires;
+   Dlist *addr_list;
+   DilloHost *dh;
+   FILE *fp;
+
+   if ((fp = fopen(filename, "r"))) {
+      while ((line = dGetline(fp))) {
+         p = line;
+         if (line[0] != '#' && (tok = dStrsep(&p, " \n")) &&
+             (expires = strtol(tok, NULL, 10)) > now &&
+             (hostname = dStrsep(&p, " \n")) && *hostname) {
+            addr_list = dList_new(4);
+            while ((tok = dStrsep(&p, " \n"))) {
+               dh = dNew0(DilloHost, 1);
+               if (inet_pton(AF_INET, tok, dh->data) == 1) {
+                  dh->af = AF_INET;
+                  dh->alen = 4;
 #ifdef ENABLE_IPV6
-      } else if (res->ai_family == AF_INET6) {
-         struct sockaddr_in6 *in6_addr;
-
-         if (res->ai_addrlen < sizeof(struct sockaddr_in6)) {
-            continue;
-         }
-
-         dh = dNew0(DilloHost, 1);
-         dh->af = AF_INET6;
-
-         in6_addr = (struct sockaddr_in6*) res->ai_addr;
-         dh->alen = sizeof (struct in6_addr);
-         memcpy(&dh->data[0], &in6_addr->sin6_addr.s6_addr, dh->alen);
-
-         dList_append(list, dh);
+               } else if (inet_pton(AF_INET6, tok, dh->data) == 1) {
+                  dh->af = AF_INET6;
+                  dh->alen = 16;
 #endif
+               } else {
+                  dFree(dh);
+                  continue;
+               }
+               dList_append(addr_list, dh);
+            }
+            if (dList_length(addr_list) &&
+                Dns_cache_add(hostname, addr_list, (time_t)expires)) {
+               dns_stats.loaded++;
+            } else {
+               a_Dns_addr_list_free(addr_list);
+            }
+         }
+         dFree(line);
       }
+      fclose(fp);
    }
+   dFree(filename);
 }
 
 /*
- *  Server function (runs on its own thread)
+ * Save the answers that are still good. Like the history, they tell
+ * where the user has been, so the file is for the user's eyes only.
  */
-static void *Dns_server(void *data)
+static void Dns_cache_save(void)
 {
-   int channel = VOIDP2INT(data);
-   struct addrinfo hints, *res0;
-   int error;
-   Dlist *hosts;
-   size_t length, i;
+   char *filename = dStrconcat(dGethomedir(), "/.dillo/dns_cache", NULL);
    char addr_string[40];
-
-   memset(&hints, 0, sizeof(hints));
-#ifdef ENABLE_IPV6
-   hints.ai_family = AF_UNSPEC;
-#else
-   hints.ai_family = AF_INET;
-#endif
-   hints.ai_socktype = SOCK_STREAM;
-
-   hosts = dList_new(2);
-
-   _MSG("Dns_server: starting...\n ch: %d host: %s\n",
-        channel, dns_server[channel].hostname);
-
-   error = getaddrinfo(dns_server[channel].hostname, NULL, &hints, &res0);
-
-   if (error != 0) {
-      dns_server[channel].status = error;
-      if (error == EAI_NONAME)
-         MSG("DNS error: HOST_NOT_FOUND\n");
-      else if (error == EAI_AGAIN)
-         MSG("DNS error: TRY_AGAIN\n");
-#ifdef EAI_NODATA
-      /* Some FreeBSD don't have this anymore */
-      else if (error == EAI_NODATA)
-         MSG("DNS error: NO_ADDRESS\n");
-#endif
-      else if (h_errno == EAI_FAIL)
-         MSG("DNS error: NO_RECOVERY\n");
+   time_t now = time(NULL);
+   GDnsCache *entry;
+   FILE *fp;
+   int i, j, fd;
+
+   if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1 ||
+       !(fp = fdopen(fd, "w"))) {
+      MSG("Dns: can't save the cache in %s: %s\n", filename,
+          dStrerror(errno));
+      if (fd != -1)
+         close(fd);
    } else {
-      Dns_note_hosts(hosts, res0);
-      dns_server[channel].status = 0;
-      freeaddrinfo(res0);
-   }
-
-   if (dList_length(hosts) > 0) {
-      dns_server[channel].status = 0;
-   } else {
-      dList_free(hosts);
-      hosts = NULL;
-   }
-
-   /* tell our findings */
-   MSG("Dns_server [%d]: %s is", channel,
-       dns_server[channel].hostname);
-   if ((length = dList_length(hosts))) {
-      for (i = 0; i < length; i++) {
-         a_Dns_dillohost_to_string(dList_nth_data(hosts, i),
-                                   addr_string, sizeof(addr_string));
-         MSG(" %s", addr_string);
+      fprintf(fp, "# Dillo DNS cache, written on exit\n");
+      for (i = 0; i < DNS_CACHE_BUCKETS; i++) {
+         for (entry = dns_cache[i]; entry; entry = entry->next) {
+            if (!entry->addr_list || entry->expires <= now)
+               continue;
+            fprintf(fp, "%ld %s", (long)entry->expires, entry->hostname);
+            for (j = 0; j < dList_length(entry->addr_list); j++) {
+               a_Dns_dillohost_to_string(
+                  dList_nth_data(entry->addr_list, j),
+                  addr_string, sizeof(addr_string));
+               fprintf(fp, " %s", addr_string);
+            }
+            fprintf(fp, "\n");
+         }
       }
-      MSG("\n");
-   } else {
-      MSG(" (nil)\n");
+      fclose(fp);
    }
-   dns_server[channel].addr_list = hosts;
-   dns_server[channel].state = DNS_SERVER_RESOLVED;
-
-   write(dns_notify_pipe[1], ".", 1);
-
-   return NULL;                 /* (avoids a compiler warning) */
+   dFree(filename);
 }
 
-
 /*
- *  Request function (spawn a server and let it handle the request)
+ * Make the "about:dns" page
  */
-static void Dns_server_req(int channel, const char *hostname)
+Dstr *a_Dns_stats_page(void)
 {
-#ifdef D_DNS_THREADED
-   static pthread_attr_t thrATTR;
-   static int thrATTRInitialized = 0;
-#endif
-
-   dns_server[channel].state = DNS_SERVER_PROCESSING;
-
-   dFree(dns_server[channel].hostname);
-   dns_server[channel].hostname = dStrdup(hostname);
-
-#ifdef D_DNS_THREADED
-   /* set the thread attribute to the detached state */
-   if (!thrATTRInitialized) {
-      pthread_attr_init(&thrATTR);
-      pthread_attr_setdetachstate(&thrATTR, PTHREAD_CREATE_DETACHED);
-      thrATTRInitialized = 1;
-   }
-   /* Spawn thread */
-   pthread_create(&dns_server[channel].th1, &thrATTR, Dns_server,
-                  INT2VOIDP(dns_server[channel].channel));
-#else
-   Dns_server(0);
-#endif
+   Dstr *ds = dStr_new("");
+   int lookups = dns_stats.hits + dns_stats.misses;
+
+   dStr_sprintfa(ds,
+      "<!DOCTYPE HTML PUBLIC '-//W3C//DTD HTML 4.01//EN'>\n"
+      "<html><head><title>DNS cache</title></head><body>\n"
+      "<h2>DNS cache</h2>\n<table border='1' cellpadding='3'>\n"
+      "<tr><td>Names cached<td>%d (at most %d)\n"
+      "<tr><td>Hits<td>%d (%d of them for names that don't exist)\n"
+      "<tr><td>Misses<td>%d\n"
+      "<tr><td>Hit rate<td>%d%%\n"
+      "<tr><td>Expired<td>%d\n"
+      "<tr><td>Evicted<td>%d\n"
+      "<tr><td>Loaded from the last run<td>%d\n"
+      "</table></body></html>\n",
+      dns_cache_size, prefs.dns_cache_size,
+      dns_stats.hits, dns_stats.negative_hits, dns_stats.misses,
+      lookups ? dns_stats.hits * 100 / lookups : 0,
+      dns_stats.expired, dns_stats.evicted, dns_stats.loaded);
+   return ds;
 }
 
+
 /*
- * Return the IP for the given hostname using a callback.
- * Side effect: a thread is spawned when hostname is not cached.
+ *  Initializer function
  */
-void a_Dns_resolve(const char *hostname, DnsCallback_t cb_func, void *cb_data)
+void a_Dns_init(void)
 {
-   int i, channel;
+   MSG("dillo_dns_init: Here we go!\n");
 
-   if (!hostname)
-      return;
-
-   /* check for cache hit. */
-   for (i = 0; i < dns_cache_size; i++)
-      if (!dStrAsciiCasecmp(hostname, dns_cache[i].hostname))
-         break;
-
-   if (i < dns_cache_size) {
-      /* already resolved, call the Callback immediately. */
-      cb_func(0, dns_cache[i].addr_list, cb_data);
-
-   } else if ((i = Dns_queue_find(hostname)) != -1) {
-      /* hit in queue, but answer hasn't come back yet. */
-      Dns_queue_add(dns_queue[i].channel, hostname, cb_func, cb_data);
+   dns_queue_size = 0;
+   dns_queue_size_max = 16;
+   dns_queue = dNew(GDnsQueue, dns_queue_size_max);
 
-   } else {
-      /* Never requested before -- we must resolve it! */
+   dns_cache_size = 0;
+   if (prefs.dns_save_cache)
+      Dns_cache_load();
 
-      /* Find a channel we can send the request to */
-      for (channel = 0; channel < num_servers; channel++)
-         if (dns_server[channel].state == DNS_SERVER_IDLE)
-            break;
-      if (channel < num_servers) {
-         /* Found a free channel! */
-         Dns_queue_add(channel, hostname, cb_func, cb_data);
-         Dns_server_req(channel, hostname);
-      } else {
-         /* We'll have to wait for a thread to finish... */
-         Dns_queue_add(-2, hostname, cb_func, cb_data);
-      }
-   }
+   a_Resolv_init(DNS_RESOLV_CONF, DNS_HOSTS_FILE);
 }
 
 /*
- * Give answer to all queued callbacks on this channel
+ * The resolver is done with a hostname: cache the answer, and give it to
+ * all the queued callbacks for the hostname.
  */
-static void Dns_serve_channel(int channel)
+static void Dns_resolved(int status, Dlist *addr_list, long ttl, void *data)
 {
-   int i;
-   DnsServer *srv = &dns_server[channel];
+   char *hostname = data, addr_string[40];
+   int i, length;
+   bool_t cached;
 
+   /* tell our findings */
+   MSG("Dns: %s is", hostname);
+   if ((length = dList_length(addr_list))) {
+      for (i = 0; i < length; i++) {
+         a_Dns_dillohost_to_string(dList_nth_data(addr_list, i),
+                                   addr_string, sizeof(addr_string));
+         MSG(" %s", addr_string);
+      }
+      MSG("\n");
+   } else {
+      MSG(" (nil)%s\n", status == RESOLV_NOT_FOUND ? " HOST_NOT_FOUND" :
+          status == RESOLV_NO_ANSWER ? " TRY_AGAIN" : "");
+   }
+
+   if (!length) {
+      if (addr_list)
+         dList_free(addr_list);
+      addr_list = NULL;
+      if (status == RESOLV_OK)
+         status = RESOLV_NOT_FOUND;
+   }
+   cached = Dns_cache_add(hostname, addr_list,
+                          time(NULL) + Dns_cache_ttl(status, ttl));
    for (i = 0; i < dns_queue_size; i++) {
-      if (dns_queue[i].channel == channel) {
-         dns_queue[i].cb_func(srv->status, srv->addr_list,
-                              dns_queue[i].cb_data);
+      if (!dStrAsciiCasecmp(dns_queue[i].hostname, hostname)) {
+         DnsCallback_t cb_func = dns_queue[i].cb_func;
+         void *cb_data = dns_queue[i].cb_data;
+
          Dns_queue_remove(i);
          --i;
+         cb_func(status, addr_list, cb_data);
       }
    }
+   if (addr_list && !cached)
+      a_Dns_addr_list_free(addr_list);
+   dFree(hostname);
 }
 
 /*
- * Assign free channels to waiting clients (-2)
+ * Return the IP for the given hostname using a callback.
+ * Side effect: the resolver is asked when hostname is not cached.
  */
-static void Dns_assign_channels(void)
+void a_Dns_resolve(const char *hostname, DnsCallback_t cb_func, void *cb_data)
 {
-   int ch, i, j;
-
-   for (ch = 0; ch < num_servers; ++ch) {
-      if (dns_server[ch].state == DNS_SERVER_IDLE) {
-         /* Find the next query in the queue (we're a FIFO) */
-         for (i = 0; i < dns_queue_size; i++)
-            if (dns_queue[i].channel == -2)
-               break;
-
-         if (i < dns_queue_size) {
-            /* assign this channel to every queued request
-             * with the same hostname*/
-            for (j = i; j < dns_queue_size; j++)
-               if (dns_queue[j].channel == -2 &&
-                   !dStrAsciiCasecmp(dns_queue[j].hostname,
-                                     dns_queue[i].hostname)) {
-                  dns_queue[j].channel = ch;
-               }
-            Dns_server_req(ch, dns_queue[i].hostname);
-         } else
-            return;
-      }
-   }
-}
+   GDnsCache *entry;
 
-/*
- * This function is called on the main thread and
- * reads the DNS results.
- */
-static void Dns_timeout_client(int fd, void *data)
-{
-   int i;
-   char buf[16];
+   if (!hostname)
+      return;
 
-   while (read(dns_notify_pipe[0], buf, sizeof(buf)) > 0);
+   if ((entry = Dns_cache_find(hostname))) {
+      /* already resolved, call the Callback immediately. */
+      dns_stats.hits++;
+      if (entry->addr_list) {
+         cb_func(RESOLV_OK, entry->addr_list, cb_data);
+      } else {
+         dns_stats.negative_hits++;
+         cb_func(RESOLV_NOT_FOUND, NULL, cb_data);
+      }
 
-   for (i = 0; i < num_servers; ++i) {
-      DnsServer *srv = &dns_server[i];
+   } else if (Dns_queue_find(hostname) != -1) {
+      /* hit in queue, but answer hasn't come back yet. */
+      Dns_queue_add(hostname, cb_func, cb_data);
 
-      if (srv->state == DNS_SERVER_RESOLVED) {
-         if (srv->addr_list != NULL) {
-            /* DNS succeeded, let's cache it */
-            Dns_cache_add(srv->hostname, srv->addr_list);
-         }
-         Dns_serve_channel(i);
-         srv->state = DNS_SERVER_IDLE;
-      }
+   } else {
+      /* Never requested before -- we must resolve it! */
+      dns_stats.misses++;
+      Dns_queue_add(hostname, cb_func, cb_data);
+      a_Resolv_lookup(hostname, Dns_resolved, dStrdup(hostname));
    }
-   Dns_assign_channels();
 }
 
 
@@ -500,18 +498,17 @@ static void Dns_timeout_client(int fd, void *data)
  */
 void a_Dns_freeall(void)
 {
-   int i, j;
+   int i;
 
-   for ( i = 0; i < dns_cache_size; ++i ){
-      dFree(dns_cache[i].hostname);
-      for ( j = 0; j < dList_length(dns_cache[i].addr_list); ++j)
-         dFree(dList_nth_data(dns_cache[i].addr_list, j));
-      dList_free(dns_cache[i].addr_list);
-   }
-   a_IOwatch_remove_fd(dns_notify_pipe[0], DIO_READ);
-   dClose(dns_notify_pipe[0]);
-   dClose(dns_notify_pipe[1]);
-   dFree(dns_cache);
+   MSG("Dns cache: %d hits (%d negative), %d misses, %d expired, "
+       "%d evicted\n", dns_stats.hits, dns_stats.negative_hits,
+       dns_stats.misses, dns_stats.expired, dns_stats.evicted);
+   if (prefs.dns_save_cache)
+      Dns_cache_save();
+   for (i = 0; i < DNS_CACHE_BUCKETS; ++i)
+      while (dns_cache[i])
+         Dns_cache_remove(dns_cache[i]);
+   a_Resolv_freeall();
 }
 
 /*
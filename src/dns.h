@@ -27,6 +27,9 @@ typedef struct {
 } DilloHost;
 
 void a_Dns_dillohost_to_string(DilloHost *host, char *dst, size_t size);
+Dlist *a_Dns_addr_list_copy(Dlist *addr_list);
+void a_Dns_addr_list_free(Dlist *addr_list);
+Dstr *a_Dns_stats_page(void);
 
 #ifdef __cplusplus
 }
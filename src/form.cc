@@ -2019,7 +2019,7 @@ static Embed *Html_input_image(DilloHtml *html, const char *tag, int tagsize)
 
    /* create new image and add it to the button */
    a_Html_common_image_attrs(html, tag, tagsize);
-   if ((Image = a_Html_image_new(html, tag, tagsize))) {
+   if ((Image = a_Html_image_new(html, tag, tagsize, false))) {
       // At this point, we know that Image->ir represents an image
       // widget. Notice that the order of the casts matters, because
       // of multiple inheritance.
@@ -35,6 +35,7 @@
 #include "menu.hh"
 #include "prefs.h"
 #include "capi.h"
+#include "dicache.h"
 #include "html.hh"
 #include "html_common.hh"
 #include "form.hh"
@@ -56,6 +57,9 @@
 
 #define TAB_SIZE 8
 
+/* How many of the first links of a page get their server preconnected */
+#define HTML_PRECONNECT_LINKS 8
+
 /*-----------------------------------------------------------------------------
  * Name spaces
  *---------------------------------------------------------------------------*/
@@ -397,14 +401,17 @@ DilloHtml::DilloHtml(BrowserWindow *p_bw, const DilloUrl *url,
    base_url = a_Url_dup(url);
    dw = NULL;
 
-   /* Init event receiver */
+   /* Init event receivers */
    linkReceiver.html = this;
    HT2LT(this)->connectLink (&linkReceiver);
+   layoutReceiver.html = this;
+   HT2LT(this)->connect (&layoutReceiver);
 
    a_Bw_add_doc(p_bw, this);
 
    /* Init for-parsing variables */
    Start_Buf = NULL;
+   Start_Buf_Ofs = 0;
    Start_Ofs = 0;
 
    _MSG("DilloHtml(): content type: %s\n", content_type);
@@ -530,15 +537,18 @@ DilloHtml::~DilloHtml()
 
 /*
  * Process the newly arrived html and put it into the page structure.
+ * 'Buf' holds the document from offset 'BufStart' on, which is never past
+ * what was left unparsed last time.
  * (This function is called by Html_callback whenever there's new data)
  */
-void DilloHtml::write(char *Buf, int BufSize, int Eof)
+void DilloHtml::write(char *Buf, int BufStart, int BufSize, int Eof)
 {
    int token_start;
-   char *buf = Buf + Start_Ofs;
-   int bufsize = BufSize - Start_Ofs;
+   char *buf = Buf + (Start_Ofs - BufStart);
+   int bufsize = BufStart + BufSize - Start_Ofs;
 
-   _MSG("DilloHtml::write BufSize=%d Start_Ofs=%d\n", BufSize, Start_Ofs);
+   _MSG("DilloHtml::write BufStart=%d BufSize=%d Start_Ofs=%d\n",
+        BufStart, BufSize, Start_Ofs);
 #if 0
    char *aux = dStrndup(Buf, BufSize);
    MSG(" {%s}\n", aux);
@@ -547,12 +557,18 @@ void DilloHtml::write(char *Buf, int BufSize, int Eof)
 
    /* Update Start_Buf. It may be used after the parser is stopped */
    Start_Buf = Buf;
+   Start_Buf_Ofs = BufStart;
 
    dReturn_if (dw == NULL);
    dReturn_if (stop_parser == true);
 
    token_start = Html_write_raw(this, buf, bufsize, Eof);
    Start_Ofs += token_start;
+
+   /* Count the lines parsed so far, as the buffer may not hold them
+    * next time */
+   CurrOfs = Start_Ofs;
+   getCurrLineNumber();
 }
 
 /*
@@ -568,9 +584,9 @@ int DilloHtml::getCurrLineNumber()
    /* Disable line counting for META hack. Buffers differ. */
    dReturn_val_if((InFlags & IN_META_HACK), -1);
 
-   ofs = CurrOfs;
+   ofs = CurrOfs - Start_Buf_Ofs;
    line = OldLine;
-   for (i = OldOfs; i < ofs; ++i)
+   for (i = OldOfs - Start_Buf_Ofs; i < ofs; ++i)
       if (p[i] == '\n' || (p[i] == '\r' && p[i+1] != '\n'))
          ++line;
    OldOfs = CurrOfs;
@@ -684,6 +700,120 @@ void DilloHtml::loadImages (const DilloUrl *pattern)
    }
 }
 
+/*
+ * An image, and how far it is from the viewport.
+ */
+typedef struct {
+   int dist;
+   DilloHtmlImage *hi;
+} Html_ImageDist;
+
+static int Html_image_dist_cmp(const void *a, const void *b)
+{
+   return ((const Html_ImageDist *)a)->dist -
+          ((const Html_ImageDist *)b)->dist;
+}
+
+/*
+ * Load the pending images that were laid out within prefs.lazy_images
+ * screens of the viewport (one, at least, for the dropped ones), the
+ * nearest ones first.
+ */
+void DilloHtml::loadNearImages ()
+{
+   dReturn_if (!prefs.load_images);
+   dReturn_if (a_Bw_expecting(bw));
+
+   dw::core::Layout *layout = HT2LT(this);
+   int range = MAX(prefs.lazy_images, 1) * layout->getHeightViewport ();
+   Html_ImageDist *pending = NULL;
+   int n = 0;
+
+   for (int i = 0; i < images->size(); i++) {
+      DilloHtmlImage *hi = images->get(i);
+
+      if (hi->image && hi->lazy) {
+         int dist = hi->dw->getViewportDistance();
+
+         if (dist >= 0 && dist <= range) {
+            if (!pending)
+               pending = dNew(Html_ImageDist, images->size() - i);
+            pending[n].dist = dist;
+            pending[n++].hi = hi;
+         }
+      }
+   }
+   dReturn_if (n == 0);
+
+   qsort(pending, n, sizeof(Html_ImageDist), Html_image_dist_cmp);
+   for (int i = 0; i < n; i++) {
+      DilloHtmlImage *hi = pending[i].hi;
+
+      hi->lazy = false;
+      if (Html_load_image(bw, hi->url, page_url, hi->image)) {
+         a_Image_unref (hi->image);
+         hi->image = NULL;  // web owns it now
+      }
+   }
+   dFree(pending);
+}
+
+/*
+ * When the decoded images take up more than prefs.image_cache_size, let
+ * the loaded images that are far from the viewport drop their data, the
+ * farthest first, until they fit. loadNearImages() asks for them again
+ * as they come near.
+ */
+void DilloHtml::dropFarImages ()
+{
+   long excess;
+
+   dReturn_if (!prefs.load_images || !(excess = a_Dicache_over_budget()));
+
+   dw::core::Layout *layout = HT2LT(this);
+   int range = 2 * MAX(prefs.lazy_images, 1) * layout->getHeightViewport ();
+   Html_ImageDist *distant = NULL;
+   int n = 0;
+
+   for (int i = 0; i < images->size(); i++) {
+      DilloHtmlImage *hi = images->get(i);
+
+      if (!hi->image && hi->in_page && hi->dw->getBuffer()) {
+         int dist = hi->dw->getViewportDistance();
+
+         if (dist > range) {
+            if (!distant)
+               distant = dNew(Html_ImageDist, images->size() - i);
+            distant[n].dist = dist;
+            distant[n++].hi = hi;
+         }
+      }
+   }
+   dReturn_if (n == 0);
+
+   qsort(distant, n, sizeof(Html_ImageDist), Html_image_dist_cmp);
+   /* images of the same URL share their root buffer: count it once */
+   Dlist *roots = dList_new(8);
+   while (n-- > 0 && excess > 0) {
+      DilloHtmlImage *hi = distant[n].hi;
+      dw::core::Imgbuf *root = hi->dw->getBuffer()->getRoot();
+
+      if (!dList_find(roots, root)) {
+         excess -= root->getMemSize();
+         dList_append(roots, root);
+      }
+      hi->dw->dropBuffer();
+      hi->image = a_Image_new(layout, (void*)(dw::core::ImgRenderer*)hi->dw,
+                              hi->bg_color);
+      a_Image_ref(hi->image);
+      hi->lazy = true;
+   }
+   dList_free(roots);
+   dFree(distant);
+   /* free the data nothing shows anymore */
+   a_Dicache_cleanup();
+}
+
 /*
  * Save URL in a vector (may be loaded later).
  */
@@ -694,6 +824,23 @@ void DilloHtml::addCssUrl(const DilloUrl *url)
    cssUrls->set(nu, a_Url_dup(url));
 }
 
+/*
+ * Layout and scrolling move images towards the viewport, and away.
+ */
+void DilloHtml::HtmlLayoutReceiver::canvasSizeChanged (int width, int ascent,
+                                                       int descent)
+{
+   html->dropFarImages();
+   html->loadNearImages();
+}
+
+void DilloHtml::HtmlLayoutReceiver::viewportChanged (int x, int y,
+                                                     int width, int height)
+{
+   html->dropFarImages();
+   html->loadNearImages();
+}
+
 bool DilloHtml::HtmlLinkReceiver::enter (Widget *widget, int link, int img,
                                          int x, int y)
 {
@@ -707,6 +854,7 @@ bool DilloHtml::HtmlLinkReceiver::enter (Widget *widget, int link, int img,
       _MSG(" Link  ENTER  notify...\n");
       Html_set_link_coordinates(html, link, x, y);
       a_UIcmd_set_msg(bw, "%s", URL_STR(html->links->get(link)));
+      a_Capi_preconnect(html->links->get(link));
    }
    return true;
 }
@@ -2190,7 +2338,14 @@ void a_Html_common_image_attrs(DilloHtml *html, const char *tag, int tagsize)
    dFree(height_ptr);
 }
 
-DilloImage *a_Html_image_new(DilloHtml *html, const char *tag, int tagsize)
+/*
+ * Make an image for the tag, and load it, or keep it for later.
+ * 'in_page' tells whether it's laid out in the page itself: images inside
+ * form buttons are in their own layout, so their distance to the page's
+ * viewport is unknown, and they're loaded at once.
+ */
+DilloImage *a_Html_image_new(DilloHtml *html, const char *tag, int tagsize,
+                             bool in_page)
 {
    bool load_now;
    char *alt_ptr;
@@ -2219,12 +2374,20 @@ DilloImage *a_Html_image_new(DilloHtml *html, const char *tag, int tagsize)
 
    DilloHtmlImage *hi = dNew(DilloHtmlImage, 1);
    hi->url = url;
+   hi->dw = dw;
+   hi->bg_color = image->bg_color;
+   hi->lazy = false;
+   hi->in_page = in_page;
    html->images->increase();
    html->images->set(html->images->size() - 1, hi);
 
-   load_now = prefs.load_images ||
-              !dStrAsciiCasecmp(URL_SCHEME(url), "data") ||
-              (a_Capi_get_flags_with_redirection(url) & CAPI_IsCached);
+   /* With lazy images, loadNearImages() requests it once it is laid out
+    * near the viewport */
+   if (prefs.load_images)
+      load_now = prefs.lazy_images <= 0 || !in_page;
+   else
+      load_now = !dStrAsciiCasecmp(URL_SCHEME(url), "data") ||
+                 (a_Capi_get_flags_with_redirection(url) & CAPI_IsCached);
 
    if (load_now && Html_load_image(html->bw, url, html->page_url, image)) {
       // hi->image is NULL if dillo tries to load the image immediately
@@ -2233,6 +2396,7 @@ DilloImage *a_Html_image_new(DilloHtml *html, const char *tag, int tagsize)
    } else {
       // otherwise a reference is kept in html->images
       hi->image = image;
+      hi->lazy = prefs.load_images && !load_now;
    }
 
    dFree(alt_ptr);
@@ -2333,7 +2497,7 @@ static void Html_tag_content_img(DilloHtml *html, const char *tag, int tagsize)
    if (URL_FLAGS(html->base_url) & URL_SpamSafe)
       return;
 
-   Image = a_Html_image_new(html, tag, tagsize);
+   Image = a_Html_image_new(html, tag, tagsize, true);
    if (!Image)
       return;
 
@@ -2777,6 +2941,9 @@ static void Html_tag_open_a(DilloHtml *html, const char *tag, int tagsize)
             html->styleEngine->setNonCssHint(CSS_PROPERTY_COLOR,
                                              CSS_TYPE_COLOR,
                                              html->non_css_link_color);
+         /* The first links are likely to be in view when the page shows */
+         if (html->links->size() < HTML_PRECONNECT_LINKS)
+            a_Capi_preconnect(url);
       }
 
       html->styleEngine->setNonCssHint (PROPERTY_X_LINK, CSS_TYPE_INTEGER,
@@ -3273,6 +3440,8 @@ static void Html_tag_open_meta(DilloHtml *html, const char *tag, int tagsize)
 static void Html_css_load_callback(int Op, CacheClient_t *Client)
 {
    _MSG("Html_css_load_callback: Op=%d\n", Op);
+   /* The stylesheet is read from the cache when it's complete */
+   Client->BufParsed = Client->BufStart + Client->BufSize;
    if (Op) { /* EOF */
       BrowserWindow *bw = ((DilloWeb *)Client->Web)->bw;
       /* Repush when we've got them all */
@@ -4236,10 +4405,11 @@ static void Html_callback(int Op, CacheClient_t *Client)
    DilloHtml *html = (DilloHtml*)Client->CbData;
 
    if (Op) { /* EOF */
-      html->write((char*)Client->Buf, Client->BufSize, 1);
+      html->write((char*)Client->Buf, Client->BufStart, Client->BufSize, 1);
       html->finishParsing(Client->Key);
    } else {
-      html->write((char*)Client->Buf, Client->BufSize, 0);
+      html->write((char*)Client->Buf, Client->BufStart, Client->BufSize, 0);
+      Client->BufParsed = html->Start_Ofs;
    }
 }
 
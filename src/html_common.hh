@@ -99,6 +99,10 @@ typedef enum {
 typedef struct {
    DilloUrl *url;
    DilloImage *image;
+   dw::Image *dw;      /* the widget that shows it */
+   int32_t bg_color;
+   bool lazy;          /* waiting to come near the viewport */
+   bool in_page;       /* laid out in the page (not in a form button) */
 } DilloHtmlImage;
 
 typedef struct {
@@ -142,6 +146,15 @@ private:
    };
    HtmlLinkReceiver linkReceiver;
 
+   class HtmlLayoutReceiver: public dw::core::Layout::Receiver {
+   public:
+      DilloHtml *html;
+
+      void canvasSizeChanged (int width, int ascent, int descent);
+      void viewportChanged (int x, int y, int width, int height);
+   };
+   HtmlLayoutReceiver layoutReceiver;
+
 public:  //BUG: for now everything is public
 
    BrowserWindow *bw;
@@ -152,6 +165,7 @@ public:  //BUG: for now everything is public
    /* Variables required at parsing time                                 */
    /* -------------------------------------------------------------------*/
    char *Start_Buf;
+   int Start_Buf_Ofs;       /* offset of Start_Buf in the document */
    int Start_Ofs;
    char *content_type, *charset;
    bool stop_parser;
@@ -209,7 +223,7 @@ public:
    ~DilloHtml();
    void bugMessage(const char *format, ... );
    void connectSignals(dw::core::Widget *dw);
-   void write(char *Buf, int BufSize, int Eof);
+   void write(char *Buf, int BufStart, int BufSize, int Eof);
    int getCurrLineNumber();
    void finishParsing(int ClientKey);
    int formNew(DilloHtmlMethod method, const DilloUrl *action,
@@ -217,6 +231,8 @@ public:
    DilloHtmlForm *getCurrentForm ();
    bool_t unloadedImages();
    void loadImages (const DilloUrl *pattern);
+   void loadNearImages ();
+   void dropFarImages ();
    void addCssUrl(const DilloUrl *url);
 
    // useful shortcuts
@@ -258,7 +274,8 @@ DilloUrl *a_Html_url_new(DilloHtml *html,
                          int use_base_url);
 
 void a_Html_common_image_attrs(DilloHtml *html, const char *tag, int tagsize);
-DilloImage *a_Html_image_new(DilloHtml *html, const char *tag, int tagsize);
+DilloImage *a_Html_image_new(DilloHtml *html, const char *tag, int tagsize,
+                             bool in_page);
 
 char *a_Html_parse_entities(DilloHtml *html, const char *token, int toksize);
 void a_Html_pop_tag(DilloHtml *html, int TagIdx);
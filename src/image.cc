@@ -18,6 +18,7 @@
 #include "msg.h"
 
 #include "image.hh"
+#include "imgpool.h"
 #include "dw/core.hh"
 #include "dw/image.hh"
 
@@ -152,3 +153,39 @@ void a_Image_abort(DilloImage *Image)
    I2IR(Image)->fatal();
 }
 
+/*
+ * Get the size an image of 'width' x 'height' is going to be shown at,
+ * when it is known before it's laid out.
+ * Return value: 1 if it is known, 0 otherwise.
+ */
+typedef struct {
+   DilloImage *Image;
+   uint_t width, height, *disp_width, *disp_height;
+} DisplaySizeArgs;
+
+static int Image_get_display_size_call(void *data)
+{
+   DisplaySizeArgs *args = (DisplaySizeArgs *)data;
+
+   return a_Image_get_display_size(args->Image, args->width, args->height,
+                                   args->disp_width, args->disp_height);
+}
+
+int a_Image_get_display_size(DilloImage *Image, uint_t width, uint_t height,
+                             uint_t *disp_width, uint_t *disp_height)
+{
+   int w, h;
+
+   if (a_Imgpool_worker()) {
+      // the layout is the main thread's
+      DisplaySizeArgs args = {Image, width, height, disp_width, disp_height};
+      return a_Imgpool_call(Image_get_display_size_call, &args);
+   }
+   if (!Image || !I2IR(Image)->getDisplaySize(width, height, &w, &h) ||
+       w <= 0 || h <= 0)
+      return 0;
+   *disp_width = w;
+   *disp_height = h;
+   return 1;
+}
+
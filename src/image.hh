@@ -75,6 +75,8 @@ void a_Image_set_parms(DilloImage *Image, void *v_imgbuf, DilloUrl *url,
 void a_Image_write(DilloImage *Image, uint_t y);
 void a_Image_close(DilloImage *Image);
 void a_Image_abort(DilloImage *Image);
+int a_Image_get_display_size(DilloImage *Image, uint_t width, uint_t height,
+                             uint_t *disp_width, uint_t *disp_height);
 
 
 #ifdef __cplusplus
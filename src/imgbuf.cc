@@ -13,6 +13,7 @@
 #include "imgbuf.hh"
 #include "dw/core.hh"
 #include "dw/image.hh"
+#include "dw/fltkcore.hh"
 
 using namespace dw::core;
 
@@ -24,27 +25,19 @@ static uchar_t *linebuf = NULL;
 
 
 /*
- * Decode 'buf' (an image line) into RGB format.
+ * Decode 'buf' (an image line) into the format of its imgbuf.
+ * Indexed and gray lines are kept as they are (one byte per pixel), the
+ * imgbuf expands them when they're drawn. The rest becomes RGB.
  */
-static uchar_t *Imgbuf_rgb_line(const uchar_t *buf,
-                                DilloImgType type, uchar_t *cmap,
+static uchar_t *Imgbuf_rgb_line(const uchar_t *buf, DilloImgType type,
                                 uint_t width, uint_t y)
 {
    uint_t x;
 
    switch (type) {
    case DILLO_IMG_TYPE_INDEXED:
-      if (cmap) {
-         for (x = 0; x < width; x++)
-            memcpy(linebuf + x * 3, cmap + buf[x] * 3, 3);
-      } else {
-         MSG_WARN("Gif:: image lacks a color map\n");
-      }
-      break;
    case DILLO_IMG_TYPE_GRAY:
-      for (x = 0; x < width; x++)
-         memset(linebuf + x * 3, buf[x], 3);
-      break;
+      return (uchar_t *)buf;
    case DILLO_IMG_TYPE_CMYK_INV:
       /*
        * We treat CMYK as if it were "RGBW", and it works. Everyone who is
@@ -103,8 +96,40 @@ void *a_Imgbuf_new(void *layout, int img_type, uint_t width, uint_t height,
       linebuf = (uchar_t*) dRealloc(linebuf, linebuf_size);
    }
 
-   return (void*)((Layout*)layout)->createImgbuf(Imgbuf::RGB, width, height,
-                                                 gamma);
+   Imgbuf::Type type;
+   switch (img_type) {
+   case DILLO_IMG_TYPE_INDEXED:
+      type = Imgbuf::INDEXED;
+      break;
+   case DILLO_IMG_TYPE_GRAY:
+      type = Imgbuf::GRAY;
+      break;
+   default:
+      type = Imgbuf::RGB;
+      break;
+   }
+   return (void*)((Layout*)layout)->createImgbuf(type, width, height, gamma);
+}
+
+/*
+ * Set the colormap of an indexed Imgbuf ('num_colors' RGB triplets)
+ */
+void a_Imgbuf_set_cmap(void *v_imgbuf, const uchar_t *cmap, int num_colors)
+{
+   int colors[256];
+
+   num_colors = MIN(num_colors, 256);
+   for (int i = 0; i < num_colors; i++)
+      colors[i] = cmap[3 * i] << 16 | cmap[3 * i + 1] << 8 | cmap[3 * i + 2];
+   ((Imgbuf*)v_imgbuf)->setCMap(colors, num_colors);
+}
+
+/*
+ * The Imgbuf holds the image at a reduced size; it is 'width' x 'height'
+ */
+void a_Imgbuf_set_orig_size(void *v_imgbuf, uint_t width, uint_t height)
+{
+   ((Imgbuf*)v_imgbuf)->setOrigSize(width, height);
 }
 
 /*
@@ -115,17 +140,33 @@ int a_Imgbuf_last_reference(void *v_imgbuf)
    return ((Imgbuf*)v_imgbuf)->lastReference () ? 1 : 0;
 }
 
+/*
+ * Memory the image data takes up, scaled buffers included
+ */
+long a_Imgbuf_mem_size(void *v_imgbuf)
+{
+   return v_imgbuf ? ((Imgbuf*)v_imgbuf)->getMemSize() : 0;
+}
+
+/*
+ * Memory the scaled buffers of all the Imgbufs take up
+ */
+long a_Imgbuf_scaled_mem_size(void)
+{
+   return dw::fltk::FltkImgbuf::getScaledMemSize();
+}
+
 /*
  * Update the root buffer of an imgbuf.
  */
 void a_Imgbuf_update(void *v_imgbuf, const uchar_t *buf, DilloImgType type,
-                     uchar_t *cmap, uint_t width, uint_t height, uint_t y)
+                     uint_t width, uint_t height, uint_t y)
 
 {
    dReturn_if_fail ( y < height );
 
    /* Decode 'buf' and copy it into the imgbuf */
-   uchar_t *newbuf = Imgbuf_rgb_line(buf, type, cmap, width, y);
+   uchar_t *newbuf = Imgbuf_rgb_line(buf, type, width, y);
    ((Imgbuf*)v_imgbuf)->copyRow(y, (byte *)newbuf);
 }
 
@@ -18,9 +18,13 @@ void a_Imgbuf_ref(void *v_imgbuf);
 void a_Imgbuf_unref(void *v_imgbuf);
 void *a_Imgbuf_new(void *v_ir, int img_type, uint_t width, uint_t height,
                    double gamma);
+void a_Imgbuf_set_cmap(void *v_imgbuf, const uchar_t *cmap, int num_colors);
+void a_Imgbuf_set_orig_size(void *v_imgbuf, uint_t width, uint_t height);
 int a_Imgbuf_last_reference(void *v_imgbuf);
+long a_Imgbuf_mem_size(void *v_imgbuf);
+long a_Imgbuf_scaled_mem_size(void);
 void a_Imgbuf_update(void *v_imgbuf, const uchar_t *buf, DilloImgType type,
-                     uchar_t *cmap, uint_t width, uint_t height, uint_t y);
+                     uint_t width, uint_t height, uint_t y);
 void a_Imgbuf_new_scan(void *v_imgbuf);
 
 #ifdef __cplusplus
@@ -0,0 +1,664 @@
+/*
+ * File: imgpool.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * A pool of threads that decode images.
+ *
+ * The decoders (gif.c, jpeg.c, png.c) keep all their state in their own
+ * data, so an image can be decoded away from the main thread. Each image
+ * gets a job, with its own copy of the image data as it arrives from the
+ * cache, and a worker runs the decoder on it a round at a time (a round
+ * takes whatever data came meanwhile). What the decoder tells the dicache
+ * is recorded instead, with the rows gathered in batches, and posted to
+ * the main thread through a pipe, where it's handed to the dicache just as
+ * if the decoder ran there. The few questions the decoders ask the rest of
+ * dillo are answered there too (a_Imgpool_call).
+ *
+ * A cancelled job posts nothing more: its rows are dropped as they're
+ * decoded, and the decoder is dropped after its current round.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "msg.h"
+#include "dicache.h"
+#include "imgpool.h"
+#include "IO/iowatch.hh"
+
+/* The most workers, however many cores there are */
+#define IMGPOOL_MAX_WORKERS  64
+/* Decoded rows are posted in batches of about this size */
+#define IMGPOOL_BATCH  (64 * 1024)
+
+typedef enum {
+   IMGPOOL_PARMS,
+   IMGPOOL_ORIG_SIZE,
+   IMGPOOL_CMAP,
+   IMGPOOL_NEW_SCAN,
+   IMGPOOL_ROWS,
+   IMGPOOL_CLOSE,
+   IMGPOOL_CALL
+} ImgpoolEventType;
+
+/*
+ * Something for the main thread to do for a job
+ */
+typedef struct {
+   ImgpoolEventType type;
+   uint_t width, height;      /* PARMS, ORIG_SIZE */
+   DilloImgType img_type;     /* PARMS */
+   double gamma;              /* PARMS */
+   int bg_color;              /* CMAP */
+   uint_t num_colors;         /* CMAP */
+   int num_colors_max;        /* CMAP */
+   int bg_index;              /* CMAP */
+   Dstr *data;                /* CMAP: the map; ROWS: the rows, one by one */
+   uint_t *ys;                /* ROWS: their numbers */
+   int rows, rows_max;        /* ROWS */
+   int (*func)(void *arg);    /* CALL */
+   void *arg;                 /* CALL */
+   int result;                /* CALL */
+   bool_t done;               /* CALL: answered */
+} ImgpoolEvent;
+
+struct ImgpoolJob {
+   DilloUrl *url;
+   int version;
+   DilloImage *Image;
+   CA_Callback_t Decoder;
+   void *DecoderData;         /* NULL once the decoder closed */
+
+   /* Under the pool's lock */
+   Dstr *input;               /* image data that came since the last round */
+   bool_t eof;                /* no more will come */
+   bool_t cancelled;          /* the dicache is done with this job */
+   bool_t queued;             /* in the queue */
+   bool_t running;            /* a worker has it */
+   bool_t posted;             /* in the posted list, or being handled */
+   Dlist *events;             /* for the main thread */
+
+   /* Only for the worker that runs the job */
+   Dstr *data;                /* all the image data the decoder got */
+   ImgpoolEvent *rows;        /* decoded rows not posted yet */
+   uint_t row_size;
+};
+
+static struct {
+   pthread_mutex_t lock;
+   pthread_cond_t work;       /* a job was queued, or quit */
+   pthread_cond_t answered;   /* a call was answered, or quit */
+   pthread_key_t current;     /* the job a worker is running */
+   pthread_t *workers;
+   int num_workers;
+   Dlist *queue;              /* jobs waiting for a worker */
+   Dlist *posted;             /* jobs with events for the main thread */
+   int notify[2];             /* a pipe to wake the main thread */
+   bool_t quit;
+} Pool;
+
+
+static void *Imgpool_worker(void *arg);
+static void Imgpool_notify_cb(int fd, void *data);
+
+/*
+ * Start a worker for each core.
+ * If none can start, the images are decoded in the main thread.
+ */
+void a_Imgpool_init(void)
+{
+   long cores = sysconf(_SC_NPROCESSORS_ONLN);
+   int i;
+
+   Pool.queue = dList_new(16);
+   Pool.posted = dList_new(16);
+   if (pipe(Pool.notify) == -1) {
+      MSG_ERR("Imgpool: can't create a pipe, decoding in the main thread\n");
+      return;
+   }
+   for (i = 0; i < 2; i++) {
+      fcntl(Pool.notify[i], F_SETFL,
+            fcntl(Pool.notify[i], F_GETFL) | O_NONBLOCK);
+      fcntl(Pool.notify[i], F_SETFD, FD_CLOEXEC);
+   }
+   pthread_mutex_init(&Pool.lock, NULL);
+   pthread_cond_init(&Pool.work, NULL);
+   pthread_cond_init(&Pool.answered, NULL);
+   pthread_key_create(&Pool.current, NULL);
+
+   cores = MIN(MAX(cores, 1), IMGPOOL_MAX_WORKERS);
+   Pool.workers = dNew(pthread_t, cores);
+   for (i = 0; i < cores; i++)
+      if (pthread_create(&Pool.workers[Pool.num_workers], NULL,
+                         Imgpool_worker, NULL) == 0)
+         Pool.num_workers++;
+   if (Pool.num_workers == 0) {
+      MSG_ERR("Imgpool: can't start workers, decoding in the main thread\n");
+      close(Pool.notify[0]);
+      close(Pool.notify[1]);
+      return;
+   }
+   a_IOwatch_add_fd(Pool.notify[0], DIO_READ, Imgpool_notify_cb, NULL);
+   _MSG("Imgpool: %d workers\n", Pool.num_workers);
+}
+
+static ImgpoolEvent *Imgpool_event_new(ImgpoolEventType type)
+{
+   ImgpoolEvent *ev = dNew0(ImgpoolEvent, 1);
+
+   ev->type = type;
+   return ev;
+}
+
+static void Imgpool_event_free(ImgpoolEvent *ev)
+{
+   if (ev->data)
+      dStr_free(ev->data, 1);
+   dFree(ev->ys);
+   dFree(ev);
+}
+
+/*
+ * Create a job that decodes with 'decoder', whose data 'decoder_new'
+ * creates here, for the 'version' of 'url' that 'Image' shows.
+ * Return NULL if there are no workers.
+ */
+ImgpoolJob *a_Imgpool_job_new(void *(*decoder_new)(DilloImage *, DilloUrl *,
+                                                    int),
+                              CA_Callback_t decoder, DilloImage *Image,
+                              const DilloUrl *url, int version)
+{
+   ImgpoolJob *job;
+
+   if (Pool.num_workers == 0)
+      return NULL;
+
+   job = dNew0(ImgpoolJob, 1);
+   job->url = a_Url_dup(url);
+   job->version = version;
+   job->Image = Image;
+   a_Image_ref(Image);
+   job->Decoder = decoder;
+   job->DecoderData = decoder_new(Image, job->url, version);
+   job->input = dStr_new("");
+   job->data = dStr_new("");
+   job->events = dList_new(8);
+   return job;
+}
+
+/*
+ * Free a job that no worker has anymore (main thread only)
+ */
+static void Imgpool_job_free(ImgpoolJob *job)
+{
+   ImgpoolEvent *ev;
+
+   if (job->DecoderData)
+      job->Decoder(CA_Abort, job->DecoderData);
+   while ((ev = dList_nth_data(job->events, 0))) {
+      dList_remove_fast(job->events, ev);
+      Imgpool_event_free(ev);
+   }
+   dList_free(job->events);
+   dStr_free(job->input, 1);
+   dStr_free(job->data, 1);
+   a_Image_unref(job->Image);
+   a_Url_free(job->url);
+   dFree(job);
+}
+
+/*
+ * Wake the main thread (under the lock)
+ */
+static void Imgpool_notify(void)
+{
+   ssize_t n;
+
+   /* (if the pipe is full, it's awake already) */
+   n = write(Pool.notify[1], "", 1);
+   (void)n;
+}
+
+/*
+ * Put the job in the queue, if it's not there or running (under the lock)
+ */
+static void Imgpool_queue(ImgpoolJob *job)
+{
+   if (!job->queued && !job->running && !job->cancelled) {
+      job->queued = TRUE;
+      dList_append(Pool.queue, job);
+      pthread_cond_signal(&Pool.work);
+   }
+}
+
+/*
+ * Let the main thread know the job has events, or is to be freed
+ * (under the lock)
+ */
+static void Imgpool_post_job(ImgpoolJob *job)
+{
+   if (!job->posted) {
+      job->posted = TRUE;
+      dList_append(Pool.posted, job);
+      if (dList_length(Pool.posted) == 1)
+         Imgpool_notify();
+   }
+}
+
+/*
+ * More image data came for the job
+ */
+void a_Imgpool_job_feed(ImgpoolJob *job, const char *buf, int len)
+{
+   if (len > 0) {
+      pthread_mutex_lock(&Pool.lock);
+      dStr_append_l(job->input, buf, len);
+      Imgpool_queue(job);
+      pthread_mutex_unlock(&Pool.lock);
+   }
+}
+
+/*
+ * All the image data came: the decoder can close
+ */
+void a_Imgpool_job_finish(ImgpoolJob *job)
+{
+   pthread_mutex_lock(&Pool.lock);
+   job->eof = TRUE;
+   Imgpool_queue(job);
+   pthread_mutex_unlock(&Pool.lock);
+}
+
+/*
+ * The dicache is done with the job: stop decoding, and free it as soon as
+ * no worker has it. Nothing more of it reaches the dicache.
+ */
+void a_Imgpool_job_cancel(ImgpoolJob *job)
+{
+   bool_t idle;
+
+   pthread_mutex_lock(&Pool.lock);
+   job->cancelled = TRUE;
+   if (job->queued) {
+      dList_remove(Pool.queue, job);
+      job->queued = FALSE;
+   }
+   idle = !job->running && !job->posted;
+   pthread_mutex_unlock(&Pool.lock);
+   if (idle)
+      Imgpool_job_free(job);
+}
+
+/* Workers ----------------------------------------------------------------- */
+
+static ImgpoolJob *Imgpool_current(void)
+{
+   return pthread_getspecific(Pool.current);
+}
+
+/*
+ * Is this a worker running a decoder?
+ */
+int a_Imgpool_worker(void)
+{
+   return Pool.num_workers > 0 && Imgpool_current() != NULL;
+}
+
+/*
+ * Post an event of the current job, unless it was cancelled
+ */
+static void Imgpool_post(ImgpoolJob *job, ImgpoolEvent *ev)
+{
+   pthread_mutex_lock(&Pool.lock);
+   if (job->cancelled) {
+      Imgpool_event_free(ev);
+   } else {
+      dList_append(job->events, ev);
+      Imgpool_post_job(job);
+   }
+   pthread_mutex_unlock(&Pool.lock);
+}
+
+/*
+ * Post the rows gathered so far (before any other event, to keep the order)
+ */
+static void Imgpool_flush(ImgpoolJob *job)
+{
+   ImgpoolEvent *ev = job->rows;
+
+   if (ev) {
+      job->rows = NULL;
+      Imgpool_post(job, ev);
+   }
+}
+
+void a_Imgpool_set_parms(uint_t width, uint_t height, DilloImgType type,
+                         double gamma)
+{
+   ImgpoolJob *job = Imgpool_current();
+   ImgpoolEvent *ev = Imgpool_event_new(IMGPOOL_PARMS);
+
+   ev->width = width;
+   ev->height = height;
+   ev->img_type = type;
+   ev->gamma = gamma;
+   /* the rows the decoder writes, as a_Imgbuf_update() takes them */
+   job->row_size = width *
+      (type == DILLO_IMG_TYPE_INDEXED || type == DILLO_IMG_TYPE_GRAY ? 1 :
+       type == DILLO_IMG_TYPE_CMYK_INV ? 4 : 3);
+   Imgpool_flush(job);
+   Imgpool_post(job, ev);
+}
+
+void a_Imgpool_set_orig_size(uint_t width, uint_t height)
+{
+   ImgpoolJob *job = Imgpool_current();
+   ImgpoolEvent *ev = Imgpool_event_new(IMGPOOL_ORIG_SIZE);
+
+   ev->width = width;
+   ev->height = height;
+   Imgpool_flush(job);
+   Imgpool_post(job, ev);
+}
+
+void a_Imgpool_set_cmap(int bg_color, const uchar_t *cmap, uint_t num_colors,
+                        int num_colors_max, int bg_index)
+{
+   ImgpoolJob *job = Imgpool_current();
+   ImgpoolEvent *ev = Imgpool_event_new(IMGPOOL_CMAP);
+
+   ev->bg_color = bg_color;
+   ev->num_colors = num_colors;
+   ev->num_colors_max = num_colors_max;
+   ev->bg_index = bg_index;
+   ev->data = dStr_sized_new(3 * num_colors + 1);
+   dStr_append_l(ev->data, (const char *)cmap, 3 * num_colors);
+   Imgpool_flush(job);
+   Imgpool_post(job, ev);
+}
+
+void a_Imgpool_new_scan(void)
+{
+   ImgpoolJob *job = Imgpool_current();
+
+   Imgpool_flush(job);
+   Imgpool_post(job, Imgpool_event_new(IMGPOOL_NEW_SCAN));
+}
+
+/*
+ * Gather a decoded row
+ */
+void a_Imgpool_write(const uchar_t *buf, uint_t y)
+{
+   ImgpoolJob *job = Imgpool_current();
+   ImgpoolEvent *ev = job->rows;
+
+   if (!ev) {
+      ev = job->rows = Imgpool_event_new(IMGPOOL_ROWS);
+      ev->data = dStr_sized_new(MIN(job->row_size * 16, IMGPOOL_BATCH) + 1);
+   }
+   if (ev->rows == ev->rows_max) {
+      ev->rows_max = MAX(ev->rows_max * 2, 16);
+      ev->ys = dRealloc(ev->ys, ev->rows_max * sizeof(uint_t));
+   }
+   ev->ys[ev->rows++] = y;
+   dStr_append_l(ev->data, (const char *)buf, job->row_size);
+   if (ev->data->len >= IMGPOOL_BATCH)
+      Imgpool_flush(job);
+}
+
+void a_Imgpool_close(void)
+{
+   ImgpoolJob *job = Imgpool_current();
+
+   Imgpool_flush(job);
+   Imgpool_post(job, Imgpool_event_new(IMGPOOL_CLOSE));
+}
+
+/*
+ * Have the main thread run 'func', and wait for its result.
+ * When this isn't a worker, just run it.
+ * Return 0 if the job is cancelled, or the pool is quitting.
+ */
+int a_Imgpool_call(int (*func)(void *arg), void *arg)
+{
+   ImgpoolJob *job;
+   ImgpoolEvent *ev;
+   int result;
+
+   if (!a_Imgpool_worker())
+      return func(arg);
+
+   job = Imgpool_current();
+   Imgpool_flush(job);
+   ev = Imgpool_event_new(IMGPOOL_CALL);
+   ev->func = func;
+   ev->arg = arg;
+   pthread_mutex_lock(&Pool.lock);
+   if (!job->cancelled && !Pool.quit) {
+      dList_append(job->events, ev);
+      Imgpool_post_job(job);
+      while (!ev->done && !Pool.quit)
+         pthread_cond_wait(&Pool.answered, &Pool.lock);
+      if (!ev->done)
+         dList_remove(job->events, ev);
+   }
+   result = ev->done ? ev->result : 0;
+   pthread_mutex_unlock(&Pool.lock);
+   Imgpool_event_free(ev);
+   return result;
+}
+
+/*
+ * Run a round of the job's decoder on the data that came
+ */
+static void Imgpool_run(ImgpoolJob *job, bool_t more, bool_t eof)
+{
+   CacheClient_t Client;
+
+   memset(&Client, 0, sizeof(Client));
+   Client.Url = job->url;
+   Client.Version = job->version;
+   Client.Buf = job->data->str;
+   Client.BufSize = job->data->len;
+   Client.CbData = job->DecoderData;
+
+   pthread_setspecific(Pool.current, job);
+   if (more)
+      job->Decoder(CA_Send, &Client);
+   if (eof) {
+      /* (the decoder frees its data) */
+      job->Decoder(CA_Close, &Client);
+      job->DecoderData = NULL;
+   }
+   Imgpool_flush(job);
+   pthread_setspecific(Pool.current, NULL);
+}
+
+static void *Imgpool_worker(void *arg)
+{
+   ImgpoolJob *job;
+   bool_t more, eof, cancelled;
+
+   pthread_mutex_lock(&Pool.lock);
+   while (1) {
+      while (!Pool.quit && dList_length(Pool.queue) == 0)
+         pthread_cond_wait(&Pool.work, &Pool.lock);
+      if (Pool.quit)
+         break;
+
+      job = dList_nth_data(Pool.queue, 0);
+      dList_remove(Pool.queue, job);
+      job->queued = FALSE;
+      job->running = TRUE;
+      more = job->input->len > 0;
+      dStr_append_l(job->data, job->input->str, job->input->len);
+      dStr_truncate(job->input, 0);
+      eof = job->eof;
+      cancelled = job->cancelled;
+      pthread_mutex_unlock(&Pool.lock);
+
+      if (!cancelled && job->DecoderData)
+         Imgpool_run(job, more, eof);
+
+      pthread_mutex_lock(&Pool.lock);
+      job->running = FALSE;
+      if (job->cancelled) {
+         /* for the main thread to free */
+         Imgpool_post_job(job);
+      } else if (job->input->len > 0 || (job->eof && job->DecoderData)) {
+         Imgpool_queue(job);
+      }
+   }
+   pthread_mutex_unlock(&Pool.lock);
+   return NULL;
+}
+
+/* Main thread ------------------------------------------------------------- */
+
+/*
+ * Hand an event to the dicache
+ */
+static void Imgpool_event_apply(ImgpoolJob *job, ImgpoolEvent *ev)
+{
+   int i, len;
+
+   switch (ev->type) {
+   case IMGPOOL_PARMS:
+      a_Dicache_set_parms(job->url, job->version, job->Image, ev->width,
+                          ev->height, ev->img_type, ev->gamma);
+      break;
+   case IMGPOOL_ORIG_SIZE:
+      a_Dicache_set_orig_size(job->url, job->version, ev->width, ev->height);
+      break;
+   case IMGPOOL_CMAP:
+      a_Dicache_set_cmap(job->url, job->version, ev->bg_color,
+                         (const uchar_t *)ev->data->str, ev->num_colors,
+                         ev->num_colors_max, ev->bg_index);
+      break;
+   case IMGPOOL_NEW_SCAN:
+      a_Dicache_new_scan(job->url, job->version);
+      break;
+   case IMGPOOL_ROWS:
+      len = ev->data->len / ev->rows;
+      for (i = 0; i < ev->rows; i++)
+         a_Dicache_write(job->url, job->version,
+                         (const uchar_t *)ev->data->str + i * len, ev->ys[i]);
+      break;
+   case IMGPOOL_CLOSE:
+      a_Dicache_close(job->url, job->version, NULL);
+      break;
+   case IMGPOOL_CALL:
+      break;
+   }
+}
+
+/*
+ * Handle the events of a job, in order
+ */
+static void Imgpool_job_handle(ImgpoolJob *job, Dlist *events)
+{
+   ImgpoolEvent *ev;
+   int i, result;
+
+   for (i = 0; (ev = dList_nth_data(events, i)); ++i) {
+      if (ev->type == IMGPOOL_CALL) {
+         result = job->cancelled ? 0 : ev->func(ev->arg);
+         /* the worker frees it */
+         pthread_mutex_lock(&Pool.lock);
+         ev->result = result;
+         ev->done = TRUE;
+         pthread_cond_broadcast(&Pool.answered);
+         pthread_mutex_unlock(&Pool.lock);
+      } else {
+         /* (the dicache may cancel the job meanwhile) */
+         if (!job->cancelled)
+            Imgpool_event_apply(job, ev);
+         Imgpool_event_free(ev);
+      }
+   }
+   if (!job->cancelled)
+      a_Dicache_update(job->url, job->version);
+}
+
+/*
+ * The workers posted jobs
+ */
+static void Imgpool_notify_cb(int fd, void *data)
+{
+   char buf[64];
+   Dlist *posted, *events;
+   ImgpoolJob *job;
+   bool_t done;
+
+   while (read(fd, buf, sizeof(buf)) > 0) ;
+
+   /* what's posted from now on wakes us again */
+   pthread_mutex_lock(&Pool.lock);
+   posted = Pool.posted;
+   Pool.posted = dList_new(16);
+   pthread_mutex_unlock(&Pool.lock);
+
+   while ((job = dList_nth_data(posted, 0))) {
+      dList_remove(posted, job);
+      pthread_mutex_lock(&Pool.lock);
+      events = job->events;
+      job->events = dList_new(8);
+      pthread_mutex_unlock(&Pool.lock);
+
+      Imgpool_job_handle(job, events);
+      dList_free(events);
+
+      pthread_mutex_lock(&Pool.lock);
+      job->posted = FALSE;
+      done = job->cancelled && !job->running;
+      if (!done && dList_length(job->events) > 0)
+         Imgpool_post_job(job);
+      pthread_mutex_unlock(&Pool.lock);
+      if (done)
+         Imgpool_job_free(job);
+   }
+   dList_free(posted);
+}
+
+/*
+ * Stop the workers (call after a_Dicache_freeall(), which cancels the jobs)
+ */
+void a_Imgpool_freeall(void)
+{
+   ImgpoolJob *job;
+   int i;
+
+   if (Pool.num_workers == 0)
+      return;
+
+   pthread_mutex_lock(&Pool.lock);
+   Pool.quit = TRUE;
+   pthread_cond_broadcast(&Pool.work);
+   pthread_cond_broadcast(&Pool.answered);
+   pthread_mutex_unlock(&Pool.lock);
+   for (i = 0; i < Pool.num_workers; i++)
+      pthread_join(Pool.workers[i], NULL);
+   Pool.num_workers = 0;
+   dFree(Pool.workers);
+
+   a_IOwatch_remove_fd(Pool.notify[0], DIO_READ);
+   close(Pool.notify[0]);
+   close(Pool.notify[1]);
+
+   while ((job = dList_nth_data(Pool.posted, 0))) {
+      dList_remove_fast(Pool.posted, job);
+      Imgpool_job_free(job);
+   }
+   dList_free(Pool.posted);
+   dList_free(Pool.queue);
+}
@@ -0,0 +1,38 @@
+#ifndef __IMGPOOL_H__
+#define __IMGPOOL_H__
+
+#include "image.hh"
+#include "cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+typedef struct ImgpoolJob ImgpoolJob;
+
+void a_Imgpool_init(void);
+ImgpoolJob *a_Imgpool_job_new(void *(*decoder_new)(DilloImage *, DilloUrl *,
+                                                    int),
+                              CA_Callback_t decoder, DilloImage *Image,
+                              const DilloUrl *url, int version);
+void a_Imgpool_job_feed(ImgpoolJob *job, const char *buf, int len);
+void a_Imgpool_job_finish(ImgpoolJob *job);
+void a_Imgpool_job_cancel(ImgpoolJob *job);
+void a_Imgpool_freeall(void);
+
+/* For the decoders' calls, while they run on a worker */
+int a_Imgpool_worker(void);
+void a_Imgpool_set_parms(uint_t width, uint_t height, DilloImgType type,
+                         double gamma);
+void a_Imgpool_set_orig_size(uint_t width, uint_t height);
+void a_Imgpool_set_cmap(int bg_color, const uchar_t *cmap, uint_t num_colors,
+                        int num_colors_max, int bg_index);
+void a_Imgpool_new_scan(void);
+void a_Imgpool_write(const uchar_t *buf, uint_t y);
+void a_Imgpool_close(void);
+int a_Imgpool_call(int (*func)(void *arg), void *arg);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* !__IMGPOOL_H__ */
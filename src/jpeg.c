@@ -83,6 +83,28 @@ struct DilloJpeg {
  */
 static void Jpeg_write(DilloJpeg *jpeg, void *Buf, uint_t BufSize);
 
+/*
+ * Let libjpeg decode the image at 1/2, 1/4 or 1/8 of its size when that
+ * still covers the size it's going to be shown at. That saves most of the
+ * work and memory for photos shown as thumbnails.
+ */
+static void Jpeg_set_scale(DilloJpeg *jpeg)
+{
+   struct jpeg_decompress_struct *cinfo = &jpeg->cinfo;
+   uint_t w, h, denom = 1;
+
+   if (a_Image_get_display_size(jpeg->Image, cinfo->image_width,
+                                cinfo->image_height, &w, &h)) {
+      for (denom = 8; denom > 1; denom /= 2)
+         if ((cinfo->image_width + denom - 1) / denom >= w &&
+             (cinfo->image_height + denom - 1) / denom >= h)
+            break;
+   }
+   cinfo->scale_num = 1;
+   cinfo->scale_denom = denom;
+   jpeg_calc_output_dimensions(cinfo);
+}
+
 
 /* this is the routine called by libjpeg when it detects an error. */
 METHODDEF(void) Jpeg_errorexit (j_common_ptr cinfo)
@@ -298,11 +320,17 @@ static void Jpeg_write(DilloJpeg *jpeg, void *Buf, uint_t BufSize)
             return;
          }
 
+         Jpeg_set_scale(jpeg);
+
          /** \todo Gamma for JPEG? */
          a_Dicache_set_parms(jpeg->url, jpeg->version, jpeg->Image,
-                             (uint_t)jpeg->cinfo.image_width,
-                             (uint_t)jpeg->cinfo.image_height,
+                             (uint_t)jpeg->cinfo.output_width,
+                             (uint_t)jpeg->cinfo.output_height,
                              type, 1 / 2.2);
+         if (jpeg->cinfo.scale_denom > 1)
+            a_Dicache_set_orig_size(jpeg->url, jpeg->version,
+                                    (uint_t)jpeg->cinfo.image_width,
+                                    (uint_t)jpeg->cinfo.image_height);
          jpeg->Image = NULL; /* safeguard: may be freed by its owner later */
 
          /* decompression step 4 (see libjpeg.doc) */
@@ -342,7 +370,7 @@ static void Jpeg_write(DilloJpeg *jpeg, void *Buf, uint_t BufSize)
    }
 
    if (jpeg->state == DILLO_JPEG_READ_IN_SCAN) {
-      linebuf = dMalloc(jpeg->cinfo.image_width *
+      linebuf = dMalloc(jpeg->cinfo.output_width *
                          jpeg->cinfo.num_components);
       array[0] = linebuf;
 
@@ -356,7 +384,7 @@ static void Jpeg_write(DilloJpeg *jpeg, void *Buf, uint_t BufSize)
 
          jpeg->y++;
 
-         if (jpeg->y == jpeg->cinfo.image_height) {
+         if (jpeg->y == jpeg->cinfo.output_height) {
             /* end of scan */
             if (!jpeg->cinfo.buffered_image) {
                /* single scan */
@@ -477,3 +477,46 @@ Dstr *a_Misc_file2dstr(const char *filename)
    }
    return dstr;
 }
+
+/*
+ * Parse an HTTP date, in any of the three formats of RFC 7231 (7.1.1.1):
+ *   Sun, 06 Nov 1994 08:49:37 GMT   (IMF-fixdate)
+ *   Sunday, 06-Nov-94 08:49:37 GMT  (obsolete RFC 850 format)
+ *   Sun Nov  6 08:49:37 1994        (ANSI C's asctime() format)
+ * Return value: seconds since the Epoch, or -1 if 'date' isn't understood.
+ */
+time_t a_Misc_parse_http_date(const char *date)
+{
+   static const char *const months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+   char mon[4];
+   const char *p;
+   int y, m, d, hh, mm, ss;
+   long days;
+
+   if (!date)
+      return -1;
+   if (sscanf(date, "%*3s, %d %3s %d %d:%d:%d", &d, mon, &y, &hh, &mm,
+              &ss) != 6 &&
+       sscanf(date, "%*[A-Za-z], %d-%3s-%d %d:%d:%d", &d, mon, &y, &hh, &mm,
+              &ss) != 6 &&
+       sscanf(date, "%*3s %3s %d %d:%d:%d %d", mon, &d, &hh, &mm, &ss,
+              &y) != 6)
+      return -1;
+   mon[3] = '\0';
+   if (!(p = strstr(months, mon)) || (p - months) % 3)
+      return -1;
+   m = (p - months) / 3 + 1;
+   if (y < 100)
+      y += (y < 70) ? 2000 : 1900;   /* two-digit years (RFC 850) */
+   if (y < 1970 || d < 1 || d > 31 || hh > 23 || mm > 59 || ss > 60)
+      return -1;
+
+   /* days since 1970-01-01 in the proleptic Gregorian calendar */
+   if (m <= 2) {
+      y--;
+      m += 12;
+   }
+   days = 365L * y + y / 4 - y / 100 + y / 400 + (153 * (m - 3) + 2) / 5 + d
+          - 719469L;
+   return (time_t)(((days * 24 + hh) * 60 + mm) * 60 + ss);
+}
@@ -2,6 +2,7 @@
 #define __DILLO_MISC_H__
 
 #include <stddef.h>     /* for size_t */
+#include <time.h>       /* for time_t */
 
 
 #ifdef __cplusplus
@@ -20,6 +21,7 @@ int a_Misc_parse_geometry(char *geom, int *x, int *y, int *w, int *h);
 int a_Misc_parse_search_url(char *source, char **label, char **urlstr);
 char *a_Misc_encode_base64(const char *in);
 Dstr *a_Misc_file2dstr(const char *filename);
+time_t a_Misc_parse_http_date(const char *date);
 
 #ifdef __cplusplus
 }
@@ -232,6 +232,8 @@ static void Nav_open_url(BrowserWindow *bw, const DilloUrl *url,
 
       Web = a_Web_new(bw, url, requester);
       Web->flags |= WEB_RootUrl;
+      if (offset)
+         Web->flags |= WEB_History;
       if ((ClientKey = a_Capi_open_url(Web, NULL, NULL)) != 0) {
          a_Bw_add_client(bw, ClientKey, 1);
          a_Bw_add_url(bw, url);
@@ -56,7 +56,7 @@ public:
    DilloPlain(BrowserWindow *bw);
    ~DilloPlain();
 
-   void write(void *Buf, uint_t BufSize, int Eof);
+   void write(void *Buf, uint_t BufStart, uint_t BufSize, int Eof);
 };
 
 /* FSM states */
@@ -158,17 +158,18 @@ void DilloPlain::addLine(char *Buf, uint_t BufSize)
 
 /*
  * Here we parse plain text and put it into the page structure.
+ * 'Buf' holds the text from offset 'BufStart' on.
  * (This function is called by Plain_callback whenever there's new data)
  */
-void DilloPlain::write(void *Buf, uint_t BufSize, int Eof)
+void DilloPlain::write(void *Buf, uint_t BufStart, uint_t BufSize, int Eof)
 {
    char *Start;
    uint_t i, len, MaxBytes;
 
    _MSG("DilloPlain::write Eof=%d\n", Eof);
 
-   Start = (char*)Buf + Start_Ofs;
-   MaxBytes = BufSize - Start_Ofs;
+   Start = (char*)Buf + (Start_Ofs - BufStart);
+   MaxBytes = BufStart + BufSize - Start_Ofs;
    i = len = 0;
    while ( i < MaxBytes ) {
       switch ( state ) {
@@ -226,11 +227,12 @@ static void Plain_callback(int Op, CacheClient_t *Client)
 
    if (Op) {
       /* Do the last line: */
-      plain->write(Client->Buf, Client->BufSize, 1);
+      plain->write(Client->Buf, Client->BufStart, Client->BufSize, 1);
       /* remove this client from our active list */
       a_Bw_close_client(plain->bw, Client->Key);
    } else {
-      plain->write(Client->Buf, Client->BufSize, 0);
+      plain->write(Client->Buf, Client->BufStart, Client->BufSize, 0);
+      Client->BufParsed = plain->Start_Ofs;
    }
 }
 
@@ -41,6 +41,11 @@ void a_Prefs_init(void)
    prefs.bg_color = 0xdcd1ba;
    prefs.buffered_drawing = 1;
    prefs.contrast_visited_color = TRUE;
+   prefs.disk_cache_size = 0;
+   prefs.dns_cache_size = 256;
+   prefs.dns_cache_ttl = 0;
+   prefs.dns_negative_ttl = 30;
+   prefs.dns_save_cache = FALSE;
    prefs.enterpress_forces_submit = FALSE;
    prefs.focus_new_tab = TRUE;
    prefs.font_cursive = dStrdup(PREFS_FONT_CURSIVE);
@@ -60,20 +65,27 @@ void a_Prefs_init(void)
    prefs.ypos = PREFS_GEOMETRY_DEFAULT_YPOS;
 
    prefs.home = a_Url_new(PREFS_HOME, NULL);
+   prefs.http2 = FALSE;
    prefs.http_language = NULL;
    prefs.http_proxy = NULL;
    prefs.http_max_conns = 6;
    prefs.http_persistent_conns = TRUE;
+   prefs.http_pipelining = FALSE;
+   prefs.http_preconnect = 0;
    prefs.http_proxyuser = NULL;
    prefs.http_referer = dStrdup(PREFS_HTTP_REFERER);
    prefs.http_strict_transport_security = TRUE;
    prefs.http_user_agent = dStrdup(PREFS_HTTP_USER_AGENT);
+   prefs.image_cache_size = 64;
    prefs.limit_text_width = FALSE;
    prefs.adjust_min_width = TRUE;
    prefs.adjust_table_min_width = TRUE;
    prefs.load_images=TRUE;
    prefs.load_background_images=FALSE;
+   prefs.lazy_images = 2;
    prefs.load_stylesheets=TRUE;
+   prefs.memory_cache_compressed = FALSE;
+   prefs.memory_cache_size = 64;
    prefs.middle_click_drags_page = TRUE;
    prefs.middle_click_opens_new_tab = TRUE;
    prefs.right_click_closes_tab = FALSE;
@@ -108,6 +120,7 @@ void a_Prefs_init(void)
    prefs.small_icons = FALSE;
    prefs.start_page = a_Url_new(PREFS_START_PAGE, NULL);
    prefs.theme = dStrdup(PREFS_THEME);
+   prefs.tls_save_sessions = FALSE;
    prefs.ui_button_highlight_color = -1;
    prefs.ui_fg_color = -1;
    prefs.ui_main_bg_color = -1;
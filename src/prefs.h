@@ -38,6 +38,7 @@ typedef struct {
    int height;
    int xpos;
    int ypos;
+   bool_t http2;
    char *http_language;
    int32_t http_max_conns;
    DilloUrl *http_proxy;
@@ -93,10 +94,22 @@ typedef struct {
    bool_t fullwindow_start;
    bool_t load_images;
    bool_t load_background_images;
+   int32_t lazy_images;
    bool_t load_stylesheets;
    bool_t parse_embedded_css;
    bool_t http_persistent_conns;
+   bool_t http_pipelining;
+   int32_t http_preconnect;
    bool_t http_strict_transport_security;
+   bool_t tls_save_sessions;
+   int32_t dns_cache_size;
+   int32_t dns_cache_ttl;
+   int32_t dns_negative_ttl;
+   bool_t dns_save_cache;
+   int32_t disk_cache_size;
+   int32_t memory_cache_size;
+   bool_t memory_cache_compressed;
+   int32_t image_cache_size;
    int32_t buffered_drawing;
    char *font_serif;
    char *font_sans_serif;
@@ -151,6 +151,11 @@ void PrefsParser::parse(FILE *fp)
       { "bg_color", &prefs.bg_color, PREFS_COLOR, 0 },
       { "buffered_drawing", &prefs.buffered_drawing, PREFS_INT32, 0 },
       { "contrast_visited_color", &prefs.contrast_visited_color, PREFS_BOOL, 0 },
+      { "disk_cache_size", &prefs.disk_cache_size, PREFS_INT32, 0 },
+      { "dns_cache_size", &prefs.dns_cache_size, PREFS_INT32, 0 },
+      { "dns_cache_ttl", &prefs.dns_cache_ttl, PREFS_INT32, 0 },
+      { "dns_negative_ttl", &prefs.dns_negative_ttl, PREFS_INT32, 0 },
+      { "dns_save_cache", &prefs.dns_save_cache, PREFS_BOOL, 0 },
       { "enterpress_forces_submit", &prefs.enterpress_forces_submit,
         PREFS_BOOL, 0 },
       { "focus_new_tab", &prefs.focus_new_tab, PREFS_BOOL, 0 },
@@ -165,21 +170,29 @@ void PrefsParser::parse(FILE *fp)
       { "fullwindow_start", &prefs.fullwindow_start, PREFS_BOOL, 0 },
       { "geometry", NULL, PREFS_GEOMETRY, 0 },
       { "home", &prefs.home, PREFS_URL, 0 },
+      { "http2", &prefs.http2, PREFS_BOOL, 0 },
       { "http_language", &prefs.http_language, PREFS_STRING, 0 },
       { "http_max_conns", &prefs.http_max_conns, PREFS_INT32, 0 },
       { "http_persistent_conns", &prefs.http_persistent_conns, PREFS_BOOL, 0 },
+      { "http_pipelining", &prefs.http_pipelining, PREFS_BOOL, 0 },
+      { "http_preconnect", &prefs.http_preconnect, PREFS_INT32, 0 },
       { "http_proxy", &prefs.http_proxy, PREFS_URL, 0 },
       { "http_proxyuser", &prefs.http_proxyuser, PREFS_STRING, 0 },
       { "http_referer", &prefs.http_referer, PREFS_STRING, 0 },
       { "http_strict_transport_security",&prefs.http_strict_transport_security,
         PREFS_BOOL, 0 },
       { "http_user_agent", &prefs.http_user_agent, PREFS_STRING, 0 },
+      { "image_cache_size", &prefs.image_cache_size, PREFS_INT32, 0 },
       { "limit_text_width", &prefs.limit_text_width, PREFS_BOOL, 0 },
       { "adjust_min_width", &prefs.adjust_min_width, PREFS_BOOL, 0 },
       { "adjust_table_min_width", &prefs.adjust_table_min_width, PREFS_BOOL, 0 },
       { "load_images", &prefs.load_images, PREFS_BOOL, 0 },
       { "load_background_images", &prefs.load_background_images, PREFS_BOOL, 0 },
+      { "lazy_images", &prefs.lazy_images, PREFS_INT32, 0 },
       { "load_stylesheets", &prefs.load_stylesheets, PREFS_BOOL, 0 },
+      { "memory_cache_compressed", &prefs.memory_cache_compressed,
+        PREFS_BOOL, 0 },
+      { "memory_cache_size", &prefs.memory_cache_size, PREFS_INT32, 0 },
       { "middle_click_drags_page", &prefs.middle_click_drags_page,
         PREFS_BOOL, 0 },
       { "middle_click_opens_new_tab", &prefs.middle_click_opens_new_tab,
@@ -214,6 +227,7 @@ void PrefsParser::parse(FILE *fp)
       { "small_icons", &prefs.small_icons, PREFS_BOOL, 0 },
       { "start_page", &prefs.start_page, PREFS_URL, 0 },
       { "theme", &prefs.theme, PREFS_STRING, 0 },
+      { "tls_save_sessions", &prefs.tls_save_sessions, PREFS_BOOL, 0 },
       { "ui_button_highlight_color", &prefs.ui_button_highlight_color,
         PREFS_COLOR, 0 },
       { "ui_fg_color", &prefs.ui_fg_color, PREFS_COLOR, 0 },
@@ -501,6 +501,29 @@ int a_Url_cmp(const DilloUrl *A, const DilloUrl *B)
    return st;
 }
 
+/*
+ * Hash the parts of a URL that a_Url_cmp compares, so that URLs that
+ * compare equal hash equal.
+ */
+uint_t a_Url_hash(const DilloUrl *u)
+{
+   uint_t h = 2166136261u;   /* FNV-1a */
+   const char *p;
+   int i;
+
+   for (p = u->authority; p && *p; p++)
+      h = (h ^ (uchar_t)D_ASCII_TOLOWER(*p)) * 16777619u;
+   for (p = u->path ? u->path + (*u->path == '/') : ""; *p; p++)
+      h = (h ^ (uchar_t)*p) * 16777619u;
+   for (p = u->query; p && *p; p++)
+      h = (h ^ (uchar_t)*p) * 16777619u;
+   for (i = 0; u->data && i < u->data->len; i++)
+      h = (h ^ (uchar_t)u->data->str[i]) * 16777619u;
+   for (p = u->scheme; p && *p; p++)
+      h = (h ^ (uchar_t)D_ASCII_TOLOWER(*p)) * 16777619u;
+   return h;
+}
+
 /*
  * Set DilloUrl flags
  */
@@ -100,6 +100,7 @@ char *a_Url_str(const DilloUrl *url);
 const char *a_Url_hostname(const DilloUrl *u);
 DilloUrl* a_Url_dup(const DilloUrl *u);
 int a_Url_cmp(const DilloUrl *A, const DilloUrl *B);
+uint_t a_Url_hash(const DilloUrl *u);
 void a_Url_set_flags(DilloUrl *u, int flags);
 void a_Url_set_data(DilloUrl *u, Dstr **data);
 void a_Url_set_ismap_coords(DilloUrl *u, char *coord_str);
@@ -17,6 +17,7 @@ extern "C" {
 #define WEB_Image    2
 #define WEB_Stylesheet 4
 #define WEB_Download 8   /* Half implemented... */
+#define WEB_History  16  /* Back/forward navigation: stale is fine */
 
 
 typedef struct _DilloWeb DilloWeb;
@@ -0,0 +1,501 @@
+/*
+ * Dillo cache benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Measures the cache with many entries and many transfers in progress:
+ * 'nentries' complete responses are cached, 'nclients' more are being
+ * received, and then 'rounds' lookups by URL (a_Cache_get_flags) and
+ * 'rounds' network reads, each one feeding a chunk to one transfer
+ * (a_Cache_process_dbuf), are timed.
+ *
+ * Then a large Latin-1 page is received and served again from memory to
+ * a client that parses it like the text parsers do, to see how much of its
+ * translation to UTF-8 the cache holds at a time.
+ *
+ * Then, gzipped pages are received with and without memory_cache_compressed,
+ * to compare the memory they take with the time to read them again: all of
+ * them in turn (most are kept compressed then) and the last one over and
+ * over (it stays inflated).
+ *
+ * Last, the same body is received under many URLs, as cache-busting
+ * queries make sites do, to see the memory that the copies take.
+ *
+ *    cache-bench [nentries [nclients [rounds]]]   (10000 1000 100000)
+ *
+ * The rest of the browser is replaced by the stubs below.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <zlib.h>
+
+#include "src/prefs.h"
+#include "src/cache.h"
+#include "src/web.hh"
+#include "src/decode.h"
+#include "src/dicache.h"
+#include "src/timeout.hh"
+#include "src/IO/IO.h"
+
+DilloPrefs prefs;
+const char *AboutSplash = "<html><body>splash</body></html>";
+
+static long bytes_sent;
+
+/* The text client */
+static struct {
+   long len, sum;       /* of the UTF-8 text parsed */
+   uint_t max_window;   /* the largest buffer it was given */
+   int errors;
+} text;
+
+static TimeoutCb_t timeout_cb;
+static void *timeout_cbdata;
+
+/* Stubs ------------------------------------------------------------------ */
+
+static void bench_client(int Op, CacheClient_t *Client)
+{
+   if (Op == CA_Send)
+      bytes_sent += Client->BufSize;
+}
+
+/*
+ * Parse text as html.cc and plain.cc do: up to the last (incomplete)
+ * bytes, which are left for the next time unless it's the end.
+ */
+static void bench_text_client(int Op, CacheClient_t *Client)
+{
+   const unsigned char *buf = Client->Buf;
+   uint_t i, end = Client->BufStart + Client->BufSize, stop;
+
+   if (Client->BufStart > Client->BufParsed) {
+      text.errors++;
+      return;
+   }
+   text.max_window = MAX(text.max_window, Client->BufSize);
+   stop = (Op == CA_Close) ? end : MAX(Client->BufParsed, end - MIN(end, 100));
+   for (i = Client->BufParsed; i < stop; i++)
+      text.sum += buf[i - Client->BufStart];
+   text.len += stop - Client->BufParsed;
+   Client->BufParsed = stop;
+}
+
+int a_Web_dispatch_by_type(const char *Type, DilloWeb *web,
+                           CA_Callback_t *Call, void **Data)
+{
+   *Call = strncmp(Type, "text/", 5) ? bench_client : bench_text_client;
+   *Data = NULL;
+   return 1;
+}
+
+void a_Web_free(DilloWeb *web)
+{
+   a_Url_free(web->url);
+   dFree(web);
+}
+
+int a_Misc_get_content_type_from_data(void *Data, size_t Size,
+                                      const char **PT)
+{
+   *PT = "image/png";
+   return 0;
+}
+
+int a_Misc_content_type_check(const char *EntryType, const char *DetectedType)
+{
+   return 0;
+}
+
+void a_Misc_parse_content_type(const char *str, char **major, char **minor,
+                               char **charset)
+{
+   const char *cs = strstr(str, "charset=");
+   size_t m = strcspn(str, "/;"), end = strcspn(str, ";");
+
+   *major = dStrndup(str, m);
+   *minor = (str[m] == '/') ? dStrndup(str + m + 1, end - m - 1) : NULL;
+   *charset = cs ? dStrdup(cs + 8) : NULL;
+}
+
+int a_Misc_content_type_cmp(const char *ct1, const char *ct2)
+{
+   return ct1 && ct2 ? strcmp(ct1, ct2) : 1;
+}
+
+time_t a_Misc_parse_http_date(const char *date) { return -1; }
+DICacheEntry *a_Dicache_get_entry(const DilloUrl *Url, int version)
+{
+   return NULL;
+}
+void a_Dicache_invalidate_entry(const DilloUrl *Url) { }
+void a_Dicache_unref(const DilloUrl *Url, int version) { }
+void a_Dicache_stop_client(int Key) { }
+void a_Dicache_cleanup(void) { }
+void a_Capi_conn_abort_by_url(const DilloUrl *url) { }
+void a_Nav_push(BrowserWindow *bw, const DilloUrl *url,
+                const DilloUrl *requester) { }
+void a_Nav_reload(BrowserWindow *bw) { }
+void a_Nav_cancel_expect_if_eq(BrowserWindow *bw, const DilloUrl *url) { }
+void a_UIcmd_save_link(BrowserWindow *bw, const DilloUrl *url) { }
+void a_UIcmd_set_page_prog(BrowserWindow *bw, size_t nbytes, int cmd) { }
+void a_UIcmd_set_msg(BrowserWindow *bw, const char *format, ...) { }
+int a_Bw_remove_client(BrowserWindow *bw, int ClientKey) { return 0; }
+void a_Bw_close_client(BrowserWindow *bw, int ClientKey) { }
+void a_Cookies_set(Dlist *cookie_strings, const DilloUrl *set_url,
+                   const char *server_date) { }
+void a_Hsts_set(const char *header, const DilloUrl *url) { }
+bool_t a_Hsts_require_https(const char *host) { return FALSE; }
+int a_Auth_do_auth(Dlist *auth_string, const DilloUrl *url) { return 0; }
+bool_t a_Domain_permit(const DilloUrl *source, const DilloUrl *dest)
+{
+   return TRUE;
+}
+void a_Timeout_add(float t, TimeoutCb_t cb, void *cbdata)
+{
+   timeout_cb = cb;
+   timeout_cbdata = cbdata;
+}
+void a_Timeout_remove(void) { }
+Dstr *a_Dns_stats_page(void) { return dStr_new(""); }
+
+/* ------------------------------------------------------------------------ */
+
+static double now(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * Request 'url' as an image of some page would
+ */
+static int open_url(const DilloUrl *url)
+{
+   DilloWeb *web = dNew0(DilloWeb, 1);
+
+   web->url = a_Url_dup(url);
+   web->flags = WEB_Image;
+   return a_Cache_open_url(web, NULL, NULL);
+}
+
+/*
+ * Request a page that is in the cache, and let it be served
+ */
+static void reread_page(const DilloUrl *url)
+{
+   DilloWeb *web = dNew0(DilloWeb, 1);
+
+   web->url = a_Url_dup(url);
+   a_Cache_open_url(web, NULL, NULL);
+   if (timeout_cb)
+      timeout_cb(timeout_cbdata);
+}
+
+/*
+ * Compress 'page' as gzip
+ */
+static Dstr *gzip(Dstr *page)
+{
+   Dstr *gz = dStr_sized_new(page->len / 2 + 64);
+   z_stream zs;
+   char out[16 * 1024];
+
+   memset(&zs, 0, sizeof(zs));
+   deflateInit2(&zs, 6, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+   zs.next_in = (Bytef *)page->str;
+   zs.avail_in = page->len;
+   do {
+      zs.next_out = (Bytef *)out;
+      zs.avail_out = sizeof(out);
+      deflate(&zs, Z_FINISH);
+      dStr_append_l(gz, out, sizeof(out) - zs.avail_out);
+   } while (zs.avail_out == 0);
+   deflateEnd(&zs);
+   return gz;
+}
+
+/*
+ * Receive 'npages' gzipped pages of 'size' bytes, keeping them compressed
+ * or not, and tell the memory they take and the time to read them again.
+ */
+static void gzipped_pages(int npages, int size)
+{
+   const char *words[] = {
+      "<p>", "</p>\n", "<a href=\"/wiki/", "\">", "</a>", "the", "cache",
+      "browser", "of", "and", "page", "<li>", "</li>\n", "image", "style",
+      "memory", "to", "a", "in", "is", "<div class=\"note\">", "</div>"
+   };
+   DilloUrl **urls = dNew(DilloUrl *, npages);
+   Dstr **gz = dNew(Dstr *, npages), *page, *hdr;
+   unsigned seed = 7;
+   long before, held, len = 0;
+   double t, all, hot;
+   int mode, i, j, rounds = 100;
+   char buf[128];
+
+   /* (the pages differ, or the cache would keep just one) */
+   page = dStr_sized_new(size + 64);
+   while (page->len < size) {
+      seed = seed * 1103515245 + 12345;
+      dStr_append(page, words[(seed >> 8) % (sizeof(words)/sizeof(words[0]))]);
+      dStr_append_c(page, ' ');
+   }
+   hdr = dStr_new("");
+
+   for (mode = 0; mode < 2; mode++) {
+      for (i = 0, len = 0; i < npages; i++) {
+         snprintf(buf, sizeof(buf), "<!-- %d %05d -->", mode, i);
+         memcpy(page->str, buf, strlen(buf));
+         gz[i] = gzip(page);
+         len += gz[i]->len;
+      }
+      prefs.memory_cache_compressed = mode;
+      before = a_Cache_memory_bytes();
+      for (i = 0; i < npages; i++) {
+         DilloWeb *web = dNew0(DilloWeb, 1);
+
+         dStr_sprintf(hdr, "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n"
+                      "Content-Encoding: gzip\r\nContent-Length: %d\r\n\r\n",
+                      gz[i]->len);
+         snprintf(buf, sizeof(buf), "http://gz%d.test/%d.html", mode, i);
+         urls[i] = a_Url_new(buf, NULL);
+         web->url = a_Url_dup(urls[i]);
+         a_Cache_open_url(web, NULL, NULL);
+         a_Cache_process_dbuf(IORead, hdr->str, hdr->len, urls[i], NULL);
+         for (j = 0; j < gz[i]->len; j += 16 * 1024)
+            a_Cache_process_dbuf(IORead, gz[i]->str + j,
+                                 MIN(16 * 1024, gz[i]->len - j), urls[i],
+                                 NULL);
+      }
+      held = a_Cache_memory_bytes() - before;
+
+      memset(&text, 0, sizeof(text));
+      t = now();
+      for (i = 0; i < npages; i++)
+         reread_page(urls[i]);
+      all = (now() - t) / npages;
+      t = now();
+      for (i = 0; i < rounds; i++)
+         reread_page(urls[npages - 1]);
+      hot = (now() - t) / rounds;
+
+      printf("%d gzipped pages of %d KB (%d KB compressed), %s: %ld KB held, "
+             "%.3f ms per read, %.3f ms for the last one again%s\n",
+             npages, size / 1024, (int)(len / npages / 1024),
+             mode ? "kept compressed" : "inflated", held / 1024,
+             all * 1e3, hot * 1e3,
+             (text.len == (long)(npages + rounds) * page->len && !text.errors)
+             ? "" : " (WRONG TEXT!)");
+      for (i = 0; i < npages; i++) {
+         a_Url_free(urls[i]);
+         dStr_free(gz[i], 1);
+      }
+   }
+   prefs.memory_cache_compressed = FALSE;
+   dStr_free(page, 1);
+   dFree(gz);
+   dStr_free(hdr, 1);
+   dFree(urls);
+}
+
+/*
+ * Receive the same 'size'-byte image under 'nurls' URLs (as with
+ * cache-busting queries), and tell the memory they take.
+ */
+static void duplicate_bodies(int nurls, int size)
+{
+   DilloUrl *url;
+   Dstr *body, *hdr;
+   long before, held;
+   int i, j;
+   char buf[128];
+
+   body = dStr_sized_new(size + 1);
+   for (i = 0; i < size; i++)
+      dStr_append_c(body, (char)(i * 7 % 251));
+   hdr = dStr_new("");
+   dStr_sprintf(hdr, "HTTP/1.1 200 OK\r\nContent-Type: image/gif\r\n"
+                "Content-Length: %d\r\n\r\n", size);
+
+   before = a_Cache_memory_bytes();
+   for (i = 0; i < nurls; i++) {
+      snprintf(buf, sizeof(buf), "http://dup.test/spacer.gif?t=%d", i);
+      url = a_Url_new(buf, NULL);
+      open_url(url);
+      a_Cache_process_dbuf(IORead, hdr->str, hdr->len, url, NULL);
+      for (j = 0; j < size; j += 16 * 1024)
+         a_Cache_process_dbuf(IORead, body->str + j,
+                              MIN(16 * 1024, size - j), url, NULL);
+      a_Url_free(url);
+   }
+   held = a_Cache_memory_bytes() - before;
+   printf("%d URLs with the same %d KB body: %ld KB held (%ld KB of data)\n",
+          nurls, size / 1024, held / 1024, (long)nurls * size / 1024);
+   dStr_free(body, 1);
+   dStr_free(hdr, 1);
+}
+
+/*
+ * Receive a Latin-1 page of 'size' bytes, then get it again from memory,
+ * and tell how much of its translation the text client was given at once.
+ */
+static void latin1_page(int size)
+{
+   const char line[] =
+      "<p>Caf\xe9 cr\xe8me, na\xefve fa\xe7" "ade, \xa7 12.</p>\n";
+   DilloUrl *url = a_Url_new("http://latin1.test/page.html", NULL);
+   DilloWeb *web;
+   long utf8_len = 0, utf8_sum = 0;
+   int i, pass;
+   Dstr *ds, *page;
+   double t;
+
+   page = dStr_sized_new(size + 1);
+   for (i = 0; i < size; i++) {
+      unsigned char c = line[i % (sizeof(line) - 1)];
+
+      dStr_append_c(page, c);
+      if (c < 0x80) {
+         utf8_len++;
+         utf8_sum += c;
+      } else {
+         utf8_len += 2;
+         utf8_sum += (0xc0 | (c >> 6)) + (0x80 | (c & 0x3f));
+      }
+   }
+   ds = dStr_new("");
+   dStr_sprintf(ds, "HTTP/1.1 200 OK\r\nContent-Type: text/html; "
+                "charset=iso-8859-1\r\nContent-Length: %d\r\n\r\n", size);
+
+   for (pass = 0; pass < 2; pass++) {
+      memset(&text, 0, sizeof(text));
+      web = dNew0(DilloWeb, 1);
+      web->url = a_Url_dup(url);
+      a_Cache_open_url(web, NULL, NULL);
+      t = now();
+      if (pass == 0) {
+         a_Cache_process_dbuf(IORead, ds->str, ds->len, url, NULL);
+         for (i = 0; i < size; i += 16 * 1024)
+            a_Cache_process_dbuf(IORead, page->str + i,
+                                 MIN(16 * 1024, size - i), url, NULL);
+      } else if (timeout_cb) {
+         /* the cache serves complete entries from its idle callback */
+         timeout_cb(timeout_cbdata);
+      }
+      t = now() - t;
+      printf("%d KB Latin-1 page %s: %.1f ms, at most %u KB of its %ld KB "
+             "of UTF-8 held%s\n", size / 1024,
+             pass ? "from memory" : "received", t * 1e3,
+             text.max_window / 1024, utf8_len / 1024,
+             (text.len == utf8_len && text.sum == utf8_sum && !text.errors) ?
+             "" : " (WRONG TEXT!)");
+   }
+   dStr_free(ds, 1);
+   dStr_free(page, 1);
+   a_Url_free(url);
+}
+
+int main(int argc, char *argv[])
+{
+   int nentries = argc > 1 ? strtol(argv[1], NULL, 10) : 10000,
+       nclients = argc > 2 ? strtol(argv[2], NULL, 10) : 1000,
+       rounds = argc > 3 ? strtol(argv[3], NULL, 10) : 100000;
+   DilloUrl **cached, **active;
+   int *keys, i;
+   char chunk[256], buf[128];
+   unsigned seed = 1;
+   uint_t flags = 0;
+   double t;
+   Dstr *ds;
+
+   if (nentries < 1 || nclients < 1 || rounds < 1) {
+      fprintf(stderr, "usage: %s [nentries [nclients [rounds]]]\n", argv[0]);
+      return 1;
+   }
+   a_Cache_init();
+   memset(chunk, 'x', sizeof(chunk));
+
+   /* complete responses */
+   cached = dNew(DilloUrl *, nentries);
+   ds = dStr_new("HTTP/1.1 200 OK\r\nContent-Type: image/png\r\n"
+                 "Content-Length: 256\r\n\r\n");
+   dStr_append_l(ds, chunk, sizeof(chunk));
+   for (i = 0; i < nentries; i++) {
+      snprintf(buf, sizeof(buf), "http://host%d.test/images/%d.png",
+               i % 97, i);
+      cached[i] = a_Url_new(buf, NULL);
+      open_url(cached[i]);
+      a_Cache_process_dbuf(IORead, ds->str, ds->len, cached[i], NULL);
+   }
+   dStr_free(ds, 1);
+
+   /* transfers in progress, each with a client */
+   active = dNew(DilloUrl *, nclients);
+   keys = dNew(int, nclients);
+   ds = dStr_new("HTTP/1.1 200 OK\r\nContent-Type: image/png\r\n"
+                 "Content-Length: 10000000\r\n\r\n");
+   for (i = 0; i < nclients; i++) {
+      snprintf(buf, sizeof(buf), "http://active.test/images/%d.png", i);
+      active[i] = a_Url_new(buf, NULL);
+      keys[i] = open_url(active[i]);
+      a_Cache_process_dbuf(IORead, ds->str, ds->len, active[i], NULL);
+   }
+   dStr_free(ds, 1);
+
+   t = now();
+   for (i = 0; i < rounds; i++) {
+      seed = seed * 1103515245 + 12345;
+      flags |= a_Cache_get_flags(cached[(seed >> 8) % nentries]);
+   }
+   t = now() - t;
+   printf("%d entries: %.3f us per lookup%s\n", nentries, t * 1e6 / rounds,
+          (flags & CA_GotData) ? "" : " (NOT FOUND!)");
+
+   t = now();
+   for (i = 0; i < rounds; i++) {
+      a_Cache_process_dbuf(IORead, chunk, sizeof(chunk),
+                           active[i % nclients], NULL);
+   }
+   t = now() - t;
+   printf("%d clients: %.3f us per read (%ld bytes sent)\n", nclients,
+          t * 1e6 / rounds, bytes_sent);
+
+   t = now();
+   for (i = 0; i < nclients; i++)
+      a_Cache_stop_client(keys[i]);
+   t = now() - t;
+   printf("%d clients: %.3f us per stop\n", nclients, t * 1e6 / nclients);
+
+   latin1_page(16 * 1024 * 1024);
+   gzipped_pages(200, 256 * 1024);
+   duplicate_bodies(1000, 64 * 1024);
+
+   for (i = 0; i < nentries; i++)
+      a_Url_free(cached[i]);
+   for (i = 0; i < nclients; i++)
+      a_Url_free(active[i]);
+   dFree(cached);
+   dFree(active);
+   dFree(keys);
+   a_Cache_freeall();
+   return 0;
+}
@@ -0,0 +1,310 @@
+/*
+ * HTTP freshness test
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks how the cache tells how long a response stays fresh: the three
+ * HTTP date formats, max-age over Expires over the Last-Modified
+ * heuristic, no-cache and no-store, and then, with responses received
+ * through the cache, the Age they come with and the time they spend in
+ * it. cache.c is included, to get at its static functions.
+ *
+ *    cache-freshness-test
+ *
+ * The rest of the browser is replaced by the stubs below.
+ */
+
+#include "src/cache.c"
+
+#include "src/dicache.h"
+#include "src/timeout.hh"
+#include "check.h"
+
+DilloPrefs prefs;
+const char *AboutSplash = "<html><body>splash</body></html>";
+
+/* Sun, 06 Nov 1994 08:49:37 GMT */
+#define DATE 784111777L
+
+/* Stubs ------------------------------------------------------------------ */
+
+static void test_client(int Op, CacheClient_t *Client) { }
+
+int a_Web_dispatch_by_type(const char *Type, DilloWeb *web,
+                           CA_Callback_t *Call, void **Data)
+{
+   *Call = test_client;
+   *Data = NULL;
+   return 1;
+}
+
+void a_Web_free(DilloWeb *web)
+{
+   a_Url_free(web->url);
+   dFree(web);
+}
+
+/* (for misc.c) */
+uint_t a_Utf8_end_of_char(const char *str, uint_t i) { return i; }
+uint_t a_Utf8_decode(const char *str, const char *end, int *len)
+{
+   *len = 1;
+   return (uchar_t)*str;
+}
+int a_Utf8_test(const char *src, unsigned int srclen) { return 0; }
+bool_t a_Utf8_combining_char(int unicode) { return FALSE; }
+
+DICacheEntry *a_Dicache_get_entry(const DilloUrl *Url, int version)
+{
+   return NULL;
+}
+void a_Dicache_invalidate_entry(const DilloUrl *Url) { }
+void a_Dicache_unref(const DilloUrl *Url, int version) { }
+void a_Dicache_stop_client(int Key) { }
+void a_Dicache_cleanup(void) { }
+void a_Capi_conn_abort_by_url(const DilloUrl *url) { }
+void a_Nav_push(BrowserWindow *bw, const DilloUrl *url,
+                const DilloUrl *requester) { }
+void a_Nav_reload(BrowserWindow *bw) { }
+void a_Nav_cancel_expect_if_eq(BrowserWindow *bw, const DilloUrl *url) { }
+void a_UIcmd_save_link(BrowserWindow *bw, const DilloUrl *url) { }
+void a_UIcmd_set_page_prog(BrowserWindow *bw, size_t nbytes, int cmd) { }
+void a_UIcmd_set_msg(BrowserWindow *bw, const char *format, ...) { }
+int a_Bw_remove_client(BrowserWindow *bw, int ClientKey) { return 0; }
+void a_Bw_close_client(BrowserWindow *bw, int ClientKey) { }
+void a_Cookies_set(Dlist *cookie_strings, const DilloUrl *set_url,
+                   const char *server_date) { }
+void a_Hsts_set(const char *header, const DilloUrl *url) { }
+bool_t a_Hsts_require_https(const char *host) { return FALSE; }
+int a_Auth_do_auth(Dlist *auth_string, const DilloUrl *url) { return 0; }
+bool_t a_Domain_permit(const DilloUrl *source, const DilloUrl *dest)
+{
+   return TRUE;
+}
+void a_Timeout_add(float t, TimeoutCb_t cb, void *cbdata) { }
+void a_Timeout_remove(void) { }
+Dstr *a_Dns_stats_page(void) { return dStr_new(""); }
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * The freshness lifetime of a response with the given header fields
+ */
+static long lifetime(const char *fields)
+{
+   char *header = dStrconcat("HTTP/1.1 200 OK\n", fields, "\n", NULL);
+   long ret = Cache_freshness_lifetime(header);
+
+   dFree(header);
+   return ret;
+}
+
+/*
+ * Receive a 200 response to 'url_str', with the given header fields.
+ * Return its cache entry.
+ */
+static CacheEntry_t *receive(const char *url_str, const char *fields)
+{
+   DilloUrl *url = a_Url_new(url_str, NULL);
+   DilloWeb *web = dNew0(DilloWeb, 1);
+   Dstr *ds = dStr_new("HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n");
+   const char *p, *nl;
+   CacheEntry_t *entry;
+
+   for (p = fields; *p; p = nl + 1) {
+      nl = strchr(p, '\n');
+      dStr_append_l(ds, p, nl - p);
+      dStr_append(ds, "\r\n");
+   }
+   dStr_append(ds, "Content-Length: 4\r\n\r\nbody");
+   web->url = a_Url_dup(url);
+   a_Cache_open_url(web, NULL, NULL);
+   a_Cache_process_dbuf(IORead, ds->str, ds->len, url, NULL);
+   entry = Cache_entry_search(url);
+   dStr_free(ds, 1);
+   a_Url_free(url);
+   return entry;
+}
+
+static void dates(void)
+{
+   CHECK(a_Misc_parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT") == DATE);
+   CHECK(a_Misc_parse_http_date("Sunday, 06-Nov-94 08:49:37 GMT") == DATE);
+   CHECK(a_Misc_parse_http_date("Sun Nov  6 08:49:37 1994") == DATE);
+   CHECK(a_Misc_parse_http_date("Sun Nov 6 08:49:37 1994") == DATE);
+
+   /* two-digit years: 70 to 99 are 19xx, the rest 20xx */
+   CHECK(a_Misc_parse_http_date("Thursday, 01-Jan-70 00:00:00 GMT") == 0);
+   CHECK(a_Misc_parse_http_date("Friday, 31-Dec-99 23:59:59 GMT") ==
+         946684799L);
+   CHECK(a_Misc_parse_http_date("Saturday, 01-Jan-00 00:00:00 GMT") ==
+         946684800L);
+   CHECK(a_Misc_parse_http_date("Tue, 29 Feb 2000 12:00:00 GMT") ==
+         951825600L);
+
+   CHECK(a_Misc_parse_http_date(NULL) == -1);
+   CHECK(a_Misc_parse_http_date("") == -1);
+   CHECK(a_Misc_parse_http_date("0") == -1);
+   CHECK(a_Misc_parse_http_date("-1") == -1);
+   CHECK(a_Misc_parse_http_date("Sun, 06 Nov") == -1);
+   CHECK(a_Misc_parse_http_date("Sun, 06 Foo 1994 08:49:37 GMT") == -1);
+   CHECK(a_Misc_parse_http_date("Sun, 06 ovN 1994 08:49:37 GMT") == -1);
+   CHECK(a_Misc_parse_http_date("Sun, 06 Nov 1994 25:49:37 GMT") == -1);
+   CHECK(a_Misc_parse_http_date("Sun, 06 Nov 1969 08:49:37 GMT") == -1);
+}
+
+static void directives(void)
+{
+   long v;
+
+   CHECK(Cache_control_directive("no-cache", "no-cache", NULL));
+   CHECK(Cache_control_directive("private, No-Store", "no-store", NULL));
+   CHECK(!Cache_control_directive("no-storage", "no-store", NULL));
+   CHECK(Cache_control_directive("public,max-age=60", "max-age", &v) &&
+         v == 60);
+   CHECK(Cache_control_directive("max-age=\"120\", public", "max-age", &v) &&
+         v == 120);
+   CHECK(Cache_control_directive("max-age", "max-age", &v) && v == -1);
+   CHECK(!Cache_control_directive("s-maxage=30", "max-age", &v));
+   CHECK(!Cache_control_directive("", "max-age", &v));
+}
+
+static void lifetimes(void)
+{
+   /* max-age, over Expires */
+   CHECK(lifetime("Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+                  "Cache-Control: max-age=3600\n"
+                  "Expires: Sun, 06 Nov 1994 08:59:37 GMT") == 3600);
+   CHECK(lifetime("Cache-Control: public, max-age=\"120\"") == 120);
+   CHECK(lifetime("Cache-Control: max-age=0") == 0);
+
+   /* Expires, from the Date */
+   CHECK(lifetime("Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+                  "Expires: Sun, 06 Nov 1994 08:59:37 GMT") == 600);
+   CHECK(lifetime("Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+                  "Expires: Sunday, 06-Nov-94 09:49:37 GMT") == 3600);
+   CHECK(lifetime("Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+                  "Expires: Sun, 06 Nov 1994 07:49:37 GMT") == 0);
+   /* a max-age without a value doesn't count */
+   CHECK(lifetime("Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+                  "Cache-Control: max-age\n"
+                  "Expires: Sun, 06 Nov 1994 08:59:37 GMT") == 600);
+
+   /* an invalid Expires means already expired */
+   CHECK(lifetime("Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+                  "Expires: 0") == 0);
+   CHECK(lifetime("Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+                  "Expires: -1") == 0);
+   CHECK(lifetime("Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+                  "Expires: \n"
+                  "Last-Modified: Sun, 06 Nov 1994 07:49:37 GMT") == 0);
+   /* (and without a Date, there's nothing to count from) */
+   CHECK(lifetime("Expires: Sun, 06 Nov 1994 08:59:37 GMT") == 0);
+
+   /* a tenth of the time since Last-Modified, up to a day */
+   CHECK(lifetime("Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+                  "Last-Modified: Sun, 06 Nov 1994 07:49:37 GMT") == 360);
+   CHECK(lifetime("Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+                  "Last-Modified: Tue, 01 Jan 1991 00:00:00 GMT") ==
+         24 * 60 * 60);
+   CHECK(lifetime("Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+                  "Last-Modified: Sun, 06 Nov 1994 09:49:37 GMT") == -1);
+   CHECK(lifetime("Last-Modified: Sun, 06 Nov 1994 07:49:37 GMT") == -1);
+
+   /* no-cache and no-store, over everything */
+   CHECK(lifetime("Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+                  "Cache-Control: no-cache, max-age=3600\n"
+                  "Expires: Sun, 06 Nov 1994 08:59:37 GMT") == 0);
+   CHECK(lifetime("Cache-Control: max-age=3600, no-store") == 0);
+
+   /* nothing told */
+   CHECK(lifetime("Date: Sun, 06 Nov 1994 08:49:37 GMT") == -1);
+   CHECK(lifetime("Cache-Control: private") == -1);
+}
+
+static void staleness(void)
+{
+   CacheEntry_t *e;
+
+   /* max-age counts the Age it came with, and the time since */
+   e = receive("http://fresh.test/a", "Cache-Control: max-age=100\n");
+   CHECK(e && e->Lifetime == 100 && e->Age == 0);
+   CHECK(!Cache_entry_is_stale(e));
+   e->ResponseTime -= 101;
+   CHECK(Cache_entry_is_stale(e));
+
+   e = receive("http://fresh.test/b",
+               "Cache-Control: max-age=100\n"
+               "Age: 60\n");
+   CHECK(e && e->Age == 60 && !Cache_entry_is_stale(e));
+   e->ResponseTime -= 41;
+   CHECK(Cache_entry_is_stale(e));
+
+   e = receive("http://fresh.test/c",
+               "Cache-Control: max-age=100\n"
+               "Age: 200\n");
+   CHECK(e && Cache_entry_is_stale(e));
+
+   /* a negative Age is none */
+   e = receive("http://fresh.test/d",
+               "Cache-Control: max-age=100\n"
+               "Age: -500\n");
+   CHECK(e && e->Age == 0 && !Cache_entry_is_stale(e));
+
+   /* Expires and the Last-Modified heuristic */
+   e = receive("http://fresh.test/e",
+               "Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+               "Expires: Sun, 06 Nov 1994 08:59:37 GMT\n");
+   CHECK(e && e->Lifetime == 600 && !Cache_entry_is_stale(e));
+   e = receive("http://fresh.test/f",
+               "Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+               "Last-Modified: Sun, 06 Nov 1994 07:49:37 GMT\n");
+   CHECK(e && e->Lifetime == 360 && !Cache_entry_is_stale(e));
+   e->ResponseTime -= 360;
+   CHECK(Cache_entry_is_stale(e));
+
+   /* an invalid Expires, no-cache and no-store are stale at once */
+   e = receive("http://fresh.test/g",
+               "Date: Sun, 06 Nov 1994 08:49:37 GMT\n"
+               "Expires: 0\n");
+   CHECK(e && e->Lifetime == 0 && Cache_entry_is_stale(e));
+   e = receive("http://fresh.test/h", "Cache-Control: no-cache\n");
+   CHECK(e && Cache_entry_is_stale(e));
+   e = receive("http://fresh.test/i", "Cache-Control: no-store\n");
+   CHECK(e && Cache_entry_is_stale(e));
+
+   /* with no lifetime, validators ask for a check, and no validators
+    * keep it for the session */
+   e = receive("http://fresh.test/j", "ETag: \"abc\"\n");
+   CHECK(e && e->Lifetime == -1 && Cache_entry_is_stale(e));
+   e = receive("http://fresh.test/k", "Content-Language: en\n");
+   CHECK(e && e->Lifetime == -1 && !Cache_entry_is_stale(e));
+   e->ResponseTime -= 365 * 24 * 60 * 60L;
+   CHECK(!Cache_entry_is_stale(e));
+}
+
+int main(void)
+{
+   a_Cache_init();
+
+   dates();
+   directives();
+   lifetimes();
+   staleness();
+
+   a_Cache_freeall();
+   return CHECK_RESULT();
+}
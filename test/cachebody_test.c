@@ -0,0 +1,169 @@
+/*
+ * Cache body test
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Exercises the storage of cache bodies: small bodies in the heap, and
+ * large ones (announced or grown) in mapped temporary files, which must
+ * keep the data whole and contiguous through growth and fitting. Then
+ * bodies of the same data, small and large, must end up shared.
+ *
+ *    cachebody-test
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "src/prefs.h"
+#include "src/cachebody.h"
+#include "check.h"
+
+DilloPrefs prefs;
+
+/*
+ * Append 'len' bytes of a known pattern, in chunks of 'chunk' bytes
+ */
+static void fill(CacheBody *body, int len, int chunk)
+{
+   char buf[4096];
+   int i, n;
+
+   while (len > 0) {
+      n = MIN(len, MIN(chunk, (int)sizeof(buf)));
+      for (i = 0; i < n; i++)
+         buf[i] = (char)((body->len + i) % 251);
+      a_Cachebody_append(body, buf, n);
+      len -= n;
+   }
+}
+
+static int pattern_ok(CacheBody *body)
+{
+   int i;
+
+   for (i = 0; i < body->len; i++)
+      if (body->str[i] != (char)(i % 251))
+         return 0;
+   return body->str[body->len] == '\0';
+}
+
+/*
+ * Share bodies of identical and different data
+ */
+static void test_sharing(void)
+{
+   CacheBody *a, *b, *c, *big1, *big2;
+   long bytes, saved;
+   int bodies;
+
+   a = a_Cachebody_new(0);
+   a_Cachebody_append(a, "GIF89a spacer", 13);
+   a = a_Cachebody_share(a);
+   CHECK(a->refs == 1);
+   CHECK(a_Cachebody_share(a) == a && a->refs == 1);
+
+   b = a_Cachebody_new(0);
+   a_Cachebody_append(b, "GIF89a spacer", 13);
+   b = a_Cachebody_share(b);
+   CHECK(b == a && a->refs == 2);
+
+   /* same size, different data */
+   c = a_Cachebody_new(0);
+   a_Cachebody_append(c, "GIF89a spaceR", 13);
+   c = a_Cachebody_share(c);
+   CHECK(c != a && c->refs == 1);
+
+   /* shared bodies don't change */
+   a_Cachebody_append(a, "x", 1);
+   CHECK(a->len == 13);
+
+   big1 = a_Cachebody_new(0);
+   fill(big1, 2 * 1024 * 1024, 4096);
+   big2 = a_Cachebody_new(0);
+   fill(big2, 2 * 1024 * 1024, 1000);
+   a_Cachebody_fit(big1);
+   a_Cachebody_fit(big2);
+   big1 = a_Cachebody_share(big1);
+   big2 = a_Cachebody_share(big2);
+   CHECK(big1 == big2 && big1->refs == 2 && pattern_ok(big1));
+
+   a_Cachebody_shared_stats(&bodies, &bytes, &saved);
+   CHECK(bodies == 3 && bytes == 13 + 13 + 2 * 1024 * 1024);
+   CHECK(saved == 13 + 2 * 1024 * 1024);
+
+   a_Cachebody_free(a);
+   CHECK(b->refs == 1 && !strcmp(b->str, "GIF89a spacer"));
+   a_Cachebody_free(b);
+   a_Cachebody_free(c);
+   a_Cachebody_free(big1);
+   CHECK(pattern_ok(big2));
+   a_Cachebody_free(big2);
+   a_Cachebody_shared_stats(&bodies, &bytes, &saved);
+   CHECK(bodies == 0 && bytes == 0 && saved == 0);
+}
+
+int main(void)
+{
+   CacheBody *small, *grown, *announced;
+   long bytes;
+   int files;
+
+   /* small bodies stay in the heap */
+   small = a_Cachebody_new(100);
+   CHECK(small->fd == -1 && small->len == 0 && small->str[0] == '\0');
+   a_Cachebody_append(small, "hello", 5);
+   a_Cachebody_append(small, " world", 6);
+   CHECK(small->len == 11 && !strcmp(small->str, "hello world"));
+   a_Cachebody_truncate(small, 5);
+   CHECK(small->len == 5 && !strcmp(small->str, "hello"));
+   a_Cachebody_fit(small);
+   CHECK(small->sz == 6 && !strcmp(small->str, "hello"));
+   a_Cachebody_stats(&files, &bytes);
+   CHECK(files == 0 && bytes == 0);
+
+   /* a body that grows large moves to a temporary file */
+   grown = a_Cachebody_new(8 * 1024);
+   fill(grown, 3 * 1024 * 1024 + 17, 1000);
+   CHECK(grown->fd != -1);
+   CHECK(grown->len == 3 * 1024 * 1024 + 17 && pattern_ok(grown));
+   a_Cachebody_fit(grown);
+   CHECK(grown->sz >= grown->len + 1 && grown->sz < grown->len + 8192);
+   CHECK(pattern_ok(grown));
+
+   /* an announced large body starts there, with room for all of it */
+   announced = a_Cachebody_new(2 * 1024 * 1024);
+   CHECK(announced->fd != -1 && announced->sz > 2 * 1024 * 1024);
+   fill(announced, 2 * 1024 * 1024, 4096);
+   CHECK(announced->sz < 2 * 1024 * 1024 + 8192 && pattern_ok(announced));
+   /* ...and more, if the announcement was wrong */
+   fill(announced, 100000, 4096);
+   CHECK(announced->len == 2 * 1024 * 1024 + 100000 && pattern_ok(announced));
+
+   a_Cachebody_stats(&files, &bytes);
+   CHECK(files == 2 && bytes == grown->sz + announced->sz);
+
+   a_Cachebody_free(small);
+   a_Cachebody_free(grown);
+   a_Cachebody_free(announced);
+   a_Cachebody_stats(&files, &bytes);
+   CHECK(files == 0 && bytes == 0);
+
+   test_sharing();
+   a_Cachebody_stats(&files, &bytes);
+   CHECK(files == 0 && bytes == 0);
+
+   return CHECK_RESULT();
+}
@@ -0,0 +1,42 @@
+/*
+ * Checks for the test programs
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TEST_CHECK_H__
+#define __TEST_CHECK_H__
+
+#include <stdio.h>
+
+static int failed;            /* checks that didn't hold */
+
+/*
+ * Tell when 'cond' doesn't hold, and go on
+ */
+#define CHECK(cond) \
+   do { \
+      if (!(cond)) { \
+         printf("FAILED at line %d: %s\n", __LINE__, #cond); \
+         failed++; \
+      } \
+   } while (0)
+
+/*
+ * Tell whether all the checks held, and give the exit status for it
+ */
+#define CHECK_RESULT() \
+   (printf("%s\n", failed ? "FAILED" : "PASSED"), failed != 0)
+
+#endif /* __TEST_CHECK_H__ */
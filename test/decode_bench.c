@@ -0,0 +1,308 @@
+/*
+ * Dillo content decoding benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compares the content decoders: the files are compressed with every
+ * coding that was compiled in (at the levels servers commonly use), then
+ * each one is decoded 'rounds' times through a_Decode_content_init() and
+ * a_Decode_process(), fed in network-sized chunks as the cache does.
+ * The output is checked against the original.
+ *
+ * Then all the files, one after another, are sent with chunked transfer
+ * coding, in chunks from 1 byte to 1 MB, and decoded 'rounds' times with
+ * a_Decode_transfer_next(): once just looking at the data (as the cache
+ * stores an identity-coded body) and once gathering it in a string (as it
+ * does to feed a content decoder).
+ *
+ *    decode-bench [-r rounds] file...   (e.g. the test/ HTML, 50 rounds)
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI_ENCODER
+#include <brotli/encode.h>
+#endif
+#ifdef ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "src/prefs.h"
+#include "src/decode.h"
+
+DilloPrefs prefs;
+
+/* What a network read brings */
+#define CHUNK  (16 * 1024)
+
+typedef struct {
+   const char *name;             /* as in Content-Encoding */
+   Dstr *(*compress) (Dstr *data);
+} Coding;
+
+/* ------------------------------------------------------------------------ */
+
+static double now(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * Read a whole file, or return NULL
+ */
+static Dstr *read_file(const char *path)
+{
+   Dstr *data;
+   FILE *fp;
+   char buf[CHUNK];
+   size_t n;
+
+   if (!(fp = fopen(path, "rb")))
+      return NULL;
+   data = dStr_new("");
+   while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+      dStr_append_l(data, buf, n);
+   fclose(fp);
+   return data;
+}
+
+static Dstr *compress_gzip(Dstr *data)
+{
+   Dstr *gz = dStr_sized_new(data->len / 2 + 64);
+   z_stream zs;
+   char out[CHUNK];
+
+   memset(&zs, 0, sizeof(zs));
+   deflateInit2(&zs, 6, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+   zs.next_in = (Bytef *)data->str;
+   zs.avail_in = data->len;
+   do {
+      zs.next_out = (Bytef *)out;
+      zs.avail_out = sizeof(out);
+      deflate(&zs, Z_FINISH);
+      dStr_append_l(gz, out, sizeof(out) - zs.avail_out);
+   } while (zs.avail_out == 0);
+   deflateEnd(&zs);
+   return gz;
+}
+
+#ifdef HAVE_BROTLI_ENCODER
+static Dstr *compress_brotli(Dstr *data)
+{
+   size_t len = BrotliEncoderMaxCompressedSize(data->len);
+   Dstr *br = dStr_sized_new(len + 1);
+
+   BrotliEncoderCompress(5, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                         data->len, (const uint8_t *)data->str, &len,
+                         (uint8_t *)br->str);
+   br->len = len;
+   return br;
+}
+#endif
+
+#ifdef ENABLE_ZSTD
+static Dstr *compress_zstd(Dstr *data)
+{
+   size_t len = ZSTD_compressBound(data->len);
+   Dstr *zst = dStr_sized_new(len + 1);
+
+   len = ZSTD_compress(zst->str, len, data->str, data->len, 3);
+   zst->len = ZSTD_isError(len) ? 0 : len;
+   return zst;
+}
+#endif
+
+static Coding codings[] = {
+   {"gzip", compress_gzip},
+#ifdef HAVE_BROTLI_ENCODER
+   {"br", compress_brotli},
+#endif
+#ifdef ENABLE_ZSTD
+   {"zstd", compress_zstd},
+#endif
+};
+
+/*
+ * Decode 'enc' as a 'name' body, a chunk at a time.
+ * Return the length of the output, or -1 if it doesn't match 'orig'.
+ */
+static long decode(const char *name, Dstr *enc, Dstr *orig)
+{
+   Decode *dc = a_Decode_content_init(name);
+   Dstr *out;
+   long len = 0;
+   int i, n, wrong = 0;
+
+   for (i = 0; i < enc->len; i += n) {
+      n = MIN(CHUNK, enc->len - i);
+      out = a_Decode_process(dc, enc->str + i, n);
+      if (orig && (len + out->len > orig->len ||
+                   memcmp(orig->str + len, out->str, out->len)))
+         wrong = 1;
+      len += out->len;
+      dStr_free(out, 1);
+   }
+   a_Decode_free(dc);
+   return (wrong || (orig && len != orig->len)) ? -1 : len;
+}
+
+/*
+ * Send 'data' with chunked transfer coding, in chunks of 'size' bytes
+ */
+static Dstr *chunked(Dstr *data, int size)
+{
+   Dstr *ch = dStr_sized_new(data->len + data->len / size * 6 + 64);
+   int i, n;
+
+   for (i = 0; i < data->len; i += n) {
+      n = MIN(size, data->len - i);
+      dStr_sprintfa(ch, "%x\r\n", n);
+      dStr_append_l(ch, data->str + i, n);
+      dStr_append(ch, "\r\n");
+   }
+   dStr_append(ch, "0\r\nX-Trailer: yes\r\n\r\n");
+   return ch;
+}
+
+/*
+ * Decode the chunked 'enc', a read at a time, gathering the data in 'out'
+ * if given. Return a checksum of the data.
+ */
+static unsigned long dechunk(Dstr *enc, Dstr *out)
+{
+   DecodeTransfer *dc = a_Decode_transfer_init("chunked");
+   unsigned long sum = 0;
+   const char *str, *data;
+   int i, len, n;
+
+   for (i = 0; i < enc->len; i += CHUNK) {
+      str = enc->str + i;
+      len = MIN(CHUNK, enc->len - i);
+      while ((n = a_Decode_transfer_next(dc, &str, &len, &data))) {
+         if (out)
+            dStr_append_l(out, data, n);
+         sum += n + (uchar_t)data[n - 1];
+      }
+   }
+   if (a_Decode_transfer_surplus(dc) != 0)
+      sum = 0;
+   a_Decode_transfer_free(dc);
+   return sum;
+}
+
+static void chunked_bench(Dstr *all, int rounds)
+{
+   static const int sizes[] = {1, 16, 1024, 64 * 1024, 1024 * 1024};
+   Dstr *enc, *out = dStr_sized_new(all->len + 1);
+   double t, secs[2];
+   int i, r, copy;
+
+   for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+      enc = chunked(all, sizes[i]);
+      dStr_truncate(out, 0);
+      dechunk(enc, out);
+      if (out->len != all->len || memcmp(out->str, all->str, all->len)) {
+         printf("chunked: WRONG OUTPUT with %d-byte chunks\n", sizes[i]);
+         exit(1);
+      }
+      for (copy = 0; copy < 2; copy++) {
+         t = now();
+         for (r = 0; r < rounds; r++) {
+            dStr_truncate(out, 0);
+            dechunk(enc, copy ? out : NULL);
+         }
+         secs[copy] = now() - t;
+      }
+      printf("chunked, %7d-byte chunks: %8.1f MB/s, %8.1f MB/s copied\n",
+             sizes[i],
+             all->len * (double)rounds / (1024 * 1024) / MAX(secs[0], 1e-9),
+             all->len * (double)rounds / (1024 * 1024) / MAX(secs[1], 1e-9));
+      dStr_free(enc, 1);
+   }
+   dStr_free(out, 1);
+}
+
+int main(int argc, char **argv)
+{
+   int ncodings = sizeof(codings) / sizeof(codings[0]);
+   Dstr **files, **enc, *all;
+   long total = 0, packed;
+   double t, secs;
+   int rounds = 50, nfiles = 0, c, i, r;
+
+   if (argc > 2 && !strcmp(argv[1], "-r")) {
+      rounds = MAX(atoi(argv[2]), 1);
+      argc -= 2;
+      argv += 2;
+   }
+   if (argc < 2) {
+      fprintf(stderr, "usage: decode-bench [-r rounds] file...\n");
+      return 1;
+   }
+   files = dNew(Dstr *, argc);
+   for (i = 1; i < argc; i++) {
+      if ((files[nfiles] = read_file(argv[i])))
+         total += files[nfiles++]->len;
+      else
+         fprintf(stderr, "decode-bench: can't read %s\n", argv[i]);
+   }
+   printf("%d files, %ld KB, %d rounds; Accept-Encoding: %s\n",
+          nfiles, total / 1024, rounds, a_Decode_content_encodings());
+
+   enc = dNew(Dstr *, nfiles);
+   for (c = 0; c < ncodings; c++) {
+      packed = 0;
+      for (i = 0; i < nfiles; i++) {
+         enc[i] = codings[c].compress(files[i]);
+         packed += enc[i]->len;
+         if (decode(codings[c].name, enc[i], files[i]) == -1) {
+            printf("%s: WRONG OUTPUT for file %d\n", codings[c].name, i);
+            return 1;
+         }
+      }
+      t = now();
+      for (r = 0; r < rounds; r++)
+         for (i = 0; i < nfiles; i++)
+            decode(codings[c].name, enc[i], NULL);
+      secs = now() - t;
+      printf("%-5s %7ld KB (%4.1f%%)  %8.1f MB/s out\n", codings[c].name,
+             packed / 1024, 100.0 * packed / MAX(total, 1),
+             total * (double)rounds / (1024 * 1024) / MAX(secs, 1e-9));
+      for (i = 0; i < nfiles; i++)
+         dStr_free(enc[i], 1);
+   }
+   dFree(enc);
+
+   all = dStr_sized_new(total + 1);
+   for (i = 0; i < nfiles; i++)
+      dStr_append_l(all, files[i]->str, files[i]->len);
+   if (all->len)
+      chunked_bench(all, rounds);
+   dStr_free(all, 1);
+
+   for (i = 0; i < nfiles; i++)
+      dStr_free(files[i], 1);
+   dFree(files);
+   return 0;
+}
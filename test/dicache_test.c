@@ -0,0 +1,347 @@
+/*
+ * Dicache budget test
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Decodes made-up images into the dicache, with imgbufs that only count
+ * their memory and references, and checks what stays cached: the least
+ * recently used images that nothing shows go once the budget is full,
+ * the shown ones (and their scaled copies) stay until they're let go,
+ * and invalidated ones go first. An imgbuf that a twin with the same
+ * data replaced counts until nothing shows it. Asking whether they're over
+ * the budget changes nothing.
+ *
+ *    dicache-test
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "src/prefs.h"
+#include "src/web.hh"
+#include "src/dicache.h"
+#include "src/imgbuf.hh"
+#include "src/imgpool.h"
+#include "src/dpng.h"
+#include "src/dgif.h"
+#include "src/djpeg.h"
+#include "check.h"
+
+DilloPrefs prefs;
+
+#define NIMAGES 18
+#define TWINS   17            /* from here on, the images have the same data */
+#define SIDE    256           /* 192 KB per RGB image */
+
+/* An imgbuf that only knows its size, its references, and the memory its
+ * scaled copies take */
+typedef struct {
+   int refs;
+   long size, scaled;
+} FakeImgbuf;
+
+static int imgbufs;           /* alive */
+static long scaled_total;     /* what the scaled copies take up */
+static DilloImage images[NIMAGES + 1];
+
+/* ------------------------------------------------------------------------ */
+
+/* The urls are the images' numbers */
+DilloUrl *a_Url_dup(const DilloUrl *u) { return (DilloUrl *)u; }
+void a_Url_free(DilloUrl *u) { }
+int a_Url_cmp(const DilloUrl *A, const DilloUrl *B)
+{
+   return (int)((long)A - (long)B);
+}
+
+void *a_Imgbuf_new(void *layout, int img_type, uint_t width, uint_t height,
+                   double gamma)
+{
+   FakeImgbuf *ib = dNew(FakeImgbuf, 1);
+
+   ib->refs = 1;
+   ib->size = (long)width * height *
+      (img_type == DILLO_IMG_TYPE_INDEXED ||
+       img_type == DILLO_IMG_TYPE_GRAY ? 1 : 3);
+   ib->scaled = 0;
+   imgbufs++;
+   return ib;
+}
+
+void a_Imgbuf_ref(void *v_imgbuf)
+{
+   ((FakeImgbuf *)v_imgbuf)->refs++;
+}
+
+void a_Imgbuf_unref(void *v_imgbuf)
+{
+   FakeImgbuf *ib = v_imgbuf;
+
+   if (ib && --ib->refs == 0) {
+      dFree(ib);
+      imgbufs--;
+   }
+}
+
+int a_Imgbuf_last_reference(void *v_imgbuf)
+{
+   FakeImgbuf *ib = v_imgbuf;
+
+   return ib->refs == 1 && ib->scaled == 0;
+}
+
+long a_Imgbuf_mem_size(void *v_imgbuf)
+{
+   FakeImgbuf *ib = v_imgbuf;
+
+   return ib ? ib->size + ib->scaled : 0;
+}
+
+long a_Imgbuf_scaled_mem_size(void)
+{
+   return scaled_total;
+}
+
+void a_Imgbuf_set_cmap(void *v_imgbuf, const uchar_t *cmap, int num_colors) { }
+void a_Imgbuf_set_orig_size(void *v_imgbuf, uint_t width, uint_t height) { }
+void a_Imgbuf_update(void *v_imgbuf, const uchar_t *buf, DilloImgType type,
+                     uint_t width, uint_t height, uint_t y) { }
+void a_Imgbuf_new_scan(void *v_imgbuf) { }
+
+DilloImage *a_Image_new_with_dw(void *layout, const char *alt_text,
+                                int32_t bg_color) { return NULL; }
+void *a_Image_get_dw(DilloImage *Image) { return NULL; }
+void a_Image_ref(DilloImage *Image) { Image->RefCount++; }
+void a_Image_unref(DilloImage *Image) { Image->RefCount--; }
+void a_Image_set_parms(DilloImage *Image, void *v_imgbuf, DilloUrl *url,
+                       int version, uint_t width, uint_t height,
+                       DilloImgType type) { }
+void a_Image_write(DilloImage *Image, uint_t y) { }
+void a_Image_close(DilloImage *Image) { }
+void a_Image_abort(DilloImage *Image) { }
+int a_Image_get_display_size(DilloImage *Image, uint_t width, uint_t height,
+                             uint_t *disp_width, uint_t *disp_height)
+{
+   return 0;
+}
+
+/* No pool: the decoders run in place, and do nothing */
+ImgpoolJob *a_Imgpool_job_new(void *(*decoder_new)(DilloImage *, DilloUrl *,
+                                                    int),
+                              CA_Callback_t decoder, DilloImage *Image,
+                              const DilloUrl *url, int version)
+{
+   return NULL;
+}
+void a_Imgpool_job_feed(ImgpoolJob *job, const char *buf, int len) { }
+void a_Imgpool_job_finish(ImgpoolJob *job) { }
+void a_Imgpool_job_cancel(ImgpoolJob *job) { }
+int a_Imgpool_worker(void) { return 0; }
+void a_Imgpool_set_parms(uint_t width, uint_t height, DilloImgType type,
+                         double gamma) { }
+void a_Imgpool_set_orig_size(uint_t width, uint_t height) { }
+void a_Imgpool_set_cmap(int bg_color, const uchar_t *cmap, uint_t num_colors,
+                        int num_colors_max, int bg_index) { }
+void a_Imgpool_new_scan(void) { }
+void a_Imgpool_write(const uchar_t *buf, uint_t y) { }
+void a_Imgpool_close(void) { }
+
+void *a_Png_new(DilloImage *Image, DilloUrl *url, int version)
+{
+   return Image;
+}
+void a_Png_callback(int Op, CacheClient_t *Client) { }
+void *a_Gif_new(DilloImage *Image, DilloUrl *url, int version)
+{
+   return Image;
+}
+void a_Gif_callback(int Op, void *data) { }
+void *a_Jpeg_new(DilloImage *Image, DilloUrl *url, int version)
+{
+   return Image;
+}
+void a_Jpeg_callback(int Op, void *data) { }
+
+bool_t a_Cache_get_digest(const DilloUrl *url, uint64_t *digest, int *size)
+{
+   if ((long)url < TWINS)
+      return FALSE;
+   *digest = TWINS;
+   *size = 1;
+   return TRUE;
+}
+bool_t a_Cache_same_body(const DilloUrl *url, const DilloUrl *other)
+{
+   return (long)url >= TWINS && (long)other >= TWINS;
+}
+
+void a_Bw_close_client(BrowserWindow *bw, int ClientKey) { }
+
+/* ------------------------------------------------------------------------ */
+
+static DilloWeb webs[NIMAGES + 1];
+static CacheClient_t clients[NIMAGES + 1];
+
+/*
+ * Ask for image 'n', and set its parameters if it isn't in the dicache
+ */
+static void start(long n)
+{
+   DilloUrl *url = (DilloUrl *)n;
+   CA_Callback_t call;
+   void *data;
+   DICacheEntry *entry;
+
+   memset(&webs[n], 0, sizeof(DilloWeb));
+   webs[n].url = url;
+   webs[n].Image = &images[n];
+   memset(&clients[n], 0, sizeof(CacheClient_t));
+   clients[n].Key = (int)n;
+   clients[n].Url = url;
+   clients[n].Web = &webs[n];
+
+   a_Dicache_png_image("image/png", &webs[n], &call, &data);
+   entry = a_Dicache_get_entry(url, DIC_Last);
+   if (entry->State < DIC_SetParms)
+      a_Dicache_set_parms(url, entry->version, &images[n], SIDE, SIDE,
+                          DILLO_IMG_TYPE_RGB, 1.0);
+}
+
+/*
+ * The data of image 'n' is all there: the cache client is done with it
+ */
+static void finish(long n)
+{
+   DilloUrl *url = (DilloUrl *)n;
+
+   a_Dicache_close(url, a_Dicache_get_entry(url, DIC_Last)->version,
+                   &clients[n]);
+}
+
+/*
+ * Ask for image 'n', and decode it whole if it isn't in the dicache
+ */
+static void load(long n)
+{
+   start(n);
+   finish(n);
+}
+
+static int cached(long n)
+{
+   return a_Dicache_get_entry((DilloUrl *)n, DIC_Last) != NULL;
+}
+
+static FakeImgbuf *imgbuf(long n)
+{
+   return a_Dicache_get_entry((DilloUrl *)n, DIC_Last)->v_imgbuf;
+}
+
+/* Show 'ib' scaled to take up 'size' (0 for not at all) */
+static void set_scaled(FakeImgbuf *ib, long size)
+{
+   scaled_total += size - ib->scaled;
+   ib->scaled = size;
+}
+
+int main(void)
+{
+   FakeImgbuf *shown, *replaced;
+   long n, excess;
+
+   a_Dicache_init();
+   prefs.image_cache_size = 1;   /* five images fit */
+
+   /* unused images go, the least recently used first */
+   for (n = 1; n <= 8; n++) {
+      load(n);
+      a_Dicache_cleanup();
+   }
+   CHECK(!cached(1) && !cached(2) && !cached(3));
+   for (n = 4; n <= 8; n++)
+      CHECK(cached(n));
+   CHECK(imgbufs == 5);
+
+   /* asking for one again makes it recent */
+   load(4);
+   load(9);
+   a_Dicache_cleanup();
+   CHECK(cached(4) && !cached(5) && cached(9));
+
+   /* a shown image, and its scaled copy, stay and count */
+   shown = imgbuf(6);
+   a_Imgbuf_ref(shown);
+   set_scaled(shown, SIDE * SIDE * 3);
+   load(10);
+   load(11);
+   a_Dicache_cleanup();
+   CHECK(cached(6) && !cached(4) && !cached(7) && cached(11));
+   CHECK(a_Dicache_over_budget() == 0);
+
+   /* asking only tells */
+   for (n = 12; n <= 16; n++) {
+      load(n);
+      a_Imgbuf_ref(imgbuf(n));
+   }
+   CHECK(a_Dicache_over_budget() > 0);
+   CHECK(cached(9) && cached(11));
+
+   /* when the shown ones take more than the budget, they must be let go */
+   a_Dicache_cleanup();
+   excess = a_Dicache_over_budget();
+   CHECK(excess == 7L * SIDE * SIDE * 3 - 1024 * 1024);
+   CHECK(cached(6) && !cached(9) && !cached(11));
+   set_scaled(shown, 0);
+   CHECK(a_Dicache_over_budget() == excess - SIDE * SIDE * 3);
+   a_Imgbuf_unref(shown);
+   a_Dicache_cleanup();
+   CHECK(a_Dicache_over_budget() == 0);
+   CHECK(!cached(6) && cached(12));
+
+   /* invalidated images go at once, the rest only beyond the budget */
+   prefs.image_cache_size = 0;
+   load(1);
+   load(2);
+   a_Dicache_invalidate_entry((DilloUrl *)1);
+   a_Dicache_cleanup();
+   CHECK(!a_Dicache_get_entry((DilloUrl *)1, 1) && cached(2));
+   CHECK(a_Dicache_over_budget() == 0);
+
+   /* an imgbuf its twin replaced counts as long as it's shown */
+   prefs.image_cache_size = 1;
+   start(TWINS);
+   start(TWINS + 1);
+   replaced = imgbuf(TWINS + 1);
+   a_Imgbuf_ref(replaced);
+   finish(TWINS);
+   a_Imgbuf_ref(imgbuf(TWINS));
+   finish(TWINS + 1);
+   CHECK(imgbuf(TWINS + 1) == imgbuf(TWINS));
+   a_Dicache_cleanup();
+   excess = a_Dicache_over_budget();
+   CHECK(excess == 7L * SIDE * SIDE * 3 - 1024 * 1024);
+   a_Imgbuf_unref(replaced);
+   a_Dicache_cleanup();
+   CHECK(a_Dicache_over_budget() == excess - SIDE * SIDE * 3);
+   CHECK(cached(TWINS + 1));
+
+   for (n = 12; n <= TWINS; n++)
+      a_Imgbuf_unref(imgbuf(n));
+   a_Dicache_freeall();
+   CHECK(imgbufs == 0);
+
+   return CHECK_RESULT();
+}
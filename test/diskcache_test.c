@@ -0,0 +1,207 @@
+/*
+ * Disk cache test
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Exercises the disk tier of the cache in a scratch home directory:
+ * storing and reading back, sharing of identical bodies, persistence
+ * across sessions, removal of orphan files, lost bodies, and eviction.
+ *
+ *    diskcache-test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "src/prefs.h"
+#include "src/diskcache.h"
+#include "check.h"
+
+DilloPrefs prefs;
+
+static char home[] = "/tmp/diskcache-test.XXXXXX";
+static const char header[] =
+   "HTTP/1.1 200 OK\n"
+   "Content-Type: text/html\n"
+   "ETag: \"abc\"\n"
+   "Content-Length: 5\n"
+   "\n";
+
+static int count_files(void)
+{
+   char *dir = dStrconcat(home, "/.dillo/cache", NULL);
+   struct dirent *de;
+   DIR *d = opendir(dir);
+   int n = 0;
+
+   while (d && (de = readdir(d)))
+      if (de->d_name[0] != '.' && strcmp(de->d_name, "index"))
+         n++;
+   if (d)
+      closedir(d);
+   dFree(dir);
+   return n;
+}
+
+static int body_is(const char *key, const char *body, size_t len)
+{
+   Dstr *ds = a_Diskcache_body(key);
+   int ret = ds && ds->len == (int)len && !memcmp(ds->str, body, len);
+
+   dStr_free(ds, 1);
+   return ret;
+}
+
+/*
+ * Remove the body files that hold 'body'
+ */
+static void remove_files_with(const char *body)
+{
+   char *dir = dStrconcat(home, "/.dillo/cache/", NULL), *f, buf[64];
+   struct dirent *de;
+   DIR *d = opendir(dir);
+   FILE *fp;
+   size_t n;
+
+   while (d && (de = readdir(d))) {
+      if (de->d_name[0] == '.')
+         continue;
+      f = dStrconcat(dir, de->d_name, NULL);
+      if ((fp = fopen(f, "r"))) {
+         n = fread(buf, 1, sizeof(buf), fp);
+         fclose(fp);
+         if (n == strlen(body) && !memcmp(buf, body, n))
+            unlink(f);
+      }
+      dFree(f);
+   }
+   if (d)
+      closedir(d);
+   dFree(dir);
+}
+
+static void remove_tree(void)
+{
+   char *cmd = dStrconcat("rm -rf ", home, NULL);
+
+   if (system(cmd) != 0)
+      printf("couldn't remove %s\n", home);
+   dFree(cmd);
+}
+
+int main(void)
+{
+   DiskcacheStats_t st;
+   time_t rtime = 0;
+   const char *hdr;
+   char *path, *big;
+   FILE *fp;
+   int i;
+
+   if (!mkdtemp(home)) {
+      perror("mkdtemp");
+      return 1;
+   }
+   setenv("HOME", home, 1);
+   path = dStrconcat(home, "/.dillo", NULL);
+   mkdir(path, 0700);
+   dFree(path);
+
+   /* off by default */
+   a_Diskcache_init();
+   CHECK(!a_Diskcache_enabled());
+   a_Diskcache_store("http://a.test/", header, 100, "hello", 5);
+   CHECK(a_Diskcache_header("http://a.test/", NULL) == NULL);
+
+   prefs.disk_cache_size = 1;
+   a_Diskcache_init();
+   CHECK(a_Diskcache_enabled());
+
+   /* store, and share identical bodies */
+   a_Diskcache_store("http://a.test/", header, 100, "hello", 5);
+   a_Diskcache_store("http://b.test/x?y", header, 200, "hello", 5);
+   a_Diskcache_store("http://c.test/", header, 300, "world", 5);
+   CHECK((hdr = a_Diskcache_header("http://b.test/x?y", &rtime)) != NULL);
+   CHECK(hdr && !strcmp(hdr, header) && rtime == 200);
+   CHECK(body_is("http://a.test/", "hello", 5));
+   CHECK(body_is("http://c.test/", "world", 5));
+   CHECK(a_Diskcache_header("http://d.test/", NULL) == NULL);
+   a_Diskcache_stats(&st);
+   CHECK(st.entries == 3 && st.files == 2 && st.bytes == 10);
+   CHECK(count_files() == 2);
+
+   /* replacing the only user of a body removes its file */
+   a_Diskcache_store("http://c.test/", header, 400, "hello", 5);
+   CHECK(count_files() == 1);
+   CHECK(body_is("http://c.test/", "hello", 5));
+
+   /* keys with spaces or newlines would break the index */
+   a_Diskcache_store("http://e.test/a b", header, 100, "x", 1);
+   CHECK(a_Diskcache_header("http://e.test/a b", NULL) == NULL);
+
+   /* the index persists across sessions, and orphans go away */
+   a_Diskcache_store("http://d.test/", header, 500, "other", 5);
+   a_Diskcache_freeall();
+   path = dStrconcat(home, "/.dillo/cache/orphan", NULL);
+   if ((fp = fopen(path, "w")))
+      fclose(fp);
+   dFree(path);
+   a_Diskcache_init();
+   CHECK(count_files() == 2);
+   CHECK((hdr = a_Diskcache_header("http://c.test/", &rtime)) != NULL);
+   CHECK(hdr && !strcmp(hdr, header) && rtime == 400);
+   CHECK(body_is("http://a.test/", "hello", 5));
+   CHECK(body_is("http://d.test/", "other", 5));
+
+   /* a lost body drops its entry */
+   remove_files_with("other");
+   CHECK(a_Diskcache_body("http://d.test/") == NULL);
+   CHECK(a_Diskcache_header("http://d.test/", NULL) == NULL);
+   CHECK(body_is("http://a.test/", "hello", 5));
+
+   a_Diskcache_remove("http://a.test/");
+   CHECK(a_Diskcache_header("http://a.test/", NULL) == NULL);
+   CHECK(body_is("http://b.test/x?y", "hello", 5));
+
+   /* eviction keeps the bodies within the budget */
+   big = dNew(char, 200 * 1024);
+   for (i = 0; i < 8; i++) {
+      char key[32];
+
+      memset(big, 'a' + i, 200 * 1024);
+      snprintf(key, sizeof(key), "http://big.test/%d", i);
+      a_Diskcache_store(key, header, 600, big, 200 * 1024);
+   }
+   a_Diskcache_stats(&st);
+   CHECK(st.bytes <= st.limit && st.evictions > 0);
+   CHECK(a_Diskcache_header("http://big.test/7", NULL) != NULL);
+   CHECK(count_files() == st.files);
+
+   /* too big for a slot */
+   big = dRealloc(big, 300 * 1024);
+   memset(big, 'z', 300 * 1024);
+   a_Diskcache_store("http://huge.test/", header, 600, big, 300 * 1024);
+   CHECK(a_Diskcache_header("http://huge.test/", NULL) == NULL);
+   dFree(big);
+
+   a_Diskcache_freeall();
+   remove_tree();
+   return CHECK_RESULT();
+}
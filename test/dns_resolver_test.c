@@ -0,0 +1,528 @@
+/*
+ * DNS resolver test: runs the stub resolver against a fake name server
+ * (UDP and TCP on 127.0.0.1), with a small poll() loop standing in for the
+ * IO watches and timeouts of FLTK.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../src/prefs.h"
+#include "../src/dns.h"
+#include "../src/timeout.hh"
+#include "../src/IO/iowatch.hh"
+#include "../src/IO/resolv.h"
+
+DilloPrefs prefs;
+
+static int failed = 0;
+
+/* ----------------------------------------------------------------------
+ *  IO watches and timeouts
+ */
+
+#define MAX_FDS 256
+#define MAX_TIMEOUTS 256
+
+static struct {
+   CbFunction_t cb;
+   void *data;
+   int when;
+} watches[MAX_FDS];
+
+static struct {
+   double at;
+   TimeoutCb_t cb;
+   void *data;
+} timeouts[MAX_TIMEOUTS];
+static int ntimeouts;
+
+static double now(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void a_IOwatch_add_fd(int fd, int when, CbFunction_t cb, void *data)
+{
+   watches[fd].cb = cb;
+   watches[fd].data = data;
+   watches[fd].when |= when;
+}
+
+void a_IOwatch_remove_fd(int fd, int when)
+{
+   watches[fd].when &= ~when;
+}
+
+void a_Timeout_add(float t, TimeoutCb_t cb, void *data)
+{
+   timeouts[ntimeouts].at = now() + t;
+   timeouts[ntimeouts].cb = cb;
+   timeouts[ntimeouts].data = data;
+   ntimeouts++;
+}
+
+void a_Timeout_repeat(float t, TimeoutCb_t cb, void *data)
+{
+   a_Timeout_add(t, cb, data);
+}
+
+void a_Timeout_remove(void)
+{
+}
+
+/* ----------------------------------------------------------------------
+ *  Fake name server
+ */
+
+static int srv_udp, srv_tcp, srv_port, srv_conn = -1;
+static unsigned char srv_buf[514];
+static int srv_got;
+static int dropped[2];     /* queries for "drop." not answered, by type */
+static int tcp_queries;
+
+static void put16(Dstr *ds, unsigned v)
+{
+   dStr_append_c(ds, v >> 8);
+   dStr_append_c(ds, v & 0xff);
+}
+
+static void put_name(Dstr *ds, const char *name)
+{
+   const char *p = name, *dot;
+
+   while (*p) {
+      dot = strchr(p, '.');
+      dStr_append_c(ds, dot ? dot - p : (int)strlen(p));
+      dStr_append_l(ds, p, dot ? dot - p : (int)strlen(p));
+      p = dot ? dot + 1 : p + strlen(p);
+   }
+   dStr_append_c(ds, 0);
+}
+
+/* An answer record; the owner is the question (offset 12) when !name */
+static void put_rr(Dstr *ds, const char *name, int type, long ttl,
+                   const char *rdata, int rdlen)
+{
+   if (name)
+      put_name(ds, name);
+   else
+      put16(ds, 0xc000 | 12);
+   put16(ds, type);
+   put16(ds, 1);
+   put16(ds, ttl >> 16);
+   put16(ds, ttl & 0xffff);
+   put16(ds, rdlen);
+   dStr_append_l(ds, rdata, rdlen);
+}
+
+static void put_addr(Dstr *ds, const char *name, int type, const char *addr)
+{
+   char buf[16];
+
+   inet_pton(type == 1 ? AF_INET : AF_INET6, addr, buf);
+   put_rr(ds, name, type, 300, buf, type == 1 ? 4 : 16);
+}
+
+/*
+ * Answer the query in 'q'. Return value: the reply, or NULL to drop it.
+ */
+static Dstr *serve(const unsigned char *q, int len, int tcp)
+{
+   char name[256], cname[64];
+   int off = 12, n = 0, type, ancount = 0, rcode = 0, tc = 0, i;
+   Dstr *r;
+
+   while (off < len && q[off]) {
+      memcpy(name + n, q + off + 1, q[off]);
+      n += q[off];
+      name[n++] = '.';
+      off += q[off] + 1;
+   }
+   name[n ? n - 1 : 0] = '\0';
+   type = (q[off + 1] << 8) | q[off + 2];
+   off += 5;
+
+   r = dStr_new("");
+   dStr_append_l(r, (char *)q, off);
+   if (!strcasecmp(name, "www.example.test")) {
+      put_addr(r, NULL, type, type == 1 ? "192.0.2.1" : "2001:db8::1");
+      ancount = 1;
+   } else if (!strcasecmp(name, "drop.example.test")) {
+      if (dropped[type == 1]++ == 0) {
+         dStr_free(r, 1);
+         return NULL;
+      }
+      if (type == 1) {
+         put_addr(r, NULL, type, "192.0.2.2");
+         ancount = 1;
+      }
+   } else if (!strcasecmp(name, "big.example.test")) {
+      if (tcp) {
+         tcp_queries++;
+         if (type == 1) {
+            for (i = 0; i < 40; i++) {
+               char addr[32];
+
+               snprintf(addr, sizeof(addr), "192.0.2.%d", 100 + i);
+               put_addr(r, NULL, type, addr);
+            }
+            ancount = 40;
+         }
+      } else {
+         tc = 1;
+      }
+   } else if (!strcasecmp(name, "alias.example.test")) {
+      /* CNAME to a CNAME to www */
+      cname[0] = 3;
+      memcpy(cname + 1, "mid", 3);
+      cname[4] = (char)0xc0;
+      cname[5] = 12 + 6;      /* "example.test" in the question */
+      put_rr(r, NULL, 5, 120, cname, 6);
+      put_rr(r, "mid.example.test", 5, 600, "\3www\300\22", 6);
+      put_addr(r, "www.example.test", type,
+               type == 1 ? "192.0.2.1" : "2001:db8::1");
+      ancount = 3;
+   } else if (!strcasecmp(name, "short.corp.test")) {
+      if (type == 1) {
+         put_addr(r, NULL, type, "192.0.2.4");
+         ancount = 1;
+      }
+   } else if (!strncmp(name, "p", 1) && strstr(name, ".example.test")) {
+      char addr[32];
+
+      snprintf(addr, sizeof(addr), "10.0.0.%d", atoi(name + 1));
+      if (type == 1) {
+         put_addr(r, NULL, type, addr);
+         ancount = 1;
+      }
+   } else {
+      /* the SOA says how long not to ask again: 60 seconds */
+      static const char soa[] =
+         "\0\0" "\0\0\0\1" "\0\0\16\20" "\0\0\7\10" "\0\1\121\200"
+         "\0\0\0\74";
+
+      put_rr(r, "test", 6, 3600, soa, 22);
+      r->str[9] = 1;
+      rcode = 3;
+   }
+   r->str[2] = (char)(0x81 | (tc ? 0x02 : 0));
+   r->str[3] = (char)(0x80 | rcode);
+   r->str[6] = 0;
+   r->str[7] = ancount;
+   return r;
+}
+
+static void server_start(void)
+{
+   struct sockaddr_in sin;
+   socklen_t len = sizeof(sin);
+   int one = 1;
+
+   memset(&sin, 0, sizeof(sin));
+   sin.sin_family = AF_INET;
+   sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   srv_udp = socket(AF_INET, SOCK_DGRAM, 0);
+   if (bind(srv_udp, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+      perror("bind");
+      exit(1);
+   }
+   getsockname(srv_udp, (struct sockaddr *)&sin, &len);
+   srv_port = ntohs(sin.sin_port);
+   srv_tcp = socket(AF_INET, SOCK_STREAM, 0);
+   setsockopt(srv_tcp, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+   if (bind(srv_tcp, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+       listen(srv_tcp, 8) < 0) {
+      perror("tcp");
+      exit(1);
+   }
+}
+
+static void server_udp(void)
+{
+   unsigned char buf[512];
+   struct sockaddr_storage from;
+   socklen_t len = sizeof(from);
+   ssize_t n;
+   Dstr *r;
+
+   if ((n = recvfrom(srv_udp, buf, sizeof(buf), 0,
+                     (struct sockaddr *)&from, &len)) > 12 &&
+       (r = serve(buf, n, 0))) {
+      sendto(srv_udp, r->str, r->len, 0, (struct sockaddr *)&from, len);
+      dStr_free(r, 1);
+   }
+}
+
+static void server_tcp_accept(void)
+{
+   if (srv_conn == -1) {
+      srv_conn = accept(srv_tcp, NULL, NULL);
+      srv_got = 0;
+   }
+}
+
+/*
+ * Read from the TCP connection, and answer once the query is in
+ */
+static void server_tcp(void)
+{
+   char hdr[2];
+   int n;
+   Dstr *r;
+
+   if ((n = read(srv_conn, srv_buf + srv_got, sizeof(srv_buf) - srv_got)) > 0)
+      srv_got += n;
+   if (n > 0 && (srv_got < 2 ||
+                 srv_got < 2 + ((srv_buf[0] << 8) | srv_buf[1])))
+      return;
+   if (srv_got > 14 && (r = serve(srv_buf + 2, srv_got - 2, 1))) {
+      hdr[0] = r->len >> 8;
+      hdr[1] = r->len & 0xff;
+      if (write(srv_conn, hdr, 2) != 2 ||
+          write(srv_conn, r->str, r->len) != r->len)
+         perror("write");
+      dStr_free(r, 1);
+   }
+   close(srv_conn);
+   srv_conn = -1;
+}
+
+/* ----------------------------------------------------------------------
+ *  Loop
+ */
+
+static int pending;
+
+/*
+ * Run until no lookup is pending (or 'limit' seconds went by)
+ */
+static void loop(double limit)
+{
+   double end = now() + limit;
+   struct pollfd pfd[MAX_FDS];
+   int fds[MAX_FDS];
+   int i, n, t;
+
+   while (pending > 0 && now() < end) {
+      n = 0;
+      pfd[n].fd = srv_udp;
+      pfd[n++].events = POLLIN;
+      pfd[n].fd = srv_tcp;
+      pfd[n++].events = POLLIN;
+      pfd[n].fd = srv_conn;
+      pfd[n++].events = POLLIN;
+      for (i = 0; i < MAX_FDS; i++) {
+         if (watches[i].when) {
+            fds[n] = i;
+            pfd[n].fd = i;
+            pfd[n++].events = ((watches[i].when & DIO_READ) ? POLLIN : 0) |
+                              ((watches[i].when & DIO_WRITE) ? POLLOUT : 0);
+         }
+      }
+      poll(pfd, n, 50);
+      if (pfd[0].revents)
+         server_udp();
+      if (pfd[1].revents)
+         server_tcp_accept();
+      if (pfd[2].revents && srv_conn != -1)
+         server_tcp();
+      for (i = 3; i < n; i++)
+         if (pfd[i].revents && watches[fds[i]].when)
+            watches[fds[i]].cb(fds[i], watches[fds[i]].data);
+      for (t = 0; t < ntimeouts; t++) {
+         if (timeouts[t].at <= now()) {
+            TimeoutCb_t cb = timeouts[t].cb;
+            void *data = timeouts[t].data;
+
+            timeouts[t--] = timeouts[--ntimeouts];
+            cb(data);
+         }
+      }
+   }
+}
+
+/* ----------------------------------------------------------------------
+ *  Tests
+ */
+
+typedef struct {
+   const char *name;
+   int status;             /* expected */
+   const char *addrs;      /* expected, space separated, in order */
+   long ttl;               /* expected */
+   int done;
+} Check_t;
+
+static void check_cb(int status, Dlist *addr_list, long ttl, void *data)
+{
+   Check_t *c = data;
+   Dstr *got = dStr_new("");
+   char buf[64];
+   int i;
+
+   for (i = 0; i < dList_length(addr_list); i++) {
+      DilloHost *dh = dList_nth_data(addr_list, i);
+
+      inet_ntop(dh->af, dh->data, buf, sizeof(buf));
+      dStr_sprintfa(got, "%s%s", i ? " " : "", buf);
+      dFree(dh);
+   }
+   dList_free(addr_list);
+   if (c->done || status != c->status || strcmp(got->str, c->addrs) ||
+       ttl != c->ttl) {
+      printf("FAILED: %s: got %d \"%s\" ttl %ld, expected %d \"%s\" "
+             "ttl %ld\n", c->name, status, got->str, ttl, c->status,
+             c->addrs, c->ttl);
+      failed++;
+   }
+   c->done++;
+   pending--;
+   dStr_free(got, 1);
+}
+
+static void lookup(Check_t *c)
+{
+   pending++;
+   a_Resolv_lookup(c->name, check_cb, c);
+}
+
+static void wait_for(Check_t *c, int n, double limit)
+{
+   int i;
+
+   loop(limit);
+   for (i = 0; i < n; i++) {
+      if (!c[i].done) {
+         printf("FAILED: %s: no answer\n", c[i].name);
+         failed++;
+         pending--;
+      }
+   }
+}
+
+static char *write_file(const char *tmpl, const char *text)
+{
+   char *path = dStrdup(tmpl);
+   int fd = mkstemp(path);
+
+   if (fd < 0 || write(fd, text, strlen(text)) != (ssize_t)strlen(text)) {
+      perror(path);
+      exit(1);
+   }
+   close(fd);
+   return path;
+}
+
+int main(void)
+{
+   Check_t basic[] = {
+#ifdef ENABLE_IPV6
+      {"www.example.test", RESOLV_OK, "2001:db8::1 192.0.2.1", 300, 0},
+      {"alias.example.test", RESOLV_OK, "2001:db8::1 192.0.2.1", 120, 0},
+      {"WWW.Example.Test.", RESOLV_OK, "2001:db8::1 192.0.2.1", 300, 0},
+#else
+      {"www.example.test", RESOLV_OK, "192.0.2.1", 300, 0},
+      {"alias.example.test", RESOLV_OK, "192.0.2.1", 120, 0},
+      {"WWW.Example.Test.", RESOLV_OK, "192.0.2.1", 300, 0},
+#endif
+      {"nx.example.test", RESOLV_NOT_FOUND, "", 60, 0},
+      {"short", RESOLV_OK, "192.0.2.4", 300, 0},
+      {"hosts.test", RESOLV_OK, "192.0.2.9", -1, 0},
+      {"192.0.2.77", RESOLV_OK, "192.0.2.77", -1, 0},
+      {"bad..name", RESOLV_NOT_FOUND, "", -1, 0},
+   };
+   Check_t drop = {"drop.example.test", RESOLV_OK, "192.0.2.2", 300, 0};
+   Check_t big = {"big.example.test", RESOLV_OK, NULL, 300, 0};
+   Check_t dead = {"www.example.test", RESOLV_NO_ANSWER, "", -1, 0};
+   Check_t par[50];
+   char conf[256], names[50][32], addrs[50][32], *conf_file, *hosts_file;
+   Dstr *big_addrs = dStr_new("");
+   double t;
+   int i, n = sizeof(basic) / sizeof(basic[0]);
+
+   prefs.show_msg = 0;
+   server_start();
+   snprintf(conf, sizeof(conf),
+            "# test\nnameserver [127.0.0.1]:%d\nsearch corp.test\n"
+            "options timeout:1 attempts:2\n", srv_port);
+   conf_file = write_file("/tmp/resolv.conf.XXXXXX", conf);
+   hosts_file = write_file("/tmp/hosts.XXXXXX",
+                           "127.0.0.1 localhost\n192.0.2.9\thosts.test  x\n");
+   a_Resolv_init(conf_file, hosts_file);
+
+   /* Answers, CNAMEs, NXDOMAIN, the search list, the hosts file */
+   for (i = 0; i < n; i++)
+      lookup(&basic[i]);
+   wait_for(basic, n, 5);
+
+   /* A dropped query is retransmitted */
+   t = now();
+   lookup(&drop);
+   wait_for(&drop, 1, 5);
+   if (now() - t < 0.9) {
+      printf("FAILED: drop.example.test answered without a retransmission\n");
+      failed++;
+   }
+
+   /* A truncated reply is asked again over TCP */
+   for (i = 0; i < 40; i++)
+      dStr_sprintfa(big_addrs, "%s192.0.2.%d", i ? " " : "", 100 + i);
+   big.addrs = big_addrs->str;
+   lookup(&big);
+   wait_for(&big, 1, 5);
+   if (tcp_queries == 0) {
+      printf("FAILED: big.example.test not asked over TCP\n");
+      failed++;
+   }
+
+   /* Many lookups at a time */
+   for (i = 0; i < 50; i++) {
+      snprintf(names[i], sizeof(names[i]), "p%d.example.test", i);
+      snprintf(addrs[i], sizeof(addrs[i]), "10.0.0.%d", i);
+      par[i].name = names[i];
+      par[i].status = RESOLV_OK;
+      par[i].addrs = addrs[i];
+      par[i].ttl = 300;
+      par[i].done = 0;
+      lookup(&par[i]);
+   }
+   wait_for(par, 50, 5);
+
+   /* Nobody answering */
+   a_Resolv_freeall();
+   unlink(conf_file);
+   dFree(conf_file);
+   snprintf(conf, sizeof(conf), "nameserver [127.0.0.1]:%d\n"
+            "options timeout:1 attempts:1\n", srv_port == 1 ? 2 : 1);
+   conf_file = write_file("/tmp/resolv.conf.XXXXXX", conf);
+   a_Resolv_init(conf_file, hosts_file);
+   lookup(&dead);
+   wait_for(&dead, 1, 5);
+
+   a_Resolv_freeall();
+   unlink(conf_file);
+   unlink(hosts_file);
+   dFree(conf_file);
+   dFree(hosts_file);
+   dStr_free(big_addrs, 1);
+
+   printf("%s\n", failed ? "FAILED" : "PASSED");
+   return failed != 0;
+}
@@ -17,6 +17,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
 #include "../dw/core.hh"
 #include "../dw/fltkcore.hh"
 
@@ -95,6 +100,68 @@ void solution3 ()
    delete layout;
 }
 
+/*
+ * Heap in use, or -1 where it can't be told.
+ */
+static long heapInUse ()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+   return (long) mallinfo2 ().uordblks;
+#else
+   return -1;
+#endif
+}
+
+/*
+ * The memory taken by a 1000 x 1000 image of each type, decoded and shown
+ * at its size, at half and at twice its size.
+ */
+void memory ()
+{
+   static const struct { Imgbuf::Type type; const char *name; } types[] = {
+      { Imgbuf::RGB, "RGB" }, { Imgbuf::GRAY, "GRAY" },
+      { Imgbuf::INDEXED, "INDEXED" } };
+   const int size = 1000;
+
+   FltkPlatform *platform = new FltkPlatform ();
+   Layout *layout = new Layout (platform);
+   dw::core::byte *row = new dw::core::byte[3 * size];
+   int colors[256];
+
+   for (int i = 0; i < 256; i++)
+      colors[i] = i << 16 | (255 - i) << 8 | i / 2;
+
+   for (int t = 0; t < 3; t++) {
+      long before = heapInUse ();
+
+      Imgbuf *rootbuf = layout->createImgbuf (types[t].type, size, size, 1);
+      if (types[t].type == Imgbuf::INDEXED)
+         rootbuf->setCMap (colors, 256);
+      for (int y = 0; y < size; y++) {
+         memset (row, y % 256, 3 * size);
+         rootbuf->copyRow (y, row);
+      }
+      long root = heapInUse ();
+
+      Imgbuf *halfbuf = rootbuf->getScaledBuf (size / 2, size / 2);
+      Imgbuf *twicebuf = rootbuf->getScaledBuf (2 * size, 2 * size);
+      long all = heapInUse ();
+
+      printf ("=== %-7s root: %5ld KB, with scaled buffers: %6ld KB\n",
+              types[t].name, (root - before) / 1024, (all - before) / 1024);
+      printf ("=== %-7s counted: %6ld KB, of it scaled: %6ld KB\n",
+              types[t].name, rootbuf->getMemSize () / 1024,
+              FltkImgbuf::getScaledMemSize () / 1024);
+
+      twicebuf->unref ();
+      halfbuf->unref ();
+      rootbuf->unref ();
+   }
+
+   delete[] row;
+   delete layout;
+}
+
 int main (int argc, char **argv)
 {
    printf ("========== SOLUTION 1 ==========\n");
@@ -103,6 +170,8 @@ int main (int argc, char **argv)
    solution2 ();
    printf ("========== SOLUTION 3 ==========\n");
    solution3 ();
+   printf ("============ MEMORY ============\n");
+   memory ();
 
    return 0;
 }
@@ -0,0 +1,220 @@
+/*
+ * HPACK test: decodes the examples of RFC 7541, Appendix C, and checks
+ * that what the encoder produces decodes back to the same fields.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/IO/hpack.h"
+
+static int failed = 0;
+
+/*
+ * Turn "8286 8441" into bytes
+ */
+static Dstr *hex(const char *s)
+{
+   Dstr *ds = dStr_new("");
+   unsigned int b;
+
+   while (*s) {
+      if (*s == ' ') {
+         s++;
+      } else if (sscanf(s, "%2x", &b) == 1) {
+         dStr_append_c(ds, b);
+         s += 2;
+      } else {
+         break;
+      }
+   }
+   return ds;
+}
+
+/*
+ * Decode a block and compare it with 'expected' ("name: value\n"...), and
+ * the table size with 'table_size'
+ */
+static void check_block(Hpack_t *hp, const char *what, Dstr *in,
+                        const char *expected, size_t table_size)
+{
+   Dstr *got = dStr_new("");
+   Dlist *fields = dList_new(8);
+   HpackField_t *f;
+   int i;
+
+   if (a_Hpack_decode(hp, (uchar_t *)in->str, in->len, fields)) {
+      printf("FAIL %s: decoding error\n", what);
+      failed++;
+   } else {
+      for (i = 0; (f = dList_nth_data(fields, i)); i++)
+         dStr_sprintfa(got, "%s: %s\n", f->name, f->value);
+      if (strcmp(got->str, expected) || hp->size != table_size) {
+         printf("FAIL %s: got (table size %d)\n%s", what, (int)hp->size,
+                got->str);
+         failed++;
+      } else {
+         printf("ok   %s\n", what);
+      }
+   }
+   a_Hpack_fields_free(fields);
+   dStr_free(got, 1);
+}
+
+static void check_decode(Hpack_t *hp, const char *what, const char *block,
+                         const char *expected, size_t table_size)
+{
+   Dstr *in = hex(block);
+
+   check_block(hp, what, in, expected, table_size);
+   dStr_free(in, 1);
+}
+
+static void check_bad(const char *what, const char *block)
+{
+   Hpack_t *hp = a_Hpack_new(HPACK_TABLE_SIZE);
+   Dstr *in = hex(block);
+   Dlist *fields = dList_new(8);
+
+   if (a_Hpack_decode(hp, (uchar_t *)in->str, in->len, fields) == 0) {
+      printf("FAIL %s: accepted\n", what);
+      failed++;
+   } else {
+      printf("ok   %s\n", what);
+   }
+   a_Hpack_fields_free(fields);
+   dStr_free(in, 1);
+   a_Hpack_free(hp);
+}
+
+static void test_rfc_examples(void)
+{
+   Hpack_t *hp;
+
+   /* C.3: requests without Huffman coding */
+   hp = a_Hpack_new(HPACK_TABLE_SIZE);
+   check_decode(hp, "C.3.1", "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 "
+                "6f6d",
+                ":method: GET\n:scheme: http\n:path: /\n"
+                ":authority: www.example.com\n", 57);
+   check_decode(hp, "C.3.2", "8286 84be 5808 6e6f 2d63 6163 6865",
+                ":method: GET\n:scheme: http\n:path: /\n"
+                ":authority: www.example.com\n"
+                "cache-control: no-cache\n", 110);
+   check_decode(hp, "C.3.3", "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 "
+                "7573 746f 6d2d 7661 6c75 65",
+                ":method: GET\n:scheme: https\n:path: /index.html\n"
+                ":authority: www.example.com\n"
+                "custom-key: custom-value\n", 164);
+   a_Hpack_free(hp);
+
+   /* C.4: the same, Huffman coded */
+   hp = a_Hpack_new(HPACK_TABLE_SIZE);
+   check_decode(hp, "C.4.1", "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+                ":method: GET\n:scheme: http\n:path: /\n"
+                ":authority: www.example.com\n", 57);
+   check_decode(hp, "C.4.2", "8286 84be 5886 a8eb 1064 9cbf",
+                ":method: GET\n:scheme: http\n:path: /\n"
+                ":authority: www.example.com\n"
+                "cache-control: no-cache\n", 110);
+   check_decode(hp, "C.4.3", "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 "
+                "e95b b8e8 b4bf",
+                ":method: GET\n:scheme: https\n:path: /index.html\n"
+                ":authority: www.example.com\n"
+                "custom-key: custom-value\n", 164);
+   a_Hpack_free(hp);
+
+   /* C.6: responses, Huffman coded, with a 256 byte table (evictions) */
+   hp = a_Hpack_new(256);
+   check_decode(hp, "C.6.1", "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 "
+                "54d4 44a8 2005 9504 0b81 66e0 82a6 2d1b ff6e 919d 29ad 1718 "
+                "63c7 8f0b 97c8 e9ae 82ae 43d3",
+                ":status: 302\ncache-control: private\n"
+                "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+                "location: https://www.example.com\n", 222);
+   check_decode(hp, "C.6.2", "4883 640e ffc1 c0bf",
+                ":status: 307\ncache-control: private\n"
+                "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+                "location: https://www.example.com\n", 222);
+   check_decode(hp, "C.6.3", "88c1 6196 d07a be94 1054 d444 a820 0595 040b "
+                "8166 e084 a62d 1bff c05a 839b d9ab 77ad 94e7 821d d7f2 e6c7 "
+                "b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f 9587 "
+                "3160 65c0 03ed 4ee5 b106 3d50 07",
+                ":status: 200\ncache-control: private\n"
+                "date: Mon, 21 Oct 2013 20:13:22 GMT\n"
+                "location: https://www.example.com\ncontent-encoding: gzip\n"
+                "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; "
+                "version=1\n", 215);
+   a_Hpack_free(hp);
+
+   check_bad("index 0", "80");
+   check_bad("index past the table", "be");
+   check_bad("truncated string", "0085 f2b2");
+   check_bad("EOS in string", "0081 ff");
+   check_bad("padding not EOS", "0081 00 8100");
+   check_bad("table size over the limit", "3fe2 1f");
+}
+
+static void test_round_trip(void)
+{
+   static const char *const fields[][2] = {
+      { ":method", "GET" },
+      { ":scheme", "https" },
+      { ":authority", "www.dillo.org" },
+      { ":path", "/images/logo.png" },
+      { "user-agent", "Dillo/3.1-dev" },
+      { "accept", "image/png,image/*;q=0.8,*/*;q=0.5" },
+      { "cookie", "a=b" },
+      { "x-bytes", NULL }   /* every byte value but NUL */
+   };
+   Hpack_t *enc = a_Hpack_new(HPACK_TABLE_SIZE),
+           *dec = a_Hpack_new(HPACK_TABLE_SIZE);
+   Dstr *block = dStr_new(""), *expected = dStr_new(""),
+        *bytes = dStr_new("");
+   int i, round, first_len = 0;
+   char what[32];
+
+   for (i = 1; i < 256; i++)
+      dStr_append_c(bytes, i);
+   for (round = 0; round < 3; round++) {
+      dStr_truncate(block, 0);
+      dStr_truncate(expected, 0);
+      if (round == 2) {
+         /* the peer shrinks the table: announced, then used */
+         a_Hpack_set_max_size(enc, 100);
+      }
+      for (i = 0; i < (int)(sizeof(fields) / sizeof(fields[0])); i++) {
+         const char *value = fields[i][1] ? fields[i][1] : bytes->str;
+
+         a_Hpack_encode(enc, block, fields[i][0], value);
+         dStr_sprintfa(expected, "%s: %s\n", fields[i][0], value);
+      }
+      snprintf(what, sizeof(what), "round trip %d", round);
+      check_block(dec, what, block, expected->str, enc->size);
+      if (round == 0) {
+         first_len = block->len;
+      } else if (round == 1 && block->len * 2 > first_len) {
+         printf("FAIL repeated fields take %d bytes, %d the first time\n",
+                block->len, first_len);
+         failed++;
+      }
+   }
+   a_Hpack_free(enc);
+   a_Hpack_free(dec);
+   dStr_free(block, 1);
+   dStr_free(expected, 1);
+   dStr_free(bytes, 1);
+}
+
+int main(void)
+{
+   test_rfc_examples();
+   test_round_trip();
+   printf("%s\n", failed ? "FAILED" : "All tests passed.");
+   return failed ? 1 : 0;
+}
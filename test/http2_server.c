@@ -0,0 +1,908 @@
+/*
+ * HTTP/2 test server
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Plays scripted HTTP/2 exchanges over TLS on 127.0.0.1, to see how the
+ * browser's side of the protocol copes with them:
+ *
+ *    http2-server [-p port] [-w window]
+ *
+ * Load https://localhost:port/ with http2=YES, and accept the made-up
+ * certificate. Each connection gets a process of its own, which reports
+ * what the browser did, and "FAILED: ..." when it did something wrong.
+ *
+ *   /settings  sends new SETTINGS (with no header table for the browser),
+ *              and holds the page back until they are acknowledged.
+ *   /window    every stream window of the browser's is 'window' bytes
+ *              (1000 by default): the form posts more than that, which
+ *              must come in pieces as we open the window. /window/big is
+ *              larger than the browser's own windows, so it must open
+ *              them as it reads.
+ *   /goaway    has images, and each connection serves part of the queries
+ *              for them and goes away with the rest left. Those must be
+ *              sent again on a new connection, until every image shows.
+ *   /rst       has an image that is refused once (it must come again),
+ *              one that is reset halfway (it must show broken, and not come
+ *              again), and a link to a page that never finishes: stopping
+ *              it must reset its stream.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dlib/dlib.h"
+#include "src/IO/hpack.h"
+
+#ifdef ENABLE_SSL
+
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#define FRAME_HDR_LEN  9
+#define MAX_FRAME      16384
+#define MAX_STREAMS    128
+#define NIMAGES        8
+
+/* Frame types */
+#define DATA          0x0
+#define HEADERS       0x1
+#define RST_STREAM    0x3
+#define SETTINGS      0x4
+#define PING          0x6
+#define GOAWAY        0x7
+#define WINDOW_UPDATE 0x8
+#define CONTINUATION  0x9
+
+/* Frame flags */
+#define FLAG_END_STREAM  0x1
+#define FLAG_ACK         0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED      0x8
+#define FLAG_PRIORITY    0x20
+
+/* Settings */
+#define SETTINGS_HEADER_TABLE_SIZE      0x1
+#define SETTINGS_ENABLE_PUSH            0x2
+#define SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE    0x4
+#define SETTINGS_MAX_FRAME_SIZE         0x5
+
+/* Error codes */
+#define NO_ERROR       0x0
+#define REFUSED_STREAM 0x7
+#define CANCEL         0x8
+
+typedef enum {
+   ST_FREE,       /* an unused slot */
+   ST_QUERY,      /* the query is coming in */
+   ST_HELD,       /* waiting for a SETTINGS ACK */
+   ST_REPLYING,   /* the reply body is going out */
+   ST_STALLED     /* it never ends */
+} StreamState;
+
+typedef struct {
+   StreamState state;
+   uint32_t id;
+   char *method, *path;
+   int ended;             /* the browser ended its side */
+   char *body;            /* the reply body */
+   long len, sent;
+   int32_t window;        /* what we may send on it */
+   int32_t recv_window;   /* what the browser may send */
+   long received;         /* query body */
+   int frames, overrun;
+   int blocked;           /* held back by a window now */
+} Stream;
+
+static int port = 8443, window = 1000, conn_num;
+
+/* The connection of this process */
+static SSL *ssl;
+static Hpack_t *enc, *dec;
+static Dstr *in, *out, *hdr_block;
+static uint32_t hdr_stream;
+static int hdr_flags;
+static Stream streams[MAX_STREAMS];
+static uint32_t last_id;               /* the latest stream opened */
+static int32_t conn_window = 65535;    /* what we may send */
+static int32_t recv_conn_window = 65535;
+static int32_t client_window = 65535;  /* the browser's stream window */
+static int32_t acked_window = 65535;   /* ours, as the browser knows it */
+static int settings_unacked;
+static double settings_sent;
+static Dstr *client_settings;
+static int gone_away, refused;
+static uint32_t goaway_last;
+static int held_back, updates;
+
+/* a red 1x1 GIF, the page scales it up */
+static const unsigned char gif[] = {
+   0x47,0x49,0x46,0x38,0x39,0x61,0x01,0x00,0x01,0x00,0x80,0x00,0x00,0xff,
+   0x00,0x00,0x00,0x00,0x00,0x2c,0x00,0x00,0x00,0x00,0x01,0x00,0x01,0x00,
+   0x00,0x02,0x02,0x44,0x01,0x00,0x3b
+};
+
+static double now()
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report(const char *fmt, ...)
+{
+   va_list ap;
+
+   printf("[%d] ", conn_num);
+   va_start(ap, fmt);
+   vprintf(fmt, ap);
+   va_end(ap);
+   printf("\n");
+   fflush(stdout);
+}
+
+/* - Frames out - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+static void put16(uint_t v)
+{
+   dStr_append_c(out, (v >> 8) & 0xff);
+   dStr_append_c(out, v & 0xff);
+}
+
+static void put32(uint32_t v)
+{
+   put16(v >> 16);
+   put16(v & 0xffff);
+}
+
+static uint32_t get32(const uchar_t *p)
+{
+   return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void frame_hdr(uint32_t len, int type, int flags, uint32_t id)
+{
+   dStr_append_c(out, (len >> 16) & 0xff);
+   put16(len & 0xffff);
+   dStr_append_c(out, type);
+   dStr_append_c(out, flags);
+   put32(id & 0x7fffffff);
+}
+
+static void flush(void)
+{
+   if (out->len > 0 && SSL_write(ssl, out->str, out->len) <= 0)
+      report("can't write");
+   dStr_truncate(out, 0);
+}
+
+static void send_settings(int table_size)
+{
+   frame_hdr(table_size >= 0 ? 18 : 12, SETTINGS, 0, 0);
+   put16(SETTINGS_MAX_CONCURRENT_STREAMS);
+   put32(MAX_STREAMS / 2);
+   put16(SETTINGS_INITIAL_WINDOW_SIZE);
+   put32(window);
+   if (table_size >= 0) {
+      put16(SETTINGS_HEADER_TABLE_SIZE);
+      put32(table_size);
+   }
+   settings_unacked++;
+   settings_sent = now();
+}
+
+static void rst_stream(uint32_t id, uint32_t code)
+{
+   frame_hdr(4, RST_STREAM, 0, id);
+   put32(code);
+}
+
+static void window_update(uint32_t id, uint32_t inc)
+{
+   frame_hdr(4, WINDOW_UPDATE, 0, id);
+   put32(inc);
+}
+
+/* - Streams - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+static Stream *stream_by_id(uint32_t id)
+{
+   int i;
+
+   for (i = 0; i < MAX_STREAMS; ++i)
+      if (streams[i].state != ST_FREE && streams[i].id == id)
+         return &streams[i];
+   return NULL;
+}
+
+static void stream_free(Stream *st)
+{
+   free(st->method);
+   free(st->path);
+   free(st->body);
+   memset(st, 0, sizeof(*st));
+}
+
+/*
+ * Send the reply header, and queue 'body' (malloc'd) to go out as the
+ * windows allow. With 'body_len' < 0 there's no length, and no end.
+ */
+static void reply(Stream *st, const char *status, const char *type,
+                  char *body, long body_len)
+{
+   Dstr *block = dStr_sized_new(128);
+   char len[32];
+
+   a_Hpack_encode(enc, block, ":status", status);
+   a_Hpack_encode(enc, block, "content-type", type);
+   if (body_len >= 0) {
+      snprintf(len, sizeof(len), "%ld", body_len);
+      a_Hpack_encode(enc, block, "content-length", len);
+   }
+   frame_hdr(block->len, HEADERS,
+             FLAG_END_HEADERS | (body_len == 0 ? FLAG_END_STREAM : 0), st->id);
+   dStr_append_l(out, block->str, block->len);
+   dStr_free(block, 1);
+
+   st->body = body;
+   st->len = body_len;
+   st->sent = 0;
+   st->state = body_len < 0 ? ST_STALLED : ST_REPLYING;
+   if (body_len == 0)
+      stream_free(st);
+}
+
+static void reply_page(Stream *st, const char *fmt, ...)
+{
+   Dstr *page = dStr_new("<html><body>\n");
+   va_list ap;
+
+   va_start(ap, fmt);
+   dStr_vsprintfa(page, fmt, ap);
+   va_end(ap);
+   dStr_append(page, "</body></html>\n");
+   reply(st, "200", "text/html", dStrndup(page->str, page->len), page->len);
+   dStr_free(page, 1);
+}
+
+static void reply_gif(Stream *st)
+{
+   char *body = malloc(sizeof(gif));
+
+   memcpy(body, gif, sizeof(gif));
+   reply(st, "200", "image/gif", body, sizeof(gif));
+}
+
+static char *images_html(const char *dir, const char *const names[], int n)
+{
+   Dstr *ds = dStr_new("");
+   char *ret;
+   int i;
+
+   for (i = 0; i < n; ++i)
+      dStr_sprintfa(ds, "<img src=\"/%s/%s.gif\" width=32 height=32 "
+                    "alt=\"%s\">\n", dir, names[i], names[i]);
+   ret = ds->str;
+   dStr_free(ds, 0);
+   return ret;
+}
+
+/*
+ * Send what the windows allow of the replies that are going out
+ */
+static void send_bodies(void)
+{
+   Stream *st;
+   long n;
+   int i;
+
+   for (i = 0; i < MAX_STREAMS; ++i) {
+      st = &streams[i];
+      while (st->state == ST_REPLYING && st->sent < st->len) {
+         n = MIN(st->len - st->sent, MAX_FRAME);
+         n = MIN(n, MIN(st->window, conn_window));
+         if (n <= 0) {
+            if (!st->blocked)
+               held_back++;
+            st->blocked = 1;
+            break;
+         }
+         st->blocked = 0;
+         frame_hdr(n, DATA, st->sent + n == st->len ? FLAG_END_STREAM : 0,
+                   st->id);
+         dStr_append_l(out, st->body + st->sent, n);
+         st->sent += n;
+         st->window -= n;
+         conn_window -= n;
+      }
+      if (st->state == ST_REPLYING && st->sent == st->len) {
+         if (!strcmp(st->path, "/window/big"))
+            report("window: %ld bytes sent, held back by a window %d "
+                   "times, %d WINDOW_UPDATEs", st->len, held_back, updates);
+         stream_free(st);
+      }
+   }
+}
+
+/* - The script - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+static void serve(Stream *st)
+{
+   static const char *const rst_images[] = {"refused", "cancel", "ok"};
+   const char *path = st->path;
+   char *html, *body;
+   long i;
+
+   if (!strcmp(path, "/")) {
+      reply_page(st, "<h1>HTTP/2 tests</h1>\n<ul>\n"
+                 "<li><a href=\"/settings\">SETTINGS and their ACK</a>\n"
+                 "<li><a href=\"/window\">Flow control windows</a>\n"
+                 "<li><a href=\"/goaway\">GOAWAY with streams left</a>\n"
+                 "<li><a href=\"/rst\">RST_STREAM</a>\n</ul>\n");
+   } else if (!strcmp(path, "/settings")) {
+      /* the page goes out with the ACK */
+      send_settings(0);
+      st->state = ST_HELD;
+   } else if (!strcmp(path, "/window")) {
+      html = malloc(3001);
+      memset(html, 'x', 3000);
+      html[3000] = '\0';
+      reply_page(st, "<p>Stream windows are %d bytes here.\n"
+                 "<form method=\"post\" action=\"/window/post\">\n"
+                 "<textarea name=\"t\" rows=4 cols=60>%s</textarea>\n"
+                 "<input type=\"submit\" value=\"Post it\"></form>\n"
+                 "<p><a href=\"/window/big\">4 MB of text</a>\n",
+                 window, html);
+      free(html);
+   } else if (!strcmp(path, "/window/post")) {
+      report("window: %ld bytes posted in %d DATA frames%s", st->received,
+             st->frames, st->overrun ? "" : ", all within the window");
+      if (st->overrun)
+         report("FAILED: %d of them went past the window", st->overrun);
+      reply_page(st, "<p>%ld bytes came in %d DATA frames%s.\n",
+                 st->received, st->frames,
+                 st->overrun ? ", some past the window (FAILED)" : "");
+   } else if (!strcmp(path, "/window/big")) {
+      body = malloc((4 << 20) + 1);
+      for (i = 0; i < (4 << 20) / 64; ++i)
+         snprintf(body + i * 64, 65, "%-63ld\n", i);
+      reply(st, "200", "text/plain", body, 4 << 20);
+   } else if (!strcmp(path, "/goaway")) {
+      static const char *const names[NIMAGES] =
+         {"1", "2", "3", "4", "5", "6", "7", "8"};
+
+      html = images_html("goaway", names, NIMAGES);
+      reply_page(st, "<p>Every image should show.\n<p>%s", html);
+      free(html);
+   } else if (!strncmp(path, "/goaway/", 8)) {
+      reply_gif(st);
+   } else if (!strcmp(path, "/rst")) {
+      html = images_html("rst", rst_images, 3);
+      reply_page(st, "<p>\"cancel\" should be broken, the others should "
+                 "show.\n<p>%s<p><a href=\"/rst/stall\">A page that never "
+                 "finishes</a>; stop it.\n", html);
+      free(html);
+   } else if (!strcmp(path, "/rst/refused.gif") && !refused) {
+      report("rst: refused stream %u", st->id);
+      refused = 1;
+      rst_stream(st->id, REFUSED_STREAM);
+      stream_free(st);
+   } else if (!strcmp(path, "/rst/refused.gif")) {
+      report("rst: the refused query came back on stream %u", st->id);
+      reply_gif(st);
+   } else if (!strcmp(path, "/rst/cancel.gif")) {
+      body = malloc(sizeof(gif));
+      memcpy(body, gif, sizeof(gif));
+      reply(st, "200", "image/gif", body, sizeof(gif));
+      frame_hdr(sizeof(gif) / 2, DATA, 0, st->id);
+      dStr_append_l(out, body, sizeof(gif) / 2);
+      rst_stream(st->id, CANCEL);
+      report("rst: reset stream %u halfway", st->id);
+      stream_free(st);
+   } else if (!strcmp(path, "/rst/stall")) {
+      static const char start[] =
+         "<html><body><p>This page never finishes...\n";
+
+      reply(st, "200", "text/html", NULL, -1);
+      frame_hdr(sizeof(start) - 1, DATA, 0, st->id);
+      dStr_append(out, start);
+   } else if (!strncmp(path, "/rst/", 5)) {
+      reply_gif(st);
+   } else {
+      reply_page(st, "<p>No such test: %s\n", path);
+   }
+}
+
+/*
+ * Go away in the middle of the image queries that came: the ones up to
+ * the middle are served, the rest are left for another connection.
+ */
+static void go_away(Stream **q, int n)
+{
+   Stream *st;
+   int i, j;
+
+   for (i = 1; i < n; ++i)
+      for (j = i; j > 0 && q[j - 1]->id > q[j]->id; --j) {
+         st = q[j];
+         q[j] = q[j - 1];
+         q[j - 1] = st;
+      }
+   goaway_last = q[(n - 1) / 2]->id;
+   gone_away = 1;
+   frame_hdr(8, GOAWAY, 0, 0);
+   put32(goaway_last);
+   put32(NO_ERROR);
+   report("goaway: up to stream %u, %d image queries served and %d left",
+          goaway_last, (n + 1) / 2, n / 2);
+   for (i = 0; i < n; ++i) {
+      if (q[i]->id <= goaway_last)
+         serve(q[i]);
+      else
+         stream_free(q[i]);
+   }
+}
+
+/*
+ * Answer the queries that are complete, and send what we can.
+ * A lone image query for /goaway waits for others, unless 'force'd:
+ * return whether it does.
+ */
+static int act(int force)
+{
+   Stream *st, *images[MAX_STREAMS];
+   int i, n = 0;
+
+   for (i = 0; i < MAX_STREAMS; ++i) {
+      st = &streams[i];
+      if (st->state != ST_QUERY || !st->ended)
+         continue;
+      if (!strncmp(st->path, "/goaway/", 8) && !gone_away)
+         images[n++] = st;
+      else
+         serve(st);
+   }
+   if (n > 1 || (n == 1 && force))
+      go_away(images, n);
+   send_bodies();
+   flush();
+   return n == 1 && !force;
+}
+
+/* - Frames in - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+static int unpad(int flags, const uchar_t **payload, uint32_t *len)
+{
+   if (flags & FLAG_PADDED) {
+      if (*len < 1 || (*payload)[0] >= *len)
+         return -1;
+      *len -= 1 + (*payload)[0];
+      (*payload)++;
+   }
+   return 0;
+}
+
+static void header_block(uint32_t id, int flags, const uchar_t *block,
+                         uint32_t len)
+{
+   Dlist *fields = dList_new(16);
+   HpackField_t *f;
+   Stream *st = NULL;
+   int i;
+
+   if (a_Hpack_decode(dec, block, len, fields)) {
+      report("FAILED: can't decode the header block of stream %u", id);
+   } else if (gone_away && id > goaway_last) {
+      /* it crossed our GOAWAY, the browser knows to send it again */
+   } else if (id <= last_id || !(id & 1)) {
+      report("FAILED: bad stream id %u", id);
+   } else {
+      for (i = 0; i < MAX_STREAMS && streams[i].state != ST_FREE; ++i) ;
+      if (i < MAX_STREAMS) {
+         st = &streams[i];
+         st->state = ST_QUERY;
+      } else {
+         report("FAILED: more than %d streams", MAX_STREAMS / 2);
+         rst_stream(id, REFUSED_STREAM);
+      }
+   }
+   last_id = MAX(last_id, id);
+   if (st) {
+      st->id = id;
+      st->ended = flags & FLAG_END_STREAM;
+      st->window = client_window;
+      st->recv_window = acked_window;
+      for (i = 0; (f = dList_nth_data(fields, i)); ++i) {
+         if (!strcmp(f->name, ":method"))
+            st->method = strdup(f->value);
+         else if (!strcmp(f->name, ":path"))
+            st->path = strdup(f->value);
+      }
+      if (!st->method || !st->path) {
+         report("FAILED: stream %u has no method or path", id);
+         rst_stream(id, CANCEL);
+         stream_free(st);
+      } else {
+         report("stream %u: %s %s", id, st->method, st->path);
+      }
+   }
+   a_Hpack_fields_free(fields);
+}
+
+static void headers(int flags, uint32_t id, const uchar_t *p, uint32_t len)
+{
+   if (unpad(flags, &p, &len) || ((flags & FLAG_PRIORITY) && len < 5)) {
+      report("FAILED: bad HEADERS");
+      return;
+   }
+   if (flags & FLAG_PRIORITY) {
+      p += 5;
+      len -= 5;
+   }
+   if (flags & FLAG_END_HEADERS) {
+      header_block(id, flags, p, len);
+   } else {
+      hdr_block = dStr_sized_new(2 * len + 1);
+      dStr_append_l(hdr_block, (const char *)p, len);
+      hdr_stream = id;
+      hdr_flags = flags;
+   }
+}
+
+static void data(int flags, uint32_t id, const uchar_t *p, uint32_t len)
+{
+   Stream *st = stream_by_id(id);
+   uint32_t flow_len = len;
+
+   if (unpad(flags, &p, &len)) {
+      report("FAILED: bad DATA");
+      return;
+   }
+   if ((recv_conn_window -= flow_len) < 0)
+      report("FAILED: %ld bytes past the connection window",
+             (long)-recv_conn_window);
+   if (flow_len > 0) {
+      window_update(0, flow_len);
+      recv_conn_window += flow_len;
+   }
+   if (!st)
+      return;
+   if ((st->recv_window -= flow_len) < 0)
+      st->overrun++;
+   st->received += len;
+   st->frames++;
+   if (flags & FLAG_END_STREAM) {
+      st->ended = 1;
+   } else if (flow_len > 0) {
+      window_update(id, flow_len);
+      st->recv_window += flow_len;
+   }
+}
+
+static void settings(int flags, const uchar_t *p, uint32_t len)
+{
+   Stream *st;
+   uint32_t value;
+   int i;
+
+   if (flags & FLAG_ACK) {
+      if (settings_unacked == 0) {
+         report("FAILED: a SETTINGS ACK for nothing");
+      } else if (--settings_unacked == 0) {
+         /* only now does our window apply */
+         for (i = 0; i < MAX_STREAMS; ++i)
+            streams[i].recv_window += window - acked_window;
+         acked_window = window;
+         report("settings: acknowledged after %.1f ms",
+                (now() - settings_sent) * 1000);
+         for (i = 0; i < MAX_STREAMS; ++i) {
+            st = &streams[i];
+            if (st->state == ST_HELD) {
+               st->state = ST_QUERY;
+               reply_page(st, "<p>The new SETTINGS were acknowledged after "
+                          "%.1f ms, and this page was held back until then."
+                          "\n<p>The browser's own: %s\n",
+                          (now() - settings_sent) * 1000,
+                          client_settings->str);
+            }
+         }
+      }
+      return;
+   }
+
+   dStr_truncate(client_settings, 0);
+   for ( ; len >= 6; p += 6, len -= 6) {
+      value = get32(p + 2);
+      switch ((p[0] << 8) | p[1]) {
+      case SETTINGS_HEADER_TABLE_SIZE:
+         dStr_sprintfa(client_settings, "HEADER_TABLE_SIZE=%u ", value);
+         break;
+      case SETTINGS_ENABLE_PUSH:
+         dStr_sprintfa(client_settings, "ENABLE_PUSH=%u ", value);
+         break;
+      case SETTINGS_MAX_CONCURRENT_STREAMS:
+         dStr_sprintfa(client_settings, "MAX_CONCURRENT_STREAMS=%u ", value);
+         break;
+      case SETTINGS_INITIAL_WINDOW_SIZE:
+         dStr_sprintfa(client_settings, "INITIAL_WINDOW_SIZE=%u ", value);
+         for (i = 0; i < MAX_STREAMS; ++i)
+            streams[i].window += (int32_t)value - client_window;
+         client_window = value;
+         break;
+      case SETTINGS_MAX_FRAME_SIZE:
+         dStr_sprintfa(client_settings, "MAX_FRAME_SIZE=%u ", value);
+         break;
+      default:
+         break;
+      }
+   }
+   report("settings: the browser's are %s", client_settings->str);
+   frame_hdr(0, SETTINGS, FLAG_ACK, 0);
+}
+
+static void frame(int type, int flags, uint32_t id, const uchar_t *p,
+                  uint32_t len)
+{
+   Stream *st;
+   Dstr *block;
+
+   if (hdr_block && type != CONTINUATION) {
+      report("FAILED: expected a CONTINUATION");
+      return;
+   }
+   switch (type) {
+   case DATA:
+      data(flags, id, p, len);
+      break;
+   case HEADERS:
+      headers(flags, id, p, len);
+      break;
+   case CONTINUATION:
+      if (!hdr_block || id != hdr_stream) {
+         report("FAILED: unexpected CONTINUATION");
+      } else {
+         dStr_append_l(hdr_block, (const char *)p, len);
+         if (flags & FLAG_END_HEADERS) {
+            block = hdr_block;
+            hdr_block = NULL;
+            header_block(id, hdr_flags, (uchar_t *)block->str, block->len);
+            dStr_free(block, 1);
+         }
+      }
+      break;
+   case RST_STREAM:
+      if ((st = stream_by_id(id))) {
+         report("rst: the browser reset stream %u (%s), error %u", id,
+                st->path, len == 4 ? get32(p) : 0);
+         stream_free(st);
+      }
+      break;
+   case SETTINGS:
+      settings(flags, p, len);
+      break;
+   case PING:
+      if (!(flags & FLAG_ACK) && len == 8) {
+         frame_hdr(8, PING, FLAG_ACK, 0);
+         dStr_append_l(out, (const char *)p, 8);
+      }
+      break;
+   case GOAWAY:
+      report("the browser goes away, after stream %u",
+             len >= 4 ? get32(p) & 0x7fffffff : 0);
+      break;
+   case WINDOW_UPDATE:
+      updates++;
+      if (len != 4 || !(get32(p) & 0x7fffffff))
+         report("FAILED: bad WINDOW_UPDATE");
+      else if (id == 0)
+         conn_window += get32(p) & 0x7fffffff;
+      else if ((st = stream_by_id(id)))
+         st->window += get32(p) & 0x7fffffff;
+      break;
+   default:
+      break;
+   }
+}
+
+/* - Connections - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+/*
+ * Pick "h2", or fail the handshake
+ */
+static int alpn_cb(SSL *s, const uchar_t **proto, uchar_t *len,
+                   const uchar_t *offered, uint_t offered_len, void *arg)
+{
+   if (SSL_select_next_proto((uchar_t **)proto, len,
+                             (const uchar_t *)"\x02h2", 3,
+                             offered, offered_len) != OPENSSL_NPN_NEGOTIATED) {
+      report("FAILED: the browser didn't offer h2 (is http2=YES?)");
+      return SSL_TLSEXT_ERR_ALERT_FATAL;
+   }
+   return SSL_TLSEXT_ERR_OK;
+}
+
+/*
+ * A context with a fresh self-signed certificate for localhost
+ */
+static SSL_CTX *server_ctx(void)
+{
+   SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
+   EVP_PKEY *key = EVP_PKEY_new();
+   EC_KEY *ec = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+   X509 *cert = X509_new();
+   X509_NAME *name;
+
+   EC_KEY_generate_key(ec);
+   EVP_PKEY_assign_EC_KEY(key, ec);
+
+   X509_set_version(cert, 2);
+   ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+   X509_gmtime_adj(X509_get_notBefore(cert), 0);
+   X509_gmtime_adj(X509_get_notAfter(cert), 30 * 86400L);
+   X509_set_pubkey(cert, key);
+   name = X509_get_subject_name(cert);
+   X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                              (const uchar_t *)"localhost", -1, -1, 0);
+   X509_set_issuer_name(cert, name);
+   X509_sign(cert, key, EVP_sha256());
+
+   SSL_CTX_use_certificate(ctx, cert);
+   SSL_CTX_use_PrivateKey(ctx, key);
+   SSL_CTX_set_alpn_select_cb(ctx, alpn_cb, NULL);
+   X509_free(cert);
+   EVP_PKEY_free(key);
+   return ctx;
+}
+
+static void serve_conn(SSL_CTX *ctx, int fd)
+{
+   struct timeval tv = {20, 0};
+   const uchar_t *p;
+   char buf[16384];
+   size_t pos;
+   struct pollfd pfd = {fd, POLLIN, 0};
+   uint32_t len;
+   int i, n, preface = 0, waiting = 0;
+
+   setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+   ssl = SSL_new(ctx);
+   SSL_set_fd(ssl, fd);
+   if (SSL_accept(ssl) != 1)
+      return;
+
+   enc = a_Hpack_new(HPACK_TABLE_SIZE);
+   dec = a_Hpack_new(HPACK_TABLE_SIZE);
+   in = dStr_sized_new(sizeof(buf));
+   out = dStr_sized_new(1024);
+   client_settings = dStr_new("");
+   send_settings(-1);
+   flush();
+
+   while (1) {
+      if (waiting && !SSL_pending(ssl) && poll(&pfd, 1, 200) == 0) {
+         /* no other image query came along */
+         waiting = act(1);
+         continue;
+      }
+      if ((n = SSL_read(ssl, buf, sizeof(buf))) <= 0)
+         break;
+      dStr_append_l(in, buf, n);
+      pos = 0;
+      if (!preface) {
+         if (in->len < 24)
+            continue;
+         if (memcmp(in->str, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24)) {
+            report("FAILED: no connection preface");
+            break;
+         }
+         preface = 1;
+         pos = 24;
+      }
+      while (in->len - pos >= FRAME_HDR_LEN) {
+         p = (const uchar_t *)in->str + pos;
+         len = (p[0] << 16) | (p[1] << 8) | p[2];
+         if (in->len - pos < FRAME_HDR_LEN + len)
+            break;
+         frame(p[3], p[4], get32(p + 5) & 0x7fffffff, p + FRAME_HDR_LEN,
+               len);
+         pos += FRAME_HDR_LEN + len;
+      }
+      dStr_erase(in, 0, pos);
+      if (!SSL_pending(ssl))
+         waiting = act(0);
+   }
+
+   for (i = 0; i < MAX_STREAMS; ++i) {
+      if (streams[i].state == ST_HELD)
+         report("FAILED: our SETTINGS were never acknowledged");
+      else if (streams[i].blocked)
+         report("FAILED: stream %u waits for its window to open",
+                streams[i].id);
+   }
+   report("closed");
+}
+
+int main(int argc, char **argv)
+{
+   struct sockaddr_in addr;
+   SSL_CTX *ctx;
+   int lfd, fd, opt, one = 1;
+
+   while ((opt = getopt(argc, argv, "p:w:")) != -1) {
+      switch (opt) {
+      case 'p': port = atoi(optarg); break;
+      case 'w': window = atoi(optarg); break;
+      default:
+         fprintf(stderr, "usage: %s [-p port] [-w window]\n", argv[0]);
+         return 2;
+      }
+   }
+
+   SSL_library_init();
+   SSL_load_error_strings();
+   ctx = server_ctx();
+
+   lfd = socket(AF_INET, SOCK_STREAM, 0);
+   setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(lfd, 16) < 0) {
+      perror("bind/listen");
+      return 1;
+   }
+   signal(SIGCHLD, SIG_IGN);
+   printf("Serving https://localhost:%d/ (stream windows of %d bytes)\n",
+          port, window);
+   fflush(stdout);
+
+   while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+      conn_num++;
+      if (fork() == 0) {
+         close(lfd);
+         serve_conn(ctx, fd);
+         return 0;
+      }
+      close(fd);
+   }
+   perror("accept");
+   return 1;
+}
+
+#else
+
+int main(void)
+{
+   printf("TLS is disabled, and HTTP/2 with it\n");
+   return 1;
+}
+
+#endif /* ENABLE_SSL */
@@ -0,0 +1,314 @@
+/*
+ * HTTP pipelining test server
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Serves a page with many small images on 127.0.0.1, and reports how long
+ * the browser took to fetch all of it. Network latency is simulated by
+ * delaying the replies to each read() of requests once, so a round trip
+ * costs one delay whether it carries one query or several pipelined ones.
+ *
+ *    http-pipeline-server [-p port] [-n images] [-d delay_ms] [-c]
+ *                         [-v max_age]
+ *
+ * Then load http://127.0.0.1:port/ with http_pipelining=YES and =NO.
+ * -c closes the connection after each reply, as some servers do when
+ * they don't support pipelining (the browser should fall back).
+ * -v gives the replies an ETag and a max-age, and answers queries that
+ * bring the ETag back with "304 Not Modified". With a disk cache, later
+ * loads (even after a restart) should then only get 304s, or no queries
+ * at all until max_age seconds have passed.
+ */
+
+#define _GNU_SOURCE   /* memmem */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_CONNS 64
+
+typedef struct {
+   int fd;
+   char in[16384];
+   int inlen;
+   char *paths[64];    /* parsed queries waiting for their reply */
+   char conditional[64];  /* whether they came with our ETag */
+   int npaths;
+   double reply_at;    /* when the pending replies go out (0 = none) */
+} Conn;
+
+static Conn conns[MAX_CONNS];
+static int nimages = 100, delay_ms = 50, close_after_reply = 0;
+static int max_age = -1;   /* -1: no validators */
+
+/* page load statistics */
+static double page_start;
+static int served, nconns, rounds, maxbatch, full, not_modified;
+static long body_bytes;
+
+/* 1x1 transparent GIF */
+static const unsigned char gif[] = {
+   0x47,0x49,0x46,0x38,0x39,0x61,0x01,0x00,0x01,0x00,0x80,0x00,0x00,0x00,
+   0x00,0x00,0xff,0xff,0xff,0x21,0xf9,0x04,0x01,0x00,0x00,0x00,0x00,0x2c,
+   0x00,0x00,0x00,0x00,0x01,0x00,0x01,0x00,0x00,0x02,0x02,0x44,0x01,0x00,
+   0x3b
+};
+
+static double now()
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void write_all(int fd, const void *buf, size_t len)
+{
+   const char *p = buf;
+   ssize_t n;
+
+   while (len > 0) {
+      if ((n = write(fd, p, len)) < 0) {
+         if (errno == EINTR)
+            continue;
+         return;
+      }
+      p += n;
+      len -= n;
+   }
+}
+
+static void conn_close(Conn *c)
+{
+   int i;
+
+   for (i = 0; i < c->npaths; ++i)
+      free(c->paths[i]);
+   close(c->fd);
+   memset(c, 0, sizeof(*c));
+   c->fd = -1;
+}
+
+static void reply(Conn *c, const char *path, int conditional)
+{
+   char hdr[512], validators[128] = "", *body = NULL;
+   const char *type, *conn_hdr = close_after_reply ? "close" : "keep-alive";
+   size_t len = 0;
+   int i, n;
+
+   if (!strcmp(path, "/")) {
+      body = malloc(64 + 40 * nimages);
+      len = sprintf(body, "<html><body>\n");
+      for (i = 0; i < nimages; ++i)
+         len += sprintf(body + len, "<img src=\"/img/%d.gif\">\n", i);
+      len += sprintf(body + len, "</body></html>\n");
+      type = "text/html";
+   } else {
+      type = "image/gif";
+      len = sizeof(gif);
+   }
+   if (max_age >= 0)
+      snprintf(validators, sizeof(validators),
+               "ETag: \"v1\"\r\nCache-Control: max-age=%d\r\n", max_age);
+   if (conditional) {
+      n = snprintf(hdr, sizeof(hdr),
+                   "HTTP/1.1 304 Not Modified\r\n"
+                   "%s"
+                   "Connection: %s\r\n"
+                   "\r\n", validators, conn_hdr);
+      write_all(c->fd, hdr, n);
+      not_modified++;
+   } else {
+      n = snprintf(hdr, sizeof(hdr),
+                   "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: %s\r\n"
+                   "Content-Length: %lu\r\n"
+                   "%s"
+                   "Connection: %s\r\n"
+                   "\r\n", type, (unsigned long)len, validators, conn_hdr);
+      write_all(c->fd, hdr, n);
+      write_all(c->fd, body ? (const void *)body : (const void *)gif, len);
+      full++;
+      body_bytes += len;
+   }
+   free(body);
+
+   if (strncmp(path, "/img/", 5) == 0 && ++served == nimages) {
+      printf("page + %d images: %.3f s, %d connections, %d round trips, "
+             "up to %d queries per read\n", nimages, now() - page_start,
+             nconns, rounds, maxbatch);
+      if (max_age >= 0)
+         printf("  %d full replies (%ld body bytes), %d not modified\n",
+                full, body_bytes, not_modified);
+      fflush(stdout);
+   }
+}
+
+/*
+ * Take complete queries out of the input buffer
+ */
+static int parse_queries(Conn *c)
+{
+   char *end, *sp;
+   int n = 0;
+
+   while ((end = memmem(c->in, c->inlen, "\r\n\r\n", 4))) {
+      int qlen = end + 4 - c->in;
+
+      if (c->npaths < 64 && !strncmp(c->in, "GET ", 4) &&
+          (sp = memchr(c->in + 4, ' ', qlen - 4))) {
+         c->conditional[c->npaths] = max_age >= 0 &&
+            memmem(c->in, qlen, "\r\nIf-None-Match: \"v1\"\r\n", 23);
+         c->paths[c->npaths++] = strndup(c->in + 4, sp - c->in - 4);
+         if (!strcmp(c->paths[c->npaths - 1], "/")) {
+            /* a new page load */
+            page_start = now();
+            served = rounds = maxbatch = full = not_modified = 0;
+            body_bytes = 0;
+            nconns = 1;
+         }
+         n++;
+      }
+      memmove(c->in, c->in + qlen, c->inlen - qlen);
+      c->inlen -= qlen;
+   }
+   return n;
+}
+
+static void flush_replies(Conn *c)
+{
+   int i;
+
+   for (i = 0; i < c->npaths; ++i) {
+      reply(c, c->paths[i], c->conditional[i]);
+      free(c->paths[i]);
+      if (close_after_reply) {
+         /* later queries on this connection are dropped */
+         for (++i; i < c->npaths; ++i)
+            free(c->paths[i]);
+         c->npaths = 0;
+         conn_close(c);
+         return;
+      }
+   }
+   c->npaths = 0;
+   c->reply_at = 0;
+}
+
+int main(int argc, char **argv)
+{
+   struct sockaddr_in addr;
+   struct pollfd pfd[MAX_CONNS + 1];
+   int lfd, port = 8080, opt, i, one = 1;
+
+   while ((opt = getopt(argc, argv, "p:n:d:cv:")) != -1) {
+      switch (opt) {
+      case 'p': port = atoi(optarg); break;
+      case 'n': nimages = atoi(optarg); break;
+      case 'd': delay_ms = atoi(optarg); break;
+      case 'c': close_after_reply = 1; break;
+      case 'v': max_age = atoi(optarg); break;
+      default:
+         fprintf(stderr, "usage: %s [-p port] [-n images] [-d delay_ms] "
+                 "[-c] [-v max_age]\n", argv[0]);
+         return 2;
+      }
+   }
+
+   lfd = socket(AF_INET, SOCK_STREAM, 0);
+   setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(lfd, 16) < 0) {
+      perror("bind/listen");
+      return 1;
+   }
+   for (i = 0; i < MAX_CONNS; ++i)
+      conns[i].fd = -1;
+   printf("Serving http://127.0.0.1:%d/ (%d images, %d ms per round trip)\n",
+          port, nimages, delay_ms);
+   fflush(stdout);
+
+   while (1) {
+      double t = now(), next = 0;
+      int timeout = -1;
+
+      for (i = 0; i < MAX_CONNS; ++i) {
+         pfd[i].fd = conns[i].fd;
+         pfd[i].events = POLLIN;
+         if (conns[i].fd >= 0 && conns[i].reply_at &&
+             (!next || conns[i].reply_at < next))
+            next = conns[i].reply_at;
+      }
+      pfd[MAX_CONNS].fd = lfd;
+      pfd[MAX_CONNS].events = POLLIN;
+      if (next)
+         timeout = next > t ? (int)((next - t) * 1000) + 1 : 0;
+
+      if (poll(pfd, MAX_CONNS + 1, timeout) < 0 && errno != EINTR) {
+         perror("poll");
+         return 1;
+      }
+
+      if (pfd[MAX_CONNS].revents & POLLIN) {
+         int fd = accept(lfd, NULL, NULL);
+
+         for (i = 0; fd >= 0 && i < MAX_CONNS && conns[i].fd >= 0; ++i) ;
+         if (fd >= 0 && i < MAX_CONNS) {
+            conns[i].fd = fd;
+            nconns++;
+         } else if (fd >= 0) {
+            close(fd);
+         }
+      }
+      for (i = 0; i < MAX_CONNS; ++i) {
+         Conn *c = &conns[i];
+         int n;
+
+         if (c->fd < 0 || !(pfd[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+         n = read(c->fd, c->in + c->inlen, sizeof(c->in) - c->inlen);
+         if (n <= 0) {
+            conn_close(c);
+            continue;
+         }
+         c->inlen += n;
+         if ((n = parse_queries(c)) > 0) {
+            rounds++;
+            if (c->npaths > maxbatch)
+               maxbatch = c->npaths;
+            if (!c->reply_at)
+               c->reply_at = now() + delay_ms / 1000.0;
+         }
+      }
+      t = now();
+      for (i = 0; i < MAX_CONNS; ++i)
+         if (conns[i].fd >= 0 && conns[i].reply_at && conns[i].reply_at <= t)
+            flush_replies(&conns[i]);
+   }
+   return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * HTTP connection racing test server
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Listens on a "blackholed" address, that never completes a connection,
+ * and serves a page on a live one, both with the same port:
+ *
+ *    http-race-server [-p port] [-b blackholed_addr] [-l live_addr]
+ *
+ * The blackhole is a listening socket whose accept queue is kept full,
+ * so the kernel drops further SYNs, as a dead route would.
+ *
+ * Give a name both addresses in /etc/hosts, e.g.
+ *
+ *    127.0.0.2  race.test
+ *    ::1        race.test
+ *
+ * and load http://race.test:port/ a few times. The first load should only
+ * be delayed by the head start of the blackholed attempt, and later ones
+ * not at all, once the live address family is remembered.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int port = 8080;
+
+/*
+ * Make a listening socket on 'host'
+ */
+static int listen_on(const char *host, int backlog,
+                     struct sockaddr_storage *ss, socklen_t *len)
+{
+   struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+   struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+   int fd, one = 1;
+
+   memset(ss, 0, sizeof(*ss));
+   if (inet_pton(AF_INET, host, &sin->sin_addr) == 1) {
+      sin->sin_family = AF_INET;
+      sin->sin_port = htons(port);
+      *len = sizeof(*sin);
+   } else if (inet_pton(AF_INET6, host, &sin6->sin6_addr) == 1) {
+      sin6->sin6_family = AF_INET6;
+      sin6->sin6_port = htons(port);
+      *len = sizeof(*sin6);
+   } else {
+      fprintf(stderr, "bad address: %s\n", host);
+      exit(2);
+   }
+   fd = socket(ss->ss_family, SOCK_STREAM, 0);
+   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+   if (bind(fd, (struct sockaddr *)ss, *len) < 0 || listen(fd, backlog) < 0) {
+      perror(host);
+      exit(1);
+   }
+   return fd;
+}
+
+/*
+ * Fill the accept queue of a listener that never accepts
+ */
+static void blackhole(const char *host)
+{
+   struct sockaddr_storage ss;
+   socklen_t len;
+   int i, fd;
+
+   listen_on(host, 0, &ss, &len);
+   for (i = 0; i < 4; ++i) {
+      fd = socket(ss.ss_family, SOCK_STREAM, 0);
+      fcntl(fd, F_SETFL, O_NONBLOCK);
+      connect(fd, (struct sockaddr *)&ss, len);
+   }
+}
+
+int main(int argc, char **argv)
+{
+   const char *dead = "127.0.0.2", *live = "::1";
+   static const char page[] =
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: text/html\r\n"
+      "Content-Length: 37\r\n"
+      "Connection: close\r\n"
+      "\r\n"
+      "<html><body>Connected.</body></html>\n";
+   struct sockaddr_storage ss;
+   socklen_t len;
+   char buf[4096];
+   int lfd, fd, opt;
+
+   while ((opt = getopt(argc, argv, "p:b:l:")) != -1) {
+      switch (opt) {
+      case 'p': port = atoi(optarg); break;
+      case 'b': dead = optarg; break;
+      case 'l': live = optarg; break;
+      default:
+         fprintf(stderr, "usage: %s [-p port] [-b blackholed_addr] "
+                 "[-l live_addr]\n", argv[0]);
+         return 2;
+      }
+   }
+
+   blackhole(dead);
+   lfd = listen_on(live, 16, &ss, &len);
+   printf("Blackholed %s, serving on %s, port %d\n", dead, live, port);
+   fflush(stdout);
+
+   while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+      if (read(fd, buf, sizeof(buf)) > 0) {
+         if (write(fd, page, sizeof(page) - 1) < 0)
+            perror("write");
+         printf("served a query\n");
+         fflush(stdout);
+      }
+      close(fd);
+   }
+   perror("accept");
+   return 1;
+}
@@ -0,0 +1,422 @@
+/*
+ * Image decoding pool test
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs a made-up decoder in the image decoding pool, with the dicache and
+ * the main loop played by this program. The images are fed in small
+ * pieces, and what reaches the "dicache" must be what the decoder made,
+ * in order, on the main thread. A cancelled image must stop reaching it,
+ * and every decoder must be freed once. Then the same images are decoded
+ * one at a time and all at once, to see the pool use the cores.
+ *
+ *    imgpool-test
+ */
+
+#include <pthread.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "src/prefs.h"
+#include "src/dicache.h"
+#include "src/imgpool.h"
+#include "src/IO/iowatch.hh"
+#include "check.h"
+
+DilloPrefs prefs;
+
+#define NIMAGES  16
+#define WIDTH    64
+#define HEIGHT   256
+
+/* The made-up image format: a byte with the rows' work, then the rows,
+ * WIDTH bytes each. Row y of image n is all (n + y) % 256. */
+
+typedef struct {
+   DilloUrl *url;
+   int version;
+   DilloImage *Image;
+   uint_t pos, y;
+   int work;
+} FakeDecoder;
+
+typedef struct {
+   int parms, closed, calls, updates;
+   uint_t rows;               /* rows that came in order */
+   int bad;                   /* wrong, misplaced or late events */
+} FakeEntry;
+
+static FakeEntry entries[NIMAGES + 1];
+static DilloImage images[NIMAGES + 1];
+static int decoders, freed;
+static pthread_t main_thread;
+static pthread_mutex_t count_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static CbFunction_t notify_cb;
+static int notify_fd = -1;
+
+/* ------------------------------------------------------------------------ */
+
+void a_IOwatch_add_fd(int fd, int when, CbFunction_t Callback, void *data)
+{
+   notify_fd = fd;
+   notify_cb = Callback;
+}
+
+void a_IOwatch_remove_fd(int fd, int when)
+{
+   notify_fd = -1;
+}
+
+DilloUrl *a_Url_dup(const DilloUrl *u)
+{
+   return (DilloUrl *)u;
+}
+
+void a_Url_free(DilloUrl *u)
+{
+}
+
+void a_Image_ref(DilloImage *Image)
+{
+   Image->RefCount++;
+}
+
+void a_Image_unref(DilloImage *Image)
+{
+   Image->RefCount--;
+}
+
+/* The urls are the entries' numbers */
+static FakeEntry *entry_of(const DilloUrl *url)
+{
+   return &entries[(long)url];
+}
+
+static void entry_check(const DilloUrl *url)
+{
+   FakeEntry *e = entry_of(url);
+
+   if (!pthread_equal(pthread_self(), main_thread) || e->closed)
+      e->bad++;
+}
+
+void a_Dicache_set_parms(DilloUrl *url, int version, DilloImage *Image,
+                         uint_t width, uint_t height, DilloImgType type,
+                         double gamma)
+{
+   if (a_Imgpool_worker()) {
+      a_Imgpool_set_parms(width, height, type, gamma);
+      return;
+   }
+   entry_check(url);
+   entry_of(url)->parms++;
+   if (Image != &images[(long)url] || width != WIDTH || height != HEIGHT)
+      entry_of(url)->bad++;
+}
+
+void a_Dicache_set_orig_size(DilloUrl *url, int version,
+                             uint_t width, uint_t height)
+{
+}
+
+void a_Dicache_set_cmap(DilloUrl *url, int version, int bg_color,
+                        const uchar_t *cmap, uint_t num_colors,
+                        int num_colors_max, int bg_index)
+{
+}
+
+void a_Dicache_new_scan(const DilloUrl *url, int version)
+{
+}
+
+void a_Dicache_write(DilloUrl *url, int version, const uchar_t *buf, uint_t Y)
+{
+   FakeEntry *e = entry_of(url);
+   int i;
+
+   if (a_Imgpool_worker()) {
+      a_Imgpool_write(buf, Y);
+      return;
+   }
+   entry_check(url);
+   if (!e->parms || Y != e->rows)
+      e->bad++;
+   for (i = 0; i < WIDTH * 3; i++)
+      if (buf[i] != (uchar_t)((long)url + Y))
+         e->bad++;
+   e->rows++;
+}
+
+void a_Dicache_close(DilloUrl *url, int version, CacheClient_t *Client)
+{
+   if (a_Imgpool_worker()) {
+      a_Imgpool_close();
+      return;
+   }
+   entry_check(url);
+   if (Client || entry_of(url)->rows != HEIGHT)
+      entry_of(url)->bad++;
+   entry_of(url)->closed++;
+}
+
+void a_Dicache_update(const DilloUrl *url, int version)
+{
+   entry_of(url)->updates++;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void *Fake_new(DilloImage *Image, DilloUrl *url, int version)
+{
+   FakeDecoder *dec = dNew0(FakeDecoder, 1);
+
+   dec->url = url;
+   dec->version = version;
+   dec->Image = Image;
+   pthread_mutex_lock(&count_lock);
+   decoders++;
+   pthread_mutex_unlock(&count_lock);
+   return dec;
+}
+
+static void Fake_free(FakeDecoder *dec)
+{
+   pthread_mutex_lock(&count_lock);
+   freed++;
+   pthread_mutex_unlock(&count_lock);
+   dFree(dec);
+}
+
+static int Fake_ask(void *data)
+{
+   FakeEntry *e = data;
+
+   if (!pthread_equal(pthread_self(), main_thread))
+      e->bad++;
+   return ++e->calls;
+}
+
+/*
+ * Busy work, as decoding a row would take
+ */
+static uint_t Fake_work(const uchar_t *row, int rounds)
+{
+   uint_t h = 0;
+   int r, i;
+
+   for (r = 0; r < rounds; r++)
+      for (i = 0; i < WIDTH; i++)
+         h = h * 31 + row[i] + r;
+   return h;
+}
+
+static void Fake_write(FakeDecoder *dec, uchar_t *buf, uint_t len)
+{
+   uchar_t row[WIDTH * 3];
+   volatile uint_t sink;
+   int i;
+
+   if (dec->pos == 0 && len > 0) {
+      dec->work = buf[0] * 100;
+      dec->pos = 1;
+      /* ask the main thread something */
+      if (a_Imgpool_call(Fake_ask, entry_of(dec->url)) != 1)
+         entry_of(dec->url)->bad++;
+      a_Dicache_set_parms(dec->url, dec->version, dec->Image, WIDTH, HEIGHT,
+                          DILLO_IMG_TYPE_RGB, 1 / 2.2);
+   }
+   while (dec->pos + WIDTH <= len && dec->y < HEIGHT) {
+      sink = Fake_work(buf + dec->pos, dec->work);
+      (void)sink;
+      for (i = 0; i < WIDTH * 3; i++)
+         row[i] = buf[dec->pos + i / 3];
+      a_Dicache_write(dec->url, dec->version, row, dec->y++);
+      dec->pos += WIDTH;
+   }
+}
+
+static void Fake_callback(int Op, void *data)
+{
+   CacheClient_t *Client = data;
+
+   if (Op == CA_Send) {
+      Fake_write(Client->CbData, Client->Buf, Client->BufSize);
+   } else if (Op == CA_Close) {
+      FakeDecoder *dec = Client->CbData;
+      a_Dicache_close(dec->url, dec->version, NULL);
+      Fake_free(dec);
+   } else {
+      Fake_free(data);
+   }
+}
+
+/* ------------------------------------------------------------------------ */
+
+static double now(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * Wait up to 'ms' for the workers, and handle what they posted
+ */
+static void main_loop(int ms)
+{
+   struct pollfd pfd;
+
+   pfd.fd = notify_fd;
+   pfd.events = POLLIN;
+   if (poll(&pfd, 1, ms) > 0)
+      notify_cb(notify_fd, NULL);
+}
+
+static Dstr *fake_image(int n, int work)
+{
+   Dstr *data = dStr_sized_new(1 + WIDTH * HEIGHT);
+   int y, x;
+
+   dStr_append_c(data, work);
+   for (y = 0; y < HEIGHT; y++)
+      for (x = 0; x < WIDTH; x++)
+         dStr_append_c(data, (n + y) % 256);
+   return data;
+}
+
+static ImgpoolJob *start(int n)
+{
+   images[n].RefCount = 1;
+   memset(&entries[n], 0, sizeof(entries[n]));
+   return a_Imgpool_job_new(Fake_new, (CA_Callback_t)Fake_callback,
+                            &images[n], (DilloUrl *)(long)n, 1);
+}
+
+/*
+ * Did the jobs of images 1..'count' let go of them?
+ */
+static int released(int count)
+{
+   int n;
+
+   for (n = 1; n <= count; n++)
+      if (images[n].RefCount != 1)
+         return 0;
+   return 1;
+}
+
+/*
+ * Decode images 1..'count', feeding them a piece at a time
+ * Return the seconds it took.
+ */
+static double decode_all(int count, int work, int piece)
+{
+   ImgpoolJob *jobs[NIMAGES + 1];
+   Dstr *data[NIMAGES + 1];
+   double t = now();
+   int n, pos, done;
+
+   for (n = 1; n <= count; n++) {
+      jobs[n] = start(n);
+      data[n] = fake_image(n, work);
+   }
+   for (pos = 0; pos < data[1]->len; pos += piece)
+      for (n = 1; n <= count; n++)
+         a_Imgpool_job_feed(jobs[n], data[n]->str + pos,
+                            MIN(piece, data[n]->len - pos));
+   for (n = 1; n <= count; n++)
+      a_Imgpool_job_finish(jobs[n]);
+   do {
+      main_loop(1000);
+      for (done = 0, n = 1; n <= count; n++)
+         done += entries[n].closed;
+   } while (done < count);
+   t = now() - t;
+
+   /* as a_Dicache_close() does; the jobs go once no worker has them */
+   for (n = 1; n <= count; n++)
+      a_Imgpool_job_cancel(jobs[n]);
+   for (pos = 0; pos < 100 && !released(count); pos++)
+      main_loop(10);
+   for (n = 1; n <= count; n++) {
+      CHECK(entries[n].parms == 1 && entries[n].rows == HEIGHT);
+      CHECK(entries[n].calls == 1 && entries[n].closed == 1);
+      CHECK(entries[n].bad == 0);
+      CHECK(images[n].RefCount == 1);
+      dStr_free(data[n], 1);
+   }
+   return t;
+}
+
+int main(void)
+{
+   ImgpoolJob *job;
+   Dstr *data;
+   double one, all;
+   int n, cores;
+   uint_t rows;
+
+   main_thread = pthread_self();
+   a_Imgpool_init();
+   CHECK(notify_fd != -1);
+   cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+   /* all the images, in small pieces */
+   decode_all(NIMAGES, 1, 100);
+   CHECK(decoders == NIMAGES && freed == NIMAGES);
+
+   /* cancelled halfway: nothing more reaches the dicache */
+   decoders = freed = 0;
+   job = start(1);
+   data = fake_image(1, 5);
+   a_Imgpool_job_feed(job, data->str, data->len / 2);
+   do {
+      main_loop(10);
+   } while (entries[1].rows == 0);
+   a_Imgpool_job_cancel(job);
+   rows = entries[1].rows;
+   for (n = 0; n < 100 && !released(1); n++)
+      main_loop(10);
+   CHECK(entries[1].rows == rows && rows < HEIGHT && entries[1].closed == 0);
+   CHECK(entries[1].bad == 0);
+   CHECK(decoders == 1 && freed == 1 && images[1].RefCount == 1);
+
+   /* cancelled before it started */
+   job = start(2);
+   a_Imgpool_job_cancel(job);
+   main_loop(50);
+   CHECK(decoders == 2 && freed == 2 && images[2].RefCount == 1);
+   CHECK(entries[2].parms == 0);
+   dStr_free(data, 1);
+
+   /* one at a time, then all at once */
+   one = 0;
+   for (n = 0; n < NIMAGES; n++)
+      one += decode_all(1, 20, 4096);
+   all = decode_all(NIMAGES, 20, 4096);
+   printf("%d images: %.3f s one at a time, %.3f s at once (%.1fx, %d cores)\n",
+          NIMAGES, one, all, one / MAX(all, 1e-9), cores);
+   if (cores > 1)
+      CHECK(one / MAX(all, 1e-9) > MIN(cores, NIMAGES) / 2.0);
+
+   a_Imgpool_freeall();
+   return CHECK_RESULT();
+}
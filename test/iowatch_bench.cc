@@ -0,0 +1,126 @@
+/*
+ * Dillo iowatch dispatch benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Measures the cost of one FLTK wakeup with many idle FDs being watched:
+ * 'nidle' idle socketpairs are registered, and a single active pair is
+ * pinged 'rounds' times. Compare:
+ *
+ *    iowatch-bench fltk 1000      (Fl::add_fd, select/poll scan)
+ *    iowatch-bench iowatch 1000   (a_IOwatch_add_fd, epoll if available)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <FL/Fl.H>
+#include "../src/IO/iowatch.hh"
+#include "../src/prefs.h"
+
+DilloPrefs prefs;   /* for MSG() */
+
+static bool use_iowatch = false;
+static int pending = 0;
+
+static void watch(int fd, Fl_FD_Handler cb)
+{
+   if (use_iowatch)
+      a_IOwatch_add_fd(fd, DIO_READ, cb, NULL);
+   else
+      Fl::add_fd(fd, FL_READ, cb, NULL);
+}
+
+static void idle_cb(int fd, void *data)
+{
+   fprintf(stderr, "idle FD %d became ready!\n", fd);
+   exit(1);
+}
+
+static void active_cb(int fd, void *data)
+{
+   char c;
+
+   if (read(fd, &c, 1) == 1)
+      pending--;
+}
+
+static double now()
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+   int nidle = 1000, rounds = 100000, active[2], sv[2], i;
+   struct rlimit rl;
+   double t;
+
+   if (argc < 2 || (strcmp(argv[1], "fltk") && strcmp(argv[1], "iowatch"))) {
+      fprintf(stderr, "usage: %s fltk|iowatch [nidle] [rounds]\n", argv[0]);
+      return 2;
+   }
+   use_iowatch = !strcmp(argv[1], "iowatch");
+   if (argc > 2)
+      nidle = atoi(argv[2]);
+   if (argc > 3)
+      rounds = atoi(argv[3]);
+
+   if (getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+       rl.rlim_cur < (rlim_t)(2 * nidle + 16)) {
+      rl.rlim_cur = (rlim_t)(2 * nidle + 16);
+      if (rl.rlim_cur > rl.rlim_max)
+         rl.rlim_cur = rl.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &rl);
+   }
+
+   for (i = 0; i < nidle; ++i) {
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+         perror("socketpair");
+         return 1;
+      }
+      watch(sv[0], idle_cb);
+   }
+   if (socketpair(AF_UNIX, SOCK_STREAM, 0, active) < 0) {
+      perror("socketpair");
+      return 1;
+   }
+   watch(active[0], active_cb);
+
+   t = now();
+   for (i = 0; i < rounds; ++i) {
+      if (write(active[1], "x", 1) != 1) {
+         perror("write");
+         return 1;
+      }
+      pending++;
+      while (pending)
+         Fl::wait();
+   }
+   t = now() - t;
+
+   printf("%s: %d idle FDs, %d wakeups, %.3f s, %.2f us/wakeup\n",
+          argv[1], nidle, rounds, t, t * 1e6 / rounds);
+   return 0;
+}
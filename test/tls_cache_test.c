@@ -0,0 +1,185 @@
+/*
+ * TLS certificate check cache test
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Handshakes in memory with a made-up server certificate, and checks when
+ * the result of a clean certificate check is reused: for the same
+ * certificate, also after a connection closed, but not for another
+ * certificate, nor after a failure. tls.c is included, to get at its
+ * server list.
+ *
+ *    tls-cache-test
+ */
+
+#include "src/IO/tls.c"
+
+DilloPrefs prefs;
+
+#ifdef ENABLE_SSL
+
+#include "check.h"
+
+/* ------------------------------------------------------------------------ */
+
+int a_Dialog_choice(const char *title, const char *msg, ...) { return 2; }
+void a_IOwatch_add_fd(int fd, int when, CbFunction_t Callback,
+                      void *usr_data) { }
+void a_IOwatch_remove_fd(int fd, int when) { }
+void a_Http_connect_done(int fd, bool_t success) { }
+bool_t a_Hsts_require_https(const char *host) { return FALSE; }
+
+/* ------------------------------------------------------------------------ */
+
+/*
+ * A server context with a fresh self-signed certificate for 'host'
+ */
+static SSL_CTX *server_new(const char *host)
+{
+   SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
+   EVP_PKEY *key = EVP_PKEY_new();
+   EC_KEY *ec = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+   X509 *cert = X509_new();
+   X509_NAME *name;
+
+   EC_KEY_generate_key(ec);
+   EVP_PKEY_assign_EC_KEY(key, ec);
+
+   X509_set_version(cert, 2);
+   ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+   X509_gmtime_adj(X509_get_notBefore(cert), 0);
+   X509_gmtime_adj(X509_get_notAfter(cert), 30 * 86400L);
+   X509_set_pubkey(cert, key);
+   name = X509_get_subject_name(cert);
+   X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                              (const uchar_t *)host, -1, -1, 0);
+   X509_set_issuer_name(cert, name);
+   X509_sign(cert, key, EVP_sha256());
+
+   SSL_CTX_use_certificate(ctx, cert);
+   SSL_CTX_use_PrivateKey(ctx, key);
+   X509_free(cert);
+   EVP_PKEY_free(key);
+   return ctx;
+}
+
+/*
+ * Handshake with 'server' over a pair of memory BIOs.
+ * Return the client's end, or NULL if the handshake didn't complete.
+ */
+static SSL *handshake(SSL_CTX *server)
+{
+   SSL *c = SSL_new(ssl_context), *s = SSL_new(server);
+   BIO *cbio, *sbio;
+   int i, cret = 0, sret = 0;
+
+   BIO_new_bio_pair(&cbio, 0, &sbio, 0);
+   SSL_set_bio(c, cbio, cbio);
+   SSL_set_bio(s, sbio, sbio);
+   SSL_set_connect_state(c);
+   SSL_set_accept_state(s);
+   for (i = 0; i < 20 && (cret != 1 || sret != 1); i++) {
+      if (cret != 1)
+         cret = SSL_do_handshake(c);
+      if (sret != 1)
+         sret = SSL_do_handshake(s);
+   }
+   SSL_free(s);
+   if (cret != 1) {
+      SSL_free(c);
+      c = NULL;
+   }
+   return c;
+}
+
+int main(void)
+{
+   DilloUrl *url = a_Url_new("https://tls.test/", NULL);
+   SSL_CTX *server, *other;
+   SSL *first, *again, *changed;
+   Server_t *srv;
+   int fds[2];
+
+   SSL_library_init();
+   SSL_load_error_strings();
+   ssl_context = SSL_CTX_new(SSLv23_client_method());
+   servers = dList_new(8);
+   fd_map = dList_new(8);
+   server = server_new("tls.test");
+   other = server_new("tls.test");
+
+   /* the first connection is checked in full, and found clean */
+   CHECK(a_Tls_connect_ready(url) == TLS_CONNECT_READY);
+   srv = dList_find_sorted(servers, url, Tls_servers_by_url_cmp);
+   CHECK(srv && srv->cert_status == CERT_STATUS_RECEIVING);
+   first = handshake(server);
+   CHECK(first != NULL);
+   CHECK(!Tls_cert_check_cached(first, srv));
+   srv->cert_status = CERT_STATUS_CLEAN;
+   Tls_cert_check_cache(first, srv);
+
+   /* the same certificate is taken as checked, another one isn't */
+   again = handshake(server);
+   changed = handshake(other);
+   CHECK(again && changed);
+   CHECK(Tls_cert_check_cached(again, srv));
+   CHECK(!Tls_cert_check_cached(changed, srv));
+
+   /* closing a connection doesn't forget the check... */
+   pipe(fds);
+   close(fds[1]);
+   Tls_conn_new(fds[0], url, again);
+   a_Tls_close_by_fd(fds[0]);
+   CHECK(srv->cert_status == CERT_STATUS_CLEAN);
+   again = handshake(server);
+   CHECK(again && Tls_cert_check_cached(again, srv));
+
+   /* ...but a failure does */
+   Tls_cert_check_forget(srv);
+   CHECK(!Tls_cert_check_cached(again, srv));
+   Tls_cert_check_cache(again, srv);
+   CHECK(Tls_cert_check_cached(first, srv));
+
+   /* and a reset before the certificate came in lets us try again */
+   srv->cert_status = CERT_STATUS_RECEIVING;
+   CHECK(a_Tls_connect_ready(url) == TLS_CONNECT_NOT_YET);
+   a_Tls_reset_server_state(url);
+   CHECK(srv->cert_status == CERT_STATUS_NONE);
+   CHECK(a_Tls_connect_ready(url) == TLS_CONNECT_READY);
+   CHECK(srv->cert_status == CERT_STATUS_RECEIVING);
+
+   SSL_free(first);
+   SSL_free(again);
+   SSL_free(changed);
+   SSL_CTX_free(server);
+   SSL_CTX_free(other);
+   Tls_servers_freeall();
+   dList_free(fd_map);
+   SSL_CTX_free(ssl_context);
+   a_Url_free(url);
+
+   return CHECK_RESULT();
+}
+
+#else
+
+int main(void)
+{
+   printf("TLS is disabled, nothing to test\n");
+   return 0;
+}
+
+#endif /* ENABLE_SSL */